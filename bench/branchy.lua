@@ -0,0 +1,15 @@
+local a = 0
+local b = 0
+for i = 0, 2999999 do
+    for j = 0, 3 do
+        if i > j * 1000000 then
+            a = a + i - j
+        else
+            b = b + j
+        end
+        if a > 1000000000 then
+            a = a - 999999999
+        end
+    end
+end
+print(a + b)
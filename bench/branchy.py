@@ -0,0 +1,14 @@
+def main():
+    a = 0
+    b = 0
+    for i in range(0, 3000000):
+        for j in range(0, 4):
+            if i > j * 1000000:
+                a += i - j
+            else:
+                b += j
+            if a > 1000000000:
+                a -= 999999999
+    return a + b
+
+print(main())
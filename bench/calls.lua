@@ -0,0 +1,21 @@
+local function sq(x)
+    return x * x
+end
+
+local function add3(a, b, c)
+    return a + b + c
+end
+
+local function step(acc, k)
+    local t = add3(sq(k), acc, sq(k + 1))
+    if t > 100000 then
+        return t - 99999
+    end
+    return t
+end
+
+local acc = 0
+for i = 0, 999999 do
+    acc = step(acc, i - ((i >> 8) << 8))
+end
+print(acc)
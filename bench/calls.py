@@ -0,0 +1,19 @@
+def sq(x):
+    return x * x
+
+def add3(a, b, c):
+    return a + b + c
+
+def step(acc, k):
+    t = add3(sq(k), acc, sq(k + 1))
+    if t > 100000:
+        return t - 99999
+    return t
+
+def main():
+    acc = 0
+    for i in range(0, 1000000):
+        acc = step(acc, i - ((i >> 8) << 8))
+    return acc
+
+print(main())
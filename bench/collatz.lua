@@ -0,0 +1,15 @@
+local function steps(n, c)
+    if n == 1 then
+        return c
+    end
+    if (n >> 1) << 1 == n then
+        return steps(n >> 1, c + 1)
+    end
+    return steps(n * 3 + 1, c + 1)
+end
+
+local total = 0
+for i = 1, 99999 do
+    total = total + steps(i, 0)
+end
+print(total)
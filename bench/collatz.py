@@ -0,0 +1,17 @@
+# Python has no tail calls, so this loops where the others recurse.
+def steps(n, c):
+    while n != 1:
+        if (n >> 1) << 1 == n:
+            n = n >> 1
+        else:
+            n = n * 3 + 1
+        c += 1
+    return c
+
+def main():
+    total = 0
+    for i in range(1, 100000):
+        total += steps(i, 0)
+    return total
+
+print(main())
@@ -0,0 +1,7 @@
+local sum = 0.0
+local flip = -1.0
+for i = 1, 20000000 do
+    flip = -flip
+    sum = sum + flip / (i * 2 - 1)
+end
+print(string.format("%.24f", sum * 4.0))
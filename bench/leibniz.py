@@ -0,0 +1,9 @@
+def main():
+    sum = 0.0
+    flip = -1.0
+    for i in range(1, 20000001):
+        flip = -flip
+        sum += flip / ((i << 1) - 1)
+    return sum * 4.0
+
+print(main())
@@ -0,0 +1,312 @@
+#!/usr/bin/env python3
+# Runs the benchmark suite: builds each interpreter configuration, runs every benchmark a few times with each of them,
+# and writes the timings as JSON. The same programs written in Lua and Python (foo.lua, foo.py next to foo.mua) get
+# timed too, when those interpreters are installed, as a reference point.
+#
+#     python3 bench/run.py                                   # everything, results in bench/build/results.json
+#     python3 bench/run.py --configs plain jit --runs 10 fib collatz
+#     python3 bench/run.py --compare old.json                # exits with 1 if anything got slower than --threshold
+#
+# To catch regressions between versions, run the suite on both and compare:
+#
+#     git stash && python3 bench/run.py --output base.json && git stash pop
+#     python3 bench/run.py --compare base.json
+#
+# Each configuration gets its own bytecode cache directory (MUALI_CACHE_DIR) in its work directory, since cache keys
+# include the build. Benchmarks run warm (the untimed first run writes the cache) unless they're marked cold, like
+# parse_large, which empties the cache before every run so that the time is all tokenizing, parsing and compiling.
+#
+# The language has no strings, arrays, dicts or while loops yet, so there are no string building or container churn
+# benchmarks, and sorting is a sorting network over values held in variables (sortnet). Add them once those exist.
+#
+# The default dispatch relies on [[clang::musttail]], which other compilers ignore, so that every op takes native stack
+# and long-running functions overflow it. The suite builds with clang++ when it can; with any other compiler, every
+# configuration is built with USE_LOOP_DISPATCH instead, and the results record that.
+
+import argparse
+import json
+import os
+import platform
+import resource
+import shutil
+import statistics
+import subprocess
+import sys
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+ROOT = os.path.dirname(HERE)
+
+# name -> defines
+CONFIGS = {
+    "plain": [],
+    "loop_dispatch": ["USE_LOOP_DISPATCH"],
+    "nanboxed": ["VARIABLE_NANBOXED"],
+    "jit": ["USE_JIT"],
+    "tracing_jit": ["USE_TRACING_JIT"],
+}
+
+# name -> what main has to return
+BENCHMARKS = {
+    "leibniz": "3.141592603589816956599634", # float loop that bulk loops can run
+    "branchy": "1004011005", # int loops with branches in them
+    "fib": "832040", # recursion
+    "calls": "15448", # small calls from a loop
+    "collatz": "10753712", # tail calls
+    "sortnet": "22847524", # compares and swaps: 8 values at a time through a sorting network
+    "parse_large": None, # generated, along with the result; see write_parse_large
+    "startup": "0",
+}
+COLD = {"parse_large"}
+
+REFERENCES = {
+    "lua": ["lua"],
+    "python": [sys.executable],
+}
+SOURCE_EXTENSIONS = {"muali": ".mua", "lua": ".lua", "python": ".py"}
+
+PARSE_LARGE_FUNCS = 1500
+
+# A big program in all three languages: lots of small functions, with main calling each of them once.
+def write_parse_large(path, lang):
+    out = []
+    for n in range(PARSE_LARGE_FUNCS):
+        if lang == "muali":
+            out.append(f"func f{n}(x):\n    var s = x\n    for (i in 0 to {n % 7 + 1}):\n        if (s > {n}):\n"
+                f"            s -= i\n        else:\n            s += i * 2 + 1\n        end\n    end\n    return s\nend\n")
+        elif lang == "lua":
+            out.append(f"function f{n}(x)\n    local s = x\n    for i = 0, {n % 7} do\n        if s > {n} then\n"
+                f"            s = s - i\n        else\n            s = s + i * 2 + 1\n        end\n    end\n    return s\nend\n")
+        else:
+            out.append(f"def f{n}(x):\n    s = x\n    for i in range(0, {n % 7 + 1}):\n        if s > {n}:\n"
+                f"            s -= i\n        else:\n            s += i * 2 + 1\n    return s\n")
+    calls = [f"f{n}({n})" for n in range(PARSE_LARGE_FUNCS)]
+    if lang == "muali":
+        out.append("func main():\n    var t = 0\n" + "".join(f"    t += {c}\n" for c in calls) + "    return t\nend\n")
+    elif lang == "lua":
+        out.append("local t = 0\n" + "".join(f"t = t + {c}\n" for c in calls) + "print(t)\n")
+    else:
+        out.append("def main():\n    t = 0\n" + "".join(f"    t += {c}\n" for c in calls) + "    return t\n\nprint(main())\n")
+    with open(path, "w") as f:
+        f.write("\n".join(out))
+
+def parse_large_result():
+    t = 0
+    for n in range(PARSE_LARGE_FUNCS):
+        s = n
+        for i in range(n % 7 + 1):
+            s = s - i if s > n else s + i * 2 + 1
+        t += s
+    return t
+
+def log(*args):
+    print(*args, file=sys.stderr, flush=True)
+
+def build(name, defines, build_dir, cxx, cxxflags):
+    out = os.path.join(build_dir, f"muali_{name}")
+    cmd = [cxx, *cxxflags, *[f"-D{d}" for d in defines], os.path.join(ROOT, "src_c", "main.cpp"), "-o", out]
+    log(f"building {name}: {' '.join(cmd)}")
+    result = subprocess.run(cmd, cwd=ROOT, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, text=True)
+    if result.returncode != 0:
+        log(result.stderr)
+        sys.exit(f"error: couldn't build {name}")
+    return out
+
+def default_cxx():
+    return os.environ.get("CXX") or ("clang++" if shutil.which("clang++") else "g++")
+
+# Whether builds with cxx need USE_LOOP_DISPATCH, because it isn't clang (see the top).
+def needs_loop_dispatch(cxx):
+    try:
+        version = subprocess.run([cxx, "--version"], capture_output=True, text=True).stdout
+    except OSError:
+        return False
+    return "clang" not in version
+
+# Runs cmd once. Returns (wall seconds, cpu seconds, stdout).
+def run_once(cmd, env=None):
+    before = resource.getrusage(resource.RUSAGE_CHILDREN)
+    start = time.perf_counter()
+    # muali looks for src_c/grammar.txt relative to where it runs
+    result = subprocess.run(cmd, cwd=ROOT, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True, env=env)
+    wall = time.perf_counter() - start
+    after = resource.getrusage(resource.RUSAGE_CHILDREN)
+    cpu = (after.ru_utime - before.ru_utime) + (after.ru_stime - before.ru_stime)
+    if result.returncode != 0:
+        raise RuntimeError(f"{' '.join(cmd)} exited with {result.returncode}:\n{result.stdout[-2000:]}")
+    return wall, cpu, result.stdout
+
+def summarize(walls, cpus):
+    return {
+        "median": statistics.median(walls),
+        "mean": statistics.mean(walls),
+        "variance": statistics.variance(walls) if len(walls) > 1 else 0.0,
+        "stdev": statistics.stdev(walls) if len(walls) > 1 else 0.0,
+        "min": min(walls),
+        "max": max(walls),
+        "cpu_median": statistics.median(cpus),
+        "runs": walls,
+    }
+
+def check_result(bench, output):
+    expected = BENCHMARKS[bench] if bench != "parse_large" else str(parse_large_result())
+    returned = [line for line in output.splitlines() if line.startswith("main returned ")]
+    if not returned:
+        raise RuntimeError(f"{bench}: main didn't return:\n{output[-2000:]}")
+    if returned[-1] != f"main returned {expected}":
+        raise RuntimeError(f"{bench}: expected main to return {expected}, got '{returned[-1]}'")
+
+def bench_source(bench, lang, work_dir):
+    path = os.path.join(work_dir, bench + SOURCE_EXTENSIONS[lang])
+    if bench == "parse_large":
+        write_parse_large(path, lang)
+    else:
+        shutil.copyfile(os.path.join(HERE, bench + SOURCE_EXTENSIONS[lang]), path)
+    return path
+
+def time_muali(binary, bench, work_dir, runs):
+    source = bench_source(bench, "muali", work_dir)
+    cache_dir = os.path.join(work_dir, "cache")
+    env = dict(os.environ, MUALI_CACHE_DIR=cache_dir)
+    walls, cpus = [], []
+    # the first run is a warmup, and writes the cache
+    for i in range(runs + 1):
+        if bench in COLD or i == 0:
+            shutil.rmtree(cache_dir, ignore_errors=True)
+        wall, cpu, output = run_once([binary, source], env)
+        check_result(bench, output)
+        if i > 0:
+            walls.append(wall)
+            cpus.append(cpu)
+    return summarize(walls, cpus)
+
+def time_reference(command, lang, bench, work_dir, runs):
+    source = bench_source(bench, lang, work_dir)
+    walls, cpus = [], []
+    for i in range(runs + 1):
+        wall, cpu, _ = run_once([*command, source])
+        if i > 0:
+            walls.append(wall)
+            cpus.append(cpu)
+    return summarize(walls, cpus)
+
+def git_revision():
+    try:
+        rev = subprocess.run(["git", "rev-parse", "HEAD"], cwd=ROOT, capture_output=True, text=True).stdout.strip()
+        dirty = subprocess.run(["git", "status", "--porcelain", "--untracked-files=no"], cwd=ROOT, capture_output=True,
+            text=True).stdout.strip()
+        return rev + ("-dirty" if dirty else "")
+    except OSError:
+        return None
+
+def compare(results, base, threshold):
+    regressions = 0
+    print(f"\n{'benchmark':<14} {'config':<14} {'base':>9} {'now':>9} {'change':>8}")
+    for bench, configs in results["muali"].items():
+        for config, now in configs.items():
+            old = base.get("muali", {}).get(bench, {}).get(config)
+            if not old:
+                continue
+            change = now["median"] / old["median"] - 1.0
+            # differences within the noise of either run don't count
+            noise = 2.0 * max(now["stdev"], old["stdev"]) / old["median"]
+            flag = ""
+            if change > threshold and change > noise:
+                flag = "  REGRESSION"
+                regressions += 1
+            elif -change > threshold and -change > noise:
+                flag = "  faster"
+            print(f"{bench:<14} {config:<14} {old['median']:>8.3f}s {now['median']:>8.3f}s {change * 100:>+7.1f}%{flag}")
+    return regressions
+
+def print_table(results):
+    columns = [c for c in CONFIGS if any(c in r for r in results["muali"].values())]
+    refs = [r for r in REFERENCES if r in results["reference"]]
+    print(f"\n{'benchmark':<14}" + "".join(f" {c:>14}" for c in columns + refs))
+    for bench in results["muali"]:
+        row = f"{bench:<14}"
+        for c in columns:
+            r = results["muali"][bench].get(c)
+            row += f" {r['median']:>8.3f}s ±{r['stdev'] * 1000:>3.0f}" if r else f" {'':>14}"
+        for ref in refs:
+            r = results["reference"][ref].get(bench)
+            row += f" {r['median']:>8.3f}s ±{r['stdev'] * 1000:>3.0f}" if r else f" {'':>14}"
+        print(row)
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("benchmarks", nargs="*", help=f"which to run (default: all of {', '.join(BENCHMARKS)})")
+    parser.add_argument("--configs", nargs="+", default=list(CONFIGS), choices=list(CONFIGS))
+    parser.add_argument("--runs", type=int, default=5, help="timed runs per benchmark, after one warmup run")
+    parser.add_argument("--no-reference", action="store_true", help="don't time the Lua and Python versions")
+    parser.add_argument("--build-dir", default=os.path.join(HERE, "build"))
+    parser.add_argument("--no-build", action="store_true", help="use the binaries already in --build-dir")
+    parser.add_argument("--cxx", default=default_cxx())
+    parser.add_argument("--cxxflags", default="-std=c++20 -O2")
+    parser.add_argument("--output", help="where to write the JSON results (default: results.json in --build-dir)")
+    parser.add_argument("--compare", help="results from an earlier run to compare against")
+    parser.add_argument("--threshold", type=float, default=0.05, help="slowdown that counts as a regression")
+    args = parser.parse_args()
+
+    benches = args.benchmarks or list(BENCHMARKS)
+    for bench in benches:
+        if bench not in BENCHMARKS:
+            sys.exit(f"error: unknown benchmark {bench}")
+    os.makedirs(args.build_dir, exist_ok=True)
+
+    results = {
+        "revision": git_revision(),
+        "machine": platform.machine(),
+        "platform": platform.platform(),
+        "cxx": args.cxx,
+        "cxxflags": args.cxxflags,
+        "runs": args.runs,
+        "defines": {},
+        "muali": {bench: {} for bench in benches},
+        "reference": {},
+    }
+    loop_dispatch = needs_loop_dispatch(args.cxx)
+    if loop_dispatch:
+        log(f"{args.cxx} isn't clang, so every configuration gets USE_LOOP_DISPATCH")
+    for config in args.configs:
+        defines = CONFIGS[config]
+        if loop_dispatch and "USE_LOOP_DISPATCH" not in defines:
+            defines = defines + ["USE_LOOP_DISPATCH"]
+        results["defines"][config] = defines
+        binary = os.path.join(args.build_dir, f"muali_{config}")
+        if not args.no_build:
+            binary = build(config, defines, args.build_dir, args.cxx, args.cxxflags.split())
+        work_dir = os.path.join(args.build_dir, config)
+        os.makedirs(work_dir, exist_ok=True)
+        for bench in benches:
+            log(f"{config}: {bench}")
+            results["muali"][bench][config] = time_muali(binary, bench, work_dir, args.runs)
+
+    if not args.no_reference:
+        for lang, command in REFERENCES.items():
+            if not shutil.which(command[0]):
+                log(f"skipping {lang}: {command[0]} isn't installed")
+                continue
+            work_dir = os.path.join(args.build_dir, lang)
+            os.makedirs(work_dir, exist_ok=True)
+            results["reference"][lang] = {}
+            for bench in benches:
+                log(f"{lang}: {bench}")
+                results["reference"][lang][bench] = time_reference(command, lang, bench, work_dir, args.runs)
+
+    output = args.output or os.path.join(args.build_dir, "results.json")
+    with open(output, "w") as f:
+        json.dump(results, f, indent=2)
+    log(f"wrote {output}")
+    print_table(results)
+
+    if args.compare:
+        with open(args.compare) as f:
+            base = json.load(f)
+        regressions = compare(results, base, args.threshold)
+        if regressions:
+            print(f"\n{regressions} regression(s) over {args.threshold * 100:.0f}%")
+            sys.exit(1)
+
+if __name__ == "__main__":
+    main()
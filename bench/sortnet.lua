@@ -0,0 +1,137 @@
+local x = 12345
+local acc = 0
+local t = 0
+local a0 = 0
+local a1 = 0
+local a2 = 0
+local a3 = 0
+local a4 = 0
+local a5 = 0
+local a6 = 0
+local a7 = 0
+for r = 0, 199999 do
+    x = x * 1103515245 + 12345
+    x = x - ((x >> 31) << 31)
+    a0 = x >> 16
+    x = x * 1103515245 + 12345
+    x = x - ((x >> 31) << 31)
+    a1 = x >> 16
+    x = x * 1103515245 + 12345
+    x = x - ((x >> 31) << 31)
+    a2 = x >> 16
+    x = x * 1103515245 + 12345
+    x = x - ((x >> 31) << 31)
+    a3 = x >> 16
+    x = x * 1103515245 + 12345
+    x = x - ((x >> 31) << 31)
+    a4 = x >> 16
+    x = x * 1103515245 + 12345
+    x = x - ((x >> 31) << 31)
+    a5 = x >> 16
+    x = x * 1103515245 + 12345
+    x = x - ((x >> 31) << 31)
+    a6 = x >> 16
+    x = x * 1103515245 + 12345
+    x = x - ((x >> 31) << 31)
+    a7 = x >> 16
+    if a0 > a2 then
+        t = a0
+        a0 = a2
+        a2 = t
+    end
+    if a1 > a3 then
+        t = a1
+        a1 = a3
+        a3 = t
+    end
+    if a4 > a6 then
+        t = a4
+        a4 = a6
+        a6 = t
+    end
+    if a5 > a7 then
+        t = a5
+        a5 = a7
+        a7 = t
+    end
+    if a0 > a4 then
+        t = a0
+        a0 = a4
+        a4 = t
+    end
+    if a1 > a5 then
+        t = a1
+        a1 = a5
+        a5 = t
+    end
+    if a2 > a6 then
+        t = a2
+        a2 = a6
+        a6 = t
+    end
+    if a3 > a7 then
+        t = a3
+        a3 = a7
+        a7 = t
+    end
+    if a0 > a1 then
+        t = a0
+        a0 = a1
+        a1 = t
+    end
+    if a2 > a3 then
+        t = a2
+        a2 = a3
+        a3 = t
+    end
+    if a4 > a5 then
+        t = a4
+        a4 = a5
+        a5 = t
+    end
+    if a6 > a7 then
+        t = a6
+        a6 = a7
+        a7 = t
+    end
+    if a2 > a4 then
+        t = a2
+        a2 = a4
+        a4 = t
+    end
+    if a3 > a5 then
+        t = a3
+        a3 = a5
+        a5 = t
+    end
+    if a1 > a4 then
+        t = a1
+        a1 = a4
+        a4 = t
+    end
+    if a3 > a6 then
+        t = a3
+        a3 = a6
+        a6 = t
+    end
+    if a1 > a2 then
+        t = a1
+        a1 = a2
+        a2 = t
+    end
+    if a3 > a4 then
+        t = a3
+        a3 = a4
+        a4 = t
+    end
+    if a5 > a6 then
+        t = a5
+        a5 = a6
+        a6 = t
+    end
+    acc = acc + a0 + a3 * 2 + a7 * 3
+    if acc > 1000000000 then
+        acc = acc - 999999999
+    end
+end
+print(acc)
@@ -0,0 +1,118 @@
+def main():
+    x = 12345
+    acc = 0
+    a0 = 0
+    a1 = 0
+    a2 = 0
+    a3 = 0
+    a4 = 0
+    a5 = 0
+    a6 = 0
+    a7 = 0
+    for r in range(0, 200000):
+        x = x * 1103515245 + 12345
+        x = x - ((x >> 31) << 31)
+        a0 = x >> 16
+        x = x * 1103515245 + 12345
+        x = x - ((x >> 31) << 31)
+        a1 = x >> 16
+        x = x * 1103515245 + 12345
+        x = x - ((x >> 31) << 31)
+        a2 = x >> 16
+        x = x * 1103515245 + 12345
+        x = x - ((x >> 31) << 31)
+        a3 = x >> 16
+        x = x * 1103515245 + 12345
+        x = x - ((x >> 31) << 31)
+        a4 = x >> 16
+        x = x * 1103515245 + 12345
+        x = x - ((x >> 31) << 31)
+        a5 = x >> 16
+        x = x * 1103515245 + 12345
+        x = x - ((x >> 31) << 31)
+        a6 = x >> 16
+        x = x * 1103515245 + 12345
+        x = x - ((x >> 31) << 31)
+        a7 = x >> 16
+        if a0 > a2:
+            t = a0
+            a0 = a2
+            a2 = t
+        if a1 > a3:
+            t = a1
+            a1 = a3
+            a3 = t
+        if a4 > a6:
+            t = a4
+            a4 = a6
+            a6 = t
+        if a5 > a7:
+            t = a5
+            a5 = a7
+            a7 = t
+        if a0 > a4:
+            t = a0
+            a0 = a4
+            a4 = t
+        if a1 > a5:
+            t = a1
+            a1 = a5
+            a5 = t
+        if a2 > a6:
+            t = a2
+            a2 = a6
+            a6 = t
+        if a3 > a7:
+            t = a3
+            a3 = a7
+            a7 = t
+        if a0 > a1:
+            t = a0
+            a0 = a1
+            a1 = t
+        if a2 > a3:
+            t = a2
+            a2 = a3
+            a3 = t
+        if a4 > a5:
+            t = a4
+            a4 = a5
+            a5 = t
+        if a6 > a7:
+            t = a6
+            a6 = a7
+            a7 = t
+        if a2 > a4:
+            t = a2
+            a2 = a4
+            a4 = t
+        if a3 > a5:
+            t = a3
+            a3 = a5
+            a5 = t
+        if a1 > a4:
+            t = a1
+            a1 = a4
+            a4 = t
+        if a3 > a6:
+            t = a3
+            a3 = a6
+            a6 = t
+        if a1 > a2:
+            t = a1
+            a1 = a2
+            a2 = t
+        if a3 > a4:
+            t = a3
+            a3 = a4
+            a4 = t
+        if a5 > a6:
+            t = a5
+            a5 = a6
+            a6 = t
+        acc += a0 + a3 * 2 + a7 * 3
+        if acc > 1000000000:
+            acc -= 999999999
+    return acc
+
+print(main())
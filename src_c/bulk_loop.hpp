@@ -0,0 +1,623 @@
+#ifndef MUALI_BULK_LOOP
+#define MUALI_BULK_LOOP
+
+// Included by vm_common.hpp.
+
+// Bulk loops: a counted loop whose body is arithmetic on its induction variables, folded into accumulators (like
+// `sum += flip / (i<<1 - 1)`), can be described by a small kernel and run many iterations at a time with SIMD instead of
+// one iteration per trip through the dispatcher. The IR finds such loops (see ir_vectorize_loops) and puts an
+// OP_BULKLOOP right before each one. The op moves the values at the loop's header to where the last iteration would
+// leave them, so the loop itself only has to find out that it's done. If an operand doesn't have the type the kernel
+// expects, or there are only a few iterations, the op does nothing and the loop runs as usual.
+//
+// Kernels work on slots that hold one value for each iteration of a chunk of BULK_CHUNK iterations (lanes):
+// - operands fill slots as induction variables (start + k * step), sign toggles or loop invariants, and constants fill
+//   the rest of the inputs
+// - lane ops compute the other slots from those, over the whole chunk at once
+// - each reduction operand folds the lanes of its term slot into itself, in iteration order
+// Lane ops round exactly like the scalar ops they stand for, so only the reductions could change the result, and float
+// reductions keep their order unless BULK_FAST_MATH is defined.
+
+//#define BULK_FAST_MATH
+// Lets float reductions be reassociated: partial sums (or products) are kept in SIMD lanes and combined at the end, which
+// is much faster but can round differently from running the loop. Int reductions always do this, since wrapping
+// arithmetic gives the same result in any order.
+
+constexpr size_t BULK_MAX_OPERANDS = 8; // registers an OP_BULKLOOP names; the unused ones repeat the first
+constexpr size_t BULK_MAX_SLOTS = 32;
+constexpr size_t BULK_MAX_OPS = 64;
+constexpr size_t BULK_CHUNK = 64; // even, so that sign toggles have the same lanes in every chunk
+constexpr int64_t BULK_MIN_ITERATIONS = 64; // loops with fewer left just run
+constexpr uint8_t BULK_NONE = 0xFF;
+
+// what an operand is to the loop
+constexpr uint8_t BULK_INDUCTION = 0; // goes up by step every iteration
+constexpr uint8_t BULK_TOGGLE    = 1; // gets negated every iteration
+constexpr uint8_t BULK_REDUCTION = 2; // gets the term folded into it every iteration
+constexpr uint8_t BULK_INVARIANT = 3; // stays the same
+
+// lane ops; the int ones wrap, like the interpreter's
+constexpr uint8_t BULK_I_ADD  = 0x00;
+constexpr uint8_t BULK_I_SUB  = 0x01;
+constexpr uint8_t BULK_I_MUL  = 0x02;
+constexpr uint8_t BULK_I_SHL  = 0x03;
+constexpr uint8_t BULK_I_SHR  = 0x04;
+constexpr uint8_t BULK_I_NEG  = 0x05;
+constexpr uint8_t BULK_I_TO_F = 0x06;
+constexpr uint8_t BULK_F_ADD  = 0x10;
+constexpr uint8_t BULK_F_SUB  = 0x11;
+constexpr uint8_t BULK_F_MUL  = 0x12;
+constexpr uint8_t BULK_F_DIV  = 0x13;
+constexpr uint8_t BULK_F_NEG  = 0x15;
+
+struct BulkOperand {
+    uint8_t role = BULK_INVARIANT;
+    uint8_t type = TYPEID_INT; // TYPEID_INT or TYPEID_FLOAT; checked before anything runs
+    uint8_t slot = BULK_NONE; // slot with its value on each iteration, if a lane op reads it
+    uint8_t op = BULK_I_ADD; // reductions: the ADD, SUB or MUL lane op that folds the term in
+    uint8_t term = BULK_NONE; // reductions: slot with the term
+    int64_t step = 0; // inductions
+};
+
+struct BulkConstant {
+    uint8_t slot;
+    uint64_t bits; // of an int64_t or a double
+};
+
+struct BulkLaneOp {
+    uint8_t op;
+    uint8_t dest;
+    uint8_t a;
+    uint8_t b = BULK_NONE; // unused by NEG and I_TO_F
+};
+
+struct BulkKernel {
+    uint8_t operand_count = 0;
+    uint8_t counter = 0; // the induction operand the loop counts with; iterations run while counter + 1 < limit
+    uint8_t limit_operand = BULK_NONE; // operand with the limit, or BULK_NONE if it's `limit`
+    int64_t limit = 0;
+    uint8_t slot_count = 0;
+    uint8_t constant_count = 0;
+    uint8_t op_count = 0;
+    BulkOperand operands[BULK_MAX_OPERANDS];
+    BulkConstant constants[BULK_MAX_SLOTS];
+    BulkLaneOp ops[BULK_MAX_OPS];
+};
+
+// Appends a kernel as the 'k' operand of an OP_BULKLOOP: the number of bytes that follow as a u16, then the fields in
+// order, little endian.
+static inline void bulk_encode(const BulkKernel & kernel, Vec<uint8_t> & out)
+{
+    Vec<uint8_t> bytes;
+    auto put = [&](uint64_t n, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+            bytes.push_back(uint8_t(n >> (i * 8)));
+    };
+    put(kernel.operand_count, 1);
+    put(kernel.counter, 1);
+    put(kernel.limit_operand, 1);
+    put(kernel.limit, 8);
+    put(kernel.slot_count, 1);
+    put(kernel.constant_count, 1);
+    put(kernel.op_count, 1);
+    for (size_t i = 0; i < kernel.operand_count; i++)
+    {
+        auto & operand = kernel.operands[i];
+        put(operand.role, 1);
+        put(operand.type, 1);
+        put(operand.slot, 1);
+        put(operand.op, 1);
+        put(operand.term, 1);
+        put(operand.step, 8);
+    }
+    for (size_t i = 0; i < kernel.constant_count; i++)
+    {
+        put(kernel.constants[i].slot, 1);
+        put(kernel.constants[i].bits, 8);
+    }
+    for (size_t i = 0; i < kernel.op_count; i++)
+    {
+        auto & op = kernel.ops[i];
+        put(op.op, 1);
+        put(op.dest, 1);
+        put(op.a, 1);
+        put(op.b, 1);
+    }
+    assert(bytes.size() <= 0xFFFF);
+    out.push_back(uint8_t(bytes.size()));
+    out.push_back(uint8_t(bytes.size() >> 8));
+    for (auto byte : bytes)
+        out.push_back(byte);
+}
+
+// Reads a kernel written by bulk_encode, starting at its length.
+static inline void bulk_decode(const uint8_t * p, BulkKernel & kernel)
+{
+    p += 2;
+    auto get = [&](size_t size)
+    {
+        uint64_t n = 0;
+        for (size_t i = 0; i < size; i++)
+            n |= uint64_t(*p++) << (i * 8);
+        return n;
+    };
+    kernel.operand_count = get(1);
+    kernel.counter = get(1);
+    kernel.limit_operand = get(1);
+    kernel.limit = get(8);
+    kernel.slot_count = get(1);
+    kernel.constant_count = get(1);
+    kernel.op_count = get(1);
+    assert(kernel.operand_count <= BULK_MAX_OPERANDS && kernel.slot_count <= BULK_MAX_SLOTS
+        && kernel.constant_count <= BULK_MAX_SLOTS && kernel.op_count <= BULK_MAX_OPS);
+    for (size_t i = 0; i < kernel.operand_count; i++)
+    {
+        auto & operand = kernel.operands[i];
+        operand.role = get(1);
+        operand.type = get(1);
+        operand.slot = get(1);
+        operand.op = get(1);
+        operand.term = get(1);
+        operand.step = get(8);
+    }
+    for (size_t i = 0; i < kernel.constant_count; i++)
+    {
+        kernel.constants[i].slot = get(1);
+        kernel.constants[i].bits = get(8);
+    }
+    for (size_t i = 0; i < kernel.op_count; i++)
+    {
+        auto & op = kernel.ops[i];
+        op.op = get(1);
+        op.dest = get(1);
+        op.a = get(1);
+        op.b = get(1);
+    }
+}
+
+// Whether the kernel at p (starting at its length, like bulk_decode) only names slots, operands and ops that exist, so
+// that bulk_run stays inside of its slots. Kernels from the compiler always do; ones read back from a file might not.
+static inline bool bulk_valid(const uint8_t * p)
+{
+    size_t size = p[0] | (size_t(p[1]) << 8);
+    if (size < 14)
+        return false;
+    uint8_t operand_count = p[2];
+    uint8_t slot_count = p[13];
+    uint8_t constant_count = p[14];
+    uint8_t op_count = p[15];
+    if (operand_count > BULK_MAX_OPERANDS || slot_count > BULK_MAX_SLOTS || constant_count > BULK_MAX_SLOTS
+        || op_count > BULK_MAX_OPS || size != 14 + 13 * size_t(operand_count) + 9 * size_t(constant_count) + 4 * size_t(op_count))
+        return false;
+    
+    BulkKernel kernel;
+    bulk_decode(p, kernel);
+    auto slot = [&](uint8_t s, bool optional) { return s < kernel.slot_count || (optional && s == BULK_NONE); };
+    auto known = [](uint8_t op) { return op <= BULK_I_TO_F || (op >= BULK_F_ADD && op <= BULK_F_DIV) || op == BULK_F_NEG; };
+    if (kernel.counter >= kernel.operand_count
+        || (kernel.limit_operand >= kernel.operand_count && kernel.limit_operand != BULK_NONE))
+        return false;
+    for (size_t i = 0; i < kernel.operand_count; i++)
+    {
+        auto & operand = kernel.operands[i];
+        if (operand.role > BULK_INVARIANT || (operand.type != TYPEID_INT && operand.type != TYPEID_FLOAT)
+            || !slot(operand.slot, true))
+            return false;
+        if (operand.role == BULK_REDUCTION && (!slot(operand.term, false) || (operand.op != BULK_I_ADD
+            && operand.op != BULK_I_SUB && operand.op != BULK_I_MUL && operand.op != BULK_F_ADD
+            && operand.op != BULK_F_SUB && operand.op != BULK_F_MUL)))
+            return false;
+    }
+    for (size_t i = 0; i < kernel.constant_count; i++)
+    {
+        if (!slot(kernel.constants[i].slot, false))
+            return false;
+    }
+    for (size_t i = 0; i < kernel.op_count; i++)
+    {
+        auto & op = kernel.ops[i];
+        if (!known(op.op) || !slot(op.dest, false) || !slot(op.a, false) || !slot(op.b, true))
+            return false;
+    }
+    return true;
+}
+
+// Four lanes. Without AVX these are pairs of SSE2 registers.
+typedef uint64_t BulkU64x4 __attribute__((vector_size(32), __may_alias__));
+typedef int64_t BulkI64x4 __attribute__((vector_size(32), __may_alias__));
+typedef double BulkF64x4 __attribute__((vector_size(32), __may_alias__));
+constexpr size_t BULK_VECTORS = BULK_CHUNK / 4;
+
+// Sums of quotients over an int induction variable, like `sum += flip / x`, are what most bulk loops are, so bulk_run
+// has a kernel just for them that keeps everything in registers instead of going through the slots of a chunk: the
+// reduction's term is an F_DIV whose divisor is the I_TO_F of the induction variable, and whose dividend is a float
+// toggle, invariant or constant, maybe through an F_NEG.
+struct BulkQuotientSum {
+    uint8_t reduction;
+    uint8_t divisor; // the int induction operand
+    uint8_t dividend; // operand, or BULK_NONE if it's a constant
+    uint64_t dividend_bits; // the constant's
+    bool negated;
+};
+
+static inline bool bulk_match_quotient_sum(const BulkKernel & kernel, BulkQuotientSum & sum)
+{
+    sum.reduction = BULK_NONE;
+    for (size_t o = 0; o < kernel.operand_count; o++)
+    {
+        auto & operand = kernel.operands[o];
+        if (operand.role != BULK_REDUCTION)
+            continue;
+        if (sum.reduction != BULK_NONE || operand.type != TYPEID_FLOAT || (operand.op != BULK_F_ADD && operand.op != BULK_F_SUB))
+            return false;
+        sum.reduction = o;
+    }
+    if (sum.reduction == BULK_NONE)
+        return false;
+    
+    auto writer = [&](uint8_t slot) -> const BulkLaneOp *
+    {
+        for (size_t i = 0; i < kernel.op_count; i++)
+        {
+            if (kernel.ops[i].dest == slot)
+                return &kernel.ops[i];
+        }
+        return nullptr;
+    };
+    auto reader = [&](uint8_t slot) -> uint8_t
+    {
+        for (size_t o = 0; o < kernel.operand_count; o++)
+        {
+            if (kernel.operands[o].slot == slot)
+                return o;
+        }
+        return BULK_NONE;
+    };
+    auto div = writer(kernel.operands[sum.reduction].term);
+    if (!div || div->op != BULK_F_DIV)
+        return false;
+    auto conversion = writer(div->b);
+    if (!conversion || conversion->op != BULK_I_TO_F || conversion > div)
+        return false;
+    sum.divisor = reader(conversion->a);
+    if (sum.divisor == BULK_NONE || kernel.operands[sum.divisor].role != BULK_INDUCTION
+        || kernel.operands[sum.divisor].type != TYPEID_INT)
+        return false;
+    
+    uint8_t dividend_slot = div->a;
+    auto neg = writer(dividend_slot);
+    sum.negated = neg != nullptr;
+    if (neg)
+    {
+        if (neg->op != BULK_F_NEG || neg > div)
+            return false;
+        dividend_slot = neg->a;
+    }
+    // every op is one of the ones above
+    if (kernel.op_count != 2 + sum.negated || writer(dividend_slot))
+        return false;
+    sum.dividend = reader(dividend_slot);
+    if (sum.dividend != BULK_NONE)
+    {
+        auto & operand = kernel.operands[sum.dividend];
+        return operand.type == TYPEID_FLOAT && (operand.role == BULK_TOGGLE || operand.role == BULK_INVARIANT);
+    }
+    for (size_t c = 0; c < kernel.constant_count; c++)
+    {
+        if (kernel.constants[c].slot == dividend_slot)
+        {
+            sum.dividend_bits = kernel.constants[c].bits;
+            return true;
+        }
+    }
+    return false;
+}
+
+// bulk_run gets an AVX2 version next to the baseline one, picked when the program loads
+#if defined __x86_64__ && defined __linux__ && defined __GNUC__
+#define BULK_TARGETS __attribute__((target_clones("avx2", "default")))
+#else
+#define BULK_TARGETS
+#endif
+
+// Runs `count` iterations of a kernel. values has the bits of the operands (int64_t or double, by their type) from
+// before the first iteration, and gets the ones from after the last.
+BULK_TARGETS static void bulk_run(const BulkKernel & kernel, uint64_t * values, int64_t count)
+{
+    alignas(32) uint64_t lanes[BULK_MAX_SLOTS][BULK_CHUNK];
+    auto u = [&](uint8_t slot) { return (BulkU64x4 *)lanes[slot]; };
+    auto f = [&](uint8_t slot) { return (BulkF64x4 *)lanes[slot]; };
+    auto negate = [](uint64_t bits, uint8_t type) { return type == TYPEID_INT ? 0 - bits : bits ^ (1ULL << 63); };
+    // Converts ints to floats, rounding like a scalar conversion. Only AVX-512 has an instruction for that, so each
+    // 32-bit half goes through the exponent trick on its own (ORed into the mantissa of 2^52, a half makes a double
+    // that's 2^52 more than it), and since scaling the high half by 2^32 is exact, the add at the end is the only
+    // rounding. Not inlining this into the AVX2 version would make every call switch between SSE and AVX, and vectors
+    // go through a reference because passing them by value changes with the target.
+    auto to_float = [](const BulkU64x4 & x, BulkF64x4 & out) __attribute__((always_inline))
+    {
+        const uint64_t two_52_bits = 0x4330000000000000;
+        const double two_52 = 4503599627370496.0;
+        BulkU64x4 high = BulkU64x4((BulkI64x4(x) >> 32) + 0x80000000) | two_52_bits; // biased to be positive
+        BulkU64x4 low = (x & 0xFFFFFFFF) | two_52_bits;
+        out = ((BulkF64x4)high - (two_52 + 2147483648.0)) * 4294967296.0 + ((BulkF64x4)low - two_52);
+    };
+    
+    // reductions that keep their order add up in `ordered`; the others in two vectors of lanes plus `tail`, for the
+    // iterations of a last chunk that isn't full
+    struct Accumulator {
+        BulkU64x4 lanes[2];
+        uint64_t tail;
+        double ordered;
+    };
+    Accumulator accumulators[BULK_MAX_OPERANDS];
+    auto is_mul = [](uint8_t op) { return op == BULK_I_MUL || op == BULK_F_MUL; };
+    auto in_order = [](uint8_t op)
+    {
+    #ifdef BULK_FAST_MATH
+        (void)op;
+        return false;
+    #else
+        return op >= BULK_F_ADD;
+    #endif
+    };
+    for (size_t o = 0; o < kernel.operand_count; o++)
+    {
+        auto & operand = kernel.operands[o];
+        if (operand.role != BULK_REDUCTION)
+            continue;
+        auto & acc = accumulators[o];
+        uint64_t identity = 0;
+        if (operand.op == BULK_I_MUL)
+            identity = 1;
+        else if (operand.op == BULK_F_MUL)
+        {
+            double one = 1.0;
+            memcpy(&identity, &one, 8);
+        }
+        for (auto & v : acc.lanes)
+        {
+            for (size_t j = 0; j < 4; j++)
+                v[j] = identity;
+        }
+        acc.tail = identity;
+        memcpy(&acc.ordered, &values[o], 8);
+    }
+    
+    BulkQuotientSum quotient_sum;
+    if (bulk_match_quotient_sum(kernel, quotient_sum))
+    {
+        auto & acc = accumulators[quotient_sum.reduction];
+        uint64_t bits = quotient_sum.dividend == BULK_NONE ? quotient_sum.dividend_bits : values[quotient_sum.dividend];
+        if (quotient_sum.negated)
+            bits ^= 1ULL << 63;
+        double n;
+        memcpy(&n, &bits, 8);
+        bool toggle = quotient_sum.dividend != BULK_NONE && kernel.operands[quotient_sum.dividend].role == BULK_TOGGLE;
+        BulkF64x4 dividends = {n, toggle ? -n : n, n, toggle ? -n : n};
+        uint64_t step = kernel.operands[quotient_sum.divisor].step;
+        uint64_t first = values[quotient_sum.divisor];
+        BulkU64x4 x = {first, first + step, first + step * 2, first + step * 3};
+        BulkF64x4 divisors;
+        int64_t k = 0;
+        if (in_order(kernel.operands[quotient_sum.reduction].op))
+        {
+            // subtracting is adding the negation, which rounds the same
+            if (kernel.operands[quotient_sum.reduction].op == BULK_F_SUB)
+                dividends = -dividends;
+            double total = acc.ordered;
+            for (; k + 4 <= count; k += 4)
+            {
+                to_float(x, divisors);
+                BulkF64x4 q = dividends / divisors;
+                x += step * 4;
+                total += q[0];
+                total += q[1];
+                total += q[2];
+                total += q[3];
+            }
+            for (size_t j = 0; k + int64_t(j) < count; j++)
+                total += dividends[j] / double(int64_t(x[j]));
+            acc.ordered = total;
+        }
+        else
+        {
+            auto l = (BulkF64x4 *)acc.lanes;
+            for (; k + 8 <= count; k += 8)
+            {
+                to_float(x, divisors);
+                l[0] += dividends / divisors;
+                x += step * 4;
+                to_float(x, divisors);
+                l[1] += dividends / divisors;
+                x += step * 4;
+            }
+            if (k + 4 <= count)
+            {
+                to_float(x, divisors);
+                l[0] += dividends / divisors;
+                x += step * 4;
+                k += 4;
+            }
+            double tail;
+            memcpy(&tail, &acc.tail, 8);
+            for (size_t j = 0; k + int64_t(j) < count; j++)
+                tail += dividends[j] / double(int64_t(x[j]));
+            memcpy(&acc.tail, &tail, 8);
+        }
+    }
+    else
+    {
+        for (size_t c = 0; c < kernel.constant_count; c++)
+        {
+            for (size_t j = 0; j < BULK_CHUNK; j++)
+                lanes[kernel.constants[c].slot][j] = kernel.constants[c].bits;
+        }
+        for (size_t o = 0; o < kernel.operand_count; o++)
+        {
+            auto & operand = kernel.operands[o];
+            if (operand.slot == BULK_NONE)
+                continue;
+            for (size_t j = 0; j < BULK_CHUNK; j++)
+            {
+                if (operand.role == BULK_INDUCTION)
+                    lanes[operand.slot][j] = values[o] + uint64_t(j) * uint64_t(operand.step);
+                else if (operand.role == BULK_TOGGLE && j % 2)
+                    lanes[operand.slot][j] = negate(values[o], operand.type);
+                else
+                    lanes[operand.slot][j] = values[o];
+            }
+        }
+        
+        for (int64_t done = 0; done < count; done += BULK_CHUNK)
+        {
+            size_t m = count - done < int64_t(BULK_CHUNK) ? count - done : BULK_CHUNK;
+            for (size_t i = 0; i < kernel.op_count; i++)
+            {
+                auto & op = kernel.ops[i];
+                auto d = u(op.dest);
+                auto a = u(op.a);
+                auto b = op.b == BULK_NONE ? a : u(op.b);
+                auto fd = f(op.dest);
+                auto fa = f(op.a);
+                auto fb = op.b == BULK_NONE ? fa : f(op.b);
+                switch (op.op)
+                {
+                case BULK_I_ADD: for (size_t v = 0; v < BULK_VECTORS; v++) d[v] = a[v] + b[v]; break;
+                case BULK_I_SUB: for (size_t v = 0; v < BULK_VECTORS; v++) d[v] = a[v] - b[v]; break;
+                case BULK_I_MUL: for (size_t v = 0; v < BULK_VECTORS; v++) d[v] = a[v] * b[v]; break;
+                case BULK_I_SHL: for (size_t v = 0; v < BULK_VECTORS; v++) d[v] = a[v] << b[v]; break;
+                case BULK_I_SHR: for (size_t v = 0; v < BULK_VECTORS; v++) d[v] = BulkU64x4(BulkI64x4(a[v]) >> BulkI64x4(b[v])); break;
+                case BULK_I_NEG: for (size_t v = 0; v < BULK_VECTORS; v++) d[v] = -a[v]; break;
+                case BULK_I_TO_F: for (size_t v = 0; v < BULK_VECTORS; v++) to_float(a[v], fd[v]); break;
+                case BULK_F_ADD: for (size_t v = 0; v < BULK_VECTORS; v++) fd[v] = fa[v] + fb[v]; break;
+                case BULK_F_SUB: for (size_t v = 0; v < BULK_VECTORS; v++) fd[v] = fa[v] - fb[v]; break;
+                case BULK_F_MUL: for (size_t v = 0; v < BULK_VECTORS; v++) fd[v] = fa[v] * fb[v]; break;
+                case BULK_F_DIV: for (size_t v = 0; v < BULK_VECTORS; v++) fd[v] = fa[v] / fb[v]; break;
+                case BULK_F_NEG: for (size_t v = 0; v < BULK_VECTORS; v++) fd[v] = -fa[v]; break;
+                }
+            }
+            
+            for (size_t o = 0; o < kernel.operand_count; o++)
+            {
+                auto & operand = kernel.operands[o];
+                if (operand.role != BULK_REDUCTION)
+                    continue;
+                auto & acc = accumulators[o];
+                auto term = lanes[operand.term];
+                if (in_order(operand.op))
+                {
+                    // one loop for each op, in a local, so that each add only waits for the one before it
+                    const double * t = (const double *)term;
+                    double x = acc.ordered;
+                    if (operand.op == BULK_F_ADD)
+                    {
+                        for (size_t j = 0; j < m; j++)
+                            x += t[j];
+                    }
+                    else if (operand.op == BULK_F_SUB)
+                    {
+                        for (size_t j = 0; j < m; j++)
+                            x -= t[j];
+                    }
+                    else
+                    {
+                        for (size_t j = 0; j < m; j++)
+                            x *= t[j];
+                    }
+                    acc.ordered = x;
+                }
+                else if (m < BULK_CHUNK)
+                {
+                    for (size_t j = 0; j < m; j++)
+                    {
+                        if (operand.op >= BULK_F_ADD)
+                        {
+                            double x, y;
+                            memcpy(&x, &acc.tail, 8);
+                            memcpy(&y, &term[j], 8);
+                            x = is_mul(operand.op) ? x * y : x + y;
+                            memcpy(&acc.tail, &x, 8);
+                        }
+                        else
+                            acc.tail = is_mul(operand.op) ? acc.tail * term[j] : acc.tail + term[j];
+                    }
+                }
+                else if (operand.op >= BULK_F_ADD)
+                {
+                    auto t = f(operand.term);
+                    auto l = (BulkF64x4 *)acc.lanes;
+                    for (size_t v = 0; v < BULK_VECTORS; v++)
+                        l[v % 2] = is_mul(operand.op) ? l[v % 2] * t[v] : l[v % 2] + t[v];
+                }
+                else
+                {
+                    auto t = u(operand.term);
+                    for (size_t v = 0; v < BULK_VECTORS; v++)
+                        acc.lanes[v % 2] = is_mul(operand.op) ? acc.lanes[v % 2] * t[v] : acc.lanes[v % 2] + t[v];
+                }
+            }
+            
+            for (size_t o = 0; o < kernel.operand_count; o++)
+            {
+                auto & operand = kernel.operands[o];
+                if (operand.role != BULK_INDUCTION || operand.slot == BULK_NONE)
+                    continue;
+                auto s = u(operand.slot);
+                uint64_t chunk_step = uint64_t(operand.step) * BULK_CHUNK;
+                for (size_t v = 0; v < BULK_VECTORS; v++)
+                    s[v] += chunk_step;
+            }
+        }
+        
+    }
+    
+    for (size_t o = 0; o < kernel.operand_count; o++)
+    {
+        auto & operand = kernel.operands[o];
+        if (operand.role == BULK_INDUCTION)
+            values[o] += uint64_t(count) * uint64_t(operand.step);
+        else if (operand.role == BULK_TOGGLE && count % 2)
+            values[o] = negate(values[o], operand.type);
+        else if (operand.role == BULK_REDUCTION)
+        {
+            auto & acc = accumulators[o];
+            if (in_order(operand.op))
+            {
+                memcpy(&values[o], &acc.ordered, 8);
+                continue;
+            }
+            bool mul = is_mul(operand.op);
+            if (operand.op >= BULK_F_ADD)
+            {
+                double total, start;
+                memcpy(&total, &acc.tail, 8);
+                memcpy(&start, &values[o], 8);
+                for (auto & v : acc.lanes)
+                {
+                    for (size_t j = 0; j < 4; j++)
+                    {
+                        double x;
+                        memcpy(&x, (uint64_t *)&v + j, 8);
+                        total = mul ? total * x : total + x;
+                    }
+                }
+                start = operand.op == BULK_F_ADD ? start + total : operand.op == BULK_F_SUB ? start - total : start * total;
+                memcpy(&values[o], &start, 8);
+            }
+            else
+            {
+                uint64_t total = acc.tail;
+                for (auto & v : acc.lanes)
+                {
+                    for (size_t j = 0; j < 4; j++)
+                        total = mul ? total * v[j] : total + v[j];
+                }
+                auto & start = values[o];
+                start = operand.op == BULK_I_ADD ? start + total : operand.op == BULK_I_SUB ? start - total : start * total;
+            }
+        }
+    }
+}
+
+#endif // MUALI_BULK_LOOP
@@ -0,0 +1,493 @@
+#ifndef MUALI_BYTECODE_CACHE
+#define MUALI_BYTECODE_CACHE
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#include <direct.h> // _mkdir
+#endif
+
+#include "types.hpp"
+#include "vm_common.hpp"
+#include "compiler.hpp" // register_roles and code_falls_through, for checking mapped code
+
+// On-disk format for a compiled Global. Everything is little-endian and 8-byte aligned, so that the file can be
+// mmapped and the function code used in place, without copying it into the interpreter.
+//
+//     BytecodeCacheHeader
+//     BytecodeCacheFunc[func_count]
+//     BytecodeCacheName[func_name_count + var_name_count]
+//     string bytes, function code and line tables (each blob padded with zeroes to a multiple of 8, with at least 8 bytes of padding)
+//
+// The padding matters: the dispatcher reads opcodes two bytes at a time, so it can read past the final byte of a function.
+
+constexpr char BYTECODE_CACHE_MAGIC[8] = {'M', 'U', 'A', 'L', 'I', 'B', 'C', 0};
+constexpr uint32_t BYTECODE_CACHE_VERSION = 4;
+
+struct BytecodeCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t opcode_table_bits;
+    uint32_t opcode_encoding;
+    uint32_t varreg_encoding;
+    uint64_t key; // see bytecode_cache_key
+    uint64_t checksum; // fnv1a_64 of everything after the header, so that damage to the rest of the file is noticed
+    uint64_t file_size;
+    uint64_t func_count;
+    uint64_t func_name_count;
+    uint64_t var_name_count;
+};
+
+struct BytecodeCacheFunc {
+    uint64_t code_offset;
+    uint64_t code_size;
+    uint64_t num_args;
+    uint64_t num_vars;
+    uint64_t num_regs;
+    uint64_t row;
+    uint64_t column;
+    uint64_t line_table_offset;
+    uint64_t line_table_size;
+};
+
+struct BytecodeCacheName {
+    uint64_t str_offset;
+    uint64_t str_size;
+    uint64_t value;
+};
+
+static inline uint64_t fnv1a_64(const void * data, size_t len, uint64_t hash = 0xcbf29ce484222325ULL)
+{
+    auto bytes = (const uint8_t *)data;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Build settings that change what the compiler emits, beyond the encodings that the header records on its own.
+constexpr char BYTECODE_CACHE_CONFIG[] = "config:"
+#ifdef OPCODES_ALWAYS_8BIT
+    " OPCODES_ALWAYS_8BIT"
+#endif
+#ifdef OPCODES_ALWAYS_16BIT
+    " OPCODES_ALWAYS_16BIT"
+#endif
+#ifdef VARLEN_VARREG_8BIT
+    " VARLEN_VARREG_8BIT"
+#endif
+#ifdef VARLEN_VARREG_16BIT
+    " VARLEN_VARREG_16BIT"
+#endif
+#ifdef VARLEN_VARREG_SB15
+    " VARLEN_VARREG_SB15"
+#endif
+#ifdef VARLEN_VARREG_SB15LE
+    " VARLEN_VARREG_SB15LE"
+#endif
+#ifdef VARLEN_VARREG_LEB128
+    " VARLEN_VARREG_LEB128"
+#endif
+#ifdef VARLEN_VARREG_LZ4LIKE
+    " VARLEN_VARREG_LZ4LIKE"
+#endif
+#ifdef PROFILE_OPCODE_SEQUENCES
+    " PROFILE_OPCODE_SEQUENCES"
+#endif
+#ifdef VARIABLE_NANBOXED
+    " VARIABLE_NANBOXED"
+#endif
+    ;
+
+// Hash of what the bytecode means: every opcode's number and operands, the superinstructions that the compiler fuses,
+// the layout of the file's tables, and the settings above. It's the same for every build of the same sources, unlike
+// a timestamp. Changes to the compiler that keep all of this the same but change what it emits should bump BYTECODE_CACHE_VERSION.
+static inline uint64_t bytecode_cache_layout_hash(void)
+{
+    uint64_t hash = fnv1a_64(BYTECODE_CACHE_CONFIG, sizeof(BYTECODE_CACHE_CONFIG));
+    for (uint32_t op = 0; op < 0x10000; op++)
+    {
+        if (auto operands = opcode_operands(op))
+        {
+            hash = fnv1a_64(&op, sizeof(op), hash);
+            hash = fnv1a_64(operands, strlen(operands) + 1, hash);
+        }
+    }
+    #define _BYTECODE_CACHE_HASH_2(OPCODE, NAME, A, OP_A, B, OP_B) { uint32_t seq[] = {OPCODE, OP_A, OP_B}; hash = fnv1a_64(seq, sizeof(seq), hash); }
+    #define _BYTECODE_CACHE_HASH_3(OPCODE, NAME, A, OP_A, B, OP_B, C, OP_C) { uint32_t seq[] = {OPCODE, OP_A, OP_B, OP_C}; hash = fnv1a_64(seq, sizeof(seq), hash); }
+    SUPERINSTRUCTIONS_2(_BYTECODE_CACHE_HASH_2)
+    SUPERINSTRUCTIONS_3(_BYTECODE_CACHE_HASH_3)
+    #undef _BYTECODE_CACHE_HASH_2
+    #undef _BYTECODE_CACHE_HASH_3
+    uint64_t sizes[] = {sizeof(BytecodeCacheHeader), sizeof(BytecodeCacheFunc), sizeof(BytecodeCacheName)};
+    return fnv1a_64(sizes, sizeof(sizes), hash);
+}
+
+// Key that a cache file must match to be used.
+// Covers the grammar, the program source, and what the bytecode means (see above), so changing any of them invalidates old caches.
+static inline uint64_t bytecode_cache_key(const char * grammar_text, const char * source_text)
+{
+    uint64_t hash = bytecode_cache_layout_hash();
+    hash = fnv1a_64(grammar_text, strlen(grammar_text) + 1, hash);
+    hash = fnv1a_64(source_text, strlen(source_text) + 1, hash);
+    return hash;
+}
+
+// Where the cache for the program at source_path goes in dir: named after the file, plus a hash of its full path so that
+// programs with the same name in different places don't take turns overwriting one cache. Makes dir if it's missing.
+static inline String bytecode_cache_path(const char * dir, const char * source_path)
+{
+#ifndef _WIN32
+    mkdir(dir, 0777);
+    char * full_path = realpath(source_path, nullptr);
+#else
+    _mkdir(dir);
+    char * full_path = _fullpath(nullptr, source_path, 0);
+#endif
+    const char * path = full_path ? full_path : source_path;
+    uint64_t hash = fnv1a_64(path, strlen(path));
+    free(full_path);
+    
+    const char * name = source_path;
+    for (const char * c = source_path; *c; c++)
+    {
+        if (*c == '/' || *c == '\\')
+            name = c + 1;
+    }
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "-%016llx.muac", (unsigned long long)hash);
+    return String(dir) + "/" + String(name) + suffix;
+}
+
+static inline size_t _bytecode_cache_pad(size_t n)
+{
+    return (n + 8) & ~size_t(7);
+}
+
+// Returns false if the file couldn't be written. Writes to a temporary file first, so readers never see a partial cache.
+static inline bool save_bytecode_cache(const char * path, const Global & global, uint64_t key)
+{
+    Vec<uint8_t> out;
+    auto append = [&](const void * data, size_t len)
+    {
+        for (size_t i = 0; i < len; i++)
+            out.push_back(((const uint8_t *)data)[i]);
+    };
+    auto pad_to_8 = [&]()
+    {
+        while (out.size() % 8)
+            out.push_back(0);
+    };
+    
+    BytecodeCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BYTECODE_CACHE_MAGIC, 8);
+    header.version = BYTECODE_CACHE_VERSION;
+    header.opcode_table_bits = INTERPRETER_OPCODE_TABLE_BITS;
+    header.opcode_encoding = OPCODE_ENCODING_ID;
+    header.varreg_encoding = VARREG_ENCODING_ID;
+    header.key = key;
+    header.func_count = global.funcs.size();
+    header.func_name_count = global.func_names.size();
+    header.var_name_count = global.var_names.size();
+    
+    size_t offset = sizeof(BytecodeCacheHeader)
+        + sizeof(BytecodeCacheFunc) * header.func_count
+        + sizeof(BytecodeCacheName) * (header.func_name_count + header.var_name_count);
+    
+    Vec<BytecodeCacheFunc> funcs;
+    for (auto & func : global.funcs)
+    {
+        BytecodeCacheFunc f;
+        f.code_offset = offset;
+        f.code_size = func->code_size();
+        f.num_args = func->num_args;
+        f.num_vars = func->num_vars;
+        f.num_regs = func->num_regs;
+        f.row = func->row;
+        f.column = func->column;
+        offset += _bytecode_cache_pad(f.code_size);
+        f.line_table_offset = offset;
+        f.line_table_size = func->line_table_size();
+        offset += _bytecode_cache_pad(f.line_table_size);
+        funcs.push_back(f);
+    }
+    
+    Vec<BytecodeCacheName> names;
+    auto add_names = [&](const HashMap<String, size_t> & map)
+    {
+        for (auto & pair : map)
+        {
+            names.push_back(BytecodeCacheName{offset, pair._0.size(), pair._1});
+            offset += _bytecode_cache_pad(pair._0.size());
+        }
+    };
+    add_names(global.func_names);
+    add_names(global.var_names);
+    
+    header.file_size = offset;
+    
+    append(&header, sizeof(header));
+    append(funcs.data(), sizeof(BytecodeCacheFunc) * funcs.size());
+    append(names.data(), sizeof(BytecodeCacheName) * names.size());
+    for (auto & func : global.funcs)
+    {
+        append(func->code_data(), func->code_size());
+        out.push_back(0);
+        pad_to_8();
+        append(func->line_table_data(), func->line_table_size());
+        out.push_back(0);
+        pad_to_8();
+    }
+    auto add_strings = [&](const HashMap<String, size_t> & map)
+    {
+        for (auto & pair : map)
+        {
+            append(pair._0.data(), pair._0.size());
+            out.push_back(0);
+            pad_to_8();
+        }
+    };
+    add_strings(global.func_names);
+    add_strings(global.var_names);
+    
+    assert(out.size() == header.file_size);
+    header.checksum = fnv1a_64(out.data() + sizeof(header), out.size() - sizeof(header));
+    memcpy(out.data(), &header, sizeof(header));
+    
+    String temp_path = String(path) + ".tmp";
+    auto f = fopen(temp_path.data(), "wb");
+    if (!f)
+        return false;
+    bool ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+    ok = fclose(f) == 0 && ok;
+    if (ok)
+        ok = rename(temp_path.data(), path) == 0;
+    if (!ok)
+        remove(temp_path.data());
+    return ok;
+}
+
+static inline void _bytecode_cache_unmap(CodeMapping & mapping)
+{
+#ifndef _WIN32
+    munmap((void *)mapping.data, mapping.size);
+#else
+    free((void *)mapping.data);
+#endif
+}
+
+static inline Option<CodeMapping> _bytecode_cache_map_file(const char * path)
+{
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return {};
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(BytecodeCacheHeader))
+    {
+        close(fd);
+        return {};
+    }
+    void * data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return {};
+    return CodeMapping((const uint8_t *)data, st.st_size, _bytecode_cache_unmap);
+#else
+    // no mmap here; read the whole file into one buffer instead
+    auto f = fopen(path, "rb");
+    if (!f)
+        return {};
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size < (long)sizeof(BytecodeCacheHeader))
+    {
+        fclose(f);
+        return {};
+    }
+    auto data = (uint8_t *)malloc(size);
+    bool ok = data && fread(data, 1, size, f) == (size_t)size;
+    fclose(f);
+    if (!ok)
+    {
+        free(data);
+        return {};
+    }
+    return CodeMapping(data, size, _bytecode_cache_unmap);
+#endif
+}
+
+// Largest frame that cached code can ask for: as many var-regs as the encoding can address, or for the encodings
+// without a limit, more than any program needs.
+#if defined VARLEN_VARREG_16BIT
+constexpr size_t BYTECODE_CACHE_MAX_FRAME = size_t(1) << 16;
+#elif defined VARLEN_VARREG_8BIT
+constexpr size_t BYTECODE_CACHE_MAX_FRAME = size_t(1) << 8;
+#elif defined VARLEN_VARREG_SB15LE || defined VARLEN_VARREG_SB15
+constexpr size_t BYTECODE_CACHE_MAX_FRAME = size_t(1) << 15;
+#else
+constexpr size_t BYTECODE_CACHE_MAX_FRAME = size_t(1) << 24;
+#endif
+
+// Checks that mapped code only has ops the compiler emits, that its registers are in the function's frame, that its
+// calls go to functions that exist, that its jumps land on instructions, and that its bulk loop kernels stay in their
+// slots (see bulk_valid), so that a damaged cache can't make the interpreter read outside of the frame or the code.
+// code[size] has to be padding, which stops varlen ints at the end.
+static inline bool _bytecode_cache_check_code(const uint8_t * code, size_t size, size_t frame_size, size_t func_count)
+{
+    if (size == 0 || code[size] != 0)
+        return false;
+    // the compiler pads the code with zeroes too (see compile_func), and the last op can end in zeroes
+    size_t end = size;
+    while (end > 0 && code[end - 1] == 0)
+        end -= 1;
+    Vec<bool> starts(size, false);
+    Vec<size_t> targets;
+    uint16_t op = 0;
+    size_t i = 0;
+    while (i < end)
+    {
+        starts[i] = true;
+        op = unfused_opcode(opcode_at(code + i));
+        auto operands = opcode_operands(op);
+        auto roles = register_roles(op);
+        if (!operands || !roles)
+            return false;
+        size_t p = i + opcode_length(op);
+        size_t argbase = 0;
+        for (size_t k = 0; operands[k]; k++)
+        {
+            if (p >= size)
+                return false;
+            size_t value = operands[k] == 'r' ? varlen_int_value(code + p) : 0;
+            if (strchr("udmb", roles[k]) && value >= frame_size)
+                return false;
+            if (roles[k] == 'b')
+                argbase = value;
+            else if (roles[k] == 'n' && k > 0 && roles[k - 1] == 'b')
+            {
+                if (value > frame_size - argbase)
+                    return false;
+            }
+            else if (roles[k] == 'n' && value >= func_count)
+                return false;
+            else if (operands[k] == 'k' && (operand_length(code + p, 'k') > size - p || !bulk_valid(code + p)))
+                return false;
+            p += operand_length(code + p, operands[k]);
+            if (operands[k] == 'j' && p <= size)
+            {
+                int32_t offset;
+                memcpy(&offset, code + p - 4, 4);
+                targets.push_back(p + offset);
+            }
+        }
+        if (p > size)
+            return false;
+        i = p;
+    }
+    for (auto target : targets)
+    {
+        if (target >= size || !starts[target])
+            return false;
+    }
+    // running off the end would run the padding
+    return !code_falls_through(op);
+}
+
+// Returns an empty Option if the file doesn't exist, is damaged, was made for a different key, or was made with different encoding settings.
+// Function code is not copied: the returned Global's functions point into the mapped file, which the Global keeps alive.
+static inline Option<Global> load_bytecode_cache(const char * path, uint64_t key)
+{
+    auto _mapping = _bytecode_cache_map_file(path);
+    if (!_mapping)
+        return {};
+    
+    auto mapping = MakeShared<CodeMapping>(std::move(*_mapping));
+    const uint8_t * base = mapping->data;
+    size_t size = mapping->size;
+    
+    BytecodeCacheHeader header;
+    memcpy(&header, base, sizeof(header));
+    if (memcmp(header.magic, BYTECODE_CACHE_MAGIC, 8) != 0
+        || header.version != BYTECODE_CACHE_VERSION
+        || header.opcode_table_bits != INTERPRETER_OPCODE_TABLE_BITS
+        || header.opcode_encoding != OPCODE_ENCODING_ID
+        || header.varreg_encoding != VARREG_ENCODING_ID
+        || header.key != key
+        || header.file_size != size
+        || header.checksum != fnv1a_64(base + sizeof(header), size - sizeof(header)))
+        return {};
+    
+    if (header.func_count > size / sizeof(BytecodeCacheFunc)
+        || header.func_name_count > size / sizeof(BytecodeCacheName)
+        || header.var_name_count > size / sizeof(BytecodeCacheName))
+        return {};
+    size_t table_size = sizeof(BytecodeCacheHeader)
+        + sizeof(BytecodeCacheFunc) * header.func_count
+        + sizeof(BytecodeCacheName) * (header.func_name_count + header.var_name_count);
+    if (table_size > size)
+        return {};
+    
+    auto in_bounds = [&](uint64_t offset, uint64_t len)
+    {
+        return offset >= table_size && offset % 8 == 0 && offset <= size && len < size - offset;
+    };
+    
+    Global global;
+    
+    auto funcs = (const BytecodeCacheFunc *)(base + sizeof(BytecodeCacheHeader));
+    for (size_t i = 0; i < header.func_count; i++)
+    {
+        if (!in_bounds(funcs[i].code_offset, funcs[i].code_size)
+            || !in_bounds(funcs[i].line_table_offset, funcs[i].line_table_size)
+            || funcs[i].num_args > funcs[i].num_vars
+            || funcs[i].num_vars > BYTECODE_CACHE_MAX_FRAME
+            || funcs[i].num_regs > BYTECODE_CACHE_MAX_FRAME - funcs[i].num_vars
+            || !_bytecode_cache_check_code(base + funcs[i].code_offset, funcs[i].code_size,
+                funcs[i].num_vars + funcs[i].num_regs, header.func_count))
+            return {};
+        Function func;
+        func.mapped_code = base + funcs[i].code_offset;
+        func.mapped_code_size = funcs[i].code_size;
+        func.num_args = funcs[i].num_args;
+        func.num_vars = funcs[i].num_vars;
+        func.num_regs = funcs[i].num_regs;
+        func.row = funcs[i].row;
+        func.column = funcs[i].column;
+        func.mapped_line_table = base + funcs[i].line_table_offset;
+        func.mapped_line_table_size = funcs[i].line_table_size;
+        global.funcs.push_back(std::move(func));
+    }
+    
+    auto names = (const BytecodeCacheName *)(base + sizeof(BytecodeCacheHeader) + sizeof(BytecodeCacheFunc) * header.func_count);
+    for (size_t i = 0; i < header.func_name_count + header.var_name_count; i++)
+    {
+        // the string has to be exactly str_size bytes long, with its terminator in the padding after it
+        auto str = (const char *)(base + names[i].str_offset);
+        if (!in_bounds(names[i].str_offset, names[i].str_size) || strnlen(str, names[i].str_size + 1) != names[i].str_size)
+            return {};
+        String name(str);
+        // variables are numbered densely, like functions are
+        bool is_func = i < header.func_name_count;
+        auto & map = is_func ? global.func_names : global.var_names;
+        if (names[i].value >= (is_func ? header.func_count : header.var_name_count) || map.count(name))
+            return {};
+        map.insert(name, names[i].value);
+    }
+    
+    global.mapping = mapping;
+    return global;
+}
+
+#endif // MUALI_BYTECODE_CACHE
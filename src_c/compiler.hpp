@@ -6,6 +6,8 @@
 #include <cassert>
 #include <cstring>
 #include <cstdint>
+#include <cmath>
+#include <cfloat>
 
 #include "types.hpp"
 #include "grammar.hpp"
@@ -17,6 +19,7 @@ struct ExprInfo {
     Option<double> imm_float;
     Option<String> imm_string;
     Option<uint8_t> imm_null;
+    Option<bool> imm_bool;
     Option<size_t> global_var;
     Option<size_t> func_name;
     
@@ -36,13 +39,14 @@ struct ExprInfo {
     }
     bool is_immediate()
     {
-        return !!imm_int || !!imm_float || !!imm_string || !!imm_null;
+        return !!imm_int || !!imm_float || !!imm_string || !!imm_null || !!imm_bool;
     }
     
     static ExprInfo of_null()
     {
         ExprInfo ret;
         ret.imm_null = {0};
+        ret.static_type = TYPEID_NULL;
         return ret;
     }
     
@@ -50,12 +54,21 @@ struct ExprInfo {
     {
         ExprInfo ret;
         ret.imm_int = {n};
+        ret.static_type = TYPEID_INT;
         return ret;
     }
     static ExprInfo from_float(double n)
     {
         ExprInfo ret;
         ret.imm_float = {n};
+        ret.static_type = TYPEID_FLOAT;
+        return ret;
+    }
+    static ExprInfo from_bool(bool n)
+    {
+        ExprInfo ret;
+        ret.imm_bool = {n};
+        ret.static_type = TYPEID_BOOL;
         return ret;
     }
     static ExprInfo from_var_reg(size_t n)
@@ -66,15 +79,42 @@ struct ExprInfo {
     }
 };
 
+// Joins two types of the per-variable inference lattice: TYPEID_INVALID is "not assigned yet", TYPEID_VARIANT is "more than one type".
+static inline TypeId join_types(TypeId a, TypeId b)
+{
+    if (a == TYPEID_INVALID)
+        return b;
+    if (b == TYPEID_INVALID || a == b)
+        return a;
+    return TYPEID_VARIANT;
+}
+
 struct FuncCompInfo {
-    Vec<ListMap<String, size_t>> scopes;
-    ListMap<size_t, TypeId> var_types;
+    Vec<HashMap<String, size_t>> scopes;
+    // types of everything ever assigned to each variable; see compile_func for how this reaches a fixpoint
+    HashMap<size_t, TypeId> var_types;
+    bool var_types_changed = false;
+    // types that variables were declared with, which every assignment checks (see emit_checked_set) instead of joining
+    HashMap<size_t, TypeId> declared_types;
+    // declared variables that get assigned something that can't have their type; they're typed like undeclared ones
+    HashSet<size_t> dropped_declarations;
     size_t var_index = 0;
     size_t vardec_count = 0;
     
     size_t next_reg = 0;
     Vec<size_t> freed_registers;
     
+    // source positions of the nodes being compiled, innermost last, and the line table entries so far
+    Vec<SourcePos> positions;
+    Vec<SourcePos> lines;
+    
+    // the code from offset on comes from the innermost node being compiled
+    void mark_position(size_t offset)
+    {
+        if (positions.size())
+            line_table_append(lines, SourcePos{offset, positions.back().row, positions.back().column});
+    }
+    
     void push_scope()
     {
         scopes.push_back({});
@@ -93,15 +133,53 @@ struct FuncCompInfo {
         return _var_index;
     }
     
+    // records that a value of the given type (TYPEID_INVALID if not known) gets assigned to a variable
     void add_var_type(size_t index, TypeId type)
     {
         assert(index < vardec_count);
-        var_types.insert(index, type);
+        if (get_declared_type(index) != TYPEID_INVALID)
+            return;
+        if (type == TYPEID_INVALID)
+            type = TYPEID_VARIANT;
+        TypeId old = var_types.count(index) ? var_types[index] : TYPEID_INVALID;
+        TypeId joined = join_types(old, type);
+        if (joined != old)
+        {
+            var_types.insert(index, joined);
+            var_types_changed = true;
+        }
+    }
+    
+    // a declared type is where the variable's type starts, and it stays there because assignments are checked
+    void declare_var_type(size_t index, TypeId type)
+    {
+        assert(index < vardec_count);
+        if (dropped_declarations.count(index))
+            return;
+        declared_types.insert(index, type);
+        if (!var_types.count(index) || var_types[index] != type)
+        {
+            var_types.insert(index, type);
+            var_types_changed = true;
+        }
+    }
+    TypeId get_declared_type(size_t index)
+    {
+        if (dropped_declarations.count(index) || !declared_types.count(index))
+            return TYPEID_INVALID;
+        return declared_types[index];
+    }
+    // the function gets compiled again, with the variable's declared type ignored from the start
+    void drop_declared_type(size_t index)
+    {
+        dropped_declarations.insert(index);
+        var_types_changed = true;
     }
     
-    size_t get_var_type(size_t index)
+    // the type a variable always has, or TYPEID_INVALID if it isn't known to be monomorphic
+    TypeId get_var_type(size_t index)
     {
-        if (var_types.count(index))
+        if (var_types.count(index) && var_types[index] != TYPEID_VARIANT)
             return var_types[index];
         return TYPEID_INVALID;
     }
@@ -271,18 +349,497 @@ static inline void push_immediate(T & buffer, ExprInfo myimm)
     }
     else if (myimm.imm_null)
         buffer.push_back(TYPEID_NULL);
+    else if (myimm.imm_bool)
+    {
+        buffer.push_back(TYPEID_BOOL);
+        buffer.push_back(*myimm.imm_bool);
+    }
     else
         assert(((void)"TODO more types of immediate", 0));
 }
 
-static inline Option<ExprInfo> compile_func_inner(Shared<ASTNode> node, Shared<Function> func, FuncCompInfo & info, const Global & global)
+static inline Option<ExprInfo> compile_func_inner(Shared<ASTNode> node, Shared<Function> func, FuncCompInfo & info, Global & global);
+
+static inline bool is_numeric_type(TypeId type)
+{
+    return type == TYPEID_INT || type == TYPEID_FLOAT;
+}
+
+// String's == with a literal is also true for a prefix of it (so "<" == "<<"), which operators can't go by
+static inline bool op_is(const String & op, const char * name)
+{
+    return op.size() == strlen(name) && op == name;
+}
+
+// static type of the result of a binary operator, following the interpreter's promotion rules
+static inline TypeId binop_result_type(const String & op, TypeId a, TypeId b)
+{
+    if (op_is(op, "==") || op_is(op, "!=") || op_is(op, ">") || op_is(op, "<") || op_is(op, ">=") || op_is(op, "<="))
+        return TYPEID_BOOL;
+    if (op_is(op, "+") || op_is(op, "-") || op_is(op, "*") || op_is(op, "/"))
+    {
+        if (a == TYPEID_INT && b == TYPEID_INT)
+            return TYPEID_INT;
+        if (is_numeric_type(a) && is_numeric_type(b))
+            return TYPEID_FLOAT;
+    }
+    if (a == TYPEID_INT && b == TYPEID_INT)
+        return TYPEID_INT;
+    return TYPEID_INVALID;
+}
+
+// Evaluates a binary operator on two immediates, with the same semantics as the interpreter.
+// Returns nothing if it can't be evaluated at compile time (e.g. integer division by zero, which has to fault at runtime).
+static inline Option<ExprInfo> fold_binop(const String & op, ExprInfo a, ExprInfo b)
+{
+    if (a.imm_int && b.imm_int)
+    {
+        int64_t x = *a.imm_int;
+        int64_t y = *b.imm_int;
+        // wraps like the interpreter does in practice, without relying on signed overflow
+        uint64_t ux = x;
+        uint64_t uy = y;
+        if (op_is(op, "+"))
+            return ExprInfo::from_int(int64_t(ux + uy));
+        if (op_is(op, "-"))
+            return ExprInfo::from_int(int64_t(ux - uy));
+        if (op_is(op, "*"))
+            return ExprInfo::from_int(int64_t(ux * uy));
+        if ((op_is(op, "/") || op_is(op, "%")) && (y == 0 || (x == INT64_MIN && y == -1)))
+            return {};
+        if (op_is(op, "/"))
+            return ExprInfo::from_int(x / y);
+        if (op_is(op, "%"))
+            return ExprInfo::from_int(x % y);
+        if ((op_is(op, "<<") || op_is(op, ">>")) && (y < 0 || y > 63))
+            return {};
+        if (op_is(op, "<<"))
+            return ExprInfo::from_int(int64_t(ux << y));
+        if (op_is(op, ">>"))
+            return ExprInfo::from_int(x >> y);
+        if (op_is(op, "&"))
+            return ExprInfo::from_int(x & y);
+        if (op_is(op, "|"))
+            return ExprInfo::from_int(x | y);
+        if (op_is(op, "^"))
+            return ExprInfo::from_int(x ^ y);
+        if (op_is(op, "=="))
+            return ExprInfo::from_bool(x == y);
+        if (op_is(op, "!="))
+            return ExprInfo::from_bool(x != y);
+        if (op_is(op, ">"))
+            return ExprInfo::from_bool(x > y);
+        if (op_is(op, "<"))
+            return ExprInfo::from_bool(x < y);
+        if (op_is(op, ">="))
+            return ExprInfo::from_bool(x >= y);
+        if (op_is(op, "<="))
+            return ExprInfo::from_bool(x <= y);
+        return {};
+    }
+    if ((a.imm_int || a.imm_float) && (b.imm_int || b.imm_float))
+    {
+        double x = a.imm_int ? double(*a.imm_int) : *a.imm_float;
+        double y = b.imm_int ? double(*b.imm_int) : *b.imm_float;
+        if (op_is(op, "+"))
+            return ExprInfo::from_float(x + y);
+        if (op_is(op, "-"))
+            return ExprInfo::from_float(x - y);
+        if (op_is(op, "*"))
+            return ExprInfo::from_float(x * y);
+        if (op_is(op, "/"))
+            return ExprInfo::from_float(x / y);
+        if (op_is(op, "=="))
+            return ExprInfo::from_bool(x == y);
+        if (op_is(op, "!="))
+            return ExprInfo::from_bool(!(x == y));
+        if (op_is(op, ">"))
+            return ExprInfo::from_bool(x > y);
+        if (op_is(op, "<"))
+            return ExprInfo::from_bool(x < y);
+        if (op_is(op, ">="))
+            return ExprInfo::from_bool(x >= y);
+        if (op_is(op, "<="))
+            return ExprInfo::from_bool(x <= y);
+        return {};
+    }
+    if (a.imm_bool && b.imm_bool)
+    {
+        bool x = *a.imm_bool;
+        bool y = *b.imm_bool;
+        if (op_is(op, "=="))
+            return ExprInfo::from_bool(x == y);
+        if (op_is(op, "!="))
+            return ExprInfo::from_bool(x != y);
+        if (op_is(op, "and"))
+            return ExprInfo::from_bool(x && y);
+        if (op_is(op, "or"))
+            return ExprInfo::from_bool(x || y);
+        return {};
+    }
+    if (a.imm_null && b.imm_null)
+    {
+        if (op_is(op, "=="))
+            return ExprInfo::from_bool(true);
+        if (op_is(op, "!="))
+            return ExprInfo::from_bool(false);
+    }
+    return {};
+}
+
+// exact reciprocal of a power of two, if it has one that's a normal float
+static inline Option<double> exact_reciprocal(double n)
+{
+    int exponent;
+    if (!std::isfinite(n) || std::fabs(std::frexp(n, &exponent)) != 0.5)
+        return {};
+    double ret = 1.0 / n;
+    if (!std::isfinite(ret) || std::fabs(ret) < DBL_MIN)
+        return {};
+    return ret;
+}
+
+struct BinopRewrite {
+    bool is_noop = false; // the operation leaves its left-hand side unchanged
+    uint16_t opcode = 0;
+    ExprInfo imm;
+};
+
+// Algebraic simplifications for `x <op> imm`, where x has the static type `type`.
+// Only rewrites that give bit-identical results for every value of that type are done, so e.g. float `x + 0` is kept (-0.0 + 0 is 0.0).
+static inline Option<BinopRewrite> strength_reduce(const String & op, TypeId type, ExprInfo imm)
+{
+    auto noop = [](){ BinopRewrite ret; ret.is_noop = true; return Option<BinopRewrite>(ret); };
+    
+    bool is_int = !!imm.imm_int;
+    bool is_zero = (imm.imm_int && *imm.imm_int == 0) || (imm.imm_float && *imm.imm_float == 0.0 && !std::signbit(*imm.imm_float));
+    bool is_one = (imm.imm_int && *imm.imm_int == 1) || (imm.imm_float && *imm.imm_float == 1.0);
+    
+    if ((op_is(op, "+") || op_is(op, "-") || op_is(op, "<<") || op_is(op, ">>")) && is_int && is_zero && type == TYPEID_INT)
+        return noop();
+    // x - 0 is exact for every float, including -0.0
+    if (op_is(op, "-") && is_zero && type == TYPEID_FLOAT)
+        return noop();
+    if ((op_is(op, "*") || op_is(op, "/")) && is_one && (type == TYPEID_FLOAT || (is_int && type == TYPEID_INT)))
+        return noop();
+    
+    if (op_is(op, "*") && is_int && type == TYPEID_INT && *imm.imm_int > 1 && (*imm.imm_int & (*imm.imm_int - 1)) == 0)
+    {
+        BinopRewrite ret;
+        ret.opcode = OP_SHLIMM_I;
+        ret.imm = ExprInfo::from_int(__builtin_ctzll(*imm.imm_int));
+        return ret;
+    }
+    // float division by a power of two is the same as multiplying by its (exact) reciprocal
+    if (op_is(op, "/") && (type == TYPEID_FLOAT || (is_numeric_type(type) && imm.imm_float)))
+    {
+        if (auto recip = exact_reciprocal(is_int ? double(*imm.imm_int) : *imm.imm_float))
+        {
+            BinopRewrite ret;
+            ret.opcode = OP_MULIMM;
+            ret.imm = ExprInfo::from_float(*recip);
+            return ret;
+        }
+    }
+    return {};
+}
+
+// copies an expression's value into a specific var-reg
+static inline void emit_set(Shared<Function> func, size_t dest, ExprInfo expr)
+{
+    if (expr.is_immediate())
+    {
+        push_op(func->code, OP_SETIMM);
+        push_varlen_int(func->code, dest);
+        push_immediate(func->code, expr);
+    }
+    else if (expr.is_var_reg())
+    {
+        if (*expr.var_reg == dest)
+            return;
+        if (expr.static_type == TYPEID_INT)
+            push_op(func->code, OP_SET_I);
+        else if (expr.static_type == TYPEID_FLOAT)
+            push_op(func->code, OP_SET_F);
+        else
+            push_op(func->code, OP_SET);
+        push_varlen_int(func->code, dest);
+        push_varlen_int(func->code, *expr.var_reg);
+    }
+    else
+        assert(((void)"TODO (set from non-var/imm)", 0));
+}
+
+// Assigns to a variable declared as an int or float. Ints assigned to floats are converted. Any other value whose type
+// is known has to have the variable's type already; if it doesn't, that's reported, and the variable is typed like an
+// undeclared one from then on (see drop_declared_type). Values whose type isn't known get an OP_CHECK_I or OP_CHECK_F
+// after them (which converts ints, like here), so the variable really does only ever hold its type.
+static inline void emit_checked_set(Shared<Function> func, FuncCompInfo & info, size_t dest, ExprInfo expr)
+{
+    TypeId type = info.get_declared_type(dest);
+    assert(type == TYPEID_INT || type == TYPEID_FLOAT);
+    if (type == TYPEID_FLOAT && expr.static_type == TYPEID_INT)
+    {
+        if (expr.imm_int)
+            return emit_set(func, dest, ExprInfo::from_float(double(*expr.imm_int)));
+        // int + 0.0 is the int as a float, exactly
+        emit_set(func, dest, expr);
+        push_op(func->code, OP_ADDIMM);
+        push_varlen_int(func->code, dest);
+        push_immediate(func->code, ExprInfo::from_float(0.0));
+        return;
+    }
+    if (expr.static_type != type && expr.static_type != TYPEID_INVALID && expr.static_type != TYPEID_VARIANT)
+    {
+        auto name = [](TypeId t) { return t == TYPEID_INT ? "an int" : t == TYPEID_FLOAT ? "a float"
+            : t == TYPEID_BOOL ? "a bool" : t == TYPEID_NULL ? "null" : "a value of another type"; };
+        auto pos = info.positions.size() ? info.positions.back() : SourcePos{0, 0, 0};
+        printf("warning: line %zu, column %zu: %s is assigned to a variable declared as %s, so it isn't kept to that type\n",
+            pos.row, pos.column, name(expr.static_type), name(type));
+        info.drop_declared_type(dest);
+        emit_set(func, dest, expr);
+        return;
+    }
+    emit_set(func, dest, expr);
+    if (expr.static_type == type)
+        return;
+    push_op(func->code, type == TYPEID_INT ? OP_CHECK_I : OP_CHECK_F);
+    push_varlen_int(func->code, dest);
+}
+
+// puts immediates into a fresh register, for operations that don't have immediate forms
+static inline ExprInfo materialize(Shared<Function> func, FuncCompInfo & info, ExprInfo expr)
+{
+    if (expr.is_var_reg())
+        return expr;
+    size_t reg = info.alloc_register();
+    emit_set(func, reg, expr);
+    auto ret = ExprInfo::from_var_reg(reg);
+    if (expr.imm_int)
+        ret.static_type = TYPEID_INT;
+    else if (expr.imm_float)
+        ret.static_type = TYPEID_FLOAT;
+    return ret;
+}
+
+// patches a 32-bit jump offset (emitted as a placeholder at offset_pos) to point at the current end of the code
+static inline void patch_jump_here(Shared<Function> func, size_t offset_pos)
+{
+    int64_t diff = (ptrdiff_t)func->code.size() - (ptrdiff_t)(offset_pos + 4);
+    assert(diff >= -2147483647 && diff <= 2147483647);
+    int32_t diff32 = diff;
+    memcpy(func->code.data() + offset_pos, &diff32, 4);
+}
+
+static inline Option<uint8_t> comparison_info(const String & op)
+{
+    if (op == "==")
+        return OPINFO_CMPE;
+    if (op == "!=")
+        return OPINFO_CMPNE;
+    if (op == ">")
+        return OPINFO_CMPGT;
+    if (op == "<")
+        return OPINFO_CMPLT;
+    if (op == ">=")
+        return OPINFO_CMPGTE;
+    if (op == "<=")
+        return OPINFO_CMPLTE;
+    return {};
+}
+
+// same rules as var_is_truthy in the interpreter
+static inline bool immediate_is_truthy(ExprInfo imm)
+{
+    if (imm.imm_null)
+        return false;
+    if (imm.imm_int)
+        return *imm.imm_int != 0;
+    if (imm.imm_float)
+        return *imm.imm_float != 0.0;
+    if (imm.imm_bool)
+        return *imm.imm_bool;
+    return true;
+}
+
+// Emits a jump that's taken if `cond` is false. Returns the position of its offset, for patch_jump_here.
+// Returns nothing if `cond` is constant and true, in which case nothing is emitted.
+static inline Option<size_t> compile_jump_unless(Shared<ASTNode> cond, Shared<Function> func, FuncCompInfo & info, Global & global)
+{
+    Option<ExprInfo> constant;
+    if (cond->text->starts_with("binexp_1") && cond->children.size() == 3)
+    {
+        auto & op = *cond->children[1]->children[0]->text;
+        auto cmp = comparison_info(op);
+        assert(cmp);
+        auto _expr1 = compile_func_inner(cond->children[0], func, info, global);
+        assert(_expr1);
+        auto _expr2 = compile_func_inner(cond->children[2], func, info, global);
+        assert(_expr2);
+        auto expr2 = *_expr2;
+        
+        if (_expr1->is_immediate() && expr2.is_immediate())
+            constant = fold_binop(op, *_expr1, expr2);
+        if (!constant)
+        {
+            auto expr1 = materialize(func, info, *_expr1);
+            push_op(func->code, expr2.is_immediate() ? OP_JCMPIMM : OP_JCMP);
+            push_varlen_int(func->code, *expr1.var_reg);
+            if (expr2.is_immediate())
+                push_immediate(func->code, expr2);
+            else
+                push_varlen_int(func->code, *expr2.var_reg);
+            func->code.push_back(*cmp | OPINFO_NEGATE);
+            size_t offset_pos = func->code.size();
+            push_u32(func->code, 0);
+            
+            info.free_register(*expr1.var_reg);
+            if (expr2.is_var_reg())
+                info.free_register(*expr2.var_reg);
+            return offset_pos;
+        }
+    }
+    else
+    {
+        auto _expr = compile_func_inner(cond, func, info, global);
+        assert(_expr);
+        if (_expr->is_immediate())
+            constant = *_expr;
+        else
+        {
+            auto expr = materialize(func, info, *_expr);
+            push_op(func->code, OP_JIFNOT);
+            push_varlen_int(func->code, *expr.var_reg);
+            size_t offset_pos = func->code.size();
+            push_u32(func->code, 0);
+            info.free_register(*expr.var_reg);
+            return offset_pos;
+        }
+    }
+    
+    if (immediate_is_truthy(*constant))
+        return {};
+    push_op(func->code, OP_J);
+    size_t offset_pos = func->code.size();
+    push_u32(func->code, 0);
+    return offset_pos;
+}
+
+// Items of a comma-separated list like funcdefargs or funccall. All but the last come wrapped with their comma.
+static inline Vec<Shared<ASTNode>> list_items(Shared<ASTNode> node)
+{
+    Vec<Shared<ASTNode>> ret;
+    for (auto & child : node->children)
+        ret.push_back(child->text ? child : child->children[0]);
+    return ret;
+}
+
+enum CallMode {
+    CALL_MODE_VALUE,
+    CALL_MODE_DISCARD,
+    CALL_MODE_TAIL,
+};
+
+// Arguments are evaluated into a block of fresh registers at the top of the frame (above every live register).
+// The callee's register window starts at that block, so they become its first vars without being copied.
+static inline Option<ExprInfo> compile_call(ExprInfo callee, Shared<ASTNode> funccall, CallMode mode, Shared<Function> func, FuncCompInfo & info, Global & global)
+{
+    assert(callee.is_func() || callee.is_var_reg());
+    
+    auto args = list_items(funccall);
+    size_t argc = args.size();
+    size_t argbase = info.next_reg;
+    info.next_reg += argc;
+    for (size_t i = 0; i < argc; i++)
+    {
+        auto _expr = compile_func_inner(args[i], func, info, global);
+        assert(_expr);
+        auto expr = *_expr;
+        emit_set(func, argbase + i, expr);
+        if (expr.is_var_reg())
+            info.free_register(*expr.var_reg);
+    }
+    
+    if (mode == CALL_MODE_TAIL)
+        push_op(func->code, callee.is_func() ? OP_BECOME : OP_BECOME_INDIRECT);
+    else if (mode == CALL_MODE_DISCARD)
+        push_op(func->code, callee.is_func() ? OP_CALLDISCARD : OP_CALLD_INDIRECT);
+    else
+        push_op(func->code, callee.is_func() ? OP_CALL : OP_CALL_INDIRECT);
+    
+    // the destination is only written once the callee has returned, so it can reuse the argument registers
+    for (size_t i = 0; i < argc; i++)
+        info.free_register(argbase + i);
+    if (callee.is_var_reg())
+        info.free_register(*callee.var_reg);
+    
+    Option<ExprInfo> ret;
+    if (mode == CALL_MODE_VALUE)
+    {
+        size_t dest = info.alloc_register();
+        push_varlen_int(func->code, dest);
+        ret = ExprInfo::from_var_reg(dest);
+    }
+    push_varlen_int(func->code, callee.is_func() ? *callee.func_name : *callee.var_reg);
+    push_varlen_int(func->code, argbase);
+    push_varlen_int(func->code, argc);
+    
+    return ret;
+}
+
+// `node` is a base_unexp or funccall_statement; its first child is the callee and the rest are tails
+static inline Option<ExprInfo> compile_tails(Shared<ASTNode> node, CallMode last_mode, Shared<Function> func, FuncCompInfo & info, Global & global)
+{
+    auto _expr = compile_func_inner(node->children[0], func, info, global);
+    assert(_expr);
+    auto expr = *_expr;
+    for (size_t i = 1; i < node->children.size(); i++)
+    {
+        auto tail = node->children[i];
+        if (*tail->text == "expr_tail_0")
+            tail = tail->children[0];
+        if (*tail->text != "funccall")
+            assert(((void)"TODO (index and member access)", 0));
+        
+        auto mode = i + 1 == node->children.size() ? last_mode : CALL_MODE_VALUE;
+        auto ret = compile_call(expr, tail, mode, func, info, global);
+        if (!ret)
+            return {};
+        expr = *ret;
+    }
+    return expr;
+}
+
+static inline bool is_call_expr(Shared<ASTNode> node)
+{
+    if (!node->text || !node->text->starts_with("base_unexp") || node->children.size() < 2)
+        return false;
+    auto & tail = node->children.back();
+    return tail->children.size() > 0 && *tail->children[0]->text == "funccall";
+}
+
+static inline Option<ExprInfo> compile_node(Shared<ASTNode> node, Shared<Function> func, FuncCompInfo & info, Global & global);
+
+static inline Option<ExprInfo> compile_func_inner(Shared<ASTNode> node, Shared<Function> func, FuncCompInfo & info, Global & global)
+{
+    info.positions.push_back(SourcePos{0, node->start_row, node->start_column});
+    info.mark_position(func->code.size());
+    auto ret = compile_node(node, func, info, global);
+    info.positions.pop_back();
+    info.mark_position(func->code.size());
+    return ret;
+}
+
+static inline Option<ExprInfo> compile_node(Shared<ASTNode> node, Shared<Function> func, FuncCompInfo & info, Global & global)
 {
     assert(node->text);
     //printf("inside of... %s\n", node->text->data());
     if (*node->text == "funcdef")
     {
-        //for (auto _node : node->children[1]->children.size())
+        // arguments are the first vars of the function, in order
         func->num_args = node->children[1]->children.size();
+        for (auto arg : list_items(node->children[1]))
+            info.add_var_type(info.add_var(*arg->children[0]->text), TYPEID_VARIANT);
         for (auto node : node->children[2]->children)
             compile_func_inner(node, func, info, global);
     }
@@ -293,8 +850,25 @@ static inline Option<ExprInfo> compile_func_inner(Shared<ASTNode> node, Shared<F
     }
     else if (*node->text == "vardec")
     {
+        // a variable with a type annotation keeps that type, and starts out as its zero if it isn't given a value;
+        // without one, its type comes from whatever gets assigned to it
+        TypeId declared = TYPEID_INVALID;
+        if (node->children[0]->children.size() == 2)
+            declared = info.parse_type(*node->children[0]->children[1]->children[0]->text);
+        
         if (node->children.size() == 1)
-            info.add_var(*node->children[0]->children[0]->children[0]->text);
+        {
+            size_t var_index = info.add_var(*node->children[0]->children[0]->children[0]->text);
+            if (declared == TYPEID_INT)
+                emit_set(func, var_index, ExprInfo::from_int(0));
+            else if (declared == TYPEID_FLOAT)
+                emit_set(func, var_index, ExprInfo::from_float(0.0));
+            if (declared != TYPEID_INVALID)
+                info.declare_var_type(var_index, declared);
+            // a dropped declaration (see emit_checked_set) still starts the variable out as its zero
+            if (info.get_declared_type(var_index) == TYPEID_INVALID)
+                info.add_var_type(var_index, declared != TYPEID_INVALID ? declared : TYPEID_NULL);
+        }
         else
         {
             auto _expr = compile_func_inner(node->children.back(), func, info, global);
@@ -302,27 +876,17 @@ static inline Option<ExprInfo> compile_func_inner(Shared<ASTNode> node, Shared<F
             auto expr = *_expr;
             
             size_t var_index = info.add_var(*node->children[0]->children[0]->children[0]->text);
-            if (node->children[0]->children.size() == 2)
-            {
-                auto type = info.parse_type(*node->children[0]->children[1]->children[0]->text);
-                info.add_var_type(var_index, type);
-            }
-            
-            if (expr.is_immediate())
-            {
-                push_op(func->code, OP_SETIMM);
-                push_varlen_int(func->code, var_index);
-                push_immediate(func->code, expr);
-            }
-            else if (expr.is_var_reg())
+            if (declared != TYPEID_INVALID)
+                info.declare_var_type(var_index, declared);
+            if (info.get_declared_type(var_index) != TYPEID_INVALID)
+                emit_checked_set(func, info, var_index, expr);
+            else
             {
-                push_op(func->code, OP_SET);
-                push_varlen_int(func->code, var_index);
-                push_varlen_int(func->code, *expr.var_reg);
-                //printf("!!! emitting declaration assignment with %zu...\n", *expr.var_reg);
+                info.add_var_type(var_index, expr.static_type);
+                emit_set(func, var_index, expr);
             }
-            else
-                assert(((void)"TODO", 0));
+            if (expr.is_var_reg())
+                info.free_register(*expr.var_reg);
         }
     }
     else if (*node->text == "assign")
@@ -340,43 +904,28 @@ static inline Option<ExprInfo> compile_func_inner(Shared<ASTNode> node, Shared<F
             printf("failed to find variable %s\n", node->children[0]->text->data());
             throw;
         }
-        
-        if (expr.is_immediate())
-        {
-            push_op(func->code, OP_SETIMM);
-            push_varlen_int(func->code, var_index);
-            push_immediate(func->code, expr);
-        }
-        else if (expr.is_var_reg())
-        {
-            push_op(func->code, OP_SET);
-            push_varlen_int(func->code, var_index);
-            //printf("!!! emitting normal assignment with %zu...\n", *expr.var_reg);
-            push_varlen_int(func->code, *expr.var_reg);
-        }
+        TypeId declared = info.get_declared_type(var_index);
+        if (declared != TYPEID_INVALID)
+            emit_checked_set(func, info, var_index, expr);
         else
-            assert(((void)"TODO", 0));
-    }
-    else if (*node->text == "inplace_negate")
-    {
-        // TODO support globals
-        size_t var_index = info.look_up(*node->children[0]->children[0]->text);
-        if (var_index == -1ULL)
         {
-            printf("failed to find variable %s\n", node->children[0]->text->data());
-            throw;
+            info.add_var_type(var_index, expr.static_type);
+            emit_set(func, var_index, expr);
         }
-        
-        if (info.get_var_type(var_index) == TYPEID_FLOAT)
-            push_op(func->code, OP_NEGATE_F);
-        else
-            push_op(func->code, OP_NEGATE);
-        push_varlen_int(func->code, var_index);
+        if (expr.is_var_reg())
+            info.free_register(*expr.var_reg);
     }
     else if (*node->text == "name")
     {
         // TODO support globals
         size_t var_index = info.look_up(*node->children[0]->text);
+        if (var_index == -1ULL && global.func_names.count(*node->children[0]->text))
+        {
+            ExprInfo ret;
+            ret.func_name = global.func_names[*node->children[0]->text];
+            ret.static_type = TYPEID_FUNC;
+            return {ret};
+        }
         if (var_index == -1ULL)
         {
             printf("failed to find variable %s\n", node->children[0]->text->data());
@@ -392,9 +941,14 @@ static inline Option<ExprInfo> compile_func_inner(Shared<ASTNode> node, Shared<F
         if (node->children.size() == 1)
             return compile_func_inner(node->children[0], func, info, global);
         else
-        {
-            assert(((void)"TODO (base unexp)", 0));
-        }
+            return compile_tails(node, CALL_MODE_VALUE, func, info, global);
+    }
+    else if (*node->text == "pass")
+    {
+    }
+    else if (*node->text == "funccall_statement")
+    {
+        compile_tails(node, CALL_MODE_DISCARD, func, info, global);
     }
     else if (node->text->starts_with("base_binexp"))
     {
@@ -411,7 +965,7 @@ static inline Option<ExprInfo> compile_func_inner(Shared<ASTNode> node, Shared<F
                 else if (*text == "-")
                 {
                     if (ret->imm_int)
-                        *ret->imm_int = -*ret->imm_int;
+                        *ret->imm_int = int64_t(0 - uint64_t(*ret->imm_int));
                     else
                         *ret->imm_float = -*ret->imm_float;
                     return ret;
@@ -426,6 +980,13 @@ static inline Option<ExprInfo> compile_func_inner(Shared<ASTNode> node, Shared<F
                 else if (*text == "-")
                 {
                     assert(ret->is_var_reg());
+                    // negate a copy; the operand might be a variable
+                    if (*ret->var_reg < info.vardec_count)
+                    {
+                        size_t reg = info.alloc_register();
+                        emit_set(func, reg, *ret);
+                        ret->var_reg = reg;
+                    }
                     if (ret->static_type == TYPEID_FLOAT)
                         push_op(func->code, OP_NEGATE_F);
                     else
@@ -454,17 +1015,35 @@ static inline Option<ExprInfo> compile_func_inner(Shared<ASTNode> node, Shared<F
             assert(_expr2);
             auto expr2 = *_expr2;
             
-            // TODO: constant folding
-            //if (expr1.is_immediate() && expr2.is_immediate())
-            //{
-            //    // ...
-            //}
-            
             auto & op = *node->children[1]->children[0]->text;
             
+            if (expr1.is_immediate() && expr2.is_immediate())
+            {
+                if (auto folded = fold_binop(op, expr1, expr2))
+                    return folded;
+            }
+            // put immediates on the right of commutative operators, so that the immediate forms and rewrites below apply
+            if ((op == "+" || op == "*") && (expr1.imm_int || expr1.imm_float) && expr2.is_var_reg() && is_numeric_type(expr2.static_type))
+                std::swap(expr1, expr2);
+            
+            TypeId result_type = binop_result_type(op, expr1.static_type, expr2.static_type);
+            
+            Option<BinopRewrite> rewrite;
+            if (expr2.is_immediate() && !expr1.is_immediate())
+                rewrite = strength_reduce(op, expr1.static_type, expr2);
+            if (rewrite && rewrite->is_noop)
+                return expr1;
+            
+            // comparisons don't have immediate forms
+            auto cmp = comparison_info(op);
+            if (cmp)
+                expr2 = materialize(func, info, expr2);
+            
             //printf("%s\n", op.data());
             uint16_t opcode;
-            if (op == "+" && !expr2.is_immediate())
+            if (cmp)
+                opcode = OP_CMPE + *cmp; // same order as the OPINFO_CMP... values
+            else if (op == "+" && !expr2.is_immediate())
             {
                 if (expr1.static_type == TYPEID_FLOAT && expr2.static_type == TYPEID_FLOAT)
                     opcode = OP_ADD_FF;
@@ -478,7 +1057,12 @@ static inline Option<ExprInfo> compile_func_inner(Shared<ASTNode> node, Shared<F
             else if (op == "-" && !expr2.is_immediate())
                 opcode = OP_SUB;
             else if (op == "-" && expr2.is_immediate())
-                opcode = OP_SUBIMM;
+            {
+                if (expr1.static_type == TYPEID_INT && expr2.imm_int)
+                    opcode = OP_SUBIMM_I;
+                else
+                    opcode = OP_SUBIMM;
+            }
             else if (op == "*" && !expr2.is_immediate())
                 opcode = OP_MUL;
             else if (op == "*" && expr2.is_immediate())
@@ -512,6 +1096,12 @@ static inline Option<ExprInfo> compile_func_inner(Shared<ASTNode> node, Shared<F
             else
                 assert(((void)"TODO (binexp)", 0));
             
+            if (rewrite)
+            {
+                opcode = rewrite->opcode;
+                expr2 = rewrite->imm;
+            }
+            
             if (expr1.is_var_reg())
                 info.free_register(*expr1.var_reg); // does nothing if passed a variable
             
@@ -545,25 +1135,23 @@ static inline Option<ExprInfo> compile_func_inner(Shared<ASTNode> node, Shared<F
                 //out_reg.static_type = expr1.static_type;
             }
             
-            if (expr2.imm_int)
+            // the increment ops only work on ints
+            if (expr2.imm_int && expr1.static_type == TYPEID_INT)
             {
                 if (op == "-" && *expr2.imm_int == 1)
                 {
-                    if (expr1.static_type == TYPEID_INT)
-                        push_op(func->code, OP_DECI_INT);
-                    else
-                        push_op(func->code, OP_DECI);
+                    push_op(func->code, OP_DECI_INT);
                     push_varlen_int(func->code, out_reg);
                     auto ret = ExprInfo::from_var_reg(out_reg);
-                    ret.static_type = expr1.static_type;
+                    ret.static_type = result_type;
                     return {ret};
                 }
                 if (op == "+" && *expr2.imm_int == 1)
                 {
-                    push_op(func->code, OP_INCI);
+                    push_op(func->code, OP_INCI_INT);
                     push_varlen_int(func->code, out_reg);
                     auto ret = ExprInfo::from_var_reg(out_reg);
-                    ret.static_type = expr1.static_type;
+                    ret.static_type = result_type;
                     return {ret};
                 }
             }
@@ -581,10 +1169,7 @@ static inline Option<ExprInfo> compile_func_inner(Shared<ASTNode> node, Shared<F
             if (expr2.is_var_reg())
                 info.free_register(*expr2.var_reg);
             
-            if (expr1.static_type == TYPEID_FLOAT)
-                ret.static_type = TYPEID_FLOAT;
-            if (expr1.static_type == TYPEID_INT)
-                ret.static_type = TYPEID_INT;
+            ret.static_type = result_type;
             
             return ret;
         }
@@ -598,36 +1183,59 @@ static inline Option<ExprInfo> compile_func_inner(Shared<ASTNode> node, Shared<F
         assert(_expr2);
         auto expr2 = *_expr2;
         
-        // TODO: constant folding
-        //if (expr1.is_immediate() && expr2.is_immediate())
-        //{
-        //    // ...
-        //}
-        
         auto & op = *node->children[1]->children[0]->text;
+        TypeId var_type = info.get_var_type(var_index);
+        info.add_var_type(var_index, binop_result_type(op.substr(0, op.size() - 1), var_type, expr2.static_type));
+        var_type = info.get_var_type(var_index);
+        
+        // `x op= imm` gets the same simplifications as `x op imm`
+        Option<BinopRewrite> rewrite;
+        if (expr2.is_immediate())
+            rewrite = strength_reduce(op.substr(0, op.size() - 1), var_type, expr2);
+        if (rewrite && rewrite->is_noop)
+            goto out;
         
         //printf("%s\n", op.data());
         uint16_t opcode;
         if (op == "+=" && !expr2.is_immediate())
         {
-            if (info.get_var_type(var_index) == TYPEID_FLOAT && expr2.static_type == TYPEID_FLOAT)
+            if (var_type == TYPEID_FLOAT && expr2.static_type == TYPEID_FLOAT)
                 opcode = OP_ADD_FF;
-            else if (info.get_var_type(var_index) == TYPEID_FLOAT)
+            else if (var_type == TYPEID_FLOAT)
                 opcode = OP_ADD_F;
             else
                 opcode = OP_ADD;
         }
         else if (op == "+=" && expr2.is_immediate())
+        {
+            if (var_type == TYPEID_INT && expr2.imm_int && *expr2.imm_int == 1)
+            {
+                push_op(func->code, OP_INCI_INT);
+                push_varlen_int(func->code, var_index);
+                goto out;
+            }
             opcode = OP_ADDIMM;
+        }
         else if (op == "-=" && !expr2.is_immediate())
             opcode = OP_SUB;
         else if (op == "-=" && expr2.is_immediate())
-            opcode = OP_SUBIMM;
+        {
+            if (var_type == TYPEID_INT && expr2.imm_int && *expr2.imm_int == 1)
+            {
+                push_op(func->code, OP_DECI_INT);
+                push_varlen_int(func->code, var_index);
+                goto out;
+            }
+            if (var_type == TYPEID_INT && expr2.imm_int)
+                opcode = OP_SUBIMM_I;
+            else
+                opcode = OP_SUBIMM;
+        }
         else if (op == "*=" && !expr2.is_immediate())
             opcode = OP_MUL;
         else if (op == "*=" && expr2.is_immediate())
         {
-            if (info.get_var_type(var_index) == TYPEID_FLOAT && expr2.imm_float && *expr2.imm_float == -1.0)
+            if (var_type == TYPEID_FLOAT && expr2.imm_float && *expr2.imm_float == -1.0)
             {
                 push_op(func->code, OP_NEGATE_F);
                 push_varlen_int(func->code, var_index);
@@ -637,12 +1245,27 @@ static inline Option<ExprInfo> compile_func_inner(Shared<ASTNode> node, Shared<F
                 opcode = OP_MULIMM;
         }
         else if (op == "/=" && !expr2.is_immediate())
-            opcode = OP_DIV;
+        {
+            if (var_type == TYPEID_FLOAT && expr2.static_type == TYPEID_FLOAT)
+                opcode = OP_DIV_FF;
+            else if (var_type == TYPEID_FLOAT && expr2.static_type == TYPEID_INT)
+                opcode = OP_DIV_FI;
+            else if (var_type == TYPEID_FLOAT)
+                opcode = OP_DIV_F;
+            else
+                opcode = OP_DIV;
+        }
         else if (op == "/=" && expr2.is_immediate())
             opcode = OP_DIVIMM;
         else
             assert(((void)"TODO (binexp)", 0));
         
+        if (rewrite)
+        {
+            opcode = rewrite->opcode;
+            expr2 = rewrite->imm;
+        }
+        
         push_op(func->code, opcode);
         push_varlen_int(func->code, var_index);
         //push_varlen_int(func->code, var_index);
@@ -656,6 +1279,14 @@ static inline Option<ExprInfo> compile_func_inner(Shared<ASTNode> node, Shared<F
         
         if (expr2.is_var_reg())
             info.free_register(*expr2.var_reg);
+        
+        // the ops that jump to out keep the type, but the others can change it
+        if (info.get_declared_type(var_index) != TYPEID_INVALID)
+        {
+            auto result = ExprInfo::from_var_reg(var_index);
+            result.static_type = binop_result_type(op.substr(0, op.size() - 1), var_type, expr2.static_type);
+            emit_checked_set(func, info, var_index, result);
+        }
         out: {}
     }
     else if (node->text->starts_with("return"))
@@ -665,6 +1296,8 @@ static inline Option<ExprInfo> compile_func_inner(Shared<ASTNode> node, Shared<F
             push_op(func->code, OP_RETURNIMM);
             push_immediate(func->code, ExprInfo::of_null());
         }
+        else if (is_call_expr(node->children[0]))
+            compile_tails(node->children[0], CALL_MODE_TAIL, func, info, global);
         else
         {
             auto _expr = compile_func_inner(node->children[0], func, info, global);
@@ -697,6 +1330,14 @@ static inline Option<ExprInfo> compile_func_inner(Shared<ASTNode> node, Shared<F
         //assert(((void)"TODO", 0));
         return {ExprInfo::from_int(n)};
     }
+    else if (*node->text == "bool")
+    {
+        return {ExprInfo::from_bool(*node->children[0]->text == "true")};
+    }
+    else if (*node->text == "null")
+    {
+        return {ExprInfo::of_null()};
+    }
     else if (*node->text == "float")
     {
         double n = strtod(node->children[0]->text->data(), 0);
@@ -710,16 +1351,44 @@ static inline Option<ExprInfo> compile_func_inner(Shared<ASTNode> node, Shared<F
             compile_func_inner(node, func, info, global);
         info.pop_scope();
     }
+    else if (*node->text == "if" || *node->text == "if_short")
+    {
+        // children: condition, block, any number of elifs, optional else
+        auto skip_pos = compile_jump_unless(node->children[0], func, info, global);
+        compile_func_inner(node->children[1], func, info, global);
+        
+        Vec<size_t> end_jumps;
+        for (size_t i = 2; i < node->children.size(); i++)
+        {
+            push_op(func->code, OP_J);
+            end_jumps.push_back(func->code.size());
+            push_u32(func->code, 0);
+            
+            if (skip_pos)
+                patch_jump_here(func, *skip_pos);
+            skip_pos = {};
+            
+            auto & branch = node->children[i];
+            if (*branch->text == "elif" || *branch->text == "elif_short")
+            {
+                auto & cond = branch->children[branch->children.size() - 2];
+                skip_pos = compile_jump_unless(cond, func, info, global);
+            }
+            compile_func_inner(branch->children.back(), func, info, global);
+        }
+        if (skip_pos)
+            patch_jump_here(func, *skip_pos);
+        for (auto offset_pos : end_jumps)
+            patch_jump_here(func, offset_pos);
+    }
     else if (*node->text == "foreach")
     {
         info.push_scope();
         
         size_t var_index = info.add_var(*node->children[0]->children[0]->children[0]->text);
+        TypeId annotated_type = TYPEID_INVALID;
         if (node->children[0]->children.size() == 2)
-        {
-            auto type = info.parse_type(*node->children[0]->children[1]->children[0]->text);
-            info.add_var_type(var_index, type);
-        }
+            annotated_type = info.parse_type(*node->children[0]->children[1]->children[0]->text);
         
         size_t n = 1;
         if (node->children.size() == 4)
@@ -738,13 +1407,9 @@ static inline Option<ExprInfo> compile_func_inner(Shared<ASTNode> node, Shared<F
         
         if (expr.imm_int)
         {
-            if (info.get_var_type(var_index) != TYPEID_INVALID)
-            {
-                if (info.get_var_type(var_index) != TYPEID_INT)
-                    assert(((void)"type of foreach variable with int range must also be an int", 0));
-            }
-            else
-                info.add_var_type(var_index, TYPEID_INT);
+            if (annotated_type != TYPEID_INVALID && annotated_type != TYPEID_INT)
+                assert(((void)"type of foreach variable with int range must also be an int", 0));
+            info.add_var_type(var_index, TYPEID_INT);
             
             if (node->children.size() == 4)
             {
@@ -831,20 +1496,118 @@ static inline void count_vardecs(Shared<ASTNode> node, size_t * vardecs)
     else if (node->text && *node->text == "foreach")
         //*vardecs += 1;
         *vardecs += 2;
+    else if (node->text && *node->text == "funcdefargs")
+        *vardecs += node->children.size();
     
     for (auto node : node->children)
         count_vardecs(node, vardecs);
 }
-static inline Option<ExprInfo> compile_func(Shared<ASTNode> node, Shared<Function> func, const Global & global)
+// Replaces the first opcode of each run of opcodes that has a superinstruction (see superinstructions.hpp) with the
+// superinstruction's opcode. The rest of the run stays where it is, so code size and jump offsets don't change, and
+// jumping into the middle of a run still works. Runs can overlap; each position gets the longest match that starts there.
+static inline void fuse_superinstructions(Vec<uint8_t> & code)
+{
+#if !defined PROFILE_OPCODE_SEQUENCES && !defined OPCODES_ALWAYS_8BIT
+    struct Fusion {
+        uint16_t opcode;
+        uint16_t seq[3];
+        size_t len;
+    };
+    #define _FUSION_2(OPCODE, NAME, A, OP_A, B, OP_B) Fusion{OPCODE, {OP_A, OP_B, 0}, 2},
+    #define _FUSION_3(OPCODE, NAME, A, OP_A, B, OP_B, C, OP_C) Fusion{OPCODE, {OP_A, OP_B, OP_C}, 3},
+    const Fusion fusions[] = {
+        SUPERINSTRUCTIONS_3(_FUSION_3)
+        SUPERINSTRUCTIONS_2(_FUSION_2)
+        Fusion{0, {0, 0, 0}, 0},
+    };
+    #undef _FUSION_2
+    #undef _FUSION_3
+    
+    // the code ends with a zero byte, which has no operands, so stepping through it always stops before the end
+    auto op_at = [&](size_t i) -> uint16_t
+    {
+        if (i + 1 >= code.size())
+            return 0;
+        return opcode_at(code.data() + i);
+    };
+    
+    size_t i = 0;
+    while (i + 1 < code.size())
+    {
+        uint16_t ops[3] = {op_at(i), 0, 0};
+        size_t len = instruction_length(code.data() + i);
+        if (len == 0)
+            return;
+        ops[1] = op_at(i + len);
+        size_t len_1 = ops[1] ? instruction_length(code.data() + i + len) : 0;
+        if (len_1)
+            ops[2] = op_at(i + len + len_1);
+        
+        for (auto & fusion : fusions)
+        {
+            if (fusion.len == 0)
+                break;
+            bool matches = true;
+            for (size_t j = 0; j < fusion.len; j++)
+                matches = matches && ops[j] == fusion.seq[j];
+            if (!matches)
+                continue;
+            
+            assert(opcode_length(fusion.opcode) == opcode_length(ops[0]));
+        #ifdef OPCODES_ALWAYS_16BIT
+            code[i] = uint8_t(fusion.opcode);
+            code[i + 1] = uint8_t(fusion.opcode >> 8);
+        #else
+            code[i] = uint8_t(fusion.opcode);
+            if (fusion.opcode > 0xFF)
+                code[i + 1] = uint8_t(fusion.opcode >> 8);
+        #endif
+            break;
+        }
+        i += len;
+    }
+#else
+    (void)code;
+#endif
+}
+
+#include "regalloc.hpp"
+#include "ir.hpp"
+
+// Variable types are inferred by compiling the function repeatedly. Each attempt picks opcodes based on the types
+// assigned to each variable anywhere in the function by the previous attempts (plus what it has seen itself so far),
+// and stops once an attempt sees no new types. Types only ever move up the lattice, so this takes at most a few attempts.
+// Only the final attempt's code is kept, and every variable read in it was compiled with the variable's final type,
+// so a variable that gets typed opcodes really does hold that one type everywhere in the function. Variables declared
+// with a type start there and never move, because their assignments are checked instead.
+// This is one type per variable, not per program point; optimize_function's IR gives every value a type of its own and
+// picks typed opcodes again from those (see ir_specialize_types), which covers variables that change type along the way.
+static inline Option<ExprInfo> compile_func(Shared<ASTNode> node, Shared<Function> func, Global & global)
 {
     FuncCompInfo info;
-    info.scopes.push_back({});
-    count_vardecs(node, &info.vardec_count);
-    info.next_reg = info.vardec_count;
-    auto ret = compile_func_inner(node, func, info, global);
+    Option<ExprInfo> ret;
+    do
+    {
+        auto var_types = info.var_types;
+        auto dropped_declarations = info.dropped_declarations;
+        info = FuncCompInfo{};
+        info.var_types = var_types;
+        info.dropped_declarations = dropped_declarations;
+        info.scopes.push_back({});
+        count_vardecs(node, &info.vardec_count);
+        info.next_reg = info.vardec_count;
+        func->code = {};
+        ret = compile_func_inner(node, func, info, global);
+    } while (info.var_types_changed);
+    // falling off the end of a function returns null
+    push_op(func->code, OP_RETURNIMM);
+    push_immediate(func->code, ExprInfo::of_null());
     func->num_vars = info.vardec_count;
     func->num_regs = info.next_reg - info.vardec_count;
+    func->line_table = line_table_encode(info.lines);
+    optimize_function(func);
     func->code.push_back(0x00);
+    fuse_superinstructions(func->code);
     return ret;
 }
 static inline void optimize_ast(Shared<ASTNode> & node)
@@ -857,13 +1620,6 @@ static inline void optimize_ast(Shared<ASTNode> & node)
     
     if (node->children.size() == 1 && node->text && *node->text == "expr")
         node = node->children[0];
-    if (node->text && *node->text == "assign" && node->children.size() == 2 && *node->children[1]->text == "base_binexp"
-        && *node->children[1]->children[0]->children[0]->text == "-"
-        && *node->children[1]->children[1]->children[0]->text == *node->children[0]->children[0]->text)
-    {
-        *node->text = "inplace_negate";
-        node->children.erase_at(1);
-    }
 }
 static inline Global compile_root(Shared<ASTNode> root)
 {
@@ -889,6 +1645,8 @@ static inline Global compile_root(Shared<ASTNode> root)
         {
             auto name = node->children[0]->children[0]->text;
             auto index = global.func_names[*name];
+            global.funcs[index]->row = node->start_row;
+            global.funcs[index]->column = node->start_column;
             compile_func(node, global.funcs[index], global);
         }
     }
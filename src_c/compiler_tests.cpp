@@ -0,0 +1,127 @@
+// tests for the compiler's constant folding, strength reduction and type annotations; not part of the interpreter build
+// each one compiles a small program and checks what its main returns, so folded code has to agree with the interpreter
+// g++ -std=c++20 -g -fsanitize=address src_c/compiler_tests.cpp && ./a.out
+// (from the top of the repo, where src_c/grammar.txt is)
+
+#include "types.hpp"
+
+#include "grammar.hpp"
+#include "compiler.hpp"
+#include "interpreter.hpp"
+
+#include <cassert>
+
+static Vec<char> read_grammar(void)
+{
+    auto f = fopen("src_c/grammar.txt", "rb");
+    assert(f);
+    Vec<char> text;
+    int c;
+    while ((c = fgetc(f)) >= 0)
+        text.push_back(c);
+    text.push_back(0);
+    fclose(f);
+    return text;
+}
+
+static Variable run(const char * source)
+{
+    static auto grammar_text = read_grammar();
+    auto grammar = load_grammar(grammar_text.data());
+    auto tokens = tokenize(grammar, source);
+    assert(tokens.size() && tokens.back()->text);
+    ParseState parse_state;
+    auto ast = parse_as(grammar, tokens, "program", parse_state);
+    assert(ast);
+    Interpreter interpreter(compile_root(*ast));
+    return interpreter.call_func_by_name("main", {});
+}
+
+static bool compare(const char * op, double x, double y)
+{
+    if (!strcmp(op, "=="))
+        return x == y;
+    if (!strcmp(op, "!="))
+        return x != y;
+    if (!strcmp(op, "<"))
+        return x < y;
+    if (!strcmp(op, ">"))
+        return x > y;
+    if (!strcmp(op, "<="))
+        return x <= y;
+    assert(!strcmp(op, ">="));
+    return x >= y;
+}
+
+// every comparison of two literals, as a value and as an if condition, against the same comparison of variables
+static void test_fold_comparisons(void)
+{
+    const char * ops[] = {"==", "!=", "<", ">", "<=", ">="};
+    const char * operands[][2] = {{"9", "8"}, {"8", "9"}, {"8", "8"}, {"3000000000", "8"}, {"-1", "0"}, {"1.5", "2"}, {"2", "2.0"}};
+    char source[512];
+    for (auto op : ops)
+    {
+        for (auto & pair : operands)
+        {
+            bool expected = compare(op, strtod(pair[0], nullptr), strtod(pair[1], nullptr));
+            
+            snprintf(source, sizeof(source), "func main():\n    return %s %s %s\nend\n", pair[0], op, pair[1]);
+            auto folded = run(source);
+            assert(folded.kind() == TYPEID_BOOL && folded.get_bool() == expected);
+            
+            snprintf(source, sizeof(source),
+                "func main():\n    if (%s %s %s):\n        return 1\n    end\n    return 2\nend\n", pair[0], op, pair[1]);
+            assert(run(source).get_int() == (expected ? 1 : 2));
+            
+            snprintf(source, sizeof(source),
+                "func main():\n    var a = %s\n    var b = %s\n    return a %s b\nend\n", pair[0], pair[1], op);
+            assert(run(source).get_bool() == expected);
+        }
+    }
+}
+
+static void test_fold_arithmetic(void)
+{
+    assert(run("func main():\n    return 9 << 8\nend\n").get_int() == 2304);
+    assert(run("func main():\n    return -9 >> 1\nend\n").get_int() == -5);
+    assert(run("func main():\n    return 7 / 2 + 7 % 2 * 10\nend\n").get_int() == 13);
+    assert(run("func main():\n    return 1 + 0.5\nend\n").get_float() == 1.5);
+    // folding doesn't turn a division by zero into a compile-time error
+    assert(run("func main():\n    if (1 > 2):\n        return 1 / 0\n    end\n    return 0\nend\n").get_int() == 0);
+}
+
+// `x <op> 0` only drops the op for ops that leave x as it is, not for comparisons that start like them
+static void test_strength_reduce_comparisons(void)
+{
+    assert(!run("func main():\n    var x = 5\n    return x < 0\nend\n").get_bool());
+    assert(run("func main():\n    var x = 5\n    return x > 0\nend\n").get_bool());
+    assert(run("func main():\n    var x = -5\n    if (x > 0):\n        return 1\n    end\n    return 2\nend\n").get_int() == 2);
+    assert(run("func main():\n    var x = 5\n    var y = x < 0\n    if (y):\n        return 1\n    end\n    return 2\nend\n").get_int() == 2);
+    assert(run("func main():\n    var x = 5\n    return x << 0\nend\n").get_int() == 5);
+    assert(run("func main():\n    var x = -5\n    return x >> 0\nend\n").get_int() == -5);
+    assert(run("func main():\n    var x = 5\n    x <<= 0\n    return x * 2\nend\n").get_int() == 10);
+}
+
+// ints assigned to floats are converted; values that can't have a variable's declared type make it untyped instead
+static void test_annotation_mismatches(void)
+{
+    auto x = run("func main():\n    var x : float = 1\n    return x\nend\n");
+    assert(x.kind() == TYPEID_FLOAT && x.get_float() == 1.0);
+    x = run("func main():\n    var x : float = 1.5\n    x = 2\n    return x\nend\n");
+    assert(x.kind() == TYPEID_FLOAT && x.get_float() == 2.0);
+    x = run("func half(a):\n    return a / 2\nend\nfunc main():\n    var x : float = half(3)\n    return x\nend\n");
+    assert(x.kind() == TYPEID_FLOAT && x.get_float() == 1.0);
+    assert(run("func main():\n    var x : int = 1.5\n    return x\nend\n").get_float() == 1.5);
+    assert(run("func main():\n    var x : int = 1\n    x += 2.5\n    return x\nend\n").get_float() == 3.5);
+    assert(run("func main():\n    var x : int = 1\n    x = x + 2.5\n    x = x * 2\n    return x\nend\n").get_float() == 7.0);
+    assert(run("func main():\n    var x : int\n    x = 0.5\n    return x\nend\n").get_float() == 0.5);
+}
+
+int main(void)
+{
+    test_fold_comparisons();
+    test_fold_arithmetic();
+    test_strength_reduce_comparisons();
+    test_annotation_mismatches();
+    puts("All compiler tests passed!");
+}
@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+# Picks the hottest opcode pairs and triples out of opcode profiles and writes superinstructions.hpp.
+#
+# Getting profiles: build with PROFILE_OPCODE_SEQUENCES defined (see vm_common.hpp) and run it over a corpus of scripts.
+# Each run appends its counts to opcode_profile.txt (or $MUALI_OPCODE_PROFILE), so one file can cover the whole corpus:
+#
+#     g++ -std=c++20 -O2 -DPROFILE_OPCODE_SEQUENCES src_c/main.cpp -o muali_profile
+#     for f in *.mua; do ./muali_profile $f; done
+#     python3 src_c/gen_superinstructions.py opcode_profile.txt
+#
+# The checked-in superinstructions.hpp comes from the scripts at the top level and in bench/. Regenerate it whenever the
+# compiler or the IR passes change what code they emit, or the fusions it has stop matching anything.
+#
+# Only opcodes that have an opbody_... (OPBODY_HANDLER in interpreter.hpp) can be fused, and jumps only at the end.
+
+import argparse
+import os
+import re
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+# superinstructions have to have the same opcode length as the first op they replace
+ONE_BYTE_POOL = list(range(0xF1, 0xFF))
+TWO_BYTE_POOL = list(range(0xB00, 0xB80))
+
+def read(name):
+    with open(os.path.join(HERE, name)) as f:
+        return f.read()
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("profiles", nargs="+", help="files written by a PROFILE_OPCODE_SEQUENCES build")
+    parser.add_argument("--max", type=int, default=24, help="how many superinstructions to make")
+    parser.add_argument("--min-count", type=int, default=1000, help="ignore sequences that ran fewer times than this")
+    parser.add_argument("--output", default=os.path.join(HERE, "superinstructions.hpp"))
+    args = parser.parse_args()
+
+    op_values = {}
+    for name, value in re.findall(r"constexpr uint16_t (OP_\w+)\s*=\s*(0x[0-9A-Fa-f]+);", read("vm_common.hpp")):
+        op_values[int(value, 16)] = name
+    bodies = {}
+    for body, op in re.findall(r"^OPBODY_HANDLER\((\w+), (OP_\w+)\)", read("interpreter.hpp"), re.M):
+        bodies[op] = body
+
+    counts = {}
+    for path in args.profiles:
+        with open(path) as f:
+            for line in f:
+                fields = line.split()
+                if not fields or fields[0] not in ("pair", "triple"):
+                    continue
+                seq = tuple(int(x, 16) for x in fields[1:-1])
+                counts[seq] = counts.get(seq, 0) + int(fields[-1])
+
+    def fusable(seq):
+        names = [op_values.get(op) for op in seq]
+        if any(name not in bodies for name in names):
+            return False
+        return not any(name.startswith("OP_J") for name in names[:-1])
+
+    # each superinstruction saves one dispatch per extra op it covers
+    candidates = [(count * (len(seq) - 1), seq) for seq, count in counts.items() if count >= args.min_count and fusable(seq)]
+    candidates.sort(key=lambda c: (-c[0], c[1]))
+
+    pools = {1: list(ONE_BYTE_POOL), 2: list(TWO_BYTE_POOL)}
+    chosen = []
+    for _, seq in candidates:
+        if len(chosen) >= args.max:
+            break
+        pool = pools[1 if seq[0] <= 0xFF else 2]
+        if not pool:
+            continue
+        chosen.append((pool.pop(0), seq))
+
+    def entry(opcode, seq):
+        names = [op_values[op] for op in seq]
+        parts = ["0x%X" % opcode, "__".join(bodies[name] for name in names)]
+        for name in names:
+            parts += [bodies[name], name]
+        return "    X(" + ", ".join(parts) + ")"
+
+    out = []
+    out.append("#ifndef MUALI_SUPERINSTRUCTIONS")
+    out.append("#define MUALI_SUPERINSTRUCTIONS")
+    out.append("")
+    out.append("// Generated by gen_superinstructions.py from opcode profiles. Regenerate it instead of editing it.")
+    out.append("// X(superinstruction opcode, name, then the body name and opcode of each op it runs)")
+    for n in (2, 3):
+        entries = [entry(opcode, seq) for opcode, seq in sorted(chosen) if len(seq) == n]
+        out.append("")
+        out.append("#define SUPERINSTRUCTIONS_%d(X)%s" % (n, " \\" if entries else ""))
+        if entries:
+            out.append(" \\\n".join(entries))
+    out.append("")
+    out.append("#endif // MUALI_SUPERINSTRUCTIONS")
+    out.append("")
+
+    with open(args.output, "w") as f:
+        f.write("\n".join(out))
+    print("wrote %d superinstructions to %s" % (len(chosen), args.output), file=sys.stderr)
+
+if __name__ == "__main__":
+    main()
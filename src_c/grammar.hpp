@@ -9,21 +9,50 @@
 
 #include "types.hpp"
 
+// backtracking through a long token (like a big string literal) can need more room than the thread's stack gets
+#define REMIMU_HEAP_STATES (1 << 22)
 #include "my_regex/my_regex.h"
 
 struct Regex {
     RegexToken tokens[64];
     String str;
     int16_t token_count;
+    RegexProgram program; // points into tokens
     Regex(String s) : str(s), token_count(0)
     {
+        // grammar regexes are user-supplied, so use the linear-time matcher unless the regex needs backtracking
         token_count = 64;
-        int e = regex_parse(str.data(), tokens, &token_count, 0);
+        int e = regex_parse(str.data(), tokens, &token_count, REMIMU_FLAG_LINEAR);
+        if (e)
+        {
+            token_count = 64;
+            e = regex_parse(str.data(), tokens, &token_count, 0);
+        }
         assert(!e);
+        e = regex_compile(tokens, &program);
+        assert(!e);
+    }
+    Regex(const Regex & other) : str(other.str), token_count(other.token_count), program(other.program)
+    {
+        memcpy(tokens, other.tokens, sizeof(tokens));
+        program.tokens = tokens;
+    }
+    Regex & operator=(const Regex & other)
+    {
+        if (this == &other)
+            return *this;
+        
+        str = other.str;
+        token_count = other.token_count;
+        memcpy(tokens, other.tokens, sizeof(tokens));
+        program = other.program;
+        program.tokens = tokens;
+        
+        return *this;
     }
     inline int match(const char * text, int * matchlength)
     {
-        int ret = regex_match(tokens, text, 0, 0, 0, 0);
+        int ret = regex_match_program(&program, text, 0, 0, 0, 0);
         if (ret > 0)
         {
             *matchlength = ret;
@@ -62,6 +91,7 @@ struct GrammarForm {
 struct GrammarPoint {
     Shared<String> name = 0;
     Vec<GrammarForm> forms;
+    size_t id = 0; // dense, from 0 to Grammar::point_count; indexes the packrat memo
     bool left_recursive = false;
     bool no_tokens = false;
     bool flatten = false;
@@ -92,13 +122,18 @@ static Shared<MatchingRule> new_rule_text(String text)
     return MakeShared<MatchingRule>(std::move(ret));
 }
 
+#include "lexer.hpp"
+
 struct Grammar
 {
-    ListSet<String> reserved_keywords;
+    HashSet<String> reserved_keywords;
     ListSet<Shared<GrammarPoint>> all_points;
-    ListMap<String, Shared<GrammarPoint>> points;
+    HashMap<String, Shared<GrammarPoint>> points;
     Vec<Shared<MatchingRule>> tokens;
     Vec<Shared<MatchingRule>> regex_tokens;
+    size_t point_count = 0;
+    LexerDfa lexer;
+    Shared<RegexSet> regex_set = 0; // the regex tokens in token order, if the lexer can't be used and they fit
     ~Grammar()
     {
         // kill inter-point references to prevent reference cycle memory leaks
@@ -150,8 +185,8 @@ static auto load_grammar(const char * text) -> Grammar
 {
     assert(text);
     
-    ListSet<String> reserved_keywords;
-    ListMap<String, Shared<GrammarPoint>> ret;
+    HashSet<String> reserved_keywords;
+    HashMap<String, Shared<GrammarPoint>> ret;
     ListSet<Shared<GrammarPoint>> all_points;
     Vec<Shared<MatchingRule>> tokens;
     Vec<Shared<MatchingRule>> regex_tokens;
@@ -505,10 +540,32 @@ static auto load_grammar(const char * text) -> Grammar
     }
     
     
+    size_t point_count = 0;
+    for (auto & point : all_points)
+        point->id = point_count++;
+    
     //for (auto & s : reserved_keywords)
     //    printf("RESERVED: `%s`\n", s.data());
     
-    return {reserved_keywords, all_points, ret, tokens, regex_tokens};
+    auto lexer = build_lexer(reserved_keywords, tokens);
+    
+    // without the lexer, tokenize matches all the regex tokens together at each position
+    Shared<RegexSet> regex_set = 0;
+    if (!lexer.ok)
+    {
+        regex_set = MakeShared<RegexSet>();
+        regex_set_init(regex_set.get());
+        for (auto & token : tokens)
+        {
+            if (token->kind == MATCH_KIND_REGEX && regex_set_add(regex_set.get(), &token->compiled_regex->program) < 0)
+            {
+                regex_set = 0;
+                break;
+            }
+        }
+    }
+    
+    return {reserved_keywords, all_points, ret, tokens, regex_tokens, point_count, std::move(lexer), regex_set};
 }
 
 struct Token {
@@ -605,45 +662,70 @@ static Vec<Shared<Token>> tokenize(Grammar & grammar, const char * _text)
         
         size_t longest_found = 0;
         Shared<MatchingRule> found;
-        for (auto _token : tokens)
+        if (grammar.lexer.ok)
+        {
+            uint32_t rule;
+            size_t len = grammar.lexer.match(&text[i], text_len - i, rule);
+            if (len > 0 && rule != LEXER_RESERVED)
+            {
+                longest_found = len;
+                found = tokens[rule];
+            }
+        }
+        else
         {
-            auto & token = *_token;
-            if (token.kind == MATCH_KIND_REGEX)
+            // one rule at a time, for grammars with regexes that the lexer DFA can't do
+            int64_t regex_lengths[REMIMU_SET_MAX_PATTERNS];
+            if (grammar.regex_set)
+                regex_set_match(grammar.regex_set.get(), &text[i], 0, regex_lengths);
+            size_t regex_index = 0;
+            for (auto _token : tokens)
             {
-                int len = 0;
-                int index = token.compiled_regex->match(&text[i], &len);
-                if (index == 0 && (unsigned int)len > longest_found)
+                auto & token = *_token;
+                if (token.kind == MATCH_KIND_REGEX)
                 {
-                    bool ok = true;
-                    for (auto & s : grammar.reserved_keywords)
+                    int len = 0;
+                    int index = -1;
+                    if (grammar.regex_set)
+                    {
+                        len = regex_lengths[regex_index++];
+                        index = len > 0 ? 0 : -1;
+                    }
+                    else
+                        index = token.compiled_regex->match(&text[i], &len);
+                    if (index == 0 && (unsigned int)len > longest_found)
                     {
-                        if ((size_t)len == s.size() && memcmp(&text[i], s.data(), len) == 0)
+                        bool ok = true;
+                        for (auto & s : grammar.reserved_keywords)
+                        {
+                            if ((size_t)len == s.size() && memcmp(&text[i], s.data(), len) == 0)
+                            {
+                                ok = false;
+                                break;
+                            }
+                        }
+                        if (ok)
                         {
-                            ok = false;
+                            longest_found = len;
+                            found = _token;
                             break;
                         }
                     }
-                    if (ok)
+                }
+                else if (token.kind == MATCH_KIND_LITERAL)
+                {
+                    if (token.text->size() <= longest_found)
+                        continue;
+                    
+                    if (starts_with(&text[i], token.text->data()))
                     {
-                        longest_found = len;
+                        longest_found = token.text->size();
                         found = _token;
-                        break;
                     }
                 }
+                else
+                    assert(((void)"Broken internal grammar state!!!!!!", 0));
             }
-            else if (token.kind == MATCH_KIND_LITERAL)
-            {
-                if (token.text->size() <= longest_found)
-                    continue;
-                
-                if (starts_with(&text[i], token.text->data()))
-                {
-                    longest_found = token.text->size();
-                    found = _token;
-                }
-            }
-            else
-                assert(((void)"Broken internal grammar state!!!!!!", 0));
         }
         
         if (!found)
@@ -739,56 +821,31 @@ static Shared<ASTNode> ast_node_from_token(Shared<Token> token, size_t token_ind
     return MakeShared<ASTNode>(ASTNode{{}, token->row, token->column, 1, token_index, token->text, true, rule});
 }
 
-struct ParseRecord
-{
-    size_t token_index;
-    Shared<String> node_name;
-    bool operator==(const ParseRecord & other) const
-    {
-        return token_index == other.token_index && *node_name == *other.node_name;
-    }
-    bool operator<(const ParseRecord & other) const
-    {
-        //if (token_index < other.token_index)
-        //    return true;
-        //if (token_index > other.token_index)
-        //    return false;
-        //return *node_name < *other.node_name;
-        if (*node_name < *other.node_name)
-            return true;
-        if (*other.node_name < *node_name)
-            return false;
-        return token_index < other.token_index;
-    }
-};
+constexpr uint8_t PARSE_MEMO_UNKNOWN = 0;
+constexpr uint8_t PARSE_MEMO_HIT = 1;
+constexpr uint8_t PARSE_MEMO_MISS = 2;
 
-/*
-template<>
-struct std::hash<ParseRecord>
-{
-    std::size_t operator()(const ParseRecord & obj) const noexcept
+// Everything a parse needs besides the grammar and the tokens, so that separate parses can run at the same time.
+struct ParseState {
+    // packrat memo of named grammar points, indexed by token_index * point_count + GrammarPoint::id
+    size_t point_count = 0;
+    Vec<uint8_t> memo;
+    HashMap<size_t, Shared<ASTNode>> memo_hits;
+    // for error messages: the furthest token that any rule got to, and what the rules there wanted
+    size_t furthest = 0;
+    HashSet<Shared<String>> furthest_maybes;
+    
+    void reset(const Grammar & grammar, size_t token_count)
     {
-        size_t a = std::hash<size_t>{}(obj.token_index);
-        size_t b = std::hash<String>{}(*obj.node_name);
-        
-        size_t x = a * 0x1061346952391 + b;
-        return x;
+        point_count = grammar.point_count;
+        memo = Vec<uint8_t>((token_count + 1) * point_count, PARSE_MEMO_UNKNOWN);
+        memo_hits.clear();
+        furthest = 0;
+        furthest_maybes.clear();
     }
 };
-*/
-
-static ListMap<ParseRecord, Shared<ASTNode>> parse_hits;
-static ListSet<ParseRecord> parse_misses;
-static size_t furthest = 0;
-static ListSet<Shared<String>> furthest_maybes;
 
-static void clear_parser_global_state()
-{
-    parse_hits.clear();
-    parse_misses.clear();
-}
-
-static auto parse_with(const Vec<Shared<Token>> & tokens, size_t starting_token_index, Shared<GrammarPoint> node_type, size_t depth) -> Option<Shared<ASTNode>>
+static auto parse_with(ParseState & state, const Vec<Shared<Token>> & tokens, size_t starting_token_index, Shared<GrammarPoint> node_type, size_t depth) -> Option<Shared<ASTNode>>
 {
     //const bool PARSER_DEBUG_DISABLE_MEMOIZATION = true;
     const bool PARSER_DEBUG_DISABLE_MEMOIZATION = false;
@@ -803,16 +860,17 @@ static auto parse_with(const Vec<Shared<Token>> & tokens, size_t starting_token_
         indent();
         //printf("+ checking for a... %s\n", node_type->name->data());
     }
-    auto base_key = ParseRecord{starting_token_index, node_type->name};
+    size_t memo_index = starting_token_index * state.point_count + node_type->id;
+    bool memoize = !PARSER_DEBUG_DISABLE_MEMOIZATION && node_type->name;
     
-    if (node_type->name && parse_hits.count(base_key) > 0)
+    if (memoize && state.memo[memo_index] == PARSE_MEMO_HIT)
     {
         //puts("returning early A");
-        auto asdf = parse_hits[base_key];
+        auto asdf = state.memo_hits[memo_index];
         //printf("%p\n", asdf.get());
         return {asdf};
     }
-    if (node_type->name && parse_misses.count(base_key) > 0)
+    if (memoize && state.memo[memo_index] == PARSE_MEMO_MISS)
     {
         //puts("returning early B");
         return {};
@@ -846,20 +904,20 @@ static auto parse_with(const Vec<Shared<Token>> & tokens, size_t starting_token_
             auto rule_ref = form->rules[i];
             auto & rule = *rule_ref;
             
-            if (token_index > furthest)
+            if (token_index > state.furthest)
             {
-                furthest = token_index;
-                furthest_maybes = {};
+                state.furthest = token_index;
+                state.furthest_maybes.clear();
             }
             
             if (rule.kind == MATCH_KIND_LITERAL || rule.kind == MATCH_KIND_REGEX)
             {
                 assert(rule.text);
-                if (token_index == furthest)
-                    furthest_maybes.insert(rule.text);
+                if (token_index == state.furthest)
+                    state.furthest_maybes.insert(rule.text);
             }
-            else if (token_index == furthest && rule.kind == MATCH_KIND_POINT)
-                parse_with(tokens, token_index, rule.rule, depth + 1);
+            else if (token_index == state.furthest && rule.kind == MATCH_KIND_POINT)
+                parse_with(state, tokens, token_index, rule.rule, depth + 1);
             
             if (token_index == tokens.size())
             {
@@ -907,7 +965,7 @@ static auto parse_with(const Vec<Shared<Token>> & tokens, size_t starting_token_
             else if (rule.kind == MATCH_KIND_POINT)
             {
                 assert(rule.rule);
-                if (auto parse = parse_with(tokens, token_index, rule.rule, depth + 1))
+                if (auto parse = parse_with(state, tokens, token_index, rule.rule, depth + 1))
                 {
                     (*parse)->rule = rule_ref;
                     if (PARSER_DO_DEBUG_PRINT)
@@ -937,6 +995,12 @@ static auto parse_with(const Vec<Shared<Token>> & tokens, size_t starting_token_
                 else
                     i = start_i + 1;
             }
+            else if (rule.qualifier == MATCH_QUAL_PLUS && start_i != i)
+            {
+                // first match of a + rule: stay on it so that it can match again (same_consec becomes nonzero below)
+                hit_fallible = true;
+                i = start_i;
+            }
             else if (rule.qualifier == MATCH_QUAL_MAYBE)
             {
                 hit_fallible = true;
@@ -1027,8 +1091,11 @@ static auto parse_with(const Vec<Shared<Token>> & tokens, size_t starting_token_
             
             auto ret_wrapped = MakeShared<ASTNode>(ret);
             
-            if (!PARSER_DEBUG_DISABLE_MEMOIZATION && node_type->name)
-                parse_hits.insert(base_key, ret_wrapped);
+            if (memoize)
+            {
+                state.memo[memo_index] = PARSE_MEMO_HIT;
+                state.memo_hits.insert(memo_index, ret_wrapped);
+            }
             
             return {ret_wrapped};
         }
@@ -1038,16 +1105,19 @@ static auto parse_with(const Vec<Shared<Token>> & tokens, size_t starting_token_
         indent();
         puts("- done checking! not found...");
     }
+    if (memoize)
+        state.memo[memo_index] = PARSE_MEMO_MISS;
     return {};
 }
 
-static auto parse_as(Grammar & grammar, const Vec<Shared<Token>> & tokens, const char * as_node_type) -> Option<Shared<ASTNode>>
+// `state` is left as the parse finished, for print_parse_error
+static auto parse_as(Grammar & grammar, const Vec<Shared<Token>> & tokens, const char * as_node_type, ParseState & state) -> Option<Shared<ASTNode>>
 {
-    furthest = 0;
+    state.reset(grammar, tokens.size());
     
     assert(grammar.points.count(String(as_node_type)) > 0);
     auto point = grammar.points[String(as_node_type)];
-    auto ret = parse_with(tokens, 0, point, 0);
+    auto ret = parse_with(state, tokens, 0, point, 0);
     if (ret && (*ret)->token_count != tokens.size())
         ret = {};
     else if (ret)
@@ -1056,7 +1126,8 @@ static auto parse_as(Grammar & grammar, const Vec<Shared<Token>> & tokens, const
         AST_delete_token_refs(*ret);
     }
     //puts("we");
-    clear_parser_global_state();
+    state.memo = {};
+    state.memo_hits.clear();
     return ret;
 }
 
@@ -1087,16 +1158,16 @@ static void print_tokenization_error(const Vec<Shared<Token>> & tokens, const St
     puts("The grammar does not recognize the pointed-to text as valid, not even on a single-chunk level.");
 }
 
-static void print_parse_error(const Vec<Shared<Token>> & tokens, const String & text)
+static void print_parse_error(const ParseState & state, const Vec<Shared<Token>> & tokens, const String & text)
 {
     printf("Parse failed. Expected one of:\n");
-    for (auto & str : furthest_maybes)
+    for (auto & str : state.furthest_maybes)
         printf("  \033[92m%s\033[0m\n", str->data());
-    if (furthest >= tokens.size())
+    if (state.furthest >= tokens.size())
         printf("At end of input stream.\n");
     else
     {
-        auto token = tokens[furthest];
+        auto token = tokens[state.furthest];
         printf("On line %zu at column %zu:\n", token->row, token->column);
         size_t i = token->line_index;
         size_t col = 0;
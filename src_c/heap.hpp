@@ -0,0 +1,315 @@
+#ifndef MUALI_HEAP
+#define MUALI_HEAP
+
+// Included by interpreter.hpp right after Variable, which it needs.
+
+// Heap values are managed with deferred reference counting (Deutsch & Bobrow) plus trial deletion for cycles (Bacon & Rajan).
+// - HeapObject::refcount only counts references from inside other heap objects (array elements, dict keys and values).
+//   Registers and C++ locals aren't counted, so moving values between registers never touches the objects they point to.
+// - When a count drops to zero the object may still be in a register, so instead of being freed it goes into the
+//   zero count table (ZCT). New objects start out there too.
+// - reconcile() counts the references held by the roots (the live part of the register stack), frees whatever in the ZCT
+//   is still at zero, collects garbage cycles, then takes the root references back out.
+// - Objects whose count drops without reaching zero, or that leave the ZCT still referenced, might be part of a cycle,
+//   so they're buffered as candidates for the cycle collector.
+// A value that isn't reachable from the roots can be freed by the next reconcile(), so anything that holds on to one
+// across a call has to keep it in a register.
+
+constexpr uint8_t HEAP_BLACK  = 0; // in use (or not looked at)
+constexpr uint8_t HEAP_GRAY   = 1; // might be garbage, being looked at by the cycle collector
+constexpr uint8_t HEAP_WHITE  = 2; // garbage cycle member
+constexpr uint8_t HEAP_PURPLE = 3; // possible root of a garbage cycle
+constexpr uint8_t HEAP_FREED  = 4; // released while buffered; the memory goes when the candidate list is processed
+
+#define HEAP_RECONCILE_MIN_PENDING 4096 // ZCT and candidate entries that have to pile up before reconcile() is worth it
+
+struct Heap {
+    Vec<HeapObject *> zct;
+    Vec<HeapObject *> candidates;
+    size_t pending_limit = HEAP_RECONCILE_MIN_PENDING;
+    size_t live_objects = 0;
+    
+    Heap() = default;
+    Heap(const Heap &) = delete;
+    Heap & operator=(const Heap &) = delete;
+    
+    Variable make_string(String s) { return Variable::of_heap(alloc(TYPEID_STRING, std::move(s))); }
+    Variable make_array() { return Variable::of_heap(alloc(TYPEID_ARRAY, Vec<Variable>())); }
+    Variable make_dict() { return Variable::of_heap(alloc(TYPEID_DICT, VarDict())); }
+    
+    // Writes to a slot inside a heap object, like an array element. Registers are written with plain assignment instead.
+    void store(Variable & slot, const Variable & value)
+    {
+        if (auto obj = value.heap_object())
+            obj->refcount += 1;
+        if (auto old = slot.heap_object())
+            decref(old);
+        slot = value;
+    }
+    void array_push(const Variable & array, const Variable & value)
+    {
+        auto & items = array.get_array();
+        items.push_back(Variable());
+        store(items.back(), value);
+    }
+    void dict_set(const Variable & dict, const Variable & key, const Variable & value)
+    {
+        auto & map = dict.get_dict();
+        for (auto & pair : map)
+        {
+            if (pair._0 == key)
+                return store(pair._1, value);
+        }
+        if (auto obj = key.heap_object())
+            obj->refcount += 1;
+        if (auto obj = value.heap_object())
+            obj->refcount += 1;
+        map.insert(key, value);
+    }
+    
+    bool wants_reconcile() const { return zct.size() + candidates.size() >= pending_limit; }
+    void reconcile(const Variable * roots, size_t root_count);
+    
+    ~Heap()
+    {
+        reconcile(nullptr, 0);
+        assert(live_objects == 0);
+    }
+    
+    template<typename T>
+    HeapObject * alloc(TypeId kind, T && value)
+    {
+        auto box = new HeapBox<T>{HeapObject{}, std::move(value)};
+        box->header.kind = kind;
+        box->header.in_zct = 1;
+        zct.push_back(&box->header);
+        live_objects += 1;
+        return &box->header;
+    }
+
+private:
+    template<typename F>
+    static void for_each_child(HeapObject * obj, F && f)
+    {
+        if (obj->kind == TYPEID_ARRAY)
+        {
+            for (auto & item : ((HeapBox<Vec<Variable>> *)obj)->value)
+            {
+                if (auto child = item.heap_object())
+                    f(child);
+            }
+        }
+        else if (obj->kind == TYPEID_DICT)
+        {
+            for (auto & pair : ((HeapBox<VarDict> *)obj)->value)
+            {
+                if (auto child = pair._0.heap_object())
+                    f(child);
+                if (auto child = pair._1.heap_object())
+                    f(child);
+            }
+        }
+    }
+    
+    void possible_cycle_root(HeapObject * obj)
+    {
+        obj->color = HEAP_PURPLE;
+        if (!obj->buffered)
+        {
+            obj->buffered = 1;
+            candidates.push_back(obj);
+        }
+    }
+    
+    void decref(HeapObject * obj)
+    {
+        obj->refcount -= 1;
+        if (obj->refcount == 0)
+        {
+            if (!obj->in_zct)
+            {
+                obj->in_zct = 1;
+                zct.push_back(obj);
+            }
+        }
+        else
+            possible_cycle_root(obj);
+    }
+    
+    void free_memory(HeapObject * obj)
+    {
+        live_objects -= 1;
+        switch (obj->kind)
+        {
+        case TYPEID_INT:
+            delete (HeapBox<int64_t> *)obj;
+            break;
+        case TYPEID_STRING:
+            delete (HeapBox<String> *)obj;
+            break;
+        case TYPEID_ARRAY:
+            delete (HeapBox<Vec<Variable>> *)obj;
+            break;
+        case TYPEID_DICT:
+            delete (HeapBox<VarDict> *)obj;
+            break;
+        default:
+            assert(((void)"freed a heap object of unknown kind", 0));
+        }
+    }
+    
+    // Count is zero and no root refers to it. Children that drop to zero go into the ZCT, which is being drained.
+    void release(HeapObject * obj)
+    {
+        for_each_child(obj, [&](HeapObject * child) { decref(child); });
+        if (obj->buffered)
+            obj->color = HEAP_FREED;
+        else
+            free_memory(obj);
+    }
+    
+    void collect_cycles();
+};
+
+inline void Heap::reconcile(const Variable * roots, size_t root_count)
+{
+    for (size_t i = 0; i < root_count; i++)
+    {
+        if (auto obj = roots[i].heap_object())
+            obj->refcount += 1;
+    }
+    
+    // zct grows while this runs, as released objects let go of their children
+    for (size_t i = 0; i < zct.size(); i++)
+    {
+        auto obj = zct[i];
+        obj->in_zct = 0;
+        if (obj->refcount == 0)
+            release(obj);
+        else
+            possible_cycle_root(obj);
+    }
+    zct.clear();
+    
+    collect_cycles();
+    
+    for (size_t i = 0; i < root_count; i++)
+    {
+        if (auto obj = roots[i].heap_object())
+            decref(obj);
+    }
+    
+    size_t pending = zct.size() + candidates.size();
+    pending_limit = pending * 2 > HEAP_RECONCILE_MIN_PENDING ? pending * 2 : HEAP_RECONCILE_MIN_PENDING;
+}
+
+// Synchronous trial deletion: take out the references that candidates' subgraphs hold on themselves, and whatever ends up
+// at zero is only kept alive by garbage. Runs with root references counted, so nothing in a register gets collected.
+inline void Heap::collect_cycles()
+{
+    Vec<HeapObject *> roots;
+    Vec<HeapObject *> work;
+    
+    // mark gray: subtract internal references
+    for (auto obj : candidates)
+    {
+        if (obj->color == HEAP_GRAY) // already reached from an earlier candidate
+            roots.push_back(obj);
+        else if (obj->color == HEAP_PURPLE)
+        {
+            roots.push_back(obj);
+            obj->color = HEAP_GRAY;
+            work.push_back(obj);
+            while (work.size())
+            {
+                auto next = work.back();
+                work.pop_back();
+                for_each_child(next, [&](HeapObject * child)
+                {
+                    child->refcount -= 1;
+                    if (child->color != HEAP_GRAY)
+                    {
+                        child->color = HEAP_GRAY;
+                        work.push_back(child);
+                    }
+                });
+            }
+        }
+        else
+        {
+            obj->buffered = 0;
+            if (obj->color == HEAP_FREED)
+                free_memory(obj);
+        }
+    }
+    candidates.clear();
+    
+    // scan: anything still referenced from outside is live, along with everything it reaches
+    for (auto root : roots)
+    {
+        work.push_back(root);
+        while (work.size())
+        {
+            auto obj = work.back();
+            work.pop_back();
+            if (obj->color != HEAP_GRAY)
+                continue;
+            if (obj->refcount == 0)
+            {
+                obj->color = HEAP_WHITE;
+                for_each_child(obj, [&](HeapObject * child) { work.push_back(child); });
+                continue;
+            }
+            Vec<HeapObject *> black = {obj};
+            obj->color = HEAP_BLACK;
+            while (black.size())
+            {
+                auto next = black.back();
+                black.pop_back();
+                for_each_child(next, [&](HeapObject * child)
+                {
+                    child->refcount += 1;
+                    if (child->color != HEAP_BLACK)
+                    {
+                        child->color = HEAP_BLACK;
+                        black.push_back(child);
+                    }
+                });
+            }
+        }
+    }
+    
+    // collect white; nothing is freed until every cycle has been walked, since they can point into each other
+    for (auto root : roots)
+        root->buffered = 0;
+    Vec<HeapObject *> garbage;
+    for (auto root : roots)
+    {
+        work.push_back(root);
+        while (work.size())
+        {
+            auto obj = work.back();
+            work.pop_back();
+            if (obj->color != HEAP_WHITE || obj->buffered)
+                continue;
+            obj->color = HEAP_BLACK;
+            garbage.push_back(obj);
+            for_each_child(obj, [&](HeapObject * child) { work.push_back(child); });
+        }
+    }
+    for (auto obj : garbage)
+        free_memory(obj);
+}
+
+// Heap that NaN-boxed big ints get allocated from. Set by the Interpreter that owns it.
+inline Heap * active_heap = nullptr;
+
+#ifdef VARIABLE_NANBOXED
+inline HeapObject * Variable::box_int(int64_t n)
+{
+    assert(active_heap);
+    return active_heap->alloc(TYPEID_INT, int64_t(n));
+}
+#endif
+
+#endif // MUALI_HEAP
@@ -4,12 +4,19 @@
 #include <cassert>
 #include <cstring>
 #include <cstdint>
+#include <sys/resource.h> // getrlimit, for how deep calls can nest
 
 #include "types.hpp"
 #include "grammar.hpp"
 #include "vm_common.hpp"
 
 //#define USE_LOOP_DISPATCH
+// compile functions to x86-64 machine code when the interpreter loads them (see jit.hpp)
+//#define USE_JIT
+// compile hot counted loops to x86-64 machine code as the interpreter runs them (see trace_jit.hpp)
+//#define USE_TRACING_JIT
+// 8-byte NaN-boxed Variable instead of the tagged union (see struct Variable); slower on int-heavy code
+//#define VARIABLE_NANBOXED
 
 #ifndef USE_LOOP_DISPATCH
 #define OPHANDLER_ABI extern "C" [[clang::preserve_none]]
@@ -39,165 +46,256 @@
 #define INC_PC_FOR_OPCODE(X) pc += ((X) > 0xFF) ? 2 : 1; (void)global; (void)vars;
 #endif
 
+// Header at the start of every heap-allocated value (strings, arrays, dicts, and big ints when NaN-boxed).
+// The object itself follows it in the same allocation; see HeapBox. Lifetimes are managed by Heap (heap.hpp).
+struct HeapObject {
+    uint32_t refcount = 0; // references from inside other heap objects only; registers aren't counted
+    uint8_t kind;
+    uint8_t color = 0; // HEAP_BLACK etc., used by the cycle collector
+    uint8_t in_zct = 0;
+    uint8_t buffered = 0; // in the cycle collector's candidate list
+};
+
+template<typename T>
+struct HeapBox {
+    HeapObject header;
+    T value;
+};
+
+struct Variable;
+typedef ListMap<Variable, Variable> VarDict;
+
+// Values are only accessed through the methods below, so that the layout can be swapped out:
+// - by default, a union of the possible payloads plus a TypeId (16 bytes)
+// - with VARIABLE_NANBOXED, a single NaN-boxed 64-bit word (8 bytes), so register files take less cache and copying
+//   a number is a plain 8-byte move
+//   This costs time on ints. Reading one's kind means decoding its tag, and reading its value means sign-extending
+//   its 48-bit payload. Ints that don't fit in 48 bits are boxed on the heap, so every op that makes one allocates.
+//   Built with g++, bench/branchy.mua and bench/collatz.mua run about 1.3x slower than with the tagged union, and a
+//   loop that adds to an int past 2^47 runs about 2.5x slower. Leave it off for int-heavy code.
+// Variables don't own what they point to, so copying one never touches a refcount. Functions belong to the
+// Interpreter and heap values to its Heap, which frees them once nothing reachable refers to them.
+#ifndef VARIABLE_NANBOXED
+
 struct Variable {
+private:
     union Data {
         uint8_t boolean;
         int64_t integer;
         double real;
-        Shared<String> string;
-        Shared<Vec<Variable>> array;
-        Shared<ListMap<Variable, Variable>> dict;
-        Shared<Function> func;
-        constexpr Data() {}
-        ~Data() {}
+        HeapObject * object;
+        Function * func;
     } data;
-    TypeId kind = TYPEID_NULL;
+    TypeId type_id = TYPEID_NULL;
+    
+public:
+    constexpr Variable() : data{0} {}
     
-    static Variable of_type(TypeId id) { auto ret = Variable(); ret.kind = id; return ret; }
+    TypeId kind() const { return type_id; }
     
-    constexpr Variable(){}
+    int64_t get_int() const { return data.integer; }
+    double get_float() const { return data.real; }
+    bool get_bool() const { return data.boolean; }
+    String & get_string() const { return ((HeapBox<String> *)data.object)->value; }
+    Vec<Variable> & get_array() const { return ((HeapBox<Vec<Variable>> *)data.object)->value; }
+    VarDict & get_dict() const { return ((HeapBox<VarDict> *)data.object)->value; }
+    Function * get_func() const { return data.func; }
+    // null if this isn't a heap value
+    HeapObject * heap_object() const { return (type_id >= TYPEID_STRING && type_id <= TYPEID_DICT) ? data.object : nullptr; }
     
-    constexpr Variable(Variable && other)
+    void set_null()
     {
-        kind = other.kind;
-        switch (kind)
-        {
-        case TYPEID_INT:
-        case TYPEID_FLOAT:
-        case TYPEID_BOOL:
-            data.integer = other.data.integer;
-            break;
-        case TYPEID_STRING:
-            ::new((void*)(&data.string)) Shared<String>(std::move(other.data.string));
-            break;
-        case TYPEID_ARRAY:
-            ::new((void*)(&data.array)) Shared<Vec<Variable>>(std::move(other.data.array));
-            break;
-        case TYPEID_DICT:
-            ::new((void*)(&data.dict)) Shared<ListMap<Variable, Variable>>(std::move(other.data.dict));
-            break;
-        case TYPEID_FUNC:
-            ::new((void*)(&data.func)) Shared<Function>(std::move(other.data.func));
-            break;
-        default:
-            break;
-        }
+        type_id = TYPEID_NULL;
+        data.integer = 0;
+    }
+    void set_int(int64_t n)
+    {
+        type_id = TYPEID_INT;
+        data.integer = n;
+    }
+    void set_float(double n)
+    {
+        type_id = TYPEID_FLOAT;
+        data.real = n;
+    }
+    void set_bool(bool n)
+    {
+        type_id = TYPEID_BOOL;
+        data.integer = n;
     }
     
-    constexpr Variable(const Variable & other)
+    static Variable of_heap(HeapObject * obj) { Variable ret; ret.type_id = obj->kind; ret.data.object = obj; return ret; }
+    static Variable of_func(Function * f) { Variable ret; ret.type_id = TYPEID_FUNC; ret.data.func = f; return ret; }
+    
+    static Variable of_int(int64_t n) { Variable ret; ret.set_int(n); return ret; }
+    static Variable of_float(double n) { Variable ret; ret.set_float(n); return ret; }
+    static Variable of_bool(bool n) { Variable ret; ret.set_bool(n); return ret; }
+};
+
+static_assert(sizeof(Variable) == 16);
+
+#else // VARIABLE_NANBOXED
+
+// Doubles are stored as-is, with NaNs canonicalized to one positive quiet NaN. Everything else goes in the payload
+// of negative quiet NaNs with one of the tags below in the top 16 bits. Hardware only ever makes the 0xFFF8 one.
+constexpr uint64_t NANBOX_TAG_INT       = 0xFFF9; // 48-bit two's complement int
+constexpr uint64_t NANBOX_TAG_NULL      = 0xFFFA;
+constexpr uint64_t NANBOX_TAG_BOOL      = 0xFFFB; // 0 or 1
+constexpr uint64_t NANBOX_TAG_BOXED_INT = 0xFFFC; // pointer to a HeapBox<int64_t>, for ints that don't fit in 48 bits
+constexpr uint64_t NANBOX_TAG_HEAP      = 0xFFFD; // pointer with (kind - TYPEID_STRING) in the low 2 bits: a HeapObject, or a Function for TYPEID_FUNC
+constexpr uint64_t NANBOX_PAYLOAD_MASK  = 0xFFFFFFFFFFFFULL;
+constexpr uint64_t NANBOX_CANONICAL_NAN = 0x7FF8000000000000ULL;
+
+struct Variable {
+private:
+    uint64_t bits = NANBOX_TAG_NULL << 48;
+    
+    uint64_t tag() const { return bits >> 48; }
+    void * pointer() const { return (void *)(bits & NANBOX_PAYLOAD_MASK & ~uint64_t(3)); }
+    static uint64_t pointer_bits(uint64_t tag, const void * ptr, uint64_t low_bits)
     {
-        kind = other.kind;
-        switch (kind)
-        {
-        case TYPEID_INT:
-        case TYPEID_FLOAT:
-        case TYPEID_BOOL:
-            data.integer = std::move(other.data.integer);
-            break;
-        case TYPEID_STRING:
-            data.string = other.data.string;
-            break;
-        case TYPEID_ARRAY:
-            data.array = other.data.array;
-            break;
-        case TYPEID_DICT:
-            data.dict = other.data.dict;
-            break;
-        case TYPEID_FUNC:
-            data.func = other.data.func;
-            break;
-        default:
-            break;
-        }
+        assert(((uint64_t)ptr & ~NANBOX_PAYLOAD_MASK) == 0 && ((uint64_t)ptr & 3) == 0);
+        return (tag << 48) | (uint64_t)ptr | low_bits;
     }
+    static HeapObject * box_int(int64_t n); // defined in heap.hpp
     
-    constexpr Variable & operator=(Variable && other)
+public:
+    TypeId kind() const
     {
-        destruct();
-        
-        kind = other.kind;
-        switch (kind)
+        if (bits < (NANBOX_TAG_INT << 48)) [[likely]]
+            return TYPEID_FLOAT;
+        switch (tag())
         {
-        case TYPEID_INT:
-        case TYPEID_FLOAT:
-        case TYPEID_BOOL:
-            data.integer = std::move(other.data.integer);
-            break;
-        case TYPEID_STRING:
-            data.string = std::move(other.data.string);
-            break;
-        case TYPEID_ARRAY:
-            data.array = std::move(other.data.array);
-            break;
-        case TYPEID_DICT:
-            data.dict = std::move(other.data.dict);
-            break;
-        case TYPEID_FUNC:
-            data.func = std::move(other.data.func);
-            break;
+        case NANBOX_TAG_INT:
+        case NANBOX_TAG_BOXED_INT:
+            return TYPEID_INT;
+        case NANBOX_TAG_NULL:
+            return TYPEID_NULL;
+        case NANBOX_TAG_BOOL:
+            return TYPEID_BOOL;
+        case NANBOX_TAG_HEAP:
+            return TYPEID_STRING + (bits & 3);
         default:
-            break;
+            return TYPEID_INVALID;
         }
-        return *this;
     }
     
-    constexpr Variable & operator=(const Variable & other)
+    int64_t get_int() const
     {
-        destruct();
-        
-        kind = other.kind;
-        switch (kind)
-        {
-        case TYPEID_INT:
-        case TYPEID_FLOAT:
-        case TYPEID_BOOL:
-            data.integer = other.data.integer;
-            break;
-        case TYPEID_STRING:
-            data.string = other.data.string;
-            break;
-        case TYPEID_ARRAY:
-            data.array = other.data.array;
-            break;
-        case TYPEID_DICT:
-            data.dict = other.data.dict;
-            break;
-        case TYPEID_FUNC:
-            data.func = other.data.func;
-            break;
-        default:
-            break;
-        }
-        return *this;
+        if (tag() == NANBOX_TAG_INT) [[likely]]
+            return int64_t(bits << 16) >> 16;
+        return ((HeapBox<int64_t> *)pointer())->value;
+    }
+    double get_float() const
+    {
+        double ret;
+        memcpy(&ret, &bits, 8);
+        return ret;
+    }
+    bool get_bool() const { return bits & 1; }
+    String & get_string() const { return ((HeapBox<String> *)pointer())->value; }
+    Vec<Variable> & get_array() const { return ((HeapBox<Vec<Variable>> *)pointer())->value; }
+    VarDict & get_dict() const { return ((HeapBox<VarDict> *)pointer())->value; }
+    Function * get_func() const { return (Function *)pointer(); }
+    // null if this isn't a heap value
+    HeapObject * heap_object() const
+    {
+        if (tag() == NANBOX_TAG_BOXED_INT || (tag() == NANBOX_TAG_HEAP && (bits & 3) != TYPEID_FUNC - TYPEID_STRING))
+            return (HeapObject *)pointer();
+        return nullptr;
     }
     
-    constexpr void destruct()
+    void set_null()
     {
-        switch (kind)
-        {
-        case TYPEID_STRING:
-            data.string = 0;
-            break;
-        case TYPEID_ARRAY:
-            data.array = 0;
-            break;
-        case TYPEID_DICT:
-            data.dict = 0;
-            break;
-        case TYPEID_FUNC:
-            data.func = 0;
-            break;
-        default:
-            break;
-        }
+        bits = NANBOX_TAG_NULL << 48;
+    }
+    void set_int(int64_t n)
+    {
+        if (int64_t(uint64_t(n) << 16) >> 16 == n) [[likely]]
+            bits = (NANBOX_TAG_INT << 48) | (uint64_t(n) & NANBOX_PAYLOAD_MASK);
+        else
+            bits = pointer_bits(NANBOX_TAG_BOXED_INT, box_int(n), 0);
+    }
+    void set_float(double n)
+    {
+        if (n != n) [[unlikely]]
+            bits = NANBOX_CANONICAL_NAN;
+        else
+            memcpy(&bits, &n, 8);
+    }
+    void set_bool(bool n)
+    {
+        bits = (NANBOX_TAG_BOOL << 48) | uint64_t(n);
     }
     
-    ~Variable()
+    static Variable of_heap(HeapObject * obj)
     {
-        destruct();
+        Variable ret;
+        if (obj->kind == TYPEID_INT)
+            ret.bits = pointer_bits(NANBOX_TAG_BOXED_INT, obj, 0);
+        else
+            ret.bits = pointer_bits(NANBOX_TAG_HEAP, obj, obj->kind - TYPEID_STRING);
+        return ret;
     }
+    static Variable of_func(Function * f) { Variable ret; ret.bits = pointer_bits(NANBOX_TAG_HEAP, f, TYPEID_FUNC - TYPEID_STRING); return ret; }
+    
+    static Variable of_int(int64_t n) { Variable ret; ret.set_int(n); return ret; }
+    static Variable of_float(double n) { Variable ret; ret.set_float(n); return ret; }
+    static Variable of_bool(bool n) { Variable ret; ret.set_bool(n); return ret; }
 };
 
+static_assert(sizeof(Variable) == 8);
+
+#endif // VARIABLE_NANBOXED
+
+// Equality and ordering for dict keys. Strings compare by contents, other heap values and functions by identity.
+static inline bool operator==(const Variable & a, const Variable & b)
+{
+    if (a.kind() != b.kind())
+        return false;
+    switch (a.kind())
+    {
+    case TYPEID_NULL:
+        return true;
+    case TYPEID_INT:
+        return a.get_int() == b.get_int();
+    case TYPEID_FLOAT:
+        return a.get_float() == b.get_float();
+    case TYPEID_BOOL:
+        return a.get_bool() == b.get_bool();
+    case TYPEID_STRING:
+        return a.get_string() == b.get_string();
+    case TYPEID_FUNC:
+        return a.get_func() == b.get_func();
+    default:
+        return a.heap_object() == b.heap_object();
+    }
+}
+static inline bool operator<(const Variable & a, const Variable & b)
+{
+    if (a.kind() != b.kind())
+        return a.kind() < b.kind();
+    switch (a.kind())
+    {
+    case TYPEID_NULL:
+        return false;
+    case TYPEID_INT:
+        return a.get_int() < b.get_int();
+    case TYPEID_FLOAT:
+        return a.get_float() < b.get_float();
+    case TYPEID_BOOL:
+        return a.get_bool() < b.get_bool();
+    case TYPEID_STRING:
+        return a.get_string() < b.get_string();
+    case TYPEID_FUNC:
+        return a.get_func() < b.get_func();
+    default:
+        return a.heap_object() < b.heap_object();
+    }
+}
+
+#include "heap.hpp"
+
 
 extern "C" uint16_t read_op(const uint8_t * & pc)
 {
@@ -217,17 +315,38 @@ extern "C" uint16_t read_op(const uint8_t * & pc)
 
 
 #ifdef USE_LOOP_DISPATCH
-#define OPHANDLER_ARGS Variable * vars, const uint8_t * & pc, Interpreter * global
+#define OPHANDLER_ARGS Variable * & vars, const uint8_t * & pc, Interpreter * global
 #define CALL_ORDER vars, pc, global
 #else
 #define OPHANDLER_ARGS Variable * vars, const uint8_t * pc, Interpreter * global
 #define CALL_ORDER vars, pc, global
 #endif
 
+// what the profiling builds do on every dispatch, with pc at the opcode
+#ifdef PROFILE_OPCODE_SEQUENCES
+#define PROFILE_OPCODE_SEQUENCE(OP) global->opcode_profile.record(OP);
+#else
+#define PROFILE_OPCODE_SEQUENCE(OP)
+#endif
+#ifdef PROFILE_EXECUTION
+#define PROFILE_EXECUTION_STEP(OP) global->execution_profile.record(OP, pc);
+#else
+#define PROFILE_EXECUTION_STEP(OP)
+#endif
+#define PROFILE_DISPATCH(OP) { PROFILE_OPCODE_SEQUENCE(OP) PROFILE_EXECUTION_STEP(OP) }
+// what the sampling profiler needs from calls: where the caller was
+#ifdef PROFILE_SAMPLING
+#define PROFILE_CALL_SITE() global->sampler.call_pc = pc;
+#else
+#define PROFILE_CALL_SITE()
+#endif
+
 #ifdef USE_LOOP_DISPATCH
 #define CALL_NEXT() { }
+#elif defined PROFILE_OPCODE_SEQUENCES || defined PROFILE_EXECUTION
+#define CALL_NEXT() \
+    { uint16_t c = read_op(pc); PROFILE_DISPATCH(c); [[clang::musttail]] return opcode_table.t[c](CALL_ORDER); }
 #elif defined DO_NOT_TRACK_INTERPRETER_PREV_OPCODE
-    //global->accum += 1; 
 #define CALL_NEXT() \
     { uint16_t c = read_op(pc); [[clang::musttail]] return opcode_table.t[c](CALL_ORDER); }
     //{ uint16_t c = read_op(pc); [[clang::musttail]] [[clang::noinline]] return opcode_table.t[c](CALL_ORDER); }
@@ -246,6 +365,53 @@ struct OpTable {
 
 #define DEC_HANDLER(X) OPHANDLER_ABI void X(OPHANDLER_ARGS)
 
+// Most handlers are split into a body, which decodes the operands and does the work, and the handler around it, which
+// steps past the opcode and dispatches to the next one. Superinstructions run several bodies back to back.
+// Bodies of jumps have to come last in a superinstruction, and nothing that calls or returns has a body.
+#define OPBODY_ABI [[gnu::always_inline]] static inline
+#define OPBODY_ARGS [[maybe_unused]] Variable * vars, const uint8_t * & pc, [[maybe_unused]] Interpreter * global
+#define OPBODY_HANDLER(NAME, OPCODE) \
+    OPHANDLER_ABI void op_##NAME(OPHANDLER_ARGS) \
+    { \
+        INC_PC_FOR_OPCODE(OPCODE); \
+        opbody_##NAME(vars, pc, global); \
+        CALL_NEXT(); \
+    }
+
+#ifdef USE_TRACING_JIT
+static const uint8_t * trace_backedge(Interpreter * global, Variable * vars, const uint8_t * backedge_end, const uint8_t * head);
+// Goes in the bodies of jumps that close counted loops, right after they jump. Counts towards tracing the loop, or runs
+// its trace and moves pc to wherever that stopped.
+#define TRACE_BACKEDGE(OFFSET) { if ((OFFSET) < 0) pc = trace_backedge(global, vars, pc - (OFFSET), pc); }
+#else
+#define TRACE_BACKEDGE(OFFSET) { }
+#endif
+
+// Each superinstruction starts with an opcode of the same length as the first opcode in its sequence, and the rest of
+// the sequence stays in the code after it, so it only has to skip over their opcodes. See fuse_superinstructions.
+#define SUPERINSTRUCTION_HANDLER_2(OPCODE, NAME, A, OP_A, B, OP_B) \
+    OPHANDLER_ABI void op_super_##NAME(OPHANDLER_ARGS) \
+    { \
+        INC_PC_FOR_OPCODE(OP_A); \
+        opbody_##A(vars, pc, global); \
+        INC_PC_FOR_OPCODE(OP_B); \
+        opbody_##B(vars, pc, global); \
+        CALL_NEXT(); \
+    }
+#define SUPERINSTRUCTION_HANDLER_3(OPCODE, NAME, A, OP_A, B, OP_B, C, OP_C) \
+    OPHANDLER_ABI void op_super_##NAME(OPHANDLER_ARGS) \
+    { \
+        INC_PC_FOR_OPCODE(OP_A); \
+        opbody_##A(vars, pc, global); \
+        INC_PC_FOR_OPCODE(OP_B); \
+        opbody_##B(vars, pc, global); \
+        INC_PC_FOR_OPCODE(OP_C); \
+        opbody_##C(vars, pc, global); \
+        CALL_NEXT(); \
+    }
+#define DEC_SUPERINSTRUCTION_HANDLER_2(OPCODE, NAME, ...) DEC_HANDLER(op_super_##NAME);
+#define DEC_SUPERINSTRUCTION_HANDLER_3(OPCODE, NAME, ...) DEC_HANDLER(op_super_##NAME);
+
 DEC_HANDLER(op_set);
 DEC_HANDLER(op_add);
 DEC_HANDLER(op_sub);
@@ -264,6 +430,8 @@ DEC_HANDLER(op_modimm);
 
 DEC_HANDLER(op_set_i);
 DEC_HANDLER(op_set_f);
+DEC_HANDLER(op_check_i);
+DEC_HANDLER(op_check_f);
 DEC_HANDLER(op_subimm_i);
 
 DEC_HANDLER(op_div_f);
@@ -282,6 +450,7 @@ DEC_HANDLER(op_decf);
 DEC_HANDLER(op_jincilt);
 DEC_HANDLER(op_jinciltimm);
 DEC_HANDLER(op_jinciltimm_int);
+DEC_HANDLER(op_bulkloop);
 
 DEC_HANDLER(op_bitand);
 DEC_HANDLER(op_bitor);
@@ -374,6 +543,9 @@ DEC_HANDLER(op_fault);
 
 DEC_HANDLER(op_unk);
 
+SUPERINSTRUCTIONS_2(DEC_SUPERINSTRUCTION_HANDLER_2)
+SUPERINSTRUCTIONS_3(DEC_SUPERINSTRUCTION_HANDLER_3)
+
 constexpr OpTable make_opcode_table()
 {
     OpTable table = {};
@@ -386,6 +558,8 @@ constexpr OpTable make_opcode_table()
     _INSERT_OP_FUNC(OP_SET, op_set);
     _INSERT_OP_FUNC(OP_SET_I, op_set_i);
     _INSERT_OP_FUNC(OP_SET_F, op_set_f);
+    _INSERT_OP_FUNC(OP_CHECK_I, op_check_i);
+    _INSERT_OP_FUNC(OP_CHECK_F, op_check_f);
     _INSERT_OP_FUNC(OP_SETIMM, op_setimm);
     _INSERT_OP_FUNC(OP_SETZEROI, op_setzeroi);
     _INSERT_OP_FUNC(OP_ADD, op_add);
@@ -409,21 +583,45 @@ constexpr OpTable make_opcode_table()
     _INSERT_OP_FUNC(OP_DIV_FF, op_div_ff);
     _INSERT_OP_FUNC(OP_DIV_FI, op_div_fi);
     
+    _INSERT_OP_FUNC(OP_CMPE, op_cmpe);
+    _INSERT_OP_FUNC(OP_CMPNE, op_cmpne);
+    _INSERT_OP_FUNC(OP_CMPGT, op_cmpgt);
+    _INSERT_OP_FUNC(OP_CMPLT, op_cmplt);
+    _INSERT_OP_FUNC(OP_CMPGTE, op_cmpgte);
+    _INSERT_OP_FUNC(OP_CMPLTE, op_cmplte);
+    
     _INSERT_OP_FUNC(OP_RETURNVAL, op_returnval);
     _INSERT_OP_FUNC(OP_RETURNIMM, op_returnimm);
     
+    _INSERT_OP_FUNC(OP_CALL, op_call);
+    _INSERT_OP_FUNC(OP_CALL_INDIRECT, op_call_indirect);
+    _INSERT_OP_FUNC(OP_CALLDISCARD, op_calldiscard);
+    _INSERT_OP_FUNC(OP_CALLD_INDIRECT, op_calld_indirect);
+    _INSERT_OP_FUNC(OP_BECOME, op_become);
+    _INSERT_OP_FUNC(OP_BECOME_INDIRECT, op_become_indirect);
+    
     _INSERT_OP_FUNC(OP_J, op_j);
+    _INSERT_OP_FUNC(OP_JIF, op_jif);
+    _INSERT_OP_FUNC(OP_JIFNOT, op_jifnot);
+    _INSERT_OP_FUNC(OP_JCMP, op_jcmp);
+    _INSERT_OP_FUNC(OP_JCMPIMM, op_jcmpimm);
     _INSERT_OP_FUNC(OP_JILTIMM, op_jiltimm);
     
     _INSERT_OP_FUNC(OP_INCI, op_inci);
+    _INSERT_OP_FUNC(OP_INCI_INT, op_inci_int);
     _INSERT_OP_FUNC(OP_DECI, op_deci);
     _INSERT_OP_FUNC(OP_DECI_INT, op_deci_int);
     _INSERT_OP_FUNC(OP_JINCILTIMM, op_jinciltimm);
     _INSERT_OP_FUNC(OP_JINCILTIMM_INT, op_jinciltimm_int);
     _INSERT_OP_FUNC(OP_JINCILT, op_jincilt);
+    _INSERT_OP_FUNC(OP_BULKLOOP, op_bulkloop);
     _INSERT_OP_FUNC(OP_NEGATE, op_negate);
     _INSERT_OP_FUNC(OP_NEGATE_F, op_negate_f);
     
+    #define _INSERT_SUPERINSTRUCTION(OPCODE, NAME, ...) _INSERT_OP_FUNC(OPCODE, op_super_##NAME);
+    SUPERINSTRUCTIONS_2(_INSERT_SUPERINSTRUCTION)
+    SUPERINSTRUCTIONS_3(_INSERT_SUPERINSTRUCTION)
+
 #ifndef OPCODES_ALWAYS_16BIT
     for (uint16_t n = 0; n < 256; n++)
     {
@@ -442,25 +640,161 @@ constexpr OpTable make_opcode_table()
 
 constexpr OpTable opcode_table = make_opcode_table();
 
+#define INTERPRETER_STACK_INITIAL_SIZE 1024 // var-regs preallocated for the register stack
+#define INTERPRETER_MAX_CALL_DEPTH 50000 // nested (non-tail) calls recurse on the native stack, so they have to be limited
+#define INTERPRETER_NATIVE_STACK_MARGIN (256 * 1024) // ...and also stop this far short of the native stack's rlimit
+
+#include "profile.hpp"
+
+#ifdef PROFILE_OPCODE_SEQUENCES
+// Counts of opcode pairs and triples that ran back to back, for picking superinstructions.
+struct OpcodeProfile {
+    static constexpr size_t MAX_OPCODES = 128; // distinct opcodes; any past this many get counted as the last one
+    uint8_t ids[1<<INTERPRETER_OPCODE_TABLE_BITS] = {}; // 0 means not seen yet
+    uint16_t opcodes[MAX_OPCODES] = {};
+    size_t opcode_count = 1;
+    uint64_t * pairs = (uint64_t *)calloc(MAX_OPCODES * MAX_OPCODES, sizeof(uint64_t));
+    uint64_t * triples = (uint64_t *)calloc(MAX_OPCODES * MAX_OPCODES * MAX_OPCODES, sizeof(uint64_t));
+    size_t prev = 0;
+    size_t prev_prev = 0;
+    
+    OpcodeProfile() { }
+    OpcodeProfile(const OpcodeProfile &) = delete;
+    OpcodeProfile & operator=(const OpcodeProfile &) = delete;
+    ~OpcodeProfile()
+    {
+        free(pairs);
+        free(triples);
+    }
+    
+    void record(uint16_t op)
+    {
+        if ((op & 0xFF) >= 0x80)
+            op &= 0xFF;
+        size_t id = ids[op];
+        if (id == 0)
+        {
+            id = opcode_count < MAX_OPCODES ? opcode_count++ : MAX_OPCODES - 1;
+            ids[op] = id;
+            opcodes[id] = op;
+        }
+        if (prev)
+            pairs[prev * MAX_OPCODES + id] += 1;
+        if (prev_prev)
+            triples[(prev_prev * MAX_OPCODES + prev) * MAX_OPCODES + id] += 1;
+        prev_prev = prev;
+        prev = id;
+    }
+    
+    // Appends "pair A B count" and "triple A B C count" lines (opcodes in hex), so runs over a corpus can share a file.
+    void dump(const char * path)
+    {
+        auto f = fopen(path, "ab");
+        if (!f)
+            return (void)printf("warning: couldn't write opcode profile %s\n", path);
+        for (size_t a = 1; a < opcode_count; a++)
+        {
+            for (size_t b = 1; b < opcode_count; b++)
+            {
+                if (pairs[a * MAX_OPCODES + b])
+                    fprintf(f, "pair %04X %04X %zu\n", opcodes[a], opcodes[b], (size_t)pairs[a * MAX_OPCODES + b]);
+                for (size_t c = 1; c < opcode_count; c++)
+                {
+                    uint64_t n = triples[(a * MAX_OPCODES + b) * MAX_OPCODES + c];
+                    if (n)
+                        fprintf(f, "triple %04X %04X %04X %zu\n", opcodes[a], opcodes[b], opcodes[c], (size_t)n);
+                }
+            }
+        }
+        fclose(f);
+    }
+};
+#endif
+
+#ifdef USE_TRACING_JIT
+constexpr size_t TRACE_SLOT_COUNT = 256;
+// Machine code for one loop; returns where the interpreter picks up again.
+typedef const uint8_t * (*TraceCode)(Variable * vars);
+// Hot loop counter and compiled trace for one loop, found by hashing the address of the jump that closes the loop.
+// Loops that hash to the same slot take it from each other.
+struct TraceSlot {
+    const uint8_t * backedge_end = nullptr;
+    uint16_t count = 0;
+    uint16_t failures = 0; // recordings that didn't give a trace
+    uint16_t bails = 0; // entries in a row that the trace's kind checks turned back
+    TraceCode trace = nullptr; // lives in Interpreter::trace_code
+};
+#endif
+
 struct Interpreter {
     Vec<Shared<Function>> funcs;
-    Vec<Variable> vars;
-    ListMap<String, size_t> func_names;
-    ListMap<String, size_t> var_names;
-    
-#ifndef USE_LOOP_DISPATCH
-    Variable retval; // return value trampoline
+    // Register stack. The vars of each active call are a window into it, starting at the caller's argument registers.
+    // Handlers hold raw pointers into it, so anything that can grow it has to re-derive them afterwards.
+    Vec<Variable> stack;
+    HashMap<String, size_t> func_names;
+    HashMap<String, size_t> var_names;
+    Shared<CodeMapping> mapping; // keeps cached code alive
+#ifdef USE_JIT
+    Shared<CodeMapping> jit_code; // machine code for funcs
+#endif
+#ifdef USE_TRACING_JIT
+    TraceSlot trace_slots[TRACE_SLOT_COUNT];
+    Vec<Shared<CodeMapping>> trace_code; // every trace made so far, including ones whose slot was taken over
+    bool trace_recording = false;
 #endif
+    Heap heap;
+    size_t stack_live = 0; // stack slots that active calls can see; the heap's roots
+    
+    Variable retval; // return value trampoline. Never live across a call, so it isn't a heap root
+    size_t call_depth = 0;
+    // nested calls stop before the native stack gets below this, since how much of it each one takes depends on the
+    // build (JIT code and its helpers take more than the interpreter); 0 if the stack isn't limited
+    uintptr_t native_stack_limit = 0;
     
 #ifndef DO_NOT_TRACK_INTERPRETER_PREV_OPCODE
     uint16_t prev_inst;
 #endif
-    
-    size_t accum = 0;
+#ifdef PROFILE_OPCODE_SEQUENCES
+    OpcodeProfile opcode_profile;
+#endif
+#ifdef PROFILE_EXECUTION
+    ExecutionProfile execution_profile;
+#endif
+#ifdef PROFILE_SAMPLING
+    SamplingProfiler sampler;
+#endif
     
     Interpreter(Global info);
+    Interpreter(const Interpreter &) = delete;
+    ~Interpreter()
+    {
+    #ifdef USE_JIT
+        for (auto & func : funcs)
+            func->jit_entry = nullptr;
+    #endif
+        if (active_heap == &heap)
+            active_heap = nullptr;
+    }
     Variable call_func(Shared<Function> func, Vec<Variable> args);
     Variable call_func_by_name(String funcname, Vec<Variable> args);
+    
+    // returns the start of the register stack, which moves if it has to grow
+    Variable * reserve_stack(size_t needed)
+    {
+        if (needed > stack.size()) [[unlikely]]
+            grow_stack(needed);
+        return stack.data();
+    }
+    [[gnu::noinline]] void grow_stack(size_t needed)
+    {
+        size_t new_size = stack.size() ? stack.size() : INTERPRETER_STACK_INITIAL_SIZE;
+        while (new_size < needed)
+            new_size *= 2;
+        stack.reserve(new_size);
+        while (stack.size() < new_size)
+            stack.push_back(Variable());
+    }
+    [[gnu::noinline]] void reconcile_heap() { heap.reconcile(stack.data(), stack_live); }
 };
 
 
@@ -485,20 +819,28 @@ Variable read_immediate(const uint8_t * & pc)
 {
     auto c = *pc;
     pc++;
-    auto ret = Variable::of_type(c);
     //printf("made var with type %d\n", c);
     switch (c)
     {
     case TYPEID_NULL:
-        return ret;
+        return Variable();
     case TYPEID_INT:
-        memcpy(&ret.data.integer, pc, 8);
+    {
+        int64_t n;
+        memcpy(&n, pc, 8);
         pc += 8;
-        return ret;
+        return Variable::of_int(n);
+    }
+    case TYPEID_BOOL:
+        pc += 1;
+        return Variable::of_bool(pc[-1]);
     case TYPEID_FLOAT:
-        memcpy(&ret.data.real, pc, 8);
+    {
+        double n;
+        memcpy(&n, pc, 8);
         pc += 8;
-        return ret;
+        return Variable::of_float(n);
+    }
     default:
         ASSERT_THROW(((void)"TODO other immediates interpreter", 0));
     }
@@ -579,519 +921,620 @@ static inline uint64_t read_u64(const uint8_t * & pc)
     return ret;
 }
 
-OPHANDLER_ABI void op_j(OPHANDLER_ARGS)
+OPBODY_ABI void opbody_j(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_J);
-    {
-        int32_t offset = read_u32(pc);
-        pc += offset;
-    }
-    CALL_NEXT();
+    int32_t offset = read_u32(pc);
+    pc += offset;
 }
+OPBODY_HANDLER(j, OP_J)
 
-OPHANDLER_ABI void op_jiltimm(OPHANDLER_ARGS)
+static inline bool var_is_truthy(const Variable & var)
 {
-    INC_PC_FOR_OPCODE(OP_JILTIMM);
+    switch (var.kind())
     {
-        auto index = read_varlen_int(pc);
-        int64_t imm = read_u64(pc);
-        int32_t offset = read_u32(pc);
-        
-        ASSERT_THROW(vars[index].kind == TYPEID_INT);
-        
-        if (vars[index].data.integer < imm)
-            pc += offset;
+    case TYPEID_NULL:
+        return false;
+    case TYPEID_INT:
+        return var.get_int() != 0;
+    case TYPEID_BOOL:
+        return var.get_bool() != 0;
+    case TYPEID_FLOAT:
+        return var.get_float() != 0.0;
+    default:
+        return true;
     }
-    CALL_NEXT();
 }
 
-OPHANDLER_ABI void op_inci(OPHANDLER_ARGS)
+// Returns -1, 0 or 1 like strcmp, or 2 if the values are unordered (NaNs, or kinds that can't be compared).
+static inline int compare_vars(const Variable & a, const Variable & b)
 {
-    INC_PC_FOR_OPCODE(OP_INCI);
+    if (a.kind() == TYPEID_INT && b.kind() == TYPEID_INT) [[likely]]
+        return (a.get_int() > b.get_int()) - (a.get_int() < b.get_int());
+    if ((a.kind() == TYPEID_INT || a.kind() == TYPEID_FLOAT) && (b.kind() == TYPEID_INT || b.kind() == TYPEID_FLOAT))
     {
-        auto index = read_varlen_int(pc);
-        ASSERT_THROW(vars[index].kind == TYPEID_INT);
-        vars[index].data.integer += 1;
+        double x = a.kind() == TYPEID_INT ? double(a.get_int()) : a.get_float();
+        double y = b.kind() == TYPEID_INT ? double(b.get_int()) : b.get_float();
+        if (x < y)
+            return -1;
+        if (x > y)
+            return 1;
+        if (x == y)
+            return 0;
+        return 2;
     }
-    CALL_NEXT();
+    if (a.kind() == TYPEID_BOOL && b.kind() == TYPEID_BOOL)
+        return (a.get_bool() > b.get_bool()) - (a.get_bool() < b.get_bool());
+    if (a.kind() == TYPEID_NULL && b.kind() == TYPEID_NULL)
+        return 0;
+    return 2;
 }
-OPHANDLER_ABI void op_deci(OPHANDLER_ARGS)
+
+// `info` is one of the OPINFO_CMP... values, optionally with OPINFO_NEGATE set
+static inline bool compare_holds(uint8_t info, int c)
 {
-    INC_PC_FOR_OPCODE(OP_DECI);
+    bool ret = false;
+    switch (info & ~OPINFO_NEGATE)
     {
-        auto index = read_varlen_int(pc);
-        ASSERT_THROW(vars[index].kind == TYPEID_INT);
-        vars[index].data.integer -= 1;
+    case OPINFO_CMPE:
+        ret = c == 0;
+        break;
+    case OPINFO_CMPNE:
+        ret = c != 0;
+        break;
+    case OPINFO_CMPGT:
+        ret = c == 1;
+        break;
+    case OPINFO_CMPLT:
+        ret = c == -1;
+        break;
+    case OPINFO_CMPGTE:
+        ret = c == 1 || c == 0;
+        break;
+    case OPINFO_CMPLTE:
+        ret = c == -1 || c == 0;
+        break;
+    default:
+        ASSERT_THROW(((void)"unknown comparison kind", 0));
     }
-    CALL_NEXT();
+    return (info & OPINFO_NEGATE) ? !ret : ret;
 }
-OPHANDLER_ABI void op_deci_int(OPHANDLER_ARGS)
+
+OPBODY_ABI void opbody_jif(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_DECI_INT);
-    {
-        auto index = read_varlen_int(pc);
-        vars[index].data.integer -= 1;
-    }
-    CALL_NEXT();
+    auto index = read_varlen_int(pc);
+    int32_t offset = read_u32(pc);
+    if (var_is_truthy(vars[index]))
+        pc += offset;
+}
+OPBODY_HANDLER(jif, OP_JIF)
+OPBODY_ABI void opbody_jifnot(OPBODY_ARGS)
+{
+    auto index = read_varlen_int(pc);
+    int32_t offset = read_u32(pc);
+    if (!var_is_truthy(vars[index]))
+        pc += offset;
+}
+OPBODY_HANDLER(jifnot, OP_JIFNOT)
+
+OPBODY_ABI void opbody_jcmp(OPBODY_ARGS)
+{
+    auto i_in1 = read_varlen_int(pc);
+    auto i_in2 = read_varlen_int(pc);
+    auto info = read_u8(pc);
+    int32_t offset = read_u32(pc);
+    if (compare_holds(info, compare_vars(vars[i_in1], vars[i_in2])))
+        pc += offset;
+}
+OPBODY_HANDLER(jcmp, OP_JCMP)
+OPBODY_ABI void opbody_jcmpimm(OPBODY_ARGS)
+{
+    auto index = read_varlen_int(pc);
+    auto imm = read_immediate(pc);
+    auto info = read_u8(pc);
+    int32_t offset = read_u32(pc);
+    if (compare_holds(info, compare_vars(vars[index], imm)))
+        pc += offset;
+}
+OPBODY_HANDLER(jcmpimm, OP_JCMPIMM)
+
+OPBODY_ABI void opbody_jiltimm(OPBODY_ARGS)
+{
+    auto index = read_varlen_int(pc);
+    int64_t imm = read_u64(pc);
+    int32_t offset = read_u32(pc);
+    
+    ASSERT_THROW(vars[index].kind() == TYPEID_INT);
+    
+    if (vars[index].get_int() < imm)
+        pc += offset;
+}
+OPBODY_HANDLER(jiltimm, OP_JILTIMM)
+
+OPBODY_ABI void opbody_inci(OPBODY_ARGS)
+{
+    auto index = read_varlen_int(pc);
+    ASSERT_THROW(vars[index].kind() == TYPEID_INT);
+    vars[index].set_int(vars[index].get_int() + 1);
+}
+OPBODY_HANDLER(inci, OP_INCI)
+OPBODY_ABI void opbody_inci_int(OPBODY_ARGS)
+{
+    auto index = read_varlen_int(pc);
+    vars[index].set_int(vars[index].get_int() + 1);
+}
+OPBODY_HANDLER(inci_int, OP_INCI_INT)
+OPBODY_ABI void opbody_deci(OPBODY_ARGS)
+{
+    auto index = read_varlen_int(pc);
+    ASSERT_THROW(vars[index].kind() == TYPEID_INT);
+    vars[index].set_int(vars[index].get_int() - 1);
+}
+OPBODY_HANDLER(deci, OP_DECI)
+OPBODY_ABI void opbody_deci_int(OPBODY_ARGS)
+{
+    auto index = read_varlen_int(pc);
+    vars[index].set_int(vars[index].get_int() - 1);
 }
+OPBODY_HANDLER(deci_int, OP_DECI_INT)
 
-OPHANDLER_ABI void op_jinciltimm(OPHANDLER_ARGS)
+OPBODY_ABI void opbody_jinciltimm(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_JINCILTIMM);
+    auto index = read_varlen_int(pc);
+    
+    #ifdef USE_EXTRA_ASSERTS
+    ASSERT_THROW(vars[index].kind() == TYPEID_INT);
+    #endif
+    
+    int64_t imm = read_u64(pc);
+    
+    int64_t n = vars[index].get_int() + 1;
+    vars[index].set_int(n);
+    if (n < imm)
     {
-        auto index = read_varlen_int(pc);
-        
-        #ifdef USE_EXTRA_ASSERTS
-        ASSERT_THROW(vars[index].kind == TYPEID_INT);
-        #endif
-        
-        int64_t imm = read_u64(pc);
-        
-        if (vars[index].data.integer + 1 < imm)
-        {
-            int32_t offset = read_u32(pc);
-            pc += offset;
-        }
-        else
-            pc += 4;
-        vars[index].data.integer += 1;
+        int32_t offset = read_u32(pc);
+        pc += offset;
+        TRACE_BACKEDGE(offset);
     }
-    CALL_NEXT();
+    else
+        pc += 4;
 }
-OPHANDLER_ABI void op_jinciltimm_int(OPHANDLER_ARGS)
+OPBODY_HANDLER(jinciltimm, OP_JINCILTIMM)
+OPBODY_ABI void opbody_jinciltimm_int(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_JINCILTIMM_INT);
+    auto index = read_varlen_int(pc);
+    int64_t imm = read_u64(pc);
+    
+    int64_t n = vars[index].get_int() + 1;
+    vars[index].set_int(n);
+    if (n < imm)
     {
-        auto index = read_varlen_int(pc);
-        int64_t imm = read_u64(pc);
-        
-        if (vars[index].data.integer + 1 < imm)
-        {
-            int32_t offset = read_u32(pc);
-            pc += offset;
-        }
-        else
-            pc += 4;
-        vars[index].data.integer += 1;
+        int32_t offset = read_u32(pc);
+        pc += offset;
+        TRACE_BACKEDGE(offset);
     }
-    CALL_NEXT();
+    else
+        pc += 4;
 }
-OPHANDLER_ABI void op_jincilt(OPHANDLER_ARGS)
+OPBODY_HANDLER(jinciltimm_int, OP_JINCILTIMM_INT)
+OPBODY_ABI void opbody_jincilt(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_JINCILT);
+    auto index = read_varlen_int(pc);
+    auto i_index = read_varlen_int(pc);
+    int32_t offset = read_u32(pc);
+    //int16_t offset = read_u16(pc);
+    
+    #ifdef USE_EXTRA_ASSERTS
+    ASSERT_THROW(vars[index].kind() == TYPEID_INT && vars[i_index].kind() == TYPEID_INT);
+    #endif
+    vars[index].set_int(vars[index].get_int() + 1);
+    
+    if (vars[index].get_int() < vars[i_index].get_int())
     {
-        auto index = read_varlen_int(pc);
-        auto i_index = read_varlen_int(pc);
-        int32_t offset = read_u32(pc);
-        //int16_t offset = read_u16(pc);
-        
-        #ifdef USE_EXTRA_ASSERTS
-        ASSERT_THROW(vars[index].kind == TYPEID_INT && vars[i_index].kind == TYPEID_INT);
-        #endif
-        vars[index].data.integer += 1;
-        
-        if (vars[index].data.integer < vars[i_index].data.integer)
-            pc += offset;
+        pc += offset;
+        TRACE_BACKEDGE(offset);
     }
-    CALL_NEXT();
 }
+OPBODY_HANDLER(jincilt, OP_JINCILT)
 
-OPHANDLER_ABI void op_negate(OPHANDLER_ARGS)
+// Does the rest of the loop after an OP_BULKLOOP at once, if its operands have the types the kernel was made for and
+// there are enough iterations left to be worth it. See bulk_loop.hpp.
+[[gnu::noinline]] static void run_bulk_loop(Variable * vars, const size_t * indexes, const uint8_t * kernel_bytes)
 {
-    INC_PC_FOR_OPCODE(OP_NEGATE);
+    BulkKernel kernel;
+    bulk_decode(kernel_bytes, kernel);
+    uint64_t values[BULK_MAX_OPERANDS];
+    for (size_t o = 0; o < kernel.operand_count; o++)
     {
-        auto index = read_varlen_int(pc);
-        auto & var = vars[index];
-        switch (var.kind)
+        auto & var = vars[indexes[o]];
+        if (var.kind() != kernel.operands[o].type)
+            return;
+        if (var.kind() == TYPEID_INT)
+            values[o] = var.get_int();
+        else
         {
-        case TYPEID_INT:
-            var.data.integer = -var.data.integer;
-            break;
-        case TYPEID_FLOAT:
-            var.data.real = -var.data.real;
-            break;
-        default:
-            ASSERT_THROW(((void)"unknown type pair for + operator", 0));
+            double n = var.get_float();
+            memcpy(&values[o], &n, 8);
         }
     }
-    CALL_NEXT();
+    int64_t limit = kernel.limit_operand == BULK_NONE ? kernel.limit : int64_t(values[kernel.limit_operand]);
+    int64_t left;
+    if (__builtin_sub_overflow(limit, int64_t(values[kernel.counter]), &left) || left <= BULK_MIN_ITERATIONS)
+        return;
+    // the counter goes up before the test, so it's at limit - 1 when the last iteration starts
+    bulk_run(kernel, values, left - 1);
+    for (size_t o = 0; o < kernel.operand_count; o++)
+    {
+        if (kernel.operands[o].role == BULK_INVARIANT)
+            continue;
+        auto & var = vars[indexes[o]];
+        if (kernel.operands[o].type == TYPEID_INT)
+            var.set_int(values[o]);
+        else
+        {
+            double n;
+            memcpy(&n, &values[o], 8);
+            var.set_float(n);
+        }
+    }
+}
+OPBODY_ABI void opbody_bulkloop(OPBODY_ARGS)
+{
+    size_t indexes[BULK_MAX_OPERANDS];
+    for (auto & index : indexes)
+        index = read_varlen_int(pc);
+    run_bulk_loop(vars, indexes, pc);
+    auto kernel_size = read_u16(pc);
+    pc += kernel_size;
 }
+OPBODY_HANDLER(bulkloop, OP_BULKLOOP)
 
-OPHANDLER_ABI void op_negate_f(OPHANDLER_ARGS)
+OPBODY_ABI void opbody_negate(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_NEGATE_F);
+    auto index = read_varlen_int(pc);
+    auto & var = vars[index];
+    switch (var.kind())
     {
-        auto index = read_varlen_int(pc);
-        auto & var = vars[index];
-        var.data.real = -var.data.real;
+    case TYPEID_INT:
+        var.set_int(-var.get_int());
+        break;
+    case TYPEID_FLOAT:
+        var.set_float(-var.get_float());
+        break;
+    default:
+        ASSERT_THROW(((void)"unknown type pair for + operator", 0));
     }
-    CALL_NEXT();
 }
+OPBODY_HANDLER(negate, OP_NEGATE)
 
-OPHANDLER_ABI void op_setimm(OPHANDLER_ARGS)
+OPBODY_ABI void opbody_negate_f(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_SETIMM);
-    {
-        auto index = read_varlen_int(pc);
-        auto var = read_immediate(pc);
-        //printf("wrote var to %d\n", index);
-        vars[index] = var;
-    }
-    CALL_NEXT();
+    auto index = read_varlen_int(pc);
+    auto & var = vars[index];
+    var.set_float(-var.get_float());
 }
-OPHANDLER_ABI void op_set(OPHANDLER_ARGS)
+OPBODY_HANDLER(negate_f, OP_NEGATE_F)
+
+OPBODY_ABI void opbody_setimm(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_SET);
-    {
-        auto index = read_varlen_int(pc);
-        auto varindex = read_varlen_int(pc);
-        vars[index] = vars[varindex];
-    }
-    CALL_NEXT();
+    auto index = read_varlen_int(pc);
+    auto var = read_immediate(pc);
+    //printf("wrote var to %d\n", index);
+    vars[index] = var;
+}
+OPBODY_HANDLER(setimm, OP_SETIMM)
+OPBODY_ABI void opbody_set(OPBODY_ARGS)
+{
+    auto index = read_varlen_int(pc);
+    auto varindex = read_varlen_int(pc);
+    vars[index] = vars[varindex];
 }
+OPBODY_HANDLER(set, OP_SET)
 
-OPHANDLER_ABI void op_set_i(OPHANDLER_ARGS)
+OPBODY_ABI void opbody_set_i(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_SET_I);
-    {
-        auto index = read_varlen_int(pc);
-        auto varindex = read_varlen_int(pc);
-        ASSERT_THROW(((void)"tried to assign non-int to int variable/register", vars[varindex].kind == TYPEID_INT));
-        vars[index].kind = TYPEID_INT;
-        vars[index].data.integer = vars[varindex].data.integer;
-    }
-    CALL_NEXT();
+    auto index = read_varlen_int(pc);
+    auto varindex = read_varlen_int(pc);
+    ASSERT_THROW(((void)"tried to assign non-int to int variable/register", vars[varindex].kind() == TYPEID_INT));
+    vars[index].set_int(vars[varindex].get_int());
 }
+OPBODY_HANDLER(set_i, OP_SET_I)
 
-OPHANDLER_ABI void op_set_f(OPHANDLER_ARGS)
+OPBODY_ABI void opbody_set_f(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_SET_F);
-    {
-        auto index = read_varlen_int(pc);
-        auto varindex = read_varlen_int(pc);
-        ASSERT_THROW(((void)"tried to assign non-float to float variable/register", vars[varindex].kind == TYPEID_FLOAT));
-        vars[index].kind = TYPEID_FLOAT;
-        vars[index].data.real = vars[varindex].data.real;
-    }
-    CALL_NEXT();
+    auto index = read_varlen_int(pc);
+    auto varindex = read_varlen_int(pc);
+    ASSERT_THROW(((void)"tried to assign non-float to float variable/register", vars[varindex].kind() == TYPEID_FLOAT));
+    vars[index].set_float(vars[varindex].get_float());
 }
+OPBODY_HANDLER(set_f, OP_SET_F)
 
-OPHANDLER_ABI void op_setzeroi(OPHANDLER_ARGS)
+OPBODY_ABI void opbody_check_i(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_SETZEROI);
-    {
-        auto index = read_varlen_int(pc);
-        vars[index] = Variable::of_type(TYPEID_INT);
-        vars[index].data.integer = 0;
-    }
-    CALL_NEXT();
+    auto index = read_varlen_int(pc);
+    ASSERT_THROW(((void)"tried to assign non-int to variable declared as int", vars[index].kind() == TYPEID_INT));
+}
+OPBODY_HANDLER(check_i, OP_CHECK_I)
+OPBODY_ABI void opbody_check_f(OPBODY_ARGS)
+{
+    auto index = read_varlen_int(pc);
+    if (vars[index].kind() == TYPEID_INT)
+        vars[index].set_float(double(vars[index].get_int()));
+    ASSERT_THROW(((void)"tried to assign non-float to variable declared as float", vars[index].kind() == TYPEID_FLOAT));
 }
+OPBODY_HANDLER(check_f, OP_CHECK_F)
 
-OPHANDLER_ABI void op_add(OPHANDLER_ARGS)
+OPBODY_ABI void opbody_setzeroi(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_ADD);
+    auto index = read_varlen_int(pc);
+    vars[index].set_int(0);
+}
+OPBODY_HANDLER(setzeroi, OP_SETZEROI)
+
+OPBODY_ABI void opbody_add(OPBODY_ARGS)
+{
+    //auto i_out = read_varlen_int(pc);
+    auto i_in1 = read_varlen_int(pc);
+    auto i_in2 = read_varlen_int(pc);
+    //auto & out = vars[i_out];
+    auto & var1 = vars[i_in1];
+    auto & var2 = vars[i_in2];
+    switch (var1.kind())
     {
-        //auto i_out = read_varlen_int(pc);
-        auto i_in1 = read_varlen_int(pc);
-        auto i_in2 = read_varlen_int(pc);
-        //auto & out = vars[i_out];
-        auto & var1 = vars[i_in1];
-        auto & var2 = vars[i_in2];
-        switch (var1.kind)
+    case TYPEID_INT:
+        //out = var1;
+        if (var2.kind() == TYPEID_INT)
+            var1.set_int(var1.get_int() + var2.get_int());
+        else if (var2.kind() == TYPEID_FLOAT)
         {
-        case TYPEID_INT:
-            //out = var1;
-            if (var2.kind == TYPEID_INT)
-                var1.data.integer += var2.data.integer;
-            else if (var2.kind == TYPEID_FLOAT)
-            {
-                var1.kind = TYPEID_FLOAT;
-                var1.data.real = var1.data.integer + var2.data.real;
-            }
-            break;
-        case TYPEID_FLOAT:
-            //out = var1;
-            if (var2.kind == TYPEID_INT)
-                var1.data.real += var2.data.integer;
-            else if (var2.kind == TYPEID_FLOAT)
-                var1.data.real += var2.data.real;
-            break;
-        default:
-            ASSERT_THROW(((void)"unknown type pair for + operator", 0));
+            var1.set_float(var1.get_int() + var2.get_float());
         }
+        break;
+    case TYPEID_FLOAT:
+        //out = var1;
+        if (var2.kind() == TYPEID_INT)
+            var1.set_float(var1.get_float() + var2.get_int());
+        else if (var2.kind() == TYPEID_FLOAT)
+            var1.set_float(var1.get_float() + var2.get_float());
+        break;
+    default:
+        ASSERT_THROW(((void)"unknown type pair for + operator", 0));
     }
-    CALL_NEXT();
 }
-OPHANDLER_ABI void op_add_f(OPHANDLER_ARGS)
+OPBODY_HANDLER(add, OP_ADD)
+OPBODY_ABI void opbody_add_f(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_ADD_F);
-    {
-        auto i_in1 = read_varlen_int(pc);
-        auto i_in2 = read_varlen_int(pc);
-        auto & var1 = vars[i_in1];
-        auto & var2 = vars[i_in2];
-        if (var2.kind == TYPEID_INT)
-            var1.data.real += var2.data.integer;
-        else if (var2.kind == TYPEID_FLOAT)
-            var1.data.real += var2.data.real;
-        else
-            ASSERT_THROW(((void)"unknown type pair for + operator", 0));
-    }
-    CALL_NEXT();
+    auto i_in1 = read_varlen_int(pc);
+    auto i_in2 = read_varlen_int(pc);
+    auto & var1 = vars[i_in1];
+    auto & var2 = vars[i_in2];
+    if (var2.kind() == TYPEID_INT)
+        var1.set_float(var1.get_float() + var2.get_int());
+    else if (var2.kind() == TYPEID_FLOAT)
+        var1.set_float(var1.get_float() + var2.get_float());
+    else
+        ASSERT_THROW(((void)"unknown type pair for + operator", 0));
 }
-OPHANDLER_ABI void op_add_ff(OPHANDLER_ARGS)
+OPBODY_HANDLER(add_f, OP_ADD_F)
+OPBODY_ABI void opbody_add_ff(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_ADD_FF);
-    {
-        auto i_in1 = read_varlen_int(pc);
-        auto i_in2 = read_varlen_int(pc);
-        auto & var1 = vars[i_in1];
-        auto & var2 = vars[i_in2];
-        var1.data.real += var2.data.real;
-    }
-    CALL_NEXT();
+    auto i_in1 = read_varlen_int(pc);
+    auto i_in2 = read_varlen_int(pc);
+    auto & var1 = vars[i_in1];
+    auto & var2 = vars[i_in2];
+    var1.set_float(var1.get_float() + var2.get_float());
 }
-OPHANDLER_ABI void op_addimm(OPHANDLER_ARGS)
+OPBODY_HANDLER(add_ff, OP_ADD_FF)
+OPBODY_ABI void opbody_addimm(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_ADDIMM);
+    //auto i_out = read_varlen_int(pc);
+    auto i_in1 = read_varlen_int(pc);
+    auto var2 = read_immediate(pc);
+    //auto & out = vars[i_out];
+    auto & var1 = vars[i_in1];
+    switch (var1.kind())
     {
-        //auto i_out = read_varlen_int(pc);
-        auto i_in1 = read_varlen_int(pc);
-        auto var2 = read_immediate(pc);
-        //auto & out = vars[i_out];
-        auto & var1 = vars[i_in1];
-        switch (var1.kind)
+    case TYPEID_INT:
+        //out = var1;
+        if (var2.kind() == TYPEID_INT)
+            var1.set_int(var1.get_int() + var2.get_int());
+        else if (var2.kind() == TYPEID_FLOAT)
         {
-        case TYPEID_INT:
-            //out = var1;
-            if (var2.kind == TYPEID_INT)
-                var1.data.integer += var2.data.integer;
-            else if (var2.kind == TYPEID_FLOAT)
-            {
-                var1.kind = TYPEID_FLOAT;
-                var1.data.real = var1.data.integer + var2.data.real;
-            }
-            break;
-        case TYPEID_FLOAT:
-            //out = var1;
-            if (var2.kind == TYPEID_INT)
-                var1.data.real += var2.data.integer;
-            else if (var2.kind == TYPEID_FLOAT)
-                var1.data.real += var2.data.real;
-            break;
-        default:
-            ASSERT_THROW(((void)"unknown type pair for + operator", 0));
+            var1.set_float(var1.get_int() + var2.get_float());
         }
+        break;
+    case TYPEID_FLOAT:
+        //out = var1;
+        if (var2.kind() == TYPEID_INT)
+            var1.set_float(var1.get_float() + var2.get_int());
+        else if (var2.kind() == TYPEID_FLOAT)
+            var1.set_float(var1.get_float() + var2.get_float());
+        break;
+    default:
+        ASSERT_THROW(((void)"unknown type pair for + operator", 0));
     }
-    CALL_NEXT();
 }
+OPBODY_HANDLER(addimm, OP_ADDIMM)
 
-OPHANDLER_ABI void op_sub(OPHANDLER_ARGS)
+OPBODY_ABI void opbody_sub(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_SUB);
+    //auto i_out = read_varlen_int(pc);
+    auto i_in1 = read_varlen_int(pc);
+    auto i_in2 = read_varlen_int(pc);
+    //auto & out = vars[i_out];
+    auto & var1 = vars[i_in1];
+    auto & var2 = vars[i_in2];
+    switch (var1.kind())
     {
-        //auto i_out = read_varlen_int(pc);
-        auto i_in1 = read_varlen_int(pc);
-        auto i_in2 = read_varlen_int(pc);
-        //auto & out = vars[i_out];
-        auto & var1 = vars[i_in1];
-        auto & var2 = vars[i_in2];
-        switch (var1.kind)
+    case TYPEID_INT:
+        //out = var1;
+        if (var2.kind() == TYPEID_INT)
+            var1.set_int(var1.get_int() - var2.get_int());
+        else if (var2.kind() == TYPEID_FLOAT)
         {
-        case TYPEID_INT:
-            //out = var1;
-            if (var2.kind == TYPEID_INT)
-                var1.data.integer -= var2.data.integer;
-            else if (var2.kind == TYPEID_FLOAT)
-            {
-                var1.kind = TYPEID_FLOAT;
-                var1.data.real = var1.data.integer - var2.data.real;
-            }
-            break;
-        case TYPEID_FLOAT:
-            //out = var1;
-            if (var2.kind == TYPEID_INT)
-                var1.data.real -= var2.data.integer;
-            else if (var2.kind == TYPEID_FLOAT)
-                var1.data.real -= var2.data.real;
-            break;
-        default:
-            ASSERT_THROW(((void)"unknown type pair for - operator", 0));
+            var1.set_float(var1.get_int() - var2.get_float());
         }
+        break;
+    case TYPEID_FLOAT:
+        //out = var1;
+        if (var2.kind() == TYPEID_INT)
+            var1.set_float(var1.get_float() - var2.get_int());
+        else if (var2.kind() == TYPEID_FLOAT)
+            var1.set_float(var1.get_float() - var2.get_float());
+        break;
+    default:
+        ASSERT_THROW(((void)"unknown type pair for - operator", 0));
     }
-    CALL_NEXT();
 }
-OPHANDLER_ABI void op_subimm(OPHANDLER_ARGS)
+OPBODY_HANDLER(sub, OP_SUB)
+OPBODY_ABI void opbody_subimm(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_SUBIMM);
+    //auto i_out = read_varlen_int(pc);
+    auto i_in1 = read_varlen_int(pc);
+    auto var2 = read_immediate(pc);
+    //auto & out = vars[i_out];
+    auto & var1 = vars[i_in1];
+    switch (var1.kind())
     {
-        //auto i_out = read_varlen_int(pc);
-        auto i_in1 = read_varlen_int(pc);
-        auto var2 = read_immediate(pc);
-        //auto & out = vars[i_out];
-        auto & var1 = vars[i_in1];
-        switch (var1.kind)
+    case TYPEID_INT:
+        //out = var1;
+        if (var2.kind() == TYPEID_INT)
+            var1.set_int(var1.get_int() - var2.get_int());
+        else if (var2.kind() == TYPEID_FLOAT)
         {
-        case TYPEID_INT:
-            //out = var1;
-            if (var2.kind == TYPEID_INT)
-                var1.data.integer -= var2.data.integer;
-            else if (var2.kind == TYPEID_FLOAT)
-            {
-                var1.kind = TYPEID_FLOAT;
-                var1.data.real = var1.data.integer - var2.data.real;
-            }
-            break;
-        case TYPEID_FLOAT:
-            //out = var1;
-            if (var2.kind == TYPEID_INT)
-                var1.data.real -= var2.data.integer;
-            else if (var2.kind == TYPEID_FLOAT)
-                var1.data.real -= var2.data.real;
-            break;
-        default:
-            ASSERT_THROW(((void)"unknown type pair for - operator", 0));
+            var1.set_float(var1.get_int() - var2.get_float());
         }
+        break;
+    case TYPEID_FLOAT:
+        //out = var1;
+        if (var2.kind() == TYPEID_INT)
+            var1.set_float(var1.get_float() - var2.get_int());
+        else if (var2.kind() == TYPEID_FLOAT)
+            var1.set_float(var1.get_float() - var2.get_float());
+        break;
+    default:
+        ASSERT_THROW(((void)"unknown type pair for - operator", 0));
     }
-    CALL_NEXT();
 }
+OPBODY_HANDLER(subimm, OP_SUBIMM)
 
-OPHANDLER_ABI void op_subimm_i(OPHANDLER_ARGS)
+OPBODY_ABI void opbody_subimm_i(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_SUBIMM_I);
-    {
-        auto i_in1 = read_varlen_int(pc);
-        auto var2 = read_immediate(pc);
-        auto & var1 = vars[i_in1];
-        if (var2.kind == TYPEID_INT)
-            var1.data.integer -= var2.data.integer;
-        else if (var2.kind == TYPEID_FLOAT)
-            var1.data.integer = var1.data.integer - var2.data.real;
-        else
-            ASSERT_THROW(((void)"unknown type pair for - operator", 0));
-    }
-    CALL_NEXT();
+    auto i_in1 = read_varlen_int(pc);
+    auto var2 = read_immediate(pc);
+    auto & var1 = vars[i_in1];
+    if (var2.kind() == TYPEID_INT)
+        var1.set_int(var1.get_int() - var2.get_int());
+    else if (var2.kind() == TYPEID_FLOAT)
+        var1.set_int(int64_t(var1.get_int() - var2.get_float()));
+    else
+        ASSERT_THROW(((void)"unknown type pair for - operator", 0));
 }
+OPBODY_HANDLER(subimm_i, OP_SUBIMM_I)
 
 
-OPHANDLER_ABI void op_mul(OPHANDLER_ARGS)
+OPBODY_ABI void opbody_mul(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_MUL);
+    //auto i_out = read_varlen_int(pc);
+    auto i_in1 = read_varlen_int(pc);
+    auto i_in2 = read_varlen_int(pc);
+    //auto & out = vars[i_out];
+    auto & var1 = vars[i_in1];
+    auto & var2 = vars[i_in2];
+    switch (var1.kind())
     {
-        //auto i_out = read_varlen_int(pc);
-        auto i_in1 = read_varlen_int(pc);
-        auto i_in2 = read_varlen_int(pc);
-        //auto & out = vars[i_out];
-        auto & var1 = vars[i_in1];
-        auto & var2 = vars[i_in2];
-        switch (var1.kind)
+    case TYPEID_INT:
+        //out = var1;
+        if (var2.kind() == TYPEID_INT)
+            var1.set_int(var1.get_int() * var2.get_int());
+        else if (var2.kind() == TYPEID_FLOAT)
         {
-        case TYPEID_INT:
-            //out = var1;
-            if (var2.kind == TYPEID_INT)
-                var1.data.integer *= var2.data.integer;
-            else if (var2.kind == TYPEID_FLOAT)
-            {
-                var1.kind = TYPEID_FLOAT;
-                var1.data.real = var1.data.integer * var2.data.real;
-            }
-            break;
-        case TYPEID_FLOAT:
-            //out = var1;
-            if (var2.kind == TYPEID_INT)
-                var1.data.real *= var2.data.integer;
-            else if (var2.kind == TYPEID_FLOAT)
-                var1.data.real *= var2.data.real;
-            break;
-        default:
-            ASSERT_THROW(((void)"unknown type pair for * operator", 0));
+            var1.set_float(var1.get_int() * var2.get_float());
         }
+        break;
+    case TYPEID_FLOAT:
+        //out = var1;
+        if (var2.kind() == TYPEID_INT)
+            var1.set_float(var1.get_float() * var2.get_int());
+        else if (var2.kind() == TYPEID_FLOAT)
+            var1.set_float(var1.get_float() * var2.get_float());
+        break;
+    default:
+        ASSERT_THROW(((void)"unknown type pair for * operator", 0));
     }
-    CALL_NEXT();
 }
-OPHANDLER_ABI void op_mulimm(OPHANDLER_ARGS)
+OPBODY_HANDLER(mul, OP_MUL)
+OPBODY_ABI void opbody_mulimm(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_MULIMM);
+    //auto i_out = read_varlen_int(pc);
+    auto i_in1 = read_varlen_int(pc);
+    auto var2 = read_immediate(pc);
+    //auto & out = vars[i_out];
+    auto & var1 = vars[i_in1];
+    switch (var1.kind())
     {
-        //auto i_out = read_varlen_int(pc);
-        auto i_in1 = read_varlen_int(pc);
-        auto var2 = read_immediate(pc);
-        //auto & out = vars[i_out];
-        auto & var1 = vars[i_in1];
-        switch (var1.kind)
+    case TYPEID_INT:
+        //out = var1;
+        if (var2.kind() == TYPEID_INT)
+            var1.set_int(var1.get_int() * var2.get_int());
+        else if (var2.kind() == TYPEID_FLOAT)
         {
-        case TYPEID_INT:
-            //out = var1;
-            if (var2.kind == TYPEID_INT)
-                var1.data.integer *= var2.data.integer;
-            else if (var2.kind == TYPEID_FLOAT)
-            {
-                var1.kind = TYPEID_FLOAT;
-                var1.data.real = var1.data.integer * var2.data.real;
-            }
-            break;
-        case TYPEID_FLOAT:
-            //out = var1;
-            if (var2.kind == TYPEID_INT)
-                var1.data.real *= var2.data.integer;
-            else if (var2.kind == TYPEID_FLOAT)
-                var1.data.real *= var2.data.real;
-            break;
-        default:
-            ASSERT_THROW(((void)"unknown type pair for * operator", 0));
+            var1.set_float(var1.get_int() * var2.get_float());
         }
+        break;
+    case TYPEID_FLOAT:
+        //out = var1;
+        if (var2.kind() == TYPEID_INT)
+            var1.set_float(var1.get_float() * var2.get_int());
+        else if (var2.kind() == TYPEID_FLOAT)
+            var1.set_float(var1.get_float() * var2.get_float());
+        break;
+    default:
+        ASSERT_THROW(((void)"unknown type pair for * operator", 0));
     }
-    CALL_NEXT();
 }
+OPBODY_HANDLER(mulimm, OP_MULIMM)
 
-OPHANDLER_ABI void op_div(OPHANDLER_ARGS)
+OPBODY_ABI void opbody_div(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_DIV);
+    auto i_in1 = read_varlen_int(pc);
+    auto i_in2 = read_varlen_int(pc);
+    auto & var1 = vars[i_in1];
+    auto & var2 = vars[i_in2];
+    if (var1.kind() == TYPEID_INT && var2.kind() == TYPEID_INT)
+        var1.set_int(var1.get_int() / var2.get_int());
+    else if (var1.kind() == TYPEID_INT && var2.kind() == TYPEID_FLOAT)
     {
-        auto i_in1 = read_varlen_int(pc);
-        auto i_in2 = read_varlen_int(pc);
-        auto & var1 = vars[i_in1];
-        auto & var2 = vars[i_in2];
-        if (var1.kind == TYPEID_INT && var2.kind == TYPEID_INT)
-            var1.data.integer /= var2.data.integer;
-        else if (var1.kind == TYPEID_INT && var2.kind == TYPEID_FLOAT)
-        {
-            var1.kind = TYPEID_FLOAT;
-            var1.data.real = var1.data.integer / var2.data.real;
-        }
-        else if (var1.kind == TYPEID_FLOAT && var2.kind == TYPEID_INT)
-            var1.data.real /= var2.data.integer;
-        else if (var1.kind == TYPEID_FLOAT && var2.kind == TYPEID_FLOAT)
-            var1.data.real /= var2.data.real;
-        else
-        {
-            printf("%02X vs %02X (indexes %zu %zu) \n", var1.kind, var2.kind, i_in1, i_in2);
-            ASSERT_THROW(((void)"unknown type pair for / operator", 0));
-        }
+        var1.set_float(var1.get_int() / var2.get_float());
+    }
+    else if (var1.kind() == TYPEID_FLOAT && var2.kind() == TYPEID_INT)
+        var1.set_float(var1.get_float() / var2.get_int());
+    else if (var1.kind() == TYPEID_FLOAT && var2.kind() == TYPEID_FLOAT)
+        var1.set_float(var1.get_float() / var2.get_float());
+    else
+    {
+        printf("%02X vs %02X (indexes %zu %zu) \n", var1.kind(), var2.kind(), i_in1, i_in2);
+        ASSERT_THROW(((void)"unknown type pair for / operator", 0));
     }
-    CALL_NEXT();
 }
-OPHANDLER_ABI void op_div_f(OPHANDLER_ARGS)
+OPBODY_HANDLER(div, OP_DIV)
+OPBODY_ABI void opbody_div_f(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_DIV_F);
+    auto i_in1 = read_varlen_int(pc);
+    auto i_in2 = read_varlen_int(pc);
+    auto & var1 = vars[i_in1];
+    auto & var2 = vars[i_in2];
+    if (var2.kind() == TYPEID_INT)
+        var1.set_float(var1.get_float() / var2.get_int());
+    else if (var2.kind() == TYPEID_FLOAT)
+        var1.set_float(var1.get_float() / var2.get_float());
+    else
     {
-        auto i_in1 = read_varlen_int(pc);
-        auto i_in2 = read_varlen_int(pc);
-        auto & var1 = vars[i_in1];
-        auto & var2 = vars[i_in2];
-        if (var2.kind == TYPEID_INT)
-            var1.data.real /= var2.data.integer;
-        else if (var2.kind == TYPEID_FLOAT)
-            var1.data.real /= var2.data.real;
-        else
-        {
-            printf("%02X vs %02X (indexes %zu %zu) \n", var1.kind, var2.kind, i_in1, i_in2);
-            ASSERT_THROW(((void)"unknown type pair for / operator", 0));
-        }
+        printf("%02X vs %02X (indexes %zu %zu) \n", var1.kind(), var2.kind(), i_in1, i_in2);
+        ASSERT_THROW(((void)"unknown type pair for / operator", 0));
     }
-    CALL_NEXT();
 }
-template <typename F> void op_trivial_infix_impl(OPHANDLER_ARGS, F f)
+OPBODY_HANDLER(div_f, OP_DIV_F)
+template <typename F> OPBODY_ABI void op_trivial_infix_impl(OPBODY_ARGS, F f)
 {
     auto i_in1 = read_varlen_int(pc);
     auto i_in2 = read_varlen_int(pc);
@@ -1099,136 +1542,154 @@ template <typename F> void op_trivial_infix_impl(OPHANDLER_ARGS, F f)
     auto & var2 = vars[i_in2];
     f(var1, var2, global);
 }
-OPHANDLER_ABI void op_div_ff(OPHANDLER_ARGS)
+OPBODY_ABI void opbody_div_ff(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_DIV_FF);
-    op_trivial_infix_impl<>(CALL_ORDER, [](Variable & a, Variable & b, Interpreter *)
+    op_trivial_infix_impl<>(vars, pc, global, [](Variable & a, Variable & b, Interpreter *)
     {
-        a.data.real /= b.data.real;
+        a.set_float(a.get_float() / b.get_float());
     });
-    CALL_NEXT();
 }
-OPHANDLER_ABI void op_div_fi(OPHANDLER_ARGS)
+OPBODY_HANDLER(div_ff, OP_DIV_FF)
+OPBODY_ABI void opbody_div_fi(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_DIV_FI);
-    {
-        auto i_in1 = read_varlen_int(pc);
-        auto i_in2 = read_varlen_int(pc);
-        auto & var1 = vars[i_in1];
-        auto & var2 = vars[i_in2];
-        var1.data.real /= var2.data.integer;
-    }
-    CALL_NEXT();
+    auto i_in1 = read_varlen_int(pc);
+    auto i_in2 = read_varlen_int(pc);
+    auto & var1 = vars[i_in1];
+    auto & var2 = vars[i_in2];
+    var1.set_float(var1.get_float() / var2.get_int());
 }
-OPHANDLER_ABI void op_divimm(OPHANDLER_ARGS)
+OPBODY_HANDLER(div_fi, OP_DIV_FI)
+OPBODY_ABI void opbody_divimm(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_DIVIMM);
+    //auto i_out = read_varlen_int(pc);
+    auto i_in1 = read_varlen_int(pc);
+    auto var2 = read_immediate(pc);
+    //auto & out = vars[i_out];
+    auto & var1 = vars[i_in1];
+    switch (var1.kind())
     {
-        //auto i_out = read_varlen_int(pc);
-        auto i_in1 = read_varlen_int(pc);
-        auto var2 = read_immediate(pc);
-        //auto & out = vars[i_out];
-        auto & var1 = vars[i_in1];
-        switch (var1.kind)
+    case TYPEID_INT:
+        //out = var1;
+        if (var2.kind() == TYPEID_INT)
+            var1.set_int(var1.get_int() / var2.get_int());
+        else if (var2.kind() == TYPEID_FLOAT)
         {
-        case TYPEID_INT:
-            //out = var1;
-            if (var2.kind == TYPEID_INT)
-                var1.data.integer /= var2.data.integer;
-            else if (var2.kind == TYPEID_FLOAT)
-            {
-                var1.kind = TYPEID_FLOAT;
-                var1.data.real = var1.data.integer / var2.data.real;
-            }
-            break;
-        case TYPEID_FLOAT:
-            //out = var1;
-            if (var2.kind == TYPEID_INT)
-                var1.data.real /= var2.data.integer;
-            else if (var2.kind == TYPEID_FLOAT)
-                var1.data.real /= var2.data.real;
-            break;
-        default:
-            printf("%02X vs %02X (index %zu) \n", var1.kind, var2.kind, i_in1);
-            printf("%02X vs %02X\n", var1.kind, var2.kind);
-            ASSERT_THROW(((void)"unknown type pair for / operator (immediate)", 0));
+            var1.set_float(var1.get_int() / var2.get_float());
         }
+        break;
+    case TYPEID_FLOAT:
+        //out = var1;
+        if (var2.kind() == TYPEID_INT)
+            var1.set_float(var1.get_float() / var2.get_int());
+        else if (var2.kind() == TYPEID_FLOAT)
+            var1.set_float(var1.get_float() / var2.get_float());
+        break;
+    default:
+        printf("%02X vs %02X (index %zu) \n", var1.kind(), var2.kind(), i_in1);
+        printf("%02X vs %02X\n", var1.kind(), var2.kind());
+        ASSERT_THROW(((void)"unknown type pair for / operator (immediate)", 0));
     }
-    CALL_NEXT();
 }
+OPBODY_HANDLER(divimm, OP_DIVIMM)
 
-OPHANDLER_ABI void op_shl(OPHANDLER_ARGS)
+OPBODY_ABI void opbody_shl(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_SHL);
-    {
-        //auto i_out = read_varlen_int(pc);
-        auto i_in1 = read_varlen_int(pc);
-        auto i_in2 = read_varlen_int(pc);
-        //auto & out = vars[i_out];
-        auto & var1 = vars[i_in1];
-        auto & var2 = vars[i_in2];
-        assert(var1.kind == TYPEID_INT && var2.kind == TYPEID_INT);
-        //out = var1;
-        var1.data.integer <<= var2.data.integer;
-    }
-    CALL_NEXT();
+    //auto i_out = read_varlen_int(pc);
+    auto i_in1 = read_varlen_int(pc);
+    auto i_in2 = read_varlen_int(pc);
+    //auto & out = vars[i_out];
+    auto & var1 = vars[i_in1];
+    auto & var2 = vars[i_in2];
+    assert(var1.kind() == TYPEID_INT && var2.kind() == TYPEID_INT);
+    //out = var1;
+    var1.set_int(var1.get_int() << var2.get_int());
 }
-OPHANDLER_ABI void op_shlimm(OPHANDLER_ARGS)
+OPBODY_HANDLER(shl, OP_SHL)
+OPBODY_ABI void opbody_shlimm(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_SHLIMM);
-    {
-        auto i_in1 = read_varlen_int(pc);
-        auto var2 = read_immediate(pc);
-        auto & var1 = vars[i_in1];
-        assert(var1.kind == TYPEID_INT);
-        var1.data.integer <<= var2.data.integer;
-    }
-    CALL_NEXT();
+    auto i_in1 = read_varlen_int(pc);
+    auto var2 = read_immediate(pc);
+    auto & var1 = vars[i_in1];
+    assert(var1.kind() == TYPEID_INT);
+    var1.set_int(var1.get_int() << var2.get_int());
 }
-OPHANDLER_ABI void op_shlimm_i(OPHANDLER_ARGS)
+OPBODY_HANDLER(shlimm, OP_SHLIMM)
+OPBODY_ABI void opbody_shlimm_i(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_SHLIMM_I);
-    {
-        auto i_in1 = read_varlen_int(pc);
-        auto var2 = read_immediate(pc);
-        auto & var1 = vars[i_in1];
-        var1.data.integer <<= var2.data.integer;
-    }
-    CALL_NEXT();
+    auto i_in1 = read_varlen_int(pc);
+    auto var2 = read_immediate(pc);
+    auto & var1 = vars[i_in1];
+    var1.set_int(var1.get_int() << var2.get_int());
 }
+OPBODY_HANDLER(shlimm_i, OP_SHLIMM_I)
 
 
-OPHANDLER_ABI void op_shr(OPHANDLER_ARGS)
+OPBODY_ABI void opbody_shr(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_SHR);
-    {
-        //auto i_out = read_varlen_int(pc);
-        auto i_in1 = read_varlen_int(pc);
-        auto i_in2 = read_varlen_int(pc);
-        //auto & out = vars[i_out];
-        auto & var1 = vars[i_in1];
-        auto & var2 = vars[i_in2];
-        assert(var1.kind == TYPEID_INT && var2.kind == TYPEID_INT);
-        //out = var1;
-        var1.data.integer >>= var2.data.integer;
-    }
-    CALL_NEXT();
+    //auto i_out = read_varlen_int(pc);
+    auto i_in1 = read_varlen_int(pc);
+    auto i_in2 = read_varlen_int(pc);
+    //auto & out = vars[i_out];
+    auto & var1 = vars[i_in1];
+    auto & var2 = vars[i_in2];
+    assert(var1.kind() == TYPEID_INT && var2.kind() == TYPEID_INT);
+    //out = var1;
+    var1.set_int(var1.get_int() >> var2.get_int());
 }
-OPHANDLER_ABI void op_shrimm(OPHANDLER_ARGS)
+OPBODY_HANDLER(shr, OP_SHR)
+OPBODY_ABI void opbody_shrimm(OPBODY_ARGS)
 {
-    INC_PC_FOR_OPCODE(OP_SHRIMM);
-    {
-        //auto i_out = read_varlen_int(pc);
-        auto i_in1 = read_varlen_int(pc);
-        auto var2 = read_immediate(pc);
-        //auto & out = vars[i_out];
-        auto & var1 = vars[i_in1];
-        assert(var1.kind == TYPEID_INT && var2.kind == TYPEID_INT);
-        //out = var1;
-        var1.data.integer >>= var2.data.integer;
-    }
-    CALL_NEXT();
+    //auto i_out = read_varlen_int(pc);
+    auto i_in1 = read_varlen_int(pc);
+    auto var2 = read_immediate(pc);
+    //auto & out = vars[i_out];
+    auto & var1 = vars[i_in1];
+    assert(var1.kind() == TYPEID_INT && var2.kind() == TYPEID_INT);
+    //out = var1;
+    var1.set_int(var1.get_int() >> var2.get_int());
+}
+OPBODY_HANDLER(shrimm, OP_SHRIMM)
+
+template<uint8_t info> OPBODY_ABI void op_cmp_impl(OPBODY_ARGS)
+{
+    auto i_in1 = read_varlen_int(pc);
+    auto i_in2 = read_varlen_int(pc);
+    bool holds = compare_holds(info, compare_vars(vars[i_in1], vars[i_in2]));
+    vars[i_in1].set_bool(holds);
+}
+OPBODY_ABI void opbody_cmpe(OPBODY_ARGS)
+{
+    op_cmp_impl<OPINFO_CMPE>(vars, pc, global);
+}
+OPBODY_HANDLER(cmpe, OP_CMPE)
+OPBODY_ABI void opbody_cmpne(OPBODY_ARGS)
+{
+    op_cmp_impl<OPINFO_CMPNE>(vars, pc, global);
+}
+OPBODY_HANDLER(cmpne, OP_CMPNE)
+OPBODY_ABI void opbody_cmpgt(OPBODY_ARGS)
+{
+    op_cmp_impl<OPINFO_CMPGT>(vars, pc, global);
+}
+OPBODY_HANDLER(cmpgt, OP_CMPGT)
+OPBODY_ABI void opbody_cmplt(OPBODY_ARGS)
+{
+    op_cmp_impl<OPINFO_CMPLT>(vars, pc, global);
 }
+OPBODY_HANDLER(cmplt, OP_CMPLT)
+OPBODY_ABI void opbody_cmpgte(OPBODY_ARGS)
+{
+    op_cmp_impl<OPINFO_CMPGTE>(vars, pc, global);
+}
+OPBODY_HANDLER(cmpgte, OP_CMPGTE)
+OPBODY_ABI void opbody_cmplte(OPBODY_ARGS)
+{
+    op_cmp_impl<OPINFO_CMPLTE>(vars, pc, global);
+}
+OPBODY_HANDLER(cmplte, OP_CMPLTE)
+
+SUPERINSTRUCTIONS_2(SUPERINSTRUCTION_HANDLER_2)
+SUPERINSTRUCTIONS_3(SUPERINSTRUCTION_HANDLER_3)
 
 OPHANDLER_ABI void op_returnval(OPHANDLER_ARGS)
 {
@@ -1236,11 +1697,9 @@ OPHANDLER_ABI void op_returnval(OPHANDLER_ARGS)
     {
         auto i = read_varlen_int(pc);
         auto & ret = vars[i];
-        
-#ifdef USE_LOOP_DISPATCH
-        throw std::move(ret);
-#else
         global->retval = std::move(ret);
+#ifdef USE_LOOP_DISPATCH
+        pc = nullptr; // tells run_frame that the call is over
 #endif
     }
 }
@@ -1250,65 +1709,247 @@ OPHANDLER_ABI void op_returnimm(OPHANDLER_ARGS)
     INC_PC_FOR_OPCODE(OP_RETURNIMM);
     {
         auto ret = read_immediate(pc);
-        
+        global->retval = std::move(ret);
+#ifdef USE_LOOP_DISPATCH
+        pc = nullptr; // tells run_frame that the call is over
+#endif
+    }
+}
+
+// Runs code until it returns. The return value is left in global->retval.
+static inline void run_frame(Interpreter * global, Variable * vars, const uint8_t * pc)
+{
 #ifdef USE_LOOP_DISPATCH
-        throw std::move(ret);
+#ifdef PROFILE_SAMPLING
+    auto & shadow = global->sampler.frames[global->sampler.depth - 1];
+    auto outer_live_pc = shadow.live_pc;
+    shadow.live_pc = &pc;
+#endif
+    // until a return handler clears pc
+    do
+    {
+        uint16_t op = read_op(pc);
+        PROFILE_DISPATCH(op);
+        opcode_table.t[op](CALL_ORDER);
+    #ifndef DO_NOT_TRACK_INTERPRETER_PREV_OPCODE
+        global->prev_inst = op;
+    #endif
+    } while (pc);
+#ifdef PROFILE_SAMPLING
+    shadow.live_pc = outer_live_pc;
+#endif
 #else
-        global->retval = std::move(ret);
+#ifndef DO_NOT_TRACK_INTERPRETER_PREV_OPCODE
+    global->prev_inst = read_op(pc);
+#endif
+    PROFILE_DISPATCH(read_op(pc));
+    opcode_table.t[read_op(pc)](CALL_ORDER);
+#endif
+}
+
+// Runs func from the start, natively if the JIT compiled it. The return value is left in global->retval.
+static inline void run_function(Interpreter * global, Variable * vars, const Function & func)
+{
+#ifdef PROFILE_EXECUTION
+    global->execution_profile.enter(func);
+#endif
+#ifdef PROFILE_SAMPLING
+    global->sampler.enter(func);
+#endif
+#ifdef USE_JIT
+    if (func.jit_entry)
+        ((void (*)(Variable *, Interpreter *))func.jit_entry)(vars, global);
+    else
+        run_frame(global, vars, func.code_data());
+#else
+    run_frame(global, vars, func.code_data());
+#endif
+#ifdef PROFILE_EXECUTION
+    global->execution_profile.leave();
+#endif
+#ifdef PROFILE_SAMPLING
+    global->sampler.leave();
+#endif
+}
+
+// Sets up the window of a call to `func` starting at stack slot `base`.
+// The first argc slots already hold the arguments; the rest of the frame is cleared.
+static inline Variable * enter_frame(Interpreter * global, size_t base, size_t argc, const Function & func)
+{
+    ASSERT_THROW(((void)"wrong number of arguments", argc == func.num_args));
+    size_t frame_size = func.num_vars + func.num_regs;
+    auto vars = global->reserve_stack(base + frame_size) + base;
+    for (size_t i = argc; i < frame_size; i++)
+        vars[i] = Variable();
+    if (base + frame_size > global->stack_live)
+        global->stack_live = base + frame_size;
+    // safe point: every value the program can still reach is in the live part of the stack
+    if (global->heap.wants_reconcile()) [[unlikely]]
+        global->reconcile_heap();
+    return vars;
+}
+
+// The callee's window starts at the caller's argument registers, so arguments are passed in place.
+// Returns the caller's vars, which move if the call had to grow the register stack.
+static inline Variable * call_impl(Interpreter * global, Variable * vars, const Function & func, size_t argbase, size_t argc)
+{
+    ASSERT_THROW(((void)"too many nested calls", global->call_depth < INTERPRETER_MAX_CALL_DEPTH));
+    ASSERT_THROW(((void)"too many nested calls for the native stack", (uintptr_t)__builtin_frame_address(0) > global->native_stack_limit));
+    size_t base = vars - global->stack.data();
+    size_t live = global->stack_live;
+    global->call_depth += 1;
+    auto callee_vars = enter_frame(global, base + argbase, argc, func);
+    run_function(global, callee_vars, func);
+    global->call_depth -= 1;
+    global->stack_live = live;
+    return global->stack.data() + base;
+}
+
+// Tail call: the arguments slide down to the start of the current window, which is then reused by the callee.
+static inline Variable * become_impl(Interpreter * global, Variable * vars, const Function & func, size_t argbase, size_t argc)
+{
+#ifdef PROFILE_EXECUTION
+    global->execution_profile.become(func);
+#endif
+#ifdef PROFILE_SAMPLING
+    global->sampler.become(func);
 #endif
+    if (argbase != 0)
+    {
+        for (size_t i = 0; i < argc; i++)
+            vars[i] = std::move(vars[argbase + i]);
+    }
+    return enter_frame(global, vars - global->stack.data(), argc, func);
+}
+
+OPHANDLER_ABI void op_call(OPHANDLER_ARGS)
+{
+    INC_PC_FOR_OPCODE(OP_CALL);
+    {
+        auto dest = read_varlen_int(pc);
+        auto func_index = read_varlen_int(pc);
+        auto argbase = read_varlen_int(pc);
+        auto argc = read_varlen_int(pc);
+        PROFILE_CALL_SITE();
+        vars = call_impl(global, vars, *global->funcs[func_index], argbase, argc);
+        vars[dest] = std::move(global->retval);
+    }
+    CALL_NEXT();
+}
+OPHANDLER_ABI void op_call_indirect(OPHANDLER_ARGS)
+{
+    INC_PC_FOR_OPCODE(OP_CALL_INDIRECT);
+    {
+        auto dest = read_varlen_int(pc);
+        auto func_reg = read_varlen_int(pc);
+        auto argbase = read_varlen_int(pc);
+        auto argc = read_varlen_int(pc);
+        ASSERT_THROW(((void)"tried to call a non-function", vars[func_reg].kind() == TYPEID_FUNC));
+        // functions are owned by global->funcs, so this stays valid when the callee's window overwrites func_reg
+        auto func = vars[func_reg].get_func();
+        PROFILE_CALL_SITE();
+        vars = call_impl(global, vars, *func, argbase, argc);
+        vars[dest] = std::move(global->retval);
+    }
+    CALL_NEXT();
+}
+OPHANDLER_ABI void op_calldiscard(OPHANDLER_ARGS)
+{
+    INC_PC_FOR_OPCODE(OP_CALLDISCARD);
+    {
+        auto func_index = read_varlen_int(pc);
+        auto argbase = read_varlen_int(pc);
+        auto argc = read_varlen_int(pc);
+        PROFILE_CALL_SITE();
+        vars = call_impl(global, vars, *global->funcs[func_index], argbase, argc);
+        global->retval = Variable();
+    }
+    CALL_NEXT();
+}
+OPHANDLER_ABI void op_calld_indirect(OPHANDLER_ARGS)
+{
+    INC_PC_FOR_OPCODE(OP_CALLD_INDIRECT);
+    {
+        auto func_reg = read_varlen_int(pc);
+        auto argbase = read_varlen_int(pc);
+        auto argc = read_varlen_int(pc);
+        ASSERT_THROW(((void)"tried to call a non-function", vars[func_reg].kind() == TYPEID_FUNC));
+        auto func = vars[func_reg].get_func();
+        PROFILE_CALL_SITE();
+        vars = call_impl(global, vars, *func, argbase, argc);
+        global->retval = Variable();
+    }
+    CALL_NEXT();
+}
+
+OPHANDLER_ABI void op_become(OPHANDLER_ARGS)
+{
+    INC_PC_FOR_OPCODE(OP_BECOME);
+    {
+        auto func_index = read_varlen_int(pc);
+        auto argbase = read_varlen_int(pc);
+        auto argc = read_varlen_int(pc);
+        auto & func = *global->funcs[func_index];
+        vars = become_impl(global, vars, func, argbase, argc);
+        pc = func.code_data();
+    }
+    CALL_NEXT();
+}
+OPHANDLER_ABI void op_become_indirect(OPHANDLER_ARGS)
+{
+    INC_PC_FOR_OPCODE(OP_BECOME_INDIRECT);
+    {
+        auto func_reg = read_varlen_int(pc);
+        auto argbase = read_varlen_int(pc);
+        auto argc = read_varlen_int(pc);
+        ASSERT_THROW(((void)"tried to call a non-function", vars[func_reg].kind() == TYPEID_FUNC));
+        auto func = vars[func_reg].get_func();
+        vars = become_impl(global, vars, *func, argbase, argc);
+        pc = func->code_data();
     }
+    CALL_NEXT();
 }
 
+#if defined USE_JIT || defined USE_TRACING_JIT
+#include "jit.hpp"
+#endif
+#ifdef USE_TRACING_JIT
+#include "trace_jit.hpp"
+#endif
+
 inline Interpreter::Interpreter(Global info)
 {
     funcs = std::move(info.funcs);
     func_names = std::move(info.func_names);
     var_names = std::move(info.var_names);
+    mapping = std::move(info.mapping);
+    active_heap = &heap;
+    grow_stack(INTERPRETER_STACK_INITIAL_SIZE);
+#ifdef USE_JIT
+    jit_compile(*this);
+#endif
 }
 
 inline Variable Interpreter::call_func(Shared<Function> func, Vec<Variable> args)
 {
-    (void)args;
-    
-    Vec<Variable> _vars;
-    //printf("allocating %zu var-regs....\n", func->num_vars + func->num_regs);
-    for (size_t i = 0; i < func->num_vars + func->num_regs; i++)
-        _vars.push_back(Variable());
-    //printf("allocated %zu var-regs\n", _vars.size());
-    
-    const uint8_t * pc = func->code.data();
-    auto vars = _vars.data();
-#ifndef DO_NOT_TRACK_INTERPRETER_PREV_OPCODE
-    prev_inst = read_op(pc);
-    uint16_t op = prev_inst;
-#else
-    uint16_t op = read_op(pc);
-#endif
-    auto global = this;
-    
-#ifdef USE_LOOP_DISPATCH
-    try
-    {
-        while (1)
-        {
-            auto f = opcode_table.t[op];
-            f(CALL_ORDER);
-        #ifndef DO_NOT_TRACK_INTERPRETER_PREV_OPCODE
-            prev_inst = op;
-        #endif
-            op = read_op(pc);
-        }
-    }
-    catch (Variable retval)
+    // calls from the host start at the bottom of the register stack
+    auto vars = reserve_stack(args.size());
+    for (size_t i = 0; i < args.size(); i++)
+        vars[i] = std::move(args[i]);
+    size_t live = stack_live;
+    struct rlimit limit;
+    if (call_depth == 0 && !getrlimit(RLIMIT_STACK, &limit) && limit.rlim_cur != RLIM_INFINITY)
     {
-        return retval;
+        // the stack from here up has been used already, but it's far less than the margin
+        auto here = (uintptr_t)__builtin_frame_address(0);
+        size_t usable = limit.rlim_cur > INTERPRETER_NATIVE_STACK_MARGIN ? limit.rlim_cur - INTERPRETER_NATIVE_STACK_MARGIN : 0;
+        native_stack_limit = here > usable ? here - usable : 0;
     }
-#else
-    opcode_table.t[op](CALL_ORDER);
-#endif
-#ifndef USE_LOOP_DISPATCH
+    vars = enter_frame(this, 0, args.size(), *func);
+    
+    run_function(this, vars, *func);
+    stack_live = live;
     return std::move(retval);
-#endif
 }
 
 inline Variable Interpreter::call_func_by_name(String funcname, Vec<Variable> args)
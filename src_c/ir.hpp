@@ -0,0 +1,1949 @@
+#ifndef MUALI_IR
+#define MUALI_IR
+
+// Included by compiler.hpp after regalloc.hpp.
+
+// A mid-level SSA form of a function: basic blocks of instructions that each produce at most one value, phis where
+// control flow merges, and a type for every value. Optimizations run on it instead of on registers.
+//
+// The front end picks opcodes while it infers variable types (see compile_func), so the IR is built from the code it emits
+// rather than from the AST: every register write becomes a value that keeps its opcode and immediates, and phis go at the
+// dominance frontiers of the writes to each register (Cytron et al., with dominators from Cooper, Harvey and Kennedy).
+// A pass manager then runs type specialization, copy propagation, global value numbering, loop-invariant code motion and
+// dead code elimination until none of them finds anything left to do. Lowering turns the IR back into bytecode with one
+// register per value and copies for the phis, and allocate_registers packs those registers afterwards. Counted loops that only do arithmetic
+// into reductions also get an OP_BULKLOOP in front of them that runs them in SIMD lanes (see ir_vectorize_loops).
+
+//#define IR_PRINT_PASSES
+// Prints which passes changed each function.
+
+constexpr uint16_t IR_PHI   = 0xFFFE;
+constexpr uint16_t IR_PARAM = 0xFFFD;
+constexpr uint32_t IR_NONE  = 0xFFFFFFFF;
+
+constexpr size_t IR_MAX_INSTRUCTIONS = 1 << 16; // bigger functions skip the IR and only get their registers packed
+constexpr int IR_MAX_ROUNDS = 8;
+
+struct IrInst {
+    uint16_t op;
+    TypeId type = TYPEID_INVALID;
+    bool has_result = false;
+    bool removed = false;
+    uint32_t block = IR_NONE;
+    uint32_t replaced_by = IR_NONE; // set if removed because another value is the same
+    Vec<uint32_t> args; // values read, in operand order, then the arguments of a call; a phi's go with its block's preds
+    Vec<uint8_t> imm; // bytes of the operands that aren't registers, argument bases or jumps, in order
+    size_t reg = 0; // register the front end wrote the result to; the argument index of an IR_PARAM
+    size_t origin = SIZE_MAX; // offset of the instruction it was lifted from, for the line table
+};
+
+struct IrBlock {
+    Vec<uint32_t> insts; // phis first; a jump, return or become can only be last
+    Vec<uint32_t> preds;
+    uint32_t target = IR_NONE; // where the jump at the end goes
+    uint32_t fallthrough = IR_NONE; // the next block, if control can run into it
+    uint32_t idom = IR_NONE;
+    Vec<uint32_t> children; // in the dominator tree
+};
+
+// A loop that an OP_BULKLOOP can run (see ir_vectorize_loops).
+struct IrBulkLoop {
+    uint32_t preheader; // the op goes at its end, after the copies into the loop's phis
+    Vec<uint32_t> operands; // values whose registers the op names, in the kernel's order
+    Vec<uint8_t> kernel; // encoded by bulk_encode
+};
+
+struct IrFunc {
+    Vec<IrInst> insts;
+    Vec<IrBlock> blocks; // 0 is the entry: the parameters and constants live there, and it falls through to block 1
+    Vec<uint32_t> rpo; // reverse postorder of the blocks
+    size_t num_args = 0;
+    Vec<IrBulkLoop> bulk_loops;
+    
+    size_t successors(uint32_t b, uint32_t * out) const
+    {
+        size_t count = 0;
+        if (blocks[b].fallthrough != IR_NONE)
+            out[count++] = blocks[b].fallthrough;
+        if (blocks[b].target != IR_NONE && blocks[b].target != blocks[b].fallthrough)
+            out[count++] = blocks[b].target;
+        return count;
+    }
+    uint32_t resolve(uint32_t v) const
+    {
+        while (insts[v].replaced_by != IR_NONE)
+            v = insts[v].replaced_by;
+        return v;
+    }
+    void replace(uint32_t v, uint32_t with)
+    {
+        insts[v].removed = true;
+        insts[v].replaced_by = with;
+    }
+    bool dominates(uint32_t a, uint32_t b) const
+    {
+        while (b != a && b != IR_NONE)
+            b = blocks[b].idom;
+        return b == a;
+    }
+    uint32_t add_inst(uint16_t op, uint32_t block)
+    {
+        IrInst inst;
+        inst.op = op;
+        inst.block = block;
+        insts.push_back(std::move(inst));
+        blocks[block].insts.push_back(insts.size() - 1);
+        return insts.size() - 1;
+    }
+};
+
+static inline bool ir_is_copy(uint16_t op)
+{
+    return op == OP_SET || op == OP_SET_I || op == OP_SET_F || op == OP_CHECK_I || op == OP_CHECK_F;
+}
+static inline bool ir_is_call(uint16_t op)
+{
+    return op == OP_CALL || op == OP_CALL_INDIRECT || op == OP_CALLDISCARD || op == OP_CALLD_INDIRECT
+        || op == OP_BECOME || op == OP_BECOME_INDIRECT;
+}
+// jumps, returns and becomes, which end their block
+static inline bool ir_is_terminator(uint16_t op)
+{
+    if (op == IR_PHI || op == IR_PARAM)
+        return false;
+    return !code_falls_through(op) || strchr(opcode_operands(op), 'j');
+}
+
+// Visits the dominator tree depth first, calling enter(block) on the way down and leave(block) on the way back up.
+template<typename Enter, typename Leave>
+static inline void ir_walk_dom_tree(const IrFunc & ir, Enter && enter, Leave && leave)
+{
+    struct Step {
+        uint32_t block;
+        bool leaving;
+    };
+    Vec<Step> steps;
+    steps.push_back(Step{0, false});
+    while (steps.size())
+    {
+        auto step = steps.pop_back();
+        if (step.leaving)
+        {
+            leave(step.block);
+            continue;
+        }
+        enter(step.block);
+        steps.push_back(Step{step.block, true});
+        auto & children = ir.blocks[step.block].children;
+        for (size_t c = children.size(); c-- > 0;)
+            steps.push_back(Step{children[c], false});
+    }
+}
+
+// Builds the SSA form of a function from its code. Returns false if the code has something the IR doesn't model.
+static inline bool ir_lift(const Vec<uint8_t> & code, size_t num_args, IrFunc & ir)
+{
+    Vec<CodeInsn> insns;
+    Vec<CodeCall> calls;
+    if (!decode_code(code, insns, calls))
+        return false;
+    size_t n = insns.size();
+    if (n == 0 || n > IR_MAX_INSTRUCTIONS)
+        return false;
+    
+    // basic blocks of the code, in code order
+    Vec<uint8_t> leader(n + 1, 0);
+    leader[0] = 1;
+    for (size_t i = 0; i < n; i++)
+    {
+        if (insns[i].target >= 0)
+        {
+            if (insns[i].target == (int64_t)n)
+                return false;
+            leader[insns[i].target] = 1;
+        }
+        if (ir_is_terminator(insns[i].op))
+            leader[i + 1] = 1;
+    }
+    if (code_falls_through(insns[n - 1].op))
+        return false;
+    Vec<size_t> block_start;
+    Vec<size_t> block_of_insn(n, 0);
+    for (size_t i = 0; i < n; i++)
+    {
+        if (leader[i])
+            block_start.push_back(i);
+        block_of_insn[i] = block_start.size() - 1;
+    }
+    size_t code_blocks = block_start.size();
+    block_start.push_back(n);
+    
+    auto code_target = [&](size_t c) -> size_t
+    {
+        auto & last = insns[block_start[c + 1] - 1];
+        return last.target >= 0 ? block_of_insn[last.target] : SIZE_MAX;
+    };
+    auto code_fallthrough = [&](size_t c) -> size_t
+    {
+        return code_falls_through(insns[block_start[c + 1] - 1].op) ? c + 1 : SIZE_MAX;
+    };
+    
+    // only the blocks that can run become IR blocks, after the entry
+    Vec<uint32_t> ir_block(code_blocks, IR_NONE);
+    Vec<size_t> work;
+    work.push_back(0);
+    ir_block[0] = 0;
+    while (work.size())
+    {
+        auto c = work.pop_back();
+        size_t next[2] = {code_target(c), code_fallthrough(c)};
+        for (auto s : next)
+        {
+            if (s != SIZE_MAX && ir_block[s] == IR_NONE)
+            {
+                ir_block[s] = 0;
+                work.push_back(s);
+            }
+        }
+    }
+    ir.blocks.push_back(IrBlock{});
+    for (size_t c = 0; c < code_blocks; c++)
+    {
+        if (ir_block[c] == IR_NONE)
+            continue;
+        ir_block[c] = ir.blocks.size();
+        ir.blocks.push_back(IrBlock{});
+    }
+    ir.blocks[0].fallthrough = 1;
+    for (size_t c = 0; c < code_blocks; c++)
+    {
+        if (ir_block[c] == IR_NONE)
+            continue;
+        auto & block = ir.blocks[ir_block[c]];
+        if (code_target(c) != SIZE_MAX)
+            block.target = ir_block[code_target(c)];
+        if (code_fallthrough(c) != SIZE_MAX)
+            block.fallthrough = ir_block[code_fallthrough(c)];
+    }
+    size_t block_count = ir.blocks.size();
+    for (uint32_t b = 0; b < block_count; b++)
+    {
+        uint32_t succ[2];
+        size_t count = ir.successors(b, succ);
+        for (size_t s = 0; s < count; s++)
+            ir.blocks[succ[s]].preds.push_back(b);
+    }
+    
+    // reverse postorder
+    {
+        Vec<uint8_t> visited(block_count, 0);
+        Vec<uint32_t> postorder;
+        struct Step {
+            uint32_t block;
+            bool leaving;
+        };
+        Vec<Step> steps;
+        steps.push_back(Step{0, false});
+        while (steps.size())
+        {
+            auto step = steps.pop_back();
+            if (step.leaving)
+            {
+                postorder.push_back(step.block);
+                continue;
+            }
+            if (visited[step.block])
+                continue;
+            visited[step.block] = 1;
+            steps.push_back(Step{step.block, true});
+            uint32_t succ[2];
+            size_t count = ir.successors(step.block, succ);
+            for (size_t s = count; s-- > 0;)
+            {
+                if (!visited[succ[s]])
+                    steps.push_back(Step{succ[s], false});
+            }
+        }
+        for (size_t i = postorder.size(); i-- > 0;)
+            ir.rpo.push_back(postorder[i]);
+    }
+    
+    // dominators
+    Vec<size_t> rpo_index(block_count, 0);
+    for (size_t i = 0; i < ir.rpo.size(); i++)
+        rpo_index[ir.rpo[i]] = i;
+    ir.blocks[0].idom = 0;
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (size_t i = 1; i < ir.rpo.size(); i++)
+        {
+            auto b = ir.rpo[i];
+            uint32_t idom = IR_NONE;
+            for (auto p : ir.blocks[b].preds)
+            {
+                if (ir.blocks[p].idom == IR_NONE)
+                    continue;
+                if (idom == IR_NONE)
+                {
+                    idom = p;
+                    continue;
+                }
+                auto x = p;
+                while (x != idom)
+                {
+                    while (rpo_index[x] > rpo_index[idom])
+                        x = ir.blocks[x].idom;
+                    while (rpo_index[idom] > rpo_index[x])
+                        idom = ir.blocks[idom].idom;
+                }
+            }
+            if (idom != ir.blocks[b].idom)
+            {
+                ir.blocks[b].idom = idom;
+                changed = true;
+            }
+        }
+    }
+    ir.blocks[0].idom = IR_NONE;
+    for (uint32_t b = 1; b < block_count; b++)
+        ir.blocks[ir.blocks[b].idom].children.push_back(b);
+    
+    Vec<Vec<uint32_t>> frontier(block_count, Vec<uint32_t>{});
+    for (uint32_t b = 0; b < block_count; b++)
+    {
+        if (ir.blocks[b].preds.size() < 2)
+            continue;
+        for (auto p : ir.blocks[b].preds)
+        {
+            for (auto x = p; x != ir.blocks[b].idom; x = ir.blocks[x].idom)
+            {
+                if (frontier[x].size() == 0 || frontier[x].back() != b)
+                    frontier[x].push_back(b);
+            }
+        }
+    }
+    
+    // phis, for each register at the iterated dominance frontier of the blocks that write it
+    size_t reg_count = num_args;
+    for (auto & insn : insns)
+    {
+        for (auto & ref : insn.refs)
+        {
+            if (ref.reg + 1 > reg_count)
+                reg_count = ref.reg + 1;
+        }
+    }
+    Vec<Vec<uint32_t>> def_blocks(reg_count, Vec<uint32_t>{});
+    for (size_t c = 0; c < code_blocks; c++)
+    {
+        if (ir_block[c] == IR_NONE)
+            continue;
+        for (size_t i = block_start[c]; i < block_start[c + 1]; i++)
+        {
+            for (auto & ref : insns[i].refs)
+            {
+                auto & defs = def_blocks[ref.reg];
+                if (ref.role != 'u' && (defs.size() == 0 || defs.back() != ir_block[c]))
+                    defs.push_back(ir_block[c]);
+            }
+        }
+    }
+    Vec<size_t> has_phi(block_count, SIZE_MAX);
+    Vec<size_t> queued(block_count, SIZE_MAX);
+    Vec<uint32_t> blocks_work;
+    for (size_t reg = 0; reg < reg_count; reg++)
+    {
+        for (auto b : def_blocks[reg])
+        {
+            queued[b] = reg;
+            blocks_work.push_back(b);
+        }
+        while (blocks_work.size())
+        {
+            auto x = blocks_work.pop_back();
+            for (auto y : frontier[x])
+            {
+                if (has_phi[y] == reg)
+                    continue;
+                has_phi[y] = reg;
+                auto phi = ir.add_inst(IR_PHI, y);
+                ir.insts[phi].has_result = true;
+                ir.insts[phi].reg = reg;
+                ir.insts[phi].args = Vec<uint32_t>(ir.blocks[y].preds.size(), IR_NONE);
+                if (queued[y] != reg)
+                {
+                    queued[y] = reg;
+                    blocks_work.push_back(y);
+                }
+            }
+        }
+    }
+    
+    // the instructions themselves, with their operands to be filled in by renaming
+    Vec<uint32_t> params;
+    for (size_t a = 0; a < num_args; a++)
+    {
+        auto param = ir.add_inst(IR_PARAM, 0);
+        ir.insts[param].has_result = true;
+        ir.insts[param].reg = a;
+        params.push_back(param);
+    }
+    Vec<size_t> insn_of(ir.insts.size(), SIZE_MAX);
+    for (size_t c = 0; c < code_blocks; c++)
+    {
+        if (ir_block[c] == IR_NONE)
+            continue;
+        for (size_t i = block_start[c]; i < block_start[c + 1]; i++)
+        {
+            auto & insn = insns[i];
+            auto v = ir.add_inst(insn.op, ir_block[c]);
+            insn_of.push_back(i);
+            auto & inst = ir.insts[v];
+            inst.origin = insn.pos;
+            auto operands = opcode_operands(insn.op);
+            auto roles = register_roles(insn.op);
+            size_t p = insn.pos + opcode_length(insn.op);
+            for (size_t k = 0; operands[k]; k++)
+            {
+                size_t len = operand_length(code.data() + p, operands[k]);
+                if (roles[k] == 'd' || roles[k] == 'm')
+                {
+                    inst.has_result = true;
+                    inst.reg = varlen_int_value(code.data() + p);
+                }
+                else if (roles[k] != 'u' && roles[k] != 'b' && operands[k] != 'j')
+                {
+                    for (size_t b = 0; b < len; b++)
+                        inst.imm.push_back(code[p + b]);
+                }
+                p += len;
+            }
+        }
+    }
+    
+    // renaming: walk the dominator tree with a stack of the current value of each register
+    Vec<Vec<uint32_t>> current(reg_count, Vec<uint32_t>{});
+    Vec<size_t> pushed; // registers, in the order their stacks were pushed
+    Vec<size_t> marks(block_count, 0);
+    uint32_t null_value = IR_NONE;
+    // a register that nothing wrote yet holds the argument or the null that the frame started with
+    auto read = [&](size_t reg) -> uint32_t
+    {
+        if (current[reg].size())
+            return current[reg].back();
+        if (reg < num_args)
+            return params[reg];
+        if (null_value == IR_NONE)
+        {
+            null_value = ir.add_inst(OP_SETIMM, 0);
+            ir.insts[null_value].has_result = true;
+            ir.insts[null_value].imm.push_back(TYPEID_NULL);
+            insn_of.push_back(SIZE_MAX);
+        }
+        return null_value;
+    };
+    auto write = [&](size_t reg, uint32_t v)
+    {
+        current[reg].push_back(v);
+        pushed.push_back(reg);
+    };
+    ir_walk_dom_tree(ir, [&](uint32_t b)
+    {
+        marks[b] = pushed.size();
+        for (size_t k = 0; k < ir.blocks[b].insts.size(); k++)
+        {
+            auto v = ir.blocks[b].insts[k];
+            if (ir.insts[v].op == IR_PHI)
+            {
+                write(ir.insts[v].reg, v);
+                continue;
+            }
+            if (insn_of[v] == SIZE_MAX)
+                continue;
+            auto & insn = insns[insn_of[v]];
+            for (auto & ref : insn.refs)
+            {
+                if (ref.role != 'd')
+                {
+                    auto arg = read(ref.reg);
+                    ir.insts[v].args.push_back(arg);
+                }
+            }
+            if (ir.insts[v].has_result)
+                write(ir.insts[v].reg, v);
+        }
+        uint32_t succ[2];
+        size_t count = ir.successors(b, succ);
+        for (size_t s = 0; s < count; s++)
+        {
+            auto & to = ir.blocks[succ[s]];
+            size_t j = 0;
+            while (to.preds[j] != b)
+                j++;
+            for (size_t k = 0; k < to.insts.size() && ir.insts[to.insts[k]].op == IR_PHI; k++)
+            {
+                auto arg = read(ir.insts[to.insts[k]].reg);
+                ir.insts[to.insts[k]].args[j] = arg;
+            }
+        }
+    }, [&](uint32_t b)
+    {
+        while (pushed.size() > marks[b])
+            current[pushed.pop_back()].pop_back();
+    });
+    
+    ir.num_args = num_args;
+    return true;
+}
+
+// type of a generic arithmetic result, following the interpreter's promotion rules
+static inline TypeId ir_arith_type(TypeId a, TypeId b)
+{
+    if (a == TYPEID_INVALID || b == TYPEID_INVALID)
+        return TYPEID_INVALID;
+    if (a == TYPEID_INT && b == TYPEID_INT)
+        return TYPEID_INT;
+    if (is_numeric_type(a) && is_numeric_type(b))
+        return TYPEID_FLOAT;
+    return TYPEID_VARIANT;
+}
+
+static inline TypeId ir_result_type(const IrFunc & ir, const IrInst & inst)
+{
+    auto arg = [&](size_t k) { return ir.insts[inst.args[k]].type; };
+    switch (inst.op)
+    {
+    case IR_PHI:
+    {
+        TypeId type = TYPEID_INVALID;
+        for (auto a : inst.args)
+            type = join_types(type, ir.insts[a].type);
+        return type;
+    }
+    case OP_SETIMM:
+        return inst.imm[0];
+    case OP_SET:
+        return arg(0);
+    case OP_SET_I: case OP_CHECK_I: case OP_SETZEROI: case OP_SUBIMM_I: case OP_SHLIMM_I:
+    case OP_INCI: case OP_INCI_INT: case OP_DECI: case OP_DECI_INT:
+    case OP_SHL: case OP_SHR: case OP_SHLIMM: case OP_SHRIMM:
+    case OP_JINCILTIMM: case OP_JINCILTIMM_INT: case OP_JINCILT:
+        return TYPEID_INT;
+    case OP_SET_F: case OP_CHECK_F: case OP_ADD_F: case OP_ADD_FF: case OP_DIV_F: case OP_DIV_FF: case OP_DIV_FI:
+    case OP_NEGATE_F:
+        return TYPEID_FLOAT;
+    case OP_CMPE: case OP_CMPNE: case OP_CMPGT: case OP_CMPLT: case OP_CMPGTE: case OP_CMPLTE:
+        return TYPEID_BOOL;
+    case OP_NEGATE:
+        return arg(0) == TYPEID_INVALID || is_numeric_type(arg(0)) ? arg(0) : TYPEID_VARIANT;
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+        return ir_arith_type(arg(0), arg(1));
+    case OP_ADDIMM: case OP_SUBIMM: case OP_MULIMM: case OP_DIVIMM:
+        return ir_arith_type(arg(0), inst.imm[0]);
+    default:
+        return TYPEID_VARIANT;
+    }
+}
+
+// Gives every value the join of the types it can have at runtime, starting from nothing and going up the lattice.
+static inline void ir_infer_types(IrFunc & ir)
+{
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (auto b : ir.rpo)
+        {
+            for (auto v : ir.blocks[b].insts)
+            {
+                auto & inst = ir.insts[v];
+                if (!inst.has_result)
+                    continue;
+                auto type = join_types(inst.type, ir_result_type(ir, inst));
+                changed = changed || type != inst.type;
+                inst.type = type;
+            }
+        }
+    }
+    for (auto & inst : ir.insts)
+    {
+        if (inst.type == TYPEID_INVALID)
+            inst.type = TYPEID_VARIANT;
+    }
+}
+
+// Whether an instruction does nothing besides making its value and can't fault with the types its operands have, so
+// that it can be deleted if nothing uses it or moved somewhere else that it's available.
+static inline bool ir_is_pure(const IrFunc & ir, const IrInst & inst)
+{
+    if (!inst.has_result)
+        return false;
+    auto arg = [&](size_t k) { return ir.insts[inst.args[k]].type; };
+    TypeId imm_type = inst.imm.size() ? inst.imm[0] : TYPEID_INVALID;
+    switch (inst.op)
+    {
+    case IR_PHI: case IR_PARAM: case OP_SETIMM: case OP_SET: case OP_SETZEROI:
+    case OP_SUBIMM_I: case OP_SHLIMM_I: case OP_INCI_INT: case OP_DECI_INT:
+    case OP_ADD_FF: case OP_DIV_FF: case OP_DIV_FI: case OP_NEGATE_F:
+    case OP_CMPE: case OP_CMPNE: case OP_CMPGT: case OP_CMPLT: case OP_CMPGTE: case OP_CMPLTE:
+        return true;
+    case OP_SET_I: case OP_CHECK_I: case OP_INCI: case OP_DECI:
+        return arg(0) == TYPEID_INT;
+    case OP_SET_F: case OP_CHECK_F:
+        return arg(0) == TYPEID_FLOAT;
+    case OP_ADD_F: case OP_DIV_F:
+        return is_numeric_type(arg(1));
+    case OP_NEGATE:
+        return is_numeric_type(arg(0));
+    case OP_SHL: case OP_SHR:
+        return arg(0) == TYPEID_INT && arg(1) == TYPEID_INT;
+    case OP_SHLIMM: case OP_SHRIMM:
+        return arg(0) == TYPEID_INT && imm_type == TYPEID_INT;
+    case OP_ADD: case OP_SUB: case OP_MUL:
+        return is_numeric_type(arg(0)) && is_numeric_type(arg(1));
+    case OP_ADDIMM: case OP_SUBIMM: case OP_MULIMM:
+        return is_numeric_type(arg(0)) && is_numeric_type(imm_type);
+    // integer division by zero faults
+    case OP_DIV:
+        return is_numeric_type(arg(0)) && is_numeric_type(arg(1)) && (arg(0) == TYPEID_FLOAT || arg(1) == TYPEID_FLOAT);
+    case OP_DIVIMM:
+    {
+        if (!is_numeric_type(arg(0)) || !is_numeric_type(imm_type))
+            return false;
+        int64_t divisor = 0;
+        if (imm_type == TYPEID_INT)
+            memcpy(&divisor, inst.imm.data() + 1, 8);
+        return arg(0) == TYPEID_FLOAT || imm_type == TYPEID_FLOAT || divisor != 0;
+    }
+    default:
+        return false;
+    }
+}
+
+// Drops removed instructions from the blocks and points every operand at the value it was replaced with.
+static inline void ir_tidy(IrFunc & ir)
+{
+    for (auto & block : ir.blocks)
+    {
+        size_t kept = 0;
+        for (size_t k = 0; k < block.insts.size(); k++)
+        {
+            auto v = block.insts[k];
+            if (ir.insts[v].removed)
+                continue;
+            for (auto & a : ir.insts[v].args)
+                a = ir.resolve(a);
+            block.insts[kept++] = v;
+        }
+        while (block.insts.size() > kept)
+            block.insts.pop_back();
+    }
+}
+
+// Picks the typed form of each generic instruction whose operands' types allow one. The front end can only do that for
+// variables that hold one type everywhere in the function, but every value here has a type of its own, so a variable
+// that starts out null or gets a float after a while still gets typed opcodes wherever it's known to be an int.
+static inline bool ir_specialize_types(IrFunc & ir)
+{
+    bool changed = false;
+    for (auto & block : ir.blocks)
+    {
+        for (auto v : block.insts)
+        {
+            auto & inst = ir.insts[v];
+            if (inst.removed || inst.op == IR_PHI || inst.op == IR_PARAM)
+                continue;
+            auto arg = [&](size_t k) { return ir.insts[inst.args[k]].type; };
+            TypeId imm_type = inst.imm.size() == 9 ? inst.imm[0] : TYPEID_INVALID;
+            int64_t imm_int = 0;
+            double imm_float = 0.0;
+            if (imm_type == TYPEID_INT)
+                memcpy(&imm_int, inst.imm.data() + 1, 8);
+            if (imm_type == TYPEID_FLOAT)
+                memcpy(&imm_float, inst.imm.data() + 1, 8);
+            uint16_t op = inst.op;
+            bool drop_imm = false;
+            switch (inst.op)
+            {
+            case OP_SET:
+                op = arg(0) == TYPEID_INT ? OP_SET_I : arg(0) == TYPEID_FLOAT ? OP_SET_F : op;
+                break;
+            case OP_ADD: case OP_ADD_F:
+                if (arg(0) == TYPEID_FLOAT && arg(1) == TYPEID_FLOAT)
+                    op = OP_ADD_FF;
+                else if (arg(0) == TYPEID_FLOAT && arg(1) == TYPEID_INT)
+                    op = OP_ADD_F;
+                break;
+            case OP_DIV: case OP_DIV_F:
+                if (arg(0) == TYPEID_FLOAT && arg(1) == TYPEID_FLOAT)
+                    op = OP_DIV_FF;
+                else if (arg(0) == TYPEID_FLOAT && arg(1) == TYPEID_INT)
+                    op = OP_DIV_FI;
+                break;
+            case OP_INCI:
+                op = arg(0) == TYPEID_INT ? OP_INCI_INT : op;
+                break;
+            case OP_DECI:
+                op = arg(0) == TYPEID_INT ? OP_DECI_INT : op;
+                break;
+            case OP_ADDIMM:
+                drop_imm = arg(0) == TYPEID_INT && imm_type == TYPEID_INT && (imm_int == 1 || imm_int == -1);
+                op = drop_imm ? (imm_int == 1 ? OP_INCI_INT : OP_DECI_INT) : op;
+                break;
+            case OP_SUBIMM: case OP_SUBIMM_I:
+                if (arg(0) == TYPEID_INT && imm_type == TYPEID_INT)
+                {
+                    drop_imm = imm_int == 1;
+                    op = drop_imm ? OP_DECI_INT : OP_SUBIMM_I;
+                }
+                break;
+            case OP_MULIMM:
+                drop_imm = arg(0) == TYPEID_FLOAT && imm_type == TYPEID_FLOAT && imm_float == -1.0;
+                op = drop_imm ? OP_NEGATE_F : op;
+                break;
+            case OP_SHLIMM:
+                op = arg(0) == TYPEID_INT && imm_type == TYPEID_INT ? OP_SHLIMM_I : op;
+                break;
+            case OP_NEGATE:
+                op = arg(0) == TYPEID_FLOAT ? OP_NEGATE_F : op;
+                break;
+            case OP_JINCILTIMM:
+                op = arg(0) == TYPEID_INT ? OP_JINCILTIMM_INT : op;
+                break;
+            default:
+                break;
+            }
+            if (op == inst.op)
+                continue;
+            inst.op = op;
+            if (drop_imm)
+                inst.imm = {};
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+// Replaces copies with what they copy, and phis whose operands are all one value (or the phi itself) with that value.
+static inline bool ir_copy_propagation(IrFunc & ir)
+{
+    bool changed = false;
+    bool again = true;
+    while (again)
+    {
+        again = false;
+        for (auto & block : ir.blocks)
+        {
+            for (auto v : block.insts)
+            {
+                auto & inst = ir.insts[v];
+                if (inst.removed)
+                    continue;
+                // a check stays unless its value is known to pass it
+                if (ir_is_copy(inst.op) && ir_is_pure(ir, inst))
+                {
+                    ir.replace(v, ir.resolve(inst.args[0]));
+                    again = true;
+                }
+                else if (inst.op == IR_PHI)
+                {
+                    uint32_t same = IR_NONE;
+                    bool trivial = true;
+                    for (auto a : inst.args)
+                    {
+                        a = ir.resolve(a);
+                        if (a == v || a == same)
+                            continue;
+                        trivial = trivial && same == IR_NONE;
+                        same = a;
+                    }
+                    if (trivial && same != IR_NONE)
+                    {
+                        ir.replace(v, same);
+                        again = true;
+                    }
+                }
+            }
+        }
+        changed = changed || again;
+    }
+    return changed;
+}
+
+// Replaces each instruction with an identical one that dominates it, walking the dominator tree with a scoped table of
+// what has been computed so far. The opcodes are deterministic, so this is fine even for ones that can fault: the first
+// copy would have faulted already.
+static inline bool ir_value_numbering(IrFunc & ir)
+{
+    bool changed = false;
+    HashMap<Vec<uint64_t>, Vec<uint32_t>> available;
+    Vec<Vec<uint64_t>> pushed;
+    Vec<size_t> marks(ir.blocks.size(), 0);
+    ir_walk_dom_tree(ir, [&](uint32_t b)
+    {
+        marks[b] = pushed.size();
+        for (auto v : ir.blocks[b].insts)
+        {
+            auto & inst = ir.insts[v];
+            if (inst.removed || !inst.has_result || inst.op == IR_PHI || inst.op == IR_PARAM || ir_is_call(inst.op)
+                || ir_is_terminator(inst.op))
+                continue;
+            Vec<uint64_t> key;
+            key.push_back(inst.op);
+            for (auto a : inst.args)
+                key.push_back(ir.resolve(a));
+            for (auto byte : inst.imm)
+                key.push_back(byte);
+            auto & same = available[key];
+            if (same.size())
+            {
+                ir.replace(v, same.back());
+                changed = true;
+                continue;
+            }
+            same.push_back(v);
+            pushed.push_back(std::move(key));
+        }
+    }, [&](uint32_t b)
+    {
+        while (pushed.size() > marks[b])
+            available[pushed.pop_back()].pop_back();
+    });
+    return changed;
+}
+
+// A basic induction variable: a header phi that goes up by the same constant every iteration.
+struct IrInduction {
+    uint32_t phi;
+    uint32_t init; // value on entry, from the preheader
+    uint32_t next; // value for the next iteration, phi + step
+    int64_t step;
+};
+
+// A phi that only ever gets one arithmetic operation applied to it per iteration, like `sum += x`.
+struct IrReduction {
+    uint32_t phi;
+    uint32_t update; // the operation; its result is the phi's value for the next iteration
+    uint32_t term; // what gets folded in each iteration, or IR_NONE if it's the update's immediate
+};
+
+struct IrLoop {
+    uint32_t header;
+    uint32_t preheader; // the one block outside the loop that enters it; it goes nowhere else
+    uint32_t latch; // the one block inside the loop that goes back to the header, or IR_NONE if there are several
+    Vec<uint32_t> blocks; // header first
+    Vec<IrInduction> inductions;
+    Vec<IrReduction> reductions;
+};
+
+// Constant step of an instruction that adds a constant to its first operand, if it is one.
+static inline Option<int64_t> ir_constant_step(const IrInst & inst)
+{
+    int64_t imm = 0;
+    bool int_imm = inst.imm.size() == 9 && inst.imm[0] == TYPEID_INT;
+    if (int_imm)
+        memcpy(&imm, inst.imm.data() + 1, 8);
+    switch (inst.op)
+    {
+    case OP_JINCILTIMM: case OP_JINCILTIMM_INT: case OP_JINCILT: case OP_INCI: case OP_INCI_INT:
+        return 1;
+    case OP_DECI: case OP_DECI_INT:
+        return -1;
+    case OP_ADDIMM:
+        if (int_imm)
+            return imm;
+        return {};
+    case OP_SUBIMM: case OP_SUBIMM_I:
+        if (int_imm && imm != INT64_MIN)
+            return -imm;
+        return {};
+    default:
+        return {};
+    }
+}
+
+static inline bool ir_is_reduction_op(uint16_t op)
+{
+    switch (op)
+    {
+    case OP_ADD: case OP_ADD_F: case OP_ADD_FF: case OP_SUB: case OP_MUL:
+    case OP_ADDIMM: case OP_SUBIMM: case OP_SUBIMM_I: case OP_MULIMM:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Finds the natural loops (the blocks that reach a back edge into a header without going through the header) that
+// have a preheader, outer loops first, along with their basic induction variables and reductions.
+static inline Vec<IrLoop> ir_find_loops(const IrFunc & ir)
+{
+    Vec<IrLoop> loops;
+    Vec<uint8_t> in_loop(ir.blocks.size(), 0);
+    Vec<uint32_t> in_loop_uses(ir.insts.size(), 0);
+    Vec<uint32_t> work;
+    for (auto header : ir.rpo)
+    {
+        IrLoop loop;
+        loop.header = header;
+        loop.latch = IR_NONE;
+        size_t latches = 0;
+        in_loop[header] = 1;
+        loop.blocks.push_back(header);
+        for (auto p : ir.blocks[header].preds)
+        {
+            if (!ir.dominates(header, p))
+                continue;
+            latches += 1;
+            loop.latch = p;
+            if (!in_loop[p])
+            {
+                in_loop[p] = 1;
+                loop.blocks.push_back(p);
+                work.push_back(p);
+            }
+        }
+        while (work.size())
+        {
+            auto x = work.pop_back();
+            for (auto p : ir.blocks[x].preds)
+            {
+                if (!in_loop[p])
+                {
+                    in_loop[p] = 1;
+                    loop.blocks.push_back(p);
+                    work.push_back(p);
+                }
+            }
+        }
+        if (latches > 1)
+            loop.latch = IR_NONE;
+        
+        loop.preheader = IR_NONE;
+        size_t outside_preds = 0;
+        for (auto p : ir.blocks[header].preds)
+        {
+            if (!in_loop[p])
+            {
+                loop.preheader = p;
+                outside_preds += 1;
+            }
+        }
+        uint32_t succ[2];
+        bool usable = latches > 0 && outside_preds == 1 && ir.successors(loop.preheader, succ) == 1;
+        
+        if (usable && loop.latch != IR_NONE)
+        {
+            auto & preds = ir.blocks[header].preds;
+            size_t from_pre = 0;
+            size_t from_latch = 0;
+            for (size_t j = 0; j < preds.size(); j++)
+            {
+                if (preds[j] == loop.preheader)
+                    from_pre = j;
+                if (preds[j] == loop.latch)
+                    from_latch = j;
+            }
+            for (auto b : loop.blocks)
+            {
+                for (auto v : ir.blocks[b].insts)
+                {
+                    for (auto a : ir.insts[v].args)
+                        in_loop_uses[a] += 1;
+                }
+            }
+            for (auto v : ir.blocks[header].insts)
+            {
+                auto & phi = ir.insts[v];
+                if (phi.op != IR_PHI)
+                    break;
+                auto next = phi.args[from_latch];
+                auto & update = ir.insts[next];
+                if (!in_loop[update.block] || update.args.size() == 0)
+                    continue;
+                auto step = ir_constant_step(update);
+                if (phi.type == TYPEID_INT && update.args[0] == v && step)
+                    loop.inductions.push_back(IrInduction{v, phi.args[from_pre], next, *step});
+                // the phi goes into the update and nowhere else in the loop, and the update only goes around the loop
+                if (ir_is_reduction_op(update.op) && in_loop_uses[v] == 1 && in_loop_uses[next] == 1)
+                {
+                    if (update.args[0] == v)
+                        loop.reductions.push_back(IrReduction{v, next, update.args.size() > 1 ? update.args[1] : IR_NONE});
+                    else if (update.args.size() > 1 && update.args[1] == v && (update.op == OP_ADD || update.op == OP_MUL))
+                        loop.reductions.push_back(IrReduction{v, next, update.args[0]});
+                }
+            }
+            for (auto b : loop.blocks)
+            {
+                for (auto v : ir.blocks[b].insts)
+                {
+                    for (auto a : ir.insts[v].args)
+                        in_loop_uses[a] = 0;
+                }
+            }
+        }
+        
+        for (auto b : loop.blocks)
+            in_loop[b] = 0;
+        if (usable)
+            loops.push_back(std::move(loop));
+    }
+    return loops;
+}
+
+// Inserts v at the end of a block, but before its jump if it has one.
+static inline void ir_insert_at_end(IrFunc & ir, uint32_t block, uint32_t v)
+{
+    auto & insts = ir.blocks[block].insts;
+    ir.insts[v].block = block;
+    if (insts.size() && ir_is_terminator(ir.insts[insts.back()].op))
+        insts.insert_at(insts.size() - 1, v);
+    else
+        insts.push_back(v);
+}
+
+// Moves pure instructions whose operands all come from outside a loop into the loop's preheader.
+static inline bool ir_hoist_invariants(IrFunc & ir)
+{
+    bool changed = false;
+    Vec<uint8_t> in_loop(ir.blocks.size(), 0);
+    for (auto & loop : ir_find_loops(ir))
+    {
+        for (auto b : loop.blocks)
+            in_loop[b] = 1;
+        auto & pre_insts = ir.blocks[loop.preheader].insts;
+        uint32_t pre_end = pre_insts.size() && ir_is_terminator(ir.insts[pre_insts.back()].op) ? pre_insts.back() : IR_NONE;
+        
+        // in reverse postorder, so that an instruction comes after the ones it uses and can follow them out of the loop
+        for (auto b : ir.rpo)
+        {
+            if (!in_loop[b])
+                continue;
+            auto & insts = ir.blocks[b].insts;
+            size_t kept = 0;
+            for (size_t k = 0; k < insts.size(); k++)
+            {
+                auto v = insts[k];
+                auto & inst = ir.insts[v];
+                bool invariant = !inst.removed && inst.op != IR_PHI && ir_is_pure(ir, inst);
+                for (auto a : inst.args)
+                {
+                    a = ir.resolve(a);
+                    invariant = invariant && !in_loop[ir.insts[a].block] && a != pre_end;
+                }
+                if (!invariant)
+                {
+                    insts[kept++] = v;
+                    continue;
+                }
+                ir_insert_at_end(ir, loop.preheader, v);
+                changed = true;
+            }
+            while (insts.size() > kept)
+                insts.pop_back();
+        }
+        for (auto b : loop.blocks)
+            in_loop[b] = 0;
+    }
+    return changed;
+}
+
+static inline Vec<uint8_t> ir_int_imm(int64_t n)
+{
+    Vec<uint8_t> imm;
+    imm.push_back(TYPEID_INT);
+    for (int i = 0; i < 8; i++)
+        imm.push_back(uint8_t(uint64_t(n) >> (i * 8)));
+    return imm;
+}
+
+// Strength reduction of derived induction variables: an int value in a loop that's a * iv + b for a basic induction
+// variable iv and constants a and b (like `i<<1 - 1`) gets a header phi of its own that starts at a * init + b and goes
+// up by a * step each iteration, so the loop adds one constant instead of redoing the whole expression.
+static inline bool ir_reduce_inductions(IrFunc & ir)
+{
+    struct Affine {
+        uint32_t iv = IR_NONE; // index into the loop's inductions
+        int64_t a = 0;
+        int64_t b = 0;
+    };
+    struct Reduced {
+        Affine form;
+        uint32_t phi;
+    };
+    bool changed = false;
+    Vec<uint8_t> in_loop(ir.blocks.size(), 0);
+    for (auto & loop : ir_find_loops(ir))
+    {
+        if (loop.latch == IR_NONE || loop.inductions.size() == 0)
+            continue;
+        for (auto b : loop.blocks)
+            in_loop[b] = 1;
+        
+        HashMap<uint32_t, Affine> affine;
+        for (uint32_t k = 0; k < loop.inductions.size(); k++)
+        {
+            affine.insert(loop.inductions[k].phi, Affine{k, 1, 0});
+            affine.insert(loop.inductions[k].next, Affine{k, 1, loop.inductions[k].step});
+        }
+        Vec<uint32_t> derived;
+        for (auto b : ir.rpo)
+        {
+            if (!in_loop[b])
+                continue;
+            for (auto v : ir.blocks[b].insts)
+            {
+                auto & inst = ir.insts[v];
+                if (inst.op == IR_PHI || inst.type != TYPEID_INT || !ir_is_pure(ir, inst) || affine.count(v))
+                    continue;
+                if (inst.args.size() == 0 || !affine.count(inst.args[0]))
+                    continue;
+                auto form = affine[inst.args[0]];
+                int64_t imm = 0;
+                bool int_imm = inst.imm.size() == 9 && inst.imm[0] == TYPEID_INT;
+                if (int_imm)
+                    memcpy(&imm, inst.imm.data() + 1, 8);
+                bool ok = false;
+                switch (inst.op)
+                {
+                case OP_SHLIMM: case OP_SHLIMM_I:
+                    ok = int_imm && imm >= 0 && imm < 62 && !__builtin_mul_overflow(form.a, int64_t(1) << imm, &form.a)
+                        && !__builtin_mul_overflow(form.b, int64_t(1) << imm, &form.b);
+                    break;
+                case OP_MULIMM:
+                    ok = int_imm && !__builtin_mul_overflow(form.a, imm, &form.a) && !__builtin_mul_overflow(form.b, imm, &form.b);
+                    break;
+                case OP_ADDIMM:
+                    ok = int_imm && !__builtin_add_overflow(form.b, imm, &form.b);
+                    break;
+                case OP_SUBIMM: case OP_SUBIMM_I:
+                    ok = int_imm && !__builtin_sub_overflow(form.b, imm, &form.b);
+                    break;
+                case OP_INCI: case OP_INCI_INT:
+                    ok = !__builtin_add_overflow(form.b, int64_t(1), &form.b);
+                    break;
+                case OP_DECI: case OP_DECI_INT:
+                    ok = !__builtin_sub_overflow(form.b, int64_t(1), &form.b);
+                    break;
+                case OP_NEGATE:
+                    ok = !__builtin_sub_overflow(int64_t(0), form.a, &form.a) && !__builtin_sub_overflow(int64_t(0), form.b, &form.b);
+                    break;
+                }
+                if (!ok || form.a == 0)
+                    continue;
+                affine.insert(v, form);
+                derived.push_back(v);
+            }
+        }
+        
+        // only the ends of the chains need registers: values used by something that isn't itself affine in the loop
+        Vec<uint8_t> is_root(ir.insts.size(), 0);
+        for (auto & block : ir.blocks)
+        {
+            for (auto v : block.insts)
+            {
+                auto & inst = ir.insts[v];
+                bool user_is_derived = affine.count(v) && in_loop[inst.block] && inst.op != IR_PHI;
+                for (auto a : inst.args)
+                    is_root[a] = is_root[a] || !user_is_derived;
+            }
+        }
+        
+        Vec<Reduced> reduced;
+        auto & preds = ir.blocks[loop.header].preds;
+        for (auto d : derived)
+        {
+            if (!is_root[d])
+                continue;
+            auto form = affine[d];
+            auto & iv = loop.inductions[form.iv];
+            int64_t step;
+            if (__builtin_mul_overflow(form.a, iv.step, &step) || step == INT64_MIN)
+                continue;
+            uint32_t phi = IR_NONE;
+            for (auto & r : reduced)
+            {
+                if (r.form.iv == form.iv && r.form.a == form.a && r.form.b == form.b)
+                    phi = r.phi;
+            }
+            if (phi == IR_NONE)
+            {
+                // start: a * init + b, worked out in the preheader
+                auto emit_start = [&](uint16_t op, uint32_t arg, int64_t imm)
+                {
+                    auto v = ir.add_inst(op, loop.preheader);
+                    ir.blocks[loop.preheader].insts.pop_back();
+                    if (arg != IR_NONE)
+                        ir.insts[v].args.push_back(arg);
+                    ir.insts[v].imm = ir_int_imm(imm);
+                    ir.insts[v].has_result = true;
+                    ir.insts[v].type = TYPEID_INT;
+                    ir_insert_at_end(ir, loop.preheader, v);
+                    return v;
+                };
+                auto & init = ir.insts[iv.init];
+                uint32_t start = iv.init;
+                if (init.op == OP_SETIMM && init.imm.size() == 9 && init.imm[0] == TYPEID_INT)
+                {
+                    int64_t value;
+                    memcpy(&value, init.imm.data() + 1, 8);
+                    if (__builtin_mul_overflow(value, form.a, &value) || __builtin_add_overflow(value, form.b, &value))
+                        continue;
+                    start = emit_start(OP_SETIMM, IR_NONE, value);
+                }
+                else
+                {
+                    if (form.b == INT64_MIN)
+                        continue;
+                    if (form.a != 1)
+                        start = emit_start(OP_MULIMM, start, form.a);
+                    if (form.b != 0)
+                        start = emit_start(OP_SUBIMM_I, start, -form.b);
+                }
+                
+                phi = ir.add_inst(IR_PHI, loop.header);
+                ir.blocks[loop.header].insts.pop_back();
+                ir.blocks[loop.header].insts.insert_at(0, phi);
+                ir.insts[phi].has_result = true;
+                ir.insts[phi].type = TYPEID_INT;
+                
+                auto next = ir.add_inst(OP_SUBIMM_I, loop.latch);
+                ir.blocks[loop.latch].insts.pop_back();
+                ir.insts[next].args.push_back(phi);
+                ir.insts[next].imm = ir_int_imm(-step);
+                ir.insts[next].has_result = true;
+                ir.insts[next].type = TYPEID_INT;
+                ir_insert_at_end(ir, loop.latch, next);
+                
+                for (auto p : preds)
+                    ir.insts[phi].args.push_back(p == loop.preheader ? start : next);
+                reduced.push_back(Reduced{form, phi});
+            }
+            ir.replace(d, phi);
+            changed = true;
+        }
+        for (auto b : loop.blocks)
+            in_loop[b] = 0;
+    }
+    return changed;
+}
+
+// Removes everything that no side effect, fault or control flow depends on.
+static inline bool ir_dead_code(IrFunc & ir)
+{
+    Vec<uint8_t> live(ir.insts.size(), 0);
+    Vec<uint32_t> work;
+    for (auto & block : ir.blocks)
+    {
+        for (auto v : block.insts)
+        {
+            if (!ir.insts[v].removed && !ir_is_pure(ir, ir.insts[v]))
+            {
+                live[v] = 1;
+                work.push_back(v);
+            }
+        }
+    }
+    while (work.size())
+    {
+        auto v = work.pop_back();
+        for (auto a : ir.insts[v].args)
+        {
+            a = ir.resolve(a);
+            if (!live[a])
+            {
+                live[a] = 1;
+                work.push_back(a);
+            }
+        }
+    }
+    bool changed = false;
+    for (auto & block : ir.blocks)
+    {
+        for (auto v : block.insts)
+        {
+            if (!live[v] && !ir.insts[v].removed)
+            {
+                ir.insts[v].removed = true;
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+struct IrPass {
+    const char * name;
+    bool (*run)(IrFunc & ir); // returns whether it changed anything
+};
+
+static const IrPass ir_passes[] = {
+    {"type specialization", ir_specialize_types},
+    {"copy propagation", ir_copy_propagation},
+    {"value numbering", ir_value_numbering},
+    {"loop-invariant code motion", ir_hoist_invariants},
+    {"induction variable strength reduction", ir_reduce_inductions},
+    {"dead code elimination", ir_dead_code},
+};
+
+// Runs all the passes in order, over and over, until a round changes nothing (or for IR_MAX_ROUNDS rounds).
+static inline void ir_run_passes(IrFunc & ir)
+{
+    for (int round = 0; round < IR_MAX_ROUNDS; round++)
+    {
+        bool changed = false;
+        for (auto & pass : ir_passes)
+        {
+            bool pass_changed = pass.run(ir);
+            ir_tidy(ir);
+        #ifdef IR_PRINT_PASSES
+            if (pass_changed)
+                printf("ir: round %d: %s changed something\n", round, pass.name);
+        #endif
+            changed = changed || pass_changed;
+        }
+        if (!changed)
+            return;
+    }
+}
+
+// Describes a loop as a bulk loop kernel (see bulk_loop.hpp) if it can be one: a header with nothing but phis and the
+// jump that counts, one block of pure arithmetic that goes straight back to it, and header phis that are all induction
+// variables, sign toggles (`flip = -flip`) or reductions. Only what the reductions fold in gets lane ops.
+static inline bool ir_build_bulk_loop(const IrFunc & ir, const IrLoop & loop, IrBulkLoop & bulk)
+{
+    if (loop.latch == IR_NONE || loop.latch == loop.header || loop.blocks.size() != 2)
+        return false;
+    auto & header = ir.blocks[loop.header];
+    auto & body = ir.blocks[loop.latch];
+    uint32_t succ[2];
+    if (ir.successors(loop.latch, succ) != 1 || header.target != loop.latch || header.insts.size() == 0)
+        return false;
+    auto end = header.insts.back();
+    auto & jump = ir.insts[end];
+    if (jump.op != OP_JINCILTIMM && jump.op != OP_JINCILTIMM_INT && jump.op != OP_JINCILT)
+        return false;
+    size_t from_latch = 0;
+    while (header.preds[from_latch] != loop.latch)
+        from_latch++;
+    auto is_number = [&](uint32_t v) { return ir.insts[v].type == TYPEID_INT || ir.insts[v].type == TYPEID_FLOAT; };
+    auto in_loop = [&](uint32_t v) { return ir.insts[v].block == loop.header || ir.insts[v].block == loop.latch; };
+    
+    BulkKernel kernel;
+    Vec<uint8_t> operand_of(ir.insts.size(), BULK_NONE);
+    Vec<uint8_t> slot_of(ir.insts.size(), BULK_NONE);
+    auto add_operand = [&](uint32_t v, uint8_t role) -> uint8_t
+    {
+        if (kernel.operand_count == BULK_MAX_OPERANDS)
+            return BULK_NONE;
+        auto o = kernel.operand_count++;
+        kernel.operands[o].role = role;
+        kernel.operands[o].type = ir.insts[v].type;
+        operand_of[v] = o;
+        bulk.operands.push_back(v);
+        return o;
+    };
+    
+    // the header's phis, which the op moves to where the loop leaves them
+    for (auto v : header.insts)
+    {
+        if (v == end)
+            continue;
+        auto & phi = ir.insts[v];
+        if (phi.op != IR_PHI || !is_number(v))
+            return false;
+        uint8_t role = BULK_NONE;
+        int64_t step = 0;
+        for (auto & iv : loop.inductions)
+        {
+            if (iv.phi == v)
+            {
+                role = BULK_INDUCTION;
+                step = iv.step;
+            }
+        }
+        for (auto & r : loop.reductions)
+        {
+            if (role == BULK_NONE && r.phi == v)
+                role = BULK_REDUCTION;
+        }
+        auto & next = ir.insts[phi.args[from_latch]];
+        if (role == BULK_NONE && next.args.size() && next.args[0] == v
+            && (next.op == OP_NEGATE || (next.op == OP_NEGATE_F && phi.type == TYPEID_FLOAT)))
+            role = BULK_TOGGLE;
+        if (role == BULK_NONE)
+            return false;
+        auto o = add_operand(v, role);
+        if (o == BULK_NONE)
+            return false;
+        kernel.operands[o].step = step;
+    }
+    auto counter = jump.args[0];
+    if (operand_of[counter] == BULK_NONE || kernel.operands[operand_of[counter]].role != BULK_INDUCTION
+        || ir.insts[counter].args[from_latch] != end)
+        return false;
+    kernel.counter = operand_of[counter];
+    if (jump.op == OP_JINCILT)
+    {
+        auto limit = jump.args[1];
+        if (in_loop(limit) || ir.insts[limit].type != TYPEID_INT)
+            return false;
+        kernel.limit_operand = add_operand(limit, BULK_INVARIANT);
+        if (kernel.limit_operand == BULK_NONE)
+            return false;
+    }
+    else
+        memcpy(&kernel.limit, jump.imm.data(), 8);
+    
+    // everything in the body has to be safe to skip, and only what a reduction uses has to be computed
+    Vec<uint8_t> needed(ir.insts.size(), 0);
+    Vec<uint8_t> is_update(ir.insts.size(), 0);
+    for (auto & r : loop.reductions)
+    {
+        if (operand_of[r.phi] == BULK_NONE || kernel.operands[operand_of[r.phi]].role != BULK_REDUCTION)
+            continue;
+        is_update[r.update] = 1;
+        if (r.term != IR_NONE)
+            needed[r.term] = 1;
+    }
+    for (size_t k = body.insts.size(); k-- > 0;)
+    {
+        auto v = body.insts[k];
+        auto & inst = ir.insts[v];
+        if (inst.op == OP_J && k + 1 == body.insts.size())
+            continue;
+        if (!ir_is_pure(ir, inst))
+            return false;
+        if (needed[v])
+        {
+            for (auto a : inst.args)
+                needed[a] = 1;
+        }
+    }
+    
+    struct Lane {
+        uint8_t slot;
+        TypeId type;
+    };
+    auto new_slot = [&]() -> uint8_t
+    {
+        return kernel.slot_count < BULK_MAX_SLOTS ? kernel.slot_count++ : BULK_NONE;
+    };
+    auto constant = [&](uint64_t bits) -> uint8_t
+    {
+        for (size_t c = 0; c < kernel.constant_count; c++)
+        {
+            if (kernel.constants[c].bits == bits)
+                return kernel.constants[c].slot;
+        }
+        auto slot = new_slot();
+        if (slot != BULK_NONE)
+            kernel.constants[kernel.constant_count++] = BulkConstant{slot, bits};
+        return slot;
+    };
+    auto imm_lane = [&](const IrInst & inst) -> Lane
+    {
+        if (inst.imm.size() != 9 || (inst.imm[0] != TYPEID_INT && inst.imm[0] != TYPEID_FLOAT))
+            return Lane{BULK_NONE, TYPEID_INVALID};
+        uint64_t bits;
+        memcpy(&bits, inst.imm.data() + 1, 8);
+        return Lane{constant(bits), inst.imm[0]};
+    };
+    // slot with a value on each iteration: phis and invariants are operands, and the loop's values come from lane ops
+    // that already ran
+    auto lane = [&](uint32_t v) -> Lane
+    {
+        auto & inst = ir.insts[v];
+        if (slot_of[v] != BULK_NONE || !is_number(v))
+            return Lane{slot_of[v], inst.type};
+        if (operand_of[v] != BULK_NONE)
+        {
+            auto & operand = kernel.operands[operand_of[v]];
+            if (operand.role != BULK_REDUCTION)
+                operand.slot = slot_of[v] = new_slot();
+        }
+        else if (in_loop(v))
+            return Lane{BULK_NONE, inst.type};
+        else if (inst.op == OP_SETIMM)
+            slot_of[v] = imm_lane(inst).slot;
+        else if (add_operand(v, BULK_INVARIANT) != BULK_NONE)
+            kernel.operands[operand_of[v]].slot = slot_of[v] = new_slot();
+        return Lane{slot_of[v], inst.type};
+    };
+    auto emit = [&](uint8_t op, uint8_t a, uint8_t b) -> uint8_t
+    {
+        if (op == BULK_NONE || a == BULK_NONE || kernel.op_count == BULK_MAX_OPS)
+            return BULK_NONE;
+        auto dest = new_slot();
+        if (dest != BULK_NONE)
+            kernel.ops[kernel.op_count++] = BulkLaneOp{op, dest, a, b};
+        return dest;
+    };
+    Vec<uint8_t> float_of(BULK_MAX_SLOTS, BULK_NONE);
+    auto as_float = [&](Lane x) -> uint8_t
+    {
+        if (x.slot == BULK_NONE || x.type == TYPEID_FLOAT)
+            return x.slot;
+        if (float_of[x.slot] == BULK_NONE)
+            float_of[x.slot] = emit(BULK_I_TO_F, x.slot, BULK_NONE);
+        return float_of[x.slot];
+    };
+    
+    // Lane ops for a value in the loop. The opcodes follow the interpreter's promotion rules, so an int that meets a
+    // float becomes one first; typed opcodes only take what their operands were inferred to be.
+    auto lane_op = [&](uint32_t v) -> bool
+    {
+        auto & inst = ir.insts[v];
+        uint8_t int_op = BULK_NONE;
+        uint8_t float_op = BULK_NONE;
+        TypeId need_x = TYPEID_INVALID;
+        TypeId need_y = TYPEID_INVALID;
+        enum { Y_NONE, Y_ARG, Y_IMM, Y_ONE } y_from = inst.args.size() > 1 ? Y_ARG : Y_IMM;
+        switch (inst.op)
+        {
+        case OP_SET: case OP_SET_I: case OP_SET_F:
+            slot_of[v] = lane(inst.args[0]).slot;
+            return slot_of[v] != BULK_NONE && ir.insts[inst.args[0]].type == inst.type;
+        case OP_ADD: case OP_ADDIMM: case OP_ADD_F: case OP_ADD_FF:
+            int_op = BULK_I_ADD;
+            float_op = BULK_F_ADD;
+            need_x = inst.op == OP_ADD_F || inst.op == OP_ADD_FF ? TYPEID_FLOAT : TYPEID_INVALID;
+            need_y = inst.op == OP_ADD_FF ? TYPEID_FLOAT : TYPEID_INVALID;
+            break;
+        case OP_INCI: case OP_INCI_INT: case OP_JINCILTIMM: case OP_JINCILTIMM_INT: case OP_JINCILT:
+            int_op = BULK_I_ADD;
+            need_x = TYPEID_INT;
+            y_from = Y_ONE;
+            break;
+        case OP_SUB: case OP_SUBIMM: case OP_SUBIMM_I:
+            int_op = BULK_I_SUB;
+            float_op = BULK_F_SUB;
+            need_x = need_y = inst.op == OP_SUBIMM_I ? TYPEID_INT : TYPEID_INVALID;
+            break;
+        case OP_DECI: case OP_DECI_INT:
+            int_op = BULK_I_SUB;
+            need_x = TYPEID_INT;
+            y_from = Y_ONE;
+            break;
+        case OP_MUL: case OP_MULIMM:
+            int_op = BULK_I_MUL;
+            float_op = BULK_F_MUL;
+            break;
+        // int division can fault, so only the float kind
+        case OP_DIV: case OP_DIVIMM: case OP_DIV_F: case OP_DIV_FF: case OP_DIV_FI:
+            float_op = BULK_F_DIV;
+            need_x = inst.op == OP_DIV || inst.op == OP_DIVIMM ? TYPEID_INVALID : TYPEID_FLOAT;
+            need_y = inst.op == OP_DIV_FF ? TYPEID_FLOAT : inst.op == OP_DIV_FI ? TYPEID_INT : TYPEID_INVALID;
+            break;
+        case OP_SHLIMM: case OP_SHLIMM_I: case OP_SHRIMM:
+        {
+            int64_t shift = -1;
+            if (inst.imm.size() == 9 && inst.imm[0] == TYPEID_INT)
+                memcpy(&shift, inst.imm.data() + 1, 8);
+            if (shift < 0 || shift > 63)
+                return false;
+            int_op = inst.op == OP_SHRIMM ? BULK_I_SHR : BULK_I_SHL;
+            need_x = need_y = TYPEID_INT;
+            break;
+        }
+        case OP_NEGATE: case OP_NEGATE_F:
+            int_op = BULK_I_NEG;
+            float_op = BULK_F_NEG;
+            need_x = inst.op == OP_NEGATE_F ? TYPEID_FLOAT : TYPEID_INVALID;
+            y_from = Y_NONE;
+            break;
+        default:
+            return false;
+        }
+        
+        auto x = lane(inst.args[0]);
+        Lane y = Lane{BULK_NONE, TYPEID_INVALID};
+        if (y_from == Y_ARG)
+            y = lane(inst.args[1]);
+        else if (y_from == Y_IMM)
+            y = imm_lane(inst);
+        else if (y_from == Y_ONE)
+            y = Lane{constant(1), TYPEID_INT};
+        if (x.slot == BULK_NONE || (y_from != Y_NONE && y.slot == BULK_NONE))
+            return false;
+        if ((need_x != TYPEID_INVALID && x.type != need_x) || (need_y != TYPEID_INVALID && y.type != need_y))
+            return false;
+        bool ints = x.type == TYPEID_INT && (y_from == Y_NONE || y.type == TYPEID_INT);
+        TypeId type = ints ? TYPEID_INT : TYPEID_FLOAT;
+        if (type != inst.type)
+            return false;
+        if (ints)
+            slot_of[v] = emit(int_op, x.slot, y.slot);
+        else
+            slot_of[v] = emit(float_op, as_float(x), y_from == Y_NONE ? BULK_NONE : as_float(y));
+        return slot_of[v] != BULK_NONE;
+    };
+    
+    if (needed[end] && !lane_op(end))
+        return false;
+    for (auto v : body.insts)
+    {
+        if (needed[v] && !is_update[v] && !lane_op(v))
+            return false;
+    }
+    
+    for (auto & r : loop.reductions)
+    {
+        auto o = operand_of[r.phi];
+        if (o == BULK_NONE || kernel.operands[o].role != BULK_REDUCTION)
+            continue;
+        auto & update = ir.insts[r.update];
+        auto type = ir.insts[r.phi].type;
+        auto term = r.term != IR_NONE ? lane(r.term) : imm_lane(update);
+        uint8_t int_op = BULK_NONE;
+        uint8_t float_op = BULK_NONE;
+        TypeId need_term = TYPEID_INVALID;
+        switch (update.op)
+        {
+        case OP_ADD: case OP_ADDIMM: case OP_ADD_F: case OP_ADD_FF:
+            int_op = BULK_I_ADD;
+            float_op = BULK_F_ADD;
+            if (update.op != OP_ADD && update.op != OP_ADDIMM && type != TYPEID_FLOAT)
+                return false;
+            need_term = update.op == OP_ADD_FF ? TYPEID_FLOAT : TYPEID_INVALID;
+            break;
+        case OP_SUB: case OP_SUBIMM: case OP_SUBIMM_I:
+            int_op = BULK_I_SUB;
+            float_op = BULK_F_SUB;
+            need_term = update.op == OP_SUBIMM_I ? TYPEID_INT : TYPEID_INVALID;
+            break;
+        case OP_MUL: case OP_MULIMM:
+            int_op = BULK_I_MUL;
+            float_op = BULK_F_MUL;
+            break;
+        default:
+            return false;
+        }
+        if (term.slot == BULK_NONE || (need_term != TYPEID_INVALID && term.type != need_term) || update.type != type)
+            return false;
+        if (type == TYPEID_INT && term.type != TYPEID_INT)
+            return false;
+        kernel.operands[o].op = type == TYPEID_INT ? int_op : float_op;
+        kernel.operands[o].term = type == TYPEID_INT ? term.slot : as_float(term);
+        if (kernel.operands[o].term == BULK_NONE)
+            return false;
+    }
+    
+    bulk.preheader = loop.preheader;
+    bulk_encode(kernel, bulk.kernel);
+    return true;
+}
+
+// Finds the loops that bulk loop kernels can run, for ir_lower to put an OP_BULKLOOP in front of.
+static inline void ir_vectorize_loops(IrFunc & ir)
+{
+    for (auto & loop : ir_find_loops(ir))
+    {
+        IrBulkLoop bulk;
+        if (!ir_build_bulk_loop(ir, loop, bulk))
+            continue;
+    #ifdef IR_PRINT_PASSES
+        printf("ir: bulk loop at block %u, %zu operands\n", loop.header, bulk.operands.size());
+    #endif
+        ir.bulk_loops.push_back(std::move(bulk));
+    }
+}
+
+struct IrCopy {
+    size_t dest;
+    size_t src;
+    TypeId type;
+};
+
+static inline void ir_emit_copy(Vec<uint8_t> & code, IrCopy copy)
+{
+    if (copy.dest == copy.src)
+        return;
+    if (copy.type == TYPEID_INT)
+        push_op(code, OP_SET_I);
+    else if (copy.type == TYPEID_FLOAT)
+        push_op(code, OP_SET_F);
+    else
+        push_op(code, OP_SET);
+    push_varlen_int(code, copy.dest);
+    push_varlen_int(code, copy.src);
+}
+
+// Emits copies that all read before any of them writes. Cycles go through a new register from next_reg.
+static inline void ir_emit_parallel_copy(Vec<uint8_t> & code, Vec<IrCopy> copies, size_t & next_reg)
+{
+    while (copies.size())
+    {
+        bool emitted = false;
+        for (size_t i = 0; i < copies.size() && !emitted; i++)
+        {
+            bool blocked = false;
+            for (size_t j = 0; j < copies.size(); j++)
+                blocked = blocked || (j != i && copies[j].src == copies[i].dest);
+            if (blocked)
+                continue;
+            ir_emit_copy(code, copies.erase_at(i));
+            emitted = true;
+        }
+        if (emitted)
+            continue;
+        // every copy left is on a cycle: save one destination so that its copy can go
+        auto saved = copies[0].dest;
+        size_t temp = next_reg++;
+        for (auto & copy : copies)
+        {
+            if (copy.src == saved)
+            {
+                ir_emit_copy(code, IrCopy{temp, saved, copy.type});
+                break;
+            }
+        }
+        for (auto & copy : copies)
+        {
+            if (copy.src == saved)
+                copy.src = temp;
+        }
+    }
+}
+
+// Turns the IR back into code, with one register for each value (the arguments keep theirs) and the phis as copies at
+// the ends of their predecessors. A copy goes before the branch at the end of a predecessor when that can't clobber
+// anything; otherwise the edge gets a block of its own. Returns the number of registers used. Where each lifted
+// instruction ended up goes in moves, for remapping the line table.
+static inline size_t ir_lower(IrFunc & ir, Vec<uint8_t> & code, Vec<CodeMove> & moves)
+{
+    size_t block_count = ir.blocks.size();
+    size_t next_reg = ir.num_args;
+    Vec<size_t> reg_of(ir.insts.size(), SIZE_MAX);
+    for (auto & block : ir.blocks)
+    {
+        for (auto v : block.insts)
+        {
+            if (ir.insts[v].op == IR_PARAM)
+                reg_of[v] = ir.insts[v].reg;
+            else if (ir.insts[v].has_result)
+                reg_of[v] = next_reg++;
+        }
+    }
+    auto terminator = [&](uint32_t b) -> uint32_t
+    {
+        auto & insts = ir.blocks[b].insts;
+        return insts.size() && ir_is_terminator(ir.insts[insts.back()].op) ? insts.back() : IR_NONE;
+    };
+    
+    // layout: the blocks in order, with the edges that need blocks of their own after their predecessor if they fall
+    // through, or right before their successor if they're jumped to. The edges before a block are led by a J to it for
+    // whatever falls through from above, and each but the last ends in a J to it too. Most edges only have copies
+    // that the register allocator coalesces away, and it threads jumps through the Js that are left and drops the ones
+    // nothing reaches, so in the end most branches go straight to their block.
+    struct Item {
+        uint32_t block; // IR_NONE for an edge
+        Vec<IrCopy> copies;
+        uint32_t jump_to = IR_NONE; // block that an edge jumps to at its end
+    };
+    struct Edge {
+        uint32_t from;
+        Vec<IrCopy> copies;
+    };
+    Vec<Item> items;
+    Vec<Vec<IrCopy>> end_copies(block_count, Vec<IrCopy>{});
+    Vec<Vec<IrCopy>> fallthrough_copies(block_count, Vec<IrCopy>{});
+    Vec<Vec<Edge>> edges_before(block_count, Vec<Edge>{});
+    Vec<size_t> jump_item(block_count, SIZE_MAX); // where each block's jump goes, if not to the target's own item
+    Vec<size_t> block_item(block_count, 0);
+    for (uint32_t b = 0; b < block_count; b++)
+    {
+        uint32_t succ[2];
+        size_t count = ir.successors(b, succ);
+        auto end = terminator(b);
+        for (size_t s = 0; s < count; s++)
+        {
+            auto & to = ir.blocks[succ[s]];
+            size_t j = 0;
+            while (to.preds[j] != b)
+                j++;
+            Vec<IrCopy> copies;
+            bool fits_before_end = count == 1 || !ir.dominates(succ[s], b);
+            for (size_t k = 0; k < to.insts.size() && ir.insts[to.insts[k]].op == IR_PHI; k++)
+            {
+                auto phi = to.insts[k];
+                auto arg = ir.insts[phi].args[j];
+                copies.push_back(IrCopy{reg_of[phi], reg_of[arg], ir.insts[arg].type});
+                fits_before_end = fits_before_end && arg != end;
+                if (end != IR_NONE)
+                {
+                    for (auto a : ir.insts[end].args)
+                        fits_before_end = fits_before_end && a != phi;
+                }
+            }
+            if (copies.size() == 0)
+                continue;
+            if (fits_before_end)
+            {
+                for (auto & copy : copies)
+                    end_copies[b].push_back(copy);
+            }
+            else if (succ[s] == ir.blocks[b].fallthrough)
+                fallthrough_copies[b] = std::move(copies);
+            else
+                edges_before[succ[s]].push_back(Edge{b, std::move(copies)});
+        }
+    }
+    for (uint32_t b = 0; b < block_count; b++)
+    {
+        auto & edges = edges_before[b];
+        if (edges.size())
+            items.push_back(Item{IR_NONE, {}, b});
+        for (size_t e = 0; e < edges.size(); e++)
+        {
+            jump_item[edges[e].from] = items.size();
+            items.push_back(Item{IR_NONE, std::move(edges[e].copies), e + 1 < edges.size() ? b : IR_NONE});
+        }
+        block_item[b] = items.size();
+        items.push_back(Item{b, {}});
+        if (fallthrough_copies[b].size())
+        {
+            if (ir.blocks[b].target == ir.blocks[b].fallthrough)
+                jump_item[b] = items.size();
+            items.push_back(Item{IR_NONE, std::move(fallthrough_copies[b])});
+        }
+    }
+    for (uint32_t b = 0; b < block_count; b++)
+    {
+        if (jump_item[b] == SIZE_MAX && ir.blocks[b].target != IR_NONE)
+            jump_item[b] = block_item[ir.blocks[b].target];
+    }
+    
+    struct JumpField {
+        size_t pos;
+        size_t item;
+    };
+    Vec<JumpField> jump_fields;
+    Vec<size_t> item_pos(items.size(), 0);
+    // a bulk loop runs once its phis have their starting values
+    auto emit_end_copies = [&](uint32_t b)
+    {
+        ir_emit_parallel_copy(code, end_copies[b], next_reg);
+        for (auto & bulk : ir.bulk_loops)
+        {
+            if (bulk.preheader != b)
+                continue;
+            push_op(code, OP_BULKLOOP);
+            for (size_t k = 0; k < BULK_MAX_OPERANDS; k++)
+                push_varlen_int(code, reg_of[bulk.operands[k < bulk.operands.size() ? k : 0]]);
+            for (auto byte : bulk.kernel)
+                code.push_back(byte);
+        }
+    };
+    for (size_t i = 0; i < items.size(); i++)
+    {
+        auto & item = items[i];
+        item_pos[i] = code.size();
+        if (item.block == IR_NONE)
+        {
+            ir_emit_parallel_copy(code, item.copies, next_reg);
+            if (item.jump_to != IR_NONE)
+            {
+                push_op(code, OP_J);
+                jump_fields.push_back(JumpField{code.size(), block_item[item.jump_to]});
+                push_u32(code, 0);
+            }
+            continue;
+        }
+        auto b = item.block;
+        auto end = terminator(b);
+        for (auto v : ir.blocks[b].insts)
+        {
+            auto & inst = ir.insts[v];
+            if (inst.op == IR_PHI || inst.op == IR_PARAM)
+                continue;
+            if (v == end)
+                emit_end_copies(b);
+            if (inst.origin != SIZE_MAX)
+                moves.push_back(CodeMove{inst.origin, code.size()});
+            auto operands = opcode_operands(inst.op);
+            auto roles = register_roles(inst.op);
+            size_t reg_args = 0;
+            for (size_t k = 0; roles[k]; k++)
+            {
+                if (roles[k] == 'u' || roles[k] == 'm')
+                    reg_args += 1;
+                if (roles[k] == 'm')
+                    ir_emit_copy(code, IrCopy{reg_of[v], reg_of[inst.args[0]], ir.insts[inst.args[0]].type});
+            }
+            size_t argbase = next_reg;
+            for (size_t a = reg_args; a < inst.args.size(); a++)
+                ir_emit_copy(code, IrCopy{next_reg++, reg_of[inst.args[a]], ir.insts[inst.args[a]].type});
+            
+            push_op(code, inst.op);
+            size_t a = 0;
+            size_t p = 0;
+            for (size_t k = 0; operands[k]; k++)
+            {
+                if (roles[k] == 'u')
+                    push_varlen_int(code, reg_of[inst.args[a++]]);
+                else if (roles[k] == 'm' || roles[k] == 'd')
+                {
+                    push_varlen_int(code, reg_of[v]);
+                    a += roles[k] == 'm';
+                }
+                else if (roles[k] == 'b')
+                    push_varlen_int(code, argbase);
+                else if (operands[k] == 'j')
+                {
+                    jump_fields.push_back(JumpField{code.size(), jump_item[b]});
+                    push_u32(code, 0);
+                }
+                else
+                {
+                    size_t len = operand_length(inst.imm.data() + p, operands[k]);
+                    for (size_t byte = 0; byte < len; byte++)
+                        code.push_back(inst.imm[p + byte]);
+                    p += len;
+                }
+            }
+        }
+        if (end == IR_NONE)
+            emit_end_copies(b);
+    }
+    for (auto & field : jump_fields)
+    {
+        int32_t offset = int64_t(item_pos[field.item]) - int64_t(field.pos + 4);
+        memcpy(code.data() + field.pos, &offset, 4);
+    }
+    return next_reg;
+}
+
+// Runs func's code through the IR and its passes, then packs its registers. Code that the IR can't take, or whose
+// lowered form can't be allocated, only gets its registers packed.
+static inline void optimize_function(Shared<Function> func)
+{
+    IrFunc ir;
+    if (ir_lift(func->code, func->num_args, ir))
+    {
+        ir_infer_types(ir);
+        ir_run_passes(ir);
+        ir_vectorize_loops(ir);
+        auto old_code = func->code;
+        auto old_line_table = func->line_table;
+        size_t old_vars = func->num_vars;
+        size_t old_regs = func->num_regs;
+        func->code = {};
+        Vec<CodeMove> moves;
+        size_t reg_count = ir_lower(ir, func->code, moves);
+        func->line_table = line_table_remap(func->line_table, moves);
+        func->num_vars = func->num_args;
+        func->num_regs = reg_count - func->num_args;
+        if (allocate_registers(func))
+            return;
+        func->code = std::move(old_code);
+        func->line_table = std::move(old_line_table);
+        func->num_vars = old_vars;
+        func->num_regs = old_regs;
+    }
+    allocate_registers(func);
+}
+
+#endif // MUALI_IR
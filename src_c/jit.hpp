@@ -0,0 +1,705 @@
+#ifndef MUALI_JIT
+#define MUALI_JIT
+
+// Included by interpreter.hpp after the op handlers, when USE_JIT or USE_TRACING_JIT is defined.
+
+// Baseline JIT: when an Interpreter is made, the bytecode of each of its functions is translated to x86-64 machine code.
+// - Hot numeric ops are stencils: hand-written machine code with their var-reg offsets and immediates baked in.
+//   Their type checks branch to a call to the op's opbody_..., which handles everything else the way the interpreter does.
+// - Other ops with an opbody_... become a direct call to it, with pc pointing at the op's operands.
+// - Jumps become direct branches between the translated instructions.
+// - Calls, tail calls and returns go through small helpers that do what their handlers do.
+// - Anything else (an opcode with no body, or a jump that doesn't land on an instruction) hands the rest of the call over
+//   to the interpreter, starting at that instruction.
+// Machine code keeps vars in rbx and global in r12. Every function has the same stack frame, so a tail call can jump
+// straight past the callee's prologue.
+// The assembler and the helpers that run op bodies are also used by the tracing JIT (see trace_jit.hpp).
+
+#if !defined __x86_64__ || defined _WIN32
+#error "the JIT needs x86-64 and the System V calling convention"
+#endif
+
+#include <sys/mman.h>
+
+constexpr uint8_t JIT_RAX = 0;
+constexpr uint8_t JIT_RCX = 1;
+constexpr uint8_t JIT_RSI = 6;
+constexpr uint8_t JIT_RDI = 7;
+
+// condition codes, as in the low nibble of jcc and setcc
+constexpr uint8_t JIT_CC_E  = 0x4;
+constexpr uint8_t JIT_CC_NE = 0x5;
+constexpr uint8_t JIT_CC_L  = 0xC;
+constexpr uint8_t JIT_CC_GE = 0xD;
+constexpr uint8_t JIT_CC_LE = 0xE;
+constexpr uint8_t JIT_CC_G  = 0xF;
+constexpr uint8_t JIT_ALWAYS = 0xFF; // plain jmp
+
+constexpr size_t JIT_PROLOGUE_SIZE = 11;
+constexpr size_t JIT_EPILOGUE = SIZE_MAX; // jump target meaning the function's epilogue
+
+struct JitAssembler {
+    Vec<uint8_t> code;
+    
+    void emit(std::initializer_list<uint8_t> bytes)
+    {
+        for (auto b : bytes)
+            code.push_back(b);
+    }
+    void emit32(uint32_t n)
+    {
+        for (int i = 0; i < 4; i++)
+            code.push_back(uint8_t(n >> (i * 8)));
+    }
+    void emit64(uint64_t n)
+    {
+        for (int i = 0; i < 8; i++)
+            code.push_back(uint8_t(n >> (i * 8)));
+    }
+    // `opcode` with a [rbx + disp32] operand addressing vars[index], plus `field` bytes, and `reg` in ModRM.reg
+    void var_op(std::initializer_list<uint8_t> opcode, uint8_t reg, size_t index, size_t field = 0)
+    {
+        emit(opcode);
+        code.push_back(0x80 | (reg << 3) | 3);
+        emit32(uint32_t(index * sizeof(Variable) + field));
+    }
+    void mov_imm64(uint8_t reg, uint64_t n)
+    {
+        emit({0x48, uint8_t(0xB8 + reg)});
+        emit64(n);
+    }
+    // call helper(vars, pc, global)
+    void call_helper(const void * helper, const uint8_t * pc)
+    {
+        emit({0x48, 0x89, 0xDF}); // mov rdi, rbx
+        mov_imm64(JIT_RSI, (uint64_t)pc);
+        emit({0x4C, 0x89, 0xE2}); // mov rdx, r12
+        mov_imm64(JIT_RAX, (uint64_t)helper);
+        emit({0xFF, 0xD0}); // call rax
+    }
+    // jcc or jmp with its rel32 left to patch(); returns where the rel32 is
+    size_t jump(uint8_t cc)
+    {
+        if (cc == JIT_ALWAYS)
+            code.push_back(0xE9);
+        else
+            emit({0x0F, uint8_t(0x80 | cc)});
+        emit32(0);
+        return code.size() - 4;
+    }
+    void patch(size_t at, size_t target)
+    {
+        int32_t rel = int32_t(target - (at + 4));
+        memcpy(code.data() + at, &rel, 4);
+    }
+};
+
+// Runs an op's body with pc at its operands, and returns where that left pc (past the op, or at a jump's target).
+typedef const uint8_t * (*JitBody)(Variable * vars, const uint8_t * pc, Interpreter * global);
+template<void (*BODY)(Variable *, const uint8_t * &, Interpreter *)>
+static const uint8_t * jit_body(Variable * vars, const uint8_t * pc, Interpreter * global)
+{
+    BODY(vars, pc, global);
+    return pc;
+}
+
+#define JIT_BODY_OPS(X) \
+    X(j, OP_J) X(jif, OP_JIF) X(jifnot, OP_JIFNOT) X(jcmp, OP_JCMP) X(jcmpimm, OP_JCMPIMM) X(jiltimm, OP_JILTIMM) \
+    X(jinciltimm, OP_JINCILTIMM) X(jinciltimm_int, OP_JINCILTIMM_INT) X(jincilt, OP_JINCILT) X(bulkloop, OP_BULKLOOP) \
+    X(inci, OP_INCI) X(inci_int, OP_INCI_INT) X(deci, OP_DECI) X(deci_int, OP_DECI_INT) \
+    X(negate, OP_NEGATE) X(negate_f, OP_NEGATE_F) \
+    X(setimm, OP_SETIMM) X(set, OP_SET) X(set_i, OP_SET_I) X(set_f, OP_SET_F) X(setzeroi, OP_SETZEROI) \
+    X(check_i, OP_CHECK_I) X(check_f, OP_CHECK_F) \
+    X(add, OP_ADD) X(add_f, OP_ADD_F) X(add_ff, OP_ADD_FF) X(addimm, OP_ADDIMM) \
+    X(sub, OP_SUB) X(subimm, OP_SUBIMM) X(subimm_i, OP_SUBIMM_I) X(mul, OP_MUL) X(mulimm, OP_MULIMM) \
+    X(div, OP_DIV) X(div_f, OP_DIV_F) X(div_ff, OP_DIV_FF) X(div_fi, OP_DIV_FI) X(divimm, OP_DIVIMM) \
+    X(shl, OP_SHL) X(shlimm, OP_SHLIMM) X(shlimm_i, OP_SHLIMM_I) X(shr, OP_SHR) X(shrimm, OP_SHRIMM) \
+    X(cmpe, OP_CMPE) X(cmpne, OP_CMPNE) X(cmpgt, OP_CMPGT) X(cmplt, OP_CMPLT) X(cmpgte, OP_CMPGTE) X(cmplte, OP_CMPLTE)
+
+static inline JitBody jit_body_for(uint16_t op)
+{
+    switch (op)
+    {
+    #define _JIT_BODY_CASE(NAME, OPCODE) case OPCODE: return jit_body<opbody_##NAME>;
+    JIT_BODY_OPS(_JIT_BODY_CASE)
+    #undef _JIT_BODY_CASE
+    default:
+        return nullptr;
+    }
+}
+
+// Signed int comparison that matches compare_holds(info, ...) on two ints, or JIT_ALWAYS for none.
+static inline uint8_t jit_compare_cc(uint8_t info)
+{
+    uint8_t cc;
+    switch (info & ~OPINFO_NEGATE)
+    {
+    case OPINFO_CMPE:
+        cc = JIT_CC_E;
+        break;
+    case OPINFO_CMPNE:
+        cc = JIT_CC_NE;
+        break;
+    case OPINFO_CMPGT:
+        cc = JIT_CC_G;
+        break;
+    case OPINFO_CMPLT:
+        cc = JIT_CC_L;
+        break;
+    case OPINFO_CMPGTE:
+        cc = JIT_CC_GE;
+        break;
+    case OPINFO_CMPLTE:
+        cc = JIT_CC_LE;
+        break;
+    default:
+        return JIT_ALWAYS;
+    }
+    return (info & OPINFO_NEGATE) ? cc ^ 1 : cc;
+}
+
+#ifndef VARIABLE_NANBOXED
+constexpr size_t JIT_TYPE_FIELD = 8; // Variable is the 8-byte payload, then the TypeId
+#endif
+
+static void jit_unmap(CodeMapping & mapping)
+{
+    munmap((void *)mapping.data, mapping.size);
+}
+
+// Copies machine code into memory that can be run, or returns an empty Option if that isn't allowed.
+static Option<CodeMapping> jit_make_executable(const Vec<uint8_t> & code)
+{
+    size_t size = code.size();
+    void * memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        return {};
+    memcpy(memory, code.data(), size);
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(memory, size);
+        return {};
+    }
+    return CodeMapping((const uint8_t *)memory, size, jit_unmap);
+}
+
+#ifdef USE_JIT
+// The baseline JIT itself. Everything above is shared with the tracing JIT.
+
+template<uint16_t OP>
+static Variable * jit_call(Variable * vars, const uint8_t * pc, Interpreter * global)
+{
+    constexpr bool has_dest = OP == OP_CALL || OP == OP_CALL_INDIRECT;
+    constexpr bool indirect = OP == OP_CALL_INDIRECT || OP == OP_CALLD_INDIRECT;
+    size_t dest = has_dest ? read_varlen_int(pc) : 0;
+    auto target = read_varlen_int(pc);
+    auto argbase = read_varlen_int(pc);
+    auto argc = read_varlen_int(pc);
+    Function * func;
+    if (indirect)
+    {
+        ASSERT_THROW(((void)"tried to call a non-function", vars[target].kind() == TYPEID_FUNC));
+        func = vars[target].get_func();
+    }
+    else
+        func = global->funcs[target].get();
+    PROFILE_CALL_SITE();
+    vars = call_impl(global, vars, *func, argbase, argc);
+    if (has_dest)
+        vars[dest] = std::move(global->retval);
+    else
+        global->retval = Variable();
+    return vars;
+}
+
+// Where machine code continues after a tail call: the callee's body, or null if the callee isn't compiled and has
+// already been run by the interpreter.
+struct JitTailCall {
+    Variable * vars;
+    const uint8_t * code;
+};
+template<uint16_t OP>
+static JitTailCall jit_become(Variable * vars, const uint8_t * pc, Interpreter * global)
+{
+    auto target = read_varlen_int(pc);
+    auto argbase = read_varlen_int(pc);
+    auto argc = read_varlen_int(pc);
+    Function * func;
+    if (OP == OP_BECOME_INDIRECT)
+    {
+        ASSERT_THROW(((void)"tried to call a non-function", vars[target].kind() == TYPEID_FUNC));
+        func = vars[target].get_func();
+    }
+    else
+        func = global->funcs[target].get();
+    vars = become_impl(global, vars, *func, argbase, argc);
+    if (func->jit_entry)
+        return {vars, func->jit_entry + JIT_PROLOGUE_SIZE};
+    run_frame(global, vars, func->code_data());
+    return {vars, nullptr};
+}
+
+static void jit_returnval(Variable * vars, const uint8_t * pc, Interpreter * global)
+{
+    global->retval = vars[read_varlen_int(pc)];
+}
+static void jit_returnimm(Variable *, const uint8_t * pc, Interpreter * global)
+{
+    global->retval = read_immediate(pc);
+}
+static void jit_interpret(Variable * vars, const uint8_t * pc, Interpreter * global)
+{
+    run_frame(global, vars, pc);
+}
+
+struct _JitFixup {
+    size_t at;
+    size_t target; // bytecode offset, or JIT_EPILOGUE
+};
+
+#ifndef VARIABLE_NANBOXED
+// Emits the stencil for the op at `code` (with the given operands), if it has one. Type checks that fail jump to the
+// positions added to `to_body`, and jumps to other instructions go in `fixups`.
+static bool jit_stencil(JitAssembler & a, uint16_t op, const uint8_t * operands, size_t target,
+    Vec<size_t> & to_body, Vec<_JitFixup> & fixups)
+{
+    auto pc = operands;
+    auto guard = [&](size_t index, TypeId type)
+    {
+        a.var_op({0x83}, 7, index, JIT_TYPE_FIELD); // cmp dword [var.type], type
+        a.code.push_back(uint8_t(type));
+        to_body.push_back(a.jump(JIT_CC_NE));
+    };
+    auto set_type = [&](size_t index, TypeId type)
+    {
+        a.var_op({0xC7}, 0, index, JIT_TYPE_FIELD); // mov dword [var.type], type
+        a.emit32(type);
+    };
+    auto jump_to_target = [&](uint8_t cc) { fixups.push_back({a.jump(cc), target}); };
+    auto load = [&](uint8_t reg, size_t index) { a.var_op({0x48, 0x8B}, reg, index); }; // mov reg, [var]
+    auto store = [&](size_t index, uint8_t reg) { a.var_op({0x48, 0x89}, reg, index); }; // mov [var], reg
+    auto float_bits = [](const Variable & v) { double d = v.get_float(); uint64_t n; memcpy(&n, &d, 8); return n; };
+    
+    switch (op)
+    {
+    case OP_J:
+        jump_to_target(JIT_ALWAYS);
+        return true;
+    case OP_SET:
+    {
+        auto dst = read_varlen_int(pc);
+        auto src = read_varlen_int(pc);
+        a.var_op({0x0F, 0x10}, 0, src); // movups xmm0, [src]
+        a.var_op({0x0F, 0x11}, 0, dst); // movups [dst], xmm0
+        return true;
+    }
+    case OP_SET_I: case OP_SET_F:
+    {
+        auto dst = read_varlen_int(pc);
+        auto src = read_varlen_int(pc);
+        TypeId type = op == OP_SET_I ? TYPEID_INT : TYPEID_FLOAT;
+        guard(src, type);
+        load(JIT_RAX, src);
+        store(dst, JIT_RAX);
+        set_type(dst, type);
+        return true;
+    }
+    case OP_SETZEROI:
+    {
+        auto dst = read_varlen_int(pc);
+        a.var_op({0x48, 0xC7}, 0, dst); // mov qword [dst], 0
+        a.emit32(0);
+        set_type(dst, TYPEID_INT);
+        return true;
+    }
+    case OP_SETIMM:
+    {
+        auto dst = read_varlen_int(pc);
+        auto imm = read_immediate(pc);
+        uint64_t bits;
+        if (imm.kind() == TYPEID_INT)
+            bits = imm.get_int();
+        else if (imm.kind() == TYPEID_FLOAT)
+            bits = float_bits(imm);
+        else if (imm.kind() == TYPEID_BOOL)
+            bits = imm.get_bool();
+        else if (imm.kind() == TYPEID_NULL)
+            bits = 0;
+        else
+            return false;
+        a.mov_imm64(JIT_RAX, bits);
+        store(dst, JIT_RAX);
+        set_type(dst, imm.kind());
+        return true;
+    }
+    case OP_INCI: case OP_DECI: case OP_INCI_INT: case OP_DECI_INT:
+    {
+        auto index = read_varlen_int(pc);
+        bool checked = op == OP_INCI || op == OP_DECI;
+        if (checked)
+            guard(index, TYPEID_INT);
+        a.var_op({0x48, 0x83}, (op == OP_INCI || op == OP_INCI_INT) ? 0 : 5, index); // add/sub qword [var], 1
+        a.code.push_back(1);
+        if (!checked)
+            set_type(index, TYPEID_INT);
+        return true;
+    }
+    case OP_NEGATE:
+    {
+        auto index = read_varlen_int(pc);
+        guard(index, TYPEID_INT);
+        a.var_op({0x48, 0xF7}, 3, index); // neg qword [var]
+        return true;
+    }
+    case OP_NEGATE_F:
+    {
+        auto index = read_varlen_int(pc);
+        a.var_op({0x48, 0x0F, 0xBA}, 7, index); // btc qword [var], 63
+        a.code.push_back(63);
+        set_type(index, TYPEID_FLOAT);
+        return true;
+    }
+    case OP_ADD: case OP_SUB: case OP_MUL:
+    {
+        auto i_in1 = read_varlen_int(pc);
+        auto i_in2 = read_varlen_int(pc);
+        guard(i_in1, TYPEID_INT);
+        guard(i_in2, TYPEID_INT);
+        if (op == OP_MUL)
+        {
+            load(JIT_RAX, i_in1);
+            a.var_op({0x48, 0x0F, 0xAF}, JIT_RAX, i_in2); // imul rax, [in2]
+            store(i_in1, JIT_RAX);
+        }
+        else
+        {
+            load(JIT_RAX, i_in2);
+            a.var_op({0x48, uint8_t(op == OP_ADD ? 0x01 : 0x29)}, JIT_RAX, i_in1); // add/sub [in1], rax
+        }
+        return true;
+    }
+    case OP_ADD_F: case OP_ADD_FF: case OP_DIV_F: case OP_DIV_FF:
+    {
+        auto i_in1 = read_varlen_int(pc);
+        auto i_in2 = read_varlen_int(pc);
+        if (op == OP_ADD_F || op == OP_DIV_F)
+            guard(i_in2, TYPEID_FLOAT);
+        a.var_op({0xF2, 0x0F, 0x10}, 0, i_in1); // movsd xmm0, [in1]
+        a.var_op({0xF2, 0x0F, uint8_t((op == OP_ADD_F || op == OP_ADD_FF) ? 0x58 : 0x5E)}, 0, i_in2); // addsd/divsd xmm0, [in2]
+        a.var_op({0xF2, 0x0F, 0x11}, 0, i_in1); // movsd [in1], xmm0
+        set_type(i_in1, TYPEID_FLOAT);
+        return true;
+    }
+    case OP_DIV_FI:
+    {
+        auto i_in1 = read_varlen_int(pc);
+        auto i_in2 = read_varlen_int(pc);
+        a.var_op({0xF2, 0x0F, 0x10}, 0, i_in1); // movsd xmm0, [in1]
+        a.var_op({0xF2, 0x48, 0x0F, 0x2A}, 1, i_in2); // cvtsi2sd xmm1, qword [in2]
+        a.emit({0xF2, 0x0F, 0x5E, 0xC1}); // divsd xmm0, xmm1
+        a.var_op({0xF2, 0x0F, 0x11}, 0, i_in1); // movsd [in1], xmm0
+        set_type(i_in1, TYPEID_FLOAT);
+        return true;
+    }
+    case OP_ADDIMM: case OP_SUBIMM: case OP_MULIMM: case OP_DIVIMM:
+    {
+        auto index = read_varlen_int(pc);
+        auto imm = read_immediate(pc);
+        if (imm.kind() == TYPEID_INT && op != OP_DIVIMM)
+        {
+            guard(index, TYPEID_INT);
+            a.mov_imm64(JIT_RAX, imm.get_int());
+            if (op == OP_MULIMM)
+            {
+                a.var_op({0x48, 0x0F, 0xAF}, JIT_RAX, index); // imul rax, [var]
+                store(index, JIT_RAX);
+            }
+            else
+                a.var_op({0x48, uint8_t(op == OP_ADDIMM ? 0x01 : 0x29)}, JIT_RAX, index); // add/sub [var], rax
+            return true;
+        }
+        if (imm.kind() == TYPEID_FLOAT)
+        {
+            uint8_t sse_op = op == OP_ADDIMM ? 0x58 : op == OP_SUBIMM ? 0x5C : op == OP_MULIMM ? 0x59 : 0x5E;
+            guard(index, TYPEID_FLOAT);
+            a.mov_imm64(JIT_RAX, float_bits(imm));
+            a.emit({0x66, 0x48, 0x0F, 0x6E, 0xC8}); // movq xmm1, rax
+            a.var_op({0xF2, 0x0F, 0x10}, 0, index); // movsd xmm0, [var]
+            a.emit({0xF2, 0x0F, sse_op, 0xC1}); // op xmm0, xmm1
+            a.var_op({0xF2, 0x0F, 0x11}, 0, index); // movsd [var], xmm0
+            return true;
+        }
+        return false;
+    }
+    case OP_SUBIMM_I:
+    {
+        auto index = read_varlen_int(pc);
+        auto imm = read_immediate(pc);
+        if (imm.kind() != TYPEID_INT)
+            return false;
+        a.mov_imm64(JIT_RAX, imm.get_int());
+        a.var_op({0x48, 0x29}, JIT_RAX, index); // sub [var], rax
+        set_type(index, TYPEID_INT);
+        return true;
+    }
+    case OP_SHLIMM: case OP_SHLIMM_I: case OP_SHRIMM:
+    {
+        auto index = read_varlen_int(pc);
+        auto imm = read_immediate(pc);
+        if (imm.kind() != TYPEID_INT || imm.get_int() < 0 || imm.get_int() > 63)
+            return false;
+        if (op != OP_SHLIMM_I)
+            guard(index, TYPEID_INT);
+        a.var_op({0x48, 0xC1}, op == OP_SHRIMM ? 7 : 4, index); // sar/shl qword [var], imm
+        a.code.push_back(uint8_t(imm.get_int()));
+        if (op == OP_SHLIMM_I)
+            set_type(index, TYPEID_INT);
+        return true;
+    }
+    case OP_CMPE: case OP_CMPNE: case OP_CMPGT: case OP_CMPLT: case OP_CMPGTE: case OP_CMPLTE:
+    {
+        auto i_in1 = read_varlen_int(pc);
+        auto i_in2 = read_varlen_int(pc);
+        uint8_t cc = jit_compare_cc(op - OP_CMPE + OPINFO_CMPE);
+        guard(i_in1, TYPEID_INT);
+        guard(i_in2, TYPEID_INT);
+        load(JIT_RAX, i_in1);
+        a.var_op({0x48, 0x3B}, JIT_RAX, i_in2); // cmp rax, [in2]
+        a.emit({0x0F, uint8_t(0x90 | cc), 0xC0}); // setcc al
+        a.emit({0x0F, 0xB6, 0xC0}); // movzx eax, al
+        store(i_in1, JIT_RAX);
+        set_type(i_in1, TYPEID_BOOL);
+        return true;
+    }
+    case OP_JIF: case OP_JIFNOT:
+    {
+        auto index = read_varlen_int(pc);
+        guard(index, TYPEID_BOOL);
+        a.var_op({0x80}, 7, index); // cmp byte [var], 0
+        a.code.push_back(0);
+        jump_to_target(op == OP_JIF ? JIT_CC_NE : JIT_CC_E);
+        return true;
+    }
+    case OP_JCMP: case OP_JCMPIMM:
+    {
+        auto i_in1 = read_varlen_int(pc);
+        size_t i_in2 = 0;
+        Variable imm;
+        if (op == OP_JCMP)
+            i_in2 = read_varlen_int(pc);
+        else
+            imm = read_immediate(pc);
+        uint8_t cc = jit_compare_cc(read_u8(pc));
+        if (cc == JIT_ALWAYS || (op == OP_JCMPIMM && imm.kind() != TYPEID_INT))
+            return false;
+        guard(i_in1, TYPEID_INT);
+        load(JIT_RAX, i_in1);
+        if (op == OP_JCMP)
+        {
+            guard(i_in2, TYPEID_INT);
+            a.var_op({0x48, 0x3B}, JIT_RAX, i_in2); // cmp rax, [in2]
+        }
+        else
+        {
+            a.mov_imm64(JIT_RCX, imm.get_int());
+            a.emit({0x48, 0x39, 0xC8}); // cmp rax, rcx
+        }
+        jump_to_target(cc);
+        return true;
+    }
+    case OP_JILTIMM: case OP_JINCILTIMM: case OP_JINCILTIMM_INT:
+    {
+        auto index = read_varlen_int(pc);
+        int64_t imm = read_u64(pc);
+        if (op != OP_JINCILTIMM_INT)
+            guard(index, TYPEID_INT);
+        load(JIT_RAX, index);
+        if (op != OP_JILTIMM)
+        {
+            a.emit({0x48, 0xFF, 0xC0}); // inc rax
+            store(index, JIT_RAX);
+            if (op == OP_JINCILTIMM_INT)
+                set_type(index, TYPEID_INT);
+        }
+        a.mov_imm64(JIT_RCX, imm);
+        a.emit({0x48, 0x39, 0xC8}); // cmp rax, rcx
+        jump_to_target(JIT_CC_L);
+        return true;
+    }
+    case OP_JINCILT:
+    {
+        auto index = read_varlen_int(pc);
+        auto i_index = read_varlen_int(pc);
+        guard(index, TYPEID_INT);
+        guard(i_index, TYPEID_INT);
+        load(JIT_RAX, index);
+        a.emit({0x48, 0xFF, 0xC0}); // inc rax
+        store(index, JIT_RAX);
+        a.var_op({0x48, 0x3B}, JIT_RAX, i_index); // cmp rax, [i_index]
+        jump_to_target(JIT_CC_L);
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+#endif // VARIABLE_NANBOXED
+
+// Appends the machine code for func and returns the offset of its entry point.
+static size_t jit_compile_function(JitAssembler & a, const Function & func)
+{
+    const uint8_t * code = func.code_data();
+    size_t code_size = func.code_size();
+    
+    size_t entry = a.code.size();
+    a.emit({0x53, 0x41, 0x54, 0x41, 0x55}); // push rbx; push r12; push r13 (keeps the stack 16-byte aligned)
+    a.emit({0x48, 0x89, 0xFB}); // mov rbx, rdi
+    a.emit({0x49, 0x89, 0xF4}); // mov r12, rsi
+    assert(a.code.size() - entry == JIT_PROLOGUE_SIZE);
+    
+    constexpr size_t NO_LABEL = SIZE_MAX;
+    Vec<size_t> labels(code_size + 1, NO_LABEL); // where each instruction's machine code starts
+    Vec<_JitFixup> fixups;
+    
+    auto interpret_from = [&](size_t offset)
+    {
+        a.call_helper((const void *)jit_interpret, code + offset);
+        fixups.push_back({a.jump(JIT_ALWAYS), JIT_EPILOGUE});
+    };
+    
+    size_t i = 0;
+    while (i < code_size)
+    {
+        labels[i] = a.code.size() - entry;
+        // in-memory code isn't padded like cached code, so don't read a second opcode byte past the end
+        uint16_t op = unfused_opcode(i + 1 < code_size ? opcode_at(code + i) : code[i]);
+        size_t len = instruction_length(code + i, op);
+        if (len == 0 || i + len > code_size)
+        {
+            interpret_from(i);
+            break;
+        }
+        const uint8_t * operands = code + i + opcode_length(op);
+        const uint8_t * end = code + i + len;
+        
+        switch (op)
+        {
+        case OP_CALL:
+            a.call_helper((const void *)jit_call<OP_CALL>, operands);
+            a.emit({0x48, 0x89, 0xC3}); // mov rbx, rax
+            break;
+        case OP_CALL_INDIRECT:
+            a.call_helper((const void *)jit_call<OP_CALL_INDIRECT>, operands);
+            a.emit({0x48, 0x89, 0xC3});
+            break;
+        case OP_CALLDISCARD:
+            a.call_helper((const void *)jit_call<OP_CALLDISCARD>, operands);
+            a.emit({0x48, 0x89, 0xC3});
+            break;
+        case OP_CALLD_INDIRECT:
+            a.call_helper((const void *)jit_call<OP_CALLD_INDIRECT>, operands);
+            a.emit({0x48, 0x89, 0xC3});
+            break;
+        case OP_BECOME: case OP_BECOME_INDIRECT:
+            if (op == OP_BECOME)
+                a.call_helper((const void *)jit_become<OP_BECOME>, operands);
+            else
+                a.call_helper((const void *)jit_become<OP_BECOME_INDIRECT>, operands);
+            a.emit({0x48, 0x89, 0xC3}); // mov rbx, rax
+            a.emit({0x48, 0x85, 0xD2}); // test rdx, rdx
+            fixups.push_back({a.jump(JIT_CC_E), JIT_EPILOGUE});
+            a.emit({0xFF, 0xE2}); // jmp rdx
+            break;
+        case OP_RETURNVAL: case OP_RETURNIMM:
+            a.call_helper(op == OP_RETURNVAL ? (const void *)jit_returnval : (const void *)jit_returnimm, operands);
+            fixups.push_back({a.jump(JIT_ALWAYS), JIT_EPILOGUE});
+            break;
+        default:
+        {
+            auto body = jit_body_for(op);
+            if (!body)
+            {
+                interpret_from(i);
+                i = code_size;
+                continue;
+            }
+            
+            bool is_jump = operands != end && opcode_operands(op)[strlen(opcode_operands(op)) - 1] == 'j';
+            size_t target = 0;
+            if (is_jump)
+            {
+                int32_t offset;
+                memcpy(&offset, end - 4, 4);
+                target = i + len + offset;
+            }
+            
+            Vec<size_t> to_body;
+            bool stencil = false;
+        #ifndef VARIABLE_NANBOXED
+            stencil = jit_stencil(a, op, operands, target, to_body, fixups);
+        #endif
+            if (stencil && to_body.size() == 0)
+                break;
+            
+            size_t skip_body = 0;
+            if (stencil)
+            {
+                skip_body = a.jump(JIT_ALWAYS);
+                for (auto at : to_body)
+                    a.patch(at, a.code.size());
+            }
+            a.call_helper((const void *)body, operands);
+            if (is_jump)
+            {
+                a.mov_imm64(JIT_RCX, (uint64_t)end);
+                a.emit({0x48, 0x39, 0xC8}); // cmp rax, rcx
+                fixups.push_back({a.jump(JIT_CC_NE), target});
+            }
+            if (stencil)
+                a.patch(skip_body, a.code.size());
+        }
+        }
+        i += len;
+    }
+    if (i == code_size)
+        interpret_from(i);
+    
+    size_t epilogue = a.code.size();
+    a.emit({0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3}); // pop r13; pop r12; pop rbx; ret
+    
+    for (auto & fixup : fixups)
+    {
+        if (fixup.target == JIT_EPILOGUE)
+            a.patch(fixup.at, epilogue);
+        else if (fixup.target <= code_size && labels[fixup.target] != NO_LABEL)
+            a.patch(fixup.at, entry + labels[fixup.target]);
+        else
+        {
+            // lands somewhere that wasn't translated
+            a.patch(fixup.at, a.code.size());
+            a.call_helper((const void *)jit_interpret, code + fixup.target);
+            a.patch(a.jump(JIT_ALWAYS), epilogue);
+        }
+    }
+    
+    return entry;
+}
+
+// Compiles all of the interpreter's functions. If the machine code can't be made executable, they stay interpreted.
+static void jit_compile(Interpreter & interpreter)
+{
+    JitAssembler a;
+    Vec<size_t> entries;
+    for (auto & func : interpreter.funcs)
+        entries.push_back(jit_compile_function(a, *func));
+    
+    auto mapping = jit_make_executable(a.code);
+    if (!mapping)
+        return;
+    interpreter.jit_code = MakeShared<CodeMapping>(std::move(*mapping));
+    for (size_t i = 0; i < entries.size(); i++)
+        interpreter.funcs[i]->jit_entry = interpreter.jit_code->data + entries[i];
+}
+#endif // USE_JIT
+
+#endif // MUALI_JIT
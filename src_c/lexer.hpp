@@ -0,0 +1,319 @@
+#ifndef MUALI_LEXER
+#define MUALI_LEXER
+
+// Included by grammar.hpp once MatchingRule is defined.
+
+// All of a grammar's literal and regex token rules compiled into one DFA, so that tokenize() reads each byte of the source
+// once instead of trying every rule at every position.
+// The regex rules come already parsed by Remimu. They and the literals go through Thompson's construction into one NFA,
+// and the subset construction turns that into the DFA. Bytes that no rule tells apart share a column of the transition table.
+//
+// Matches are maximal munch. Among rules that match the same length, reserved keywords win, then the rules in
+// Grammar::tokens order (regexes, then literals). A reserved keyword is accepted as the literal rule with the same text,
+// so `var` is never a name; a reserved keyword with no literal rule can't be tokenized at all.
+
+constexpr uint32_t LEXER_NOT_ACCEPTING = 0xFFFFFFFF;
+constexpr uint32_t LEXER_RESERVED      = 0xFFFFFFFE; // reserved keyword that the grammar has no literal rule for
+
+constexpr size_t LEXER_MAX_STATES = 1 << 16;
+constexpr uint16_t LEXER_MAX_REPEAT = 64; // every repetition is another copy in the NFA
+
+struct LexerDfa {
+    uint8_t byte_class[256] = {};
+    size_t class_count = 0;
+    Vec<uint32_t> next; // next[state * class_count + byte_class[c]]; state 0 is dead and state 1 is the start
+    Vec<uint32_t> accept; // per state: index into Grammar::tokens, LEXER_RESERVED, or LEXER_NOT_ACCEPTING
+    bool ok = false; // false if a regex uses something the DFA can't do (anchors, word boundaries, lazy or possessive quantifiers)
+    
+    // Returns the length of the longest token at the start of text, or 0 if there isn't one. rule gets what it was accepted as.
+    size_t match(const char * text, size_t len, uint32_t & rule) const
+    {
+        uint32_t state = 1;
+        size_t found_len = 0;
+        rule = LEXER_NOT_ACCEPTING;
+        for (size_t i = 0; i < len; i++)
+        {
+            state = next[state * class_count + byte_class[(uint8_t)text[i]]];
+            if (state == 0)
+                break;
+            if (accept[state] != LEXER_NOT_ACCEPTING)
+            {
+                found_len = i + 1;
+                rule = accept[state];
+            }
+        }
+        return found_len;
+    }
+};
+
+struct _LexerNfaState {
+    uint16_t mask[16] = {}; // bytes that go to next, laid out like RegexToken::mask
+    uint32_t next = 0; // 0 if there's no byte transition (state 0 is the start, which nothing goes back to)
+    Vec<uint32_t> eps;
+    uint32_t priority = LEXER_NOT_ACCEPTING; // accepting if set; indexes _LexerNfa::accepts, lower wins
+};
+
+struct _LexerNfa {
+    struct Frag {
+        uint32_t start;
+        uint32_t end;
+    };
+    
+    Vec<_LexerNfaState> states;
+    Vec<uint32_t> accepts;
+    bool ok = true;
+    
+    _LexerNfa() { add_state(); }
+    
+    uint32_t add_state()
+    {
+        states.push_back(_LexerNfaState{});
+        return states.size() - 1;
+    }
+    Frag empty()
+    {
+        auto s = add_state();
+        return {s, s};
+    }
+    Frag chars(const uint16_t * mask)
+    {
+        Frag f = {add_state(), add_state()};
+        memcpy(states[f.start].mask, mask, sizeof(states[f.start].mask));
+        states[f.start].next = f.end;
+        return f;
+    }
+    Frag literal(const String & text)
+    {
+        auto f = empty();
+        for (size_t i = 0; i < text.size(); i++)
+        {
+            uint16_t mask[16] = {};
+            uint8_t c = text[i];
+            mask[c >> 4] |= 1 << (c & 0xF);
+            f = concat(f, chars(mask));
+        }
+        return f;
+    }
+    Frag concat(Frag a, Frag b)
+    {
+        states[a.end].eps.push_back(b.start);
+        return {a.start, b.end};
+    }
+    
+    // count_hi is one past the most repetitions allowed, or 0 for no limit, like in RegexToken
+    template<typename F>
+    Frag repeat(F && build, uint16_t count_lo, uint16_t count_hi)
+    {
+        if (count_lo > LEXER_MAX_REPEAT || count_hi > LEXER_MAX_REPEAT + 1)
+        {
+            ok = false;
+            return empty();
+        }
+        auto f = empty();
+        for (uint16_t n = 0; n < count_lo; n++)
+            f = concat(f, build());
+        if (count_hi == 0)
+        {
+            auto loop = empty();
+            auto body = build();
+            states[loop.start].eps.push_back(body.start);
+            states[body.end].eps.push_back(loop.start);
+            f = concat(f, loop);
+        }
+        for (uint16_t n = count_lo + 1; n < count_hi; n++)
+        {
+            Frag maybe = {add_state(), add_state()};
+            auto body = build();
+            states[maybe.start].eps.push_back(body.start);
+            states[maybe.start].eps.push_back(maybe.end);
+            states[body.end].eps.push_back(maybe.end);
+            f = concat(f, maybe);
+        }
+        return f;
+    }
+    
+    // Builds one copy of what's between the group opened at tokens[open] and its CLOSE.
+    Frag group(const RegexToken * tokens, int open)
+    {
+        int close = open + tokens[open].pair_offset;
+        Frag ret = {add_state(), add_state()};
+        auto f = empty();
+        for (int k = open + 1; k <= close && ok; k++)
+        {
+            auto & token = tokens[k];
+            if (k == close || token.kind == REMIMU_KIND_OR)
+            {
+                states[ret.start].eps.push_back(f.start);
+                states[f.end].eps.push_back(ret.end);
+                f = empty();
+            }
+            else if (token.mode != 0)
+                ok = false;
+            else if (token.kind == REMIMU_KIND_NORMAL)
+                f = concat(f, repeat([&]() { return chars(token.mask); }, token.count_lo, token.count_hi));
+            else if (token.kind == REMIMU_KIND_OPEN || token.kind == REMIMU_KIND_NCOPEN)
+            {
+                auto & inner_close = tokens[k + token.pair_offset];
+                f = concat(f, repeat([&]() { return group(tokens, k); }, inner_close.count_lo, inner_close.count_hi));
+                k += token.pair_offset;
+            }
+            else if (token.kind == REMIMU_KIND_CARET && k == 1)
+                continue; // the ^ that load_grammar puts in front; tokens are only ever matched at the current position
+            else
+                ok = false;
+        }
+        return ret;
+    }
+    
+    void add_rule(Frag f, uint32_t accept)
+    {
+        states[f.end].priority = accepts.size();
+        accepts.push_back(accept);
+        states[0].eps.push_back(f.start);
+    }
+};
+
+static LexerDfa build_lexer(const HashSet<String> & reserved_keywords, const Vec<Shared<MatchingRule>> & tokens)
+{
+    _LexerNfa nfa;
+    
+    for (auto & keyword : reserved_keywords)
+    {
+        uint32_t accept = LEXER_RESERVED;
+        for (size_t i = 0; i < tokens.size(); i++)
+        {
+            if (tokens[i]->kind == MATCH_KIND_LITERAL && *tokens[i]->text == keyword)
+                accept = i;
+        }
+        nfa.add_rule(nfa.literal(keyword), accept);
+    }
+    for (size_t i = 0; i < tokens.size(); i++)
+    {
+        auto & token = *tokens[i];
+        if (token.kind == MATCH_KIND_REGEX)
+        {
+            assert(token.compiled_regex);
+            nfa.add_rule(nfa.group(token.compiled_regex->tokens, 0), i);
+        }
+        else
+            nfa.add_rule(nfa.literal(*token.text), i);
+    }
+    if (!nfa.ok)
+        return {};
+    
+    auto has_byte = [](const uint16_t * mask, uint8_t c) { return !!(mask[c >> 4] & (1 << (c & 0xF))); };
+    
+    LexerDfa ret;
+    
+    // split the bytes into classes that every mask either fully contains or doesn't touch
+    uint8_t class_byte[256] = {}; // some byte in each class
+    ret.class_count = 1;
+    for (auto & state : nfa.states)
+    {
+        if (state.next == 0)
+            continue;
+        int16_t remap[512];
+        memset(remap, -1, sizeof(remap));
+        size_t count = 0;
+        for (int c = 0; c < 256; c++)
+        {
+            auto & n = remap[ret.byte_class[c] * 2 + has_byte(state.mask, c)];
+            if (n < 0)
+            {
+                n = count++;
+                class_byte[n] = c;
+            }
+            ret.byte_class[c] = n;
+        }
+        ret.class_count = count;
+    }
+    
+    // DFA states are sets of NFA states, as bitsets
+    size_t words = (nfa.states.size() + 63) / 64;
+    Vec<uint32_t> work;
+    auto close = [&](Vec<uint64_t> & set)
+    {
+        work.clear();
+        for (size_t i = 0; i < nfa.states.size(); i++)
+        {
+            if (set[i / 64] & (1ULL << (i % 64)))
+                work.push_back(i);
+        }
+        while (work.size())
+        {
+            auto s = work.back();
+            work.pop_back();
+            for (auto e : nfa.states[s].eps)
+            {
+                if (!(set[e / 64] & (1ULL << (e % 64))))
+                {
+                    set[e / 64] |= 1ULL << (e % 64);
+                    work.push_back(e);
+                }
+            }
+        }
+    };
+    
+    Vec<Vec<uint64_t>> sets;
+    HashMap<Vec<uint64_t>, uint32_t> ids;
+    auto add_set = [&](Vec<uint64_t> && set)
+    {
+        assert(sets.size() <= LEXER_MAX_STATES);
+        ids.insert(set, (uint32_t)sets.size());
+        sets.push_back(std::move(set));
+    };
+    
+    add_set(Vec<uint64_t>(words, 0)); // dead
+    Vec<uint64_t> start(words, 0);
+    start[0] = 1;
+    close(start);
+    add_set(std::move(start));
+    
+    for (size_t d = 0; d < sets.size(); d++)
+    {
+        auto set = sets[d];
+        
+        uint32_t priority = LEXER_NOT_ACCEPTING;
+        for (size_t i = 0; i < nfa.states.size(); i++)
+        {
+            if ((set[i / 64] & (1ULL << (i % 64))) && nfa.states[i].priority < priority)
+                priority = nfa.states[i].priority;
+        }
+        ret.accept.push_back(priority == LEXER_NOT_ACCEPTING ? LEXER_NOT_ACCEPTING : nfa.accepts[priority]);
+        
+        for (size_t c = 0; c < ret.class_count; c++)
+        {
+            Vec<uint64_t> to(words, 0);
+            bool any = false;
+            for (size_t i = 0; i < nfa.states.size(); i++)
+            {
+                auto & state = nfa.states[i];
+                if ((set[i / 64] & (1ULL << (i % 64))) && state.next != 0 && has_byte(state.mask, class_byte[c]))
+                {
+                    to[state.next / 64] |= 1ULL << (state.next % 64);
+                    any = true;
+                }
+            }
+            if (!any)
+            {
+                ret.next.push_back(0);
+                continue;
+            }
+            close(to);
+            if (ids.count(to) == 0)
+            {
+                if (sets.size() >= LEXER_MAX_STATES)
+                    return {};
+                add_set(std::move(to));
+                ret.next.push_back(sets.size() - 1);
+            }
+            else
+                ret.next.push_back(ids[to]);
+        }
+    }
+    
+    ret.ok = true;
+    return ret;
+}
+
+#endif // MUALI_LEXER
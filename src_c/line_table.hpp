@@ -0,0 +1,143 @@
+#ifndef MUALI_LINE_TABLE
+#define MUALI_LINE_TABLE
+
+// Included by vm_common.hpp.
+
+// Line tables say which source position each part of a function's code was compiled from. A table is a list of entries
+// sorted by offset, each covering the code from its offset up to the next entry's. The compiler adds one whenever the
+// AST node it's compiling changes, and passes that move code around remap them (see line_table_remap).
+//
+// Entries are stored as the differences from the entry before (the offset, then the row and column as signed numbers),
+// each in LEB128, so most take three bytes. Nothing reads them on the dispatch path: profilers and error reports look
+// positions up by scanning the table from the start, only when they need them.
+
+// A source position, and the code offset it starts at. Row 0 means unknown.
+struct SourcePos {
+    size_t offset;
+    size_t row;
+    size_t column;
+};
+
+// An instruction that a pass moved from one offset to another.
+struct CodeMove {
+    size_t from;
+    size_t to;
+};
+
+static inline void _line_table_push_uleb(Vec<uint8_t> & out, uint64_t n)
+{
+    while (n >= 0x80)
+    {
+        out.push_back(uint8_t(n) | 0x80);
+        n >>= 7;
+    }
+    out.push_back(uint8_t(n));
+}
+static inline void _line_table_push_sleb(Vec<uint8_t> & out, int64_t n)
+{
+    _line_table_push_uleb(out, (uint64_t(n) << 1) ^ uint64_t(n >> 63)); // zigzag
+}
+static inline uint64_t _line_table_read_uleb(const uint8_t * & p, const uint8_t * end)
+{
+    uint64_t n = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7)
+    {
+        uint8_t byte = *p++;
+        n |= uint64_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            break;
+    }
+    return n;
+}
+static inline int64_t _line_table_read_sleb(const uint8_t * & p, const uint8_t * end)
+{
+    uint64_t n = _line_table_read_uleb(p, end);
+    return int64_t(n >> 1) ^ -int64_t(n & 1);
+}
+
+// Adds pos to the end of a list of entries, unless it changes nothing. An entry at the same offset as the last one
+// replaces it.
+static inline void line_table_append(Vec<SourcePos> & entries, SourcePos pos)
+{
+    if (entries.size() && entries.back().offset == pos.offset)
+        entries.pop_back();
+    if (entries.size() && entries.back().row == pos.row && entries.back().column == pos.column)
+        return;
+    entries.push_back(pos);
+}
+
+static inline Vec<uint8_t> line_table_encode(const Vec<SourcePos> & entries)
+{
+    Vec<uint8_t> out;
+    SourcePos prev = {0, 0, 0};
+    for (auto & pos : entries)
+    {
+        _line_table_push_uleb(out, pos.offset - prev.offset);
+        _line_table_push_sleb(out, int64_t(pos.row) - int64_t(prev.row));
+        _line_table_push_sleb(out, int64_t(pos.column) - int64_t(prev.column));
+        prev = pos;
+    }
+    return out;
+}
+
+static inline Vec<SourcePos> line_table_decode(const uint8_t * table, size_t size)
+{
+    Vec<SourcePos> entries;
+    SourcePos pos = {0, 0, 0};
+    auto end = table + size;
+    while (table < end)
+    {
+        pos.offset += _line_table_read_uleb(table, end);
+        pos.row += _line_table_read_sleb(table, end);
+        pos.column += _line_table_read_sleb(table, end);
+        entries.push_back(pos);
+    }
+    return entries;
+}
+
+// The position that the code at offset came from.
+static inline SourcePos line_table_lookup(const uint8_t * table, size_t size, size_t offset)
+{
+    SourcePos found = {offset, 0, 0};
+    SourcePos pos = {0, 0, 0};
+    auto end = table + size;
+    while (table < end)
+    {
+        pos.offset += _line_table_read_uleb(table, end);
+        if (pos.offset > offset)
+            break;
+        pos.row += _line_table_read_sleb(table, end);
+        pos.column += _line_table_read_sleb(table, end);
+        found = SourcePos{offset, pos.row, pos.column};
+    }
+    return found;
+}
+
+// The table for code that a pass rewrote, given where each instruction it kept came from, in their new order.
+static inline Vec<uint8_t> line_table_remap(const Vec<uint8_t> & table, const Vec<CodeMove> & moves)
+{
+    auto old_entries = line_table_decode(table.data(), table.size());
+    Vec<SourcePos> entries;
+    for (auto & move : moves)
+    {
+        // last old entry at or before move.from
+        size_t lo = 0;
+        size_t hi = old_entries.size();
+        while (lo < hi)
+        {
+            size_t mid = (lo + hi) / 2;
+            if (old_entries[mid].offset <= move.from)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo == 0)
+            continue;
+        auto pos = old_entries[lo - 1];
+        pos.offset = move.to;
+        line_table_append(entries, pos);
+    }
+    return line_table_encode(entries);
+}
+
+#endif // MUALI_LINE_TABLE
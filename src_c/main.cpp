@@ -9,6 +9,7 @@
 #include "grammar.hpp"
 #include "compiler.hpp"
 #include "interpreter.hpp"
+#include "bytecode_cache.hpp"
 
 int main(int argc, char ** argv)
 {
@@ -30,70 +31,114 @@ int main(int argc, char ** argv)
         text2.push_back(c);
     text2.push_back(0);
     
-    auto grammar = load_grammar(text.data());
-    
-    //puts("HW!");
-    
-    // debug_print_grammar_points(grammar);
-    
-    auto tokens = tokenize(grammar, text2.data());
-    
-    if (tokens.size() == 0)
-    {
-        puts("Error: program is empty.");
-        return 0;
-    }
-    if (tokens.back()->text == 0)
+    // compiled programs are cached if MUALI_CACHE_DIR is set, in that directory (see bytecode_cache_path)
+    auto cache_dir = getenv("MUALI_CACHE_DIR");
+    auto cache_key = bytecode_cache_key(text.data(), text2.data());
+    String cache_path = cache_dir ? bytecode_cache_path(cache_dir, argv[1]) : String();
+    
+    Global compiled;
+    Option<Global> cached;
+    if (cache_dir)
+        cached = load_bytecode_cache(cache_path.data(), cache_key);
+    if (cached)
+        compiled = std::move(*cached);
+    else
     {
-        print_tokenization_error(tokens, String(text2.data()));
-        puts("failed to tokenize");
-        return 0;
+        auto grammar = load_grammar(text.data());
+        
+        //puts("HW!");
+        
+        // debug_print_grammar_points(grammar);
+        
+        auto tokens = tokenize(grammar, text2.data());
+        
+        if (tokens.size() == 0)
+        {
+            puts("Error: program is empty.");
+            return 0;
+        }
+        if (tokens.back()->text == 0)
+        {
+            print_tokenization_error(tokens, String(text2.data()));
+            puts("failed to tokenize");
+            return 0;
+        }
+        
+        size_t i = 0;
+        if (0)
+        for (auto n : tokens)
+        {
+            if (n->from_regex)
+                printf("> %zd\t%s (via %s)\n", i, n->text->data(), n->from_regex->str.data());
+            else
+                printf("> %zd\t%s\n", i, n->text->data());
+            i += 1;
+        }
+        
+        ParseState parse_state;
+        auto asdf = parse_as(grammar, tokens, "program", parse_state);
+        
+        if (!asdf)
+        {
+            print_parse_error(parse_state, tokens, String(text2.data()));
+            puts("failed to parse");
+            return 0;
+        }
+        
+        //print_AST(*asdf);
+        
+        //puts("bxvlhir");
+        
+        compiled = compile_root(*asdf);
+        if (cache_dir && !save_bytecode_cache(cache_path.data(), compiled, cache_key))
+            printf("warning: couldn't write bytecode cache %s\n", cache_path.data());
+        
+        //puts("aogiogw");
     }
     
-    size_t i = 0;
-    if (0)
-    for (auto n : tokens)
-    {
-        if (n->from_regex)
-            printf("> %zd\t%s (via %s)\n", i, n->text->data(), n->from_regex->str.data());
-        else
-            printf("> %zd\t%s\n", i, n->text->data());
-        i += 1;
-    }
-    
-    auto asdf = parse_as(grammar, tokens, "program");
-    
-    if (!asdf)
-    {
-        print_parse_error(tokens, String(text2.data()));
-        puts("failed to parse");
-        return 0;
-    }
-    
-    //print_AST(*asdf);
-    
-    //puts("bxvlhir");
-    
-    auto compiled = compile_root(*asdf);
-    
-    //puts("aogiogw");
-    
     //if (0)
     for (auto func : compiled.funcs)
     {
         puts("----");
-        for (auto byte : func->code)
-            printf("%02X ", byte);
+        for (size_t j = 0; j < func->code_size(); j++)
+            printf("%02X ", func->code_data()[j]);
         puts("");
     }
     
     Interpreter interpreter(compiled);
     
+#ifdef PROFILE_SAMPLING
+    auto sample_hz = getenv("MUALI_SAMPLE_HZ");
+    interpreter.sampler.start(sample_hz ? strtoull(sample_hz, nullptr, 10) : 1000);
+#endif
     auto ret = interpreter.call_func_by_name("main", {});
-    
-    printf("main returned %.24f\n", ret.data.real);
-    
-    printf("%zd\n", interpreter.accum);
+#ifdef PROFILE_SAMPLING
+    interpreter.sampler.stop();
+#endif
+    
+    if (ret.kind() == TYPEID_INT)
+        printf("main returned %zd\n", ret.get_int());
+    else if (ret.kind() == TYPEID_BOOL)
+        printf("main returned %s\n", ret.get_bool() ? "true" : "false");
+    else if (ret.kind() == TYPEID_NULL)
+        printf("main returned null\n");
+    else
+        printf("main returned %.24f\n", ret.get_float());
+    
+#ifdef PROFILE_OPCODE_SEQUENCES
+    auto profile_path = getenv("MUALI_OPCODE_PROFILE");
+    interpreter.opcode_profile.dump(profile_path ? profile_path : "opcode_profile.txt");
+#endif
+#ifdef PROFILE_EXECUTION
+    auto flat_path = getenv("MUALI_PROFILE");
+    auto stacks_path = getenv("MUALI_PROFILE_STACKS");
+    interpreter.execution_profile.dump_flat(flat_path ? flat_path : "profile.txt", interpreter.funcs, interpreter.func_names);
+    interpreter.execution_profile.dump_stacks(stacks_path ? stacks_path : "profile_stacks.txt", interpreter.funcs, interpreter.func_names);
+#endif
+#ifdef PROFILE_SAMPLING
+    auto samples_path = getenv("MUALI_SAMPLES");
+    interpreter.sampler.dump(samples_path ? samples_path : "samples.txt", interpreter.funcs, interpreter.func_names);
+#endif
     
     //throw ret;
     
@@ -18,6 +18,37 @@ FUNCTIONS
         int32_t flags               // Optional bitflags.
     )
     
+    // Returns 0 on success, or -2 on too many groups, or -3 if the regex is invalid.
+    // Works out everything that regex_match would otherwise redo on every call; see RegexProgram.
+    static inline int regex_compile(
+        const RegexToken * tokens,  // Parsed regex. Not copied; must outlive the program.
+        RegexProgram * program      // Output.
+    )
+    
+    // Same as regex_match, for a compiled regex. Only does work proportional to the text.
+    static inline int64_t regex_match_program(
+        const RegexProgram * program,
+        const char * text,
+        size_t start_i,
+        uint16_t cap_slots,
+        int64_t * cap_pos,
+        int64_t * cap_span
+    )
+    
+    // Same as regex_match_program, with caller-provided memory for backtracking; see RegexMemory.
+    static inline int64_t regex_match_program_mem(
+        const RegexProgram * program,
+        const char * text,
+        size_t start_i,
+        uint16_t cap_slots,
+        int64_t * cap_pos,
+        int64_t * cap_span,
+        RegexMemory * memory        // Arena, and how far to grow on the heap after it. Can be reused between matches.
+    )
+    
+    // Frees the heap memory that regex_match_program_mem left in memory for reuse.
+    static inline void regex_memory_free(RegexMemory * memory)
+    
     // Returns match length, or -1 on no match, or -2 on out of memory, or -3 if the regex is invalid.
     static inline int64_t regex_match(
         const RegexToken * tokens,  // Parsed regex to match against text.
@@ -32,6 +63,44 @@ FUNCTIONS
         int64_t * cap_span          // Capture length info output buffer.
     ) 
     
+    // Same as regex_match, but always uses the linear-time matcher (see PERFORMANCE). Returns -3 if the regex can't use it.
+    static inline int64_t regex_match_linear(
+        const RegexToken * tokens,
+        const char * text,
+        size_t start_i,
+        uint16_t cap_slots,
+        int64_t * cap_pos,
+        int64_t * cap_span
+    )
+    
+    // Returns the index of the leftmost match at or after start_i, or -1 if there's none, or -2 or -3 like regex_match.
+    static inline int64_t regex_search(
+        const RegexProgram * program,
+        const char * text,
+        size_t start_i,
+        int64_t * match_length,     // Output: length of the match found.
+        uint16_t cap_slots,
+        int64_t * cap_pos,
+        int64_t * cap_span
+    )
+    
+    // Sets up an empty RegexSet: many compiled regexes that get matched at the same index together.
+    static inline void regex_set_init(RegexSet * set)
+    
+    // Returns the regex's index in the set, or -2 if the set is full (REMIMU_SET_MAX_PATTERNS).
+    static inline int regex_set_add(
+        RegexSet * set,
+        const RegexProgram * program // Not copied; must outlive the set.
+    )
+    
+    // Returns how many of the set's regexes match at start_i.
+    static inline int regex_set_match(
+        const RegexSet * set,
+        const char * text,
+        size_t start_i,
+        int64_t * lengths           // Output: each regex's match length, or -1 if it doesn't match, in the order they were added.
+    )
+    
     static inline void print_regex_tokens(
         RegexToken * tokens     // Regex tokens to spew to stdout, for debugging.
     )
@@ -40,16 +109,20 @@ PERFORMANCE
 
     On simple cases, Remimu's match speed is similar to PCRE2. Regex parsing/compilation is also much faster (around 4x to 10x), so single-shot regexes are often faster than PCRE2.
 
-    HOWEVER: Remimu is a pure backtracking engine, and has `O(2^x)` complexity on regexes with catastrophic backtracking. It can be much, much, MUCH slower than PCRE2. Beware!
+    HOWEVER: Remimu is a backtracking engine by default, and has `O(2^x)` complexity on regexes with catastrophic backtracking. It can be much, much, MUCH slower than PCRE2. Beware!
+    
+    Passing REMIMU_FLAG_LINEAR to regex_parse makes regex_match use a Pike VM instead, which takes `O(text length * regex size)` time on every regex and finds the same matches. It's slower than backtracking on simple cases, needs about 180KB of stack, and only reports the first few captures (REMIMU_LINEAR_MAX_CAPS). Regexes with possessive groups or atomic groups can't use it, so regex_parse rejects them with that flag; possessive single tokens like \w++ are fine.
 
-    Remimu uses length-checked fixed memory buffers with no recursion, so memory usage is statically known.
+    regex_compile also finds the literal bytes every match has to start with, and regex_match_program checks those before anything else. Long runs of a character class of up to 4 byte ranges (\w+, [^"\\]*, [0-9]+) are matched 16 or 32 bytes at a time with SSE2/AVX2 where available.
+    
+    Remimu uses length-checked fixed memory buffers with no recursion, so memory usage is statically known. The backtracking matcher's buffer holds REMIMU_STACK_STATES backtracking points (24 bytes each); matches that need more fail with -2, unless it's allowed to continue on the heap, with REMIMU_HEAP_STATES or regex_match_program_mem.
 
 FEATURES
 
     - Lowest-common-denominator common regex syntax
     - Based on backtracking (slow in the worst case, but fast in the best case)
     - 8-bit only, no utf-16 or utf-32
-    - Statically known memory usage (no heap allocation or recursion)
+    - Statically known memory usage (no recursion, and no heap allocation unless asked for)
     - Groups with or without capture, and with or without quantifiers
     - Supported escapes:
     - - 2-digit hex: e.g. \x00, \xFF, or lowercase, or mixed case
@@ -96,6 +169,21 @@ USAGE
     int64_t match_len = regex_match(tokens, "23.53) ", 0, 0, 0, 0);
     printf("########### return: %zd\n", match_len);
     
+    // matching the same regex many times:
+    
+    RegexProgram program;
+    e = regex_compile(tokens, &program);
+    assert(!e);
+    
+    for (size_t i = 0; i < line_count; i++)
+        match_len = regex_match_program(&program, lines[i], 0, 0, 0, 0);
+    
+    // finding every match in a text (this regex can't match nothing, so each search starts further on):
+    
+    int64_t len = 0;
+    for (int64_t at = regex_search(&program, text, 0, &len, 0, 0, 0); at >= 0; at = regex_search(&program, text, at + len, &len, 0, 0, 0))
+        printf("match at %zd: %.*s\n", at, (int)len, text + at);
+    
     // with captures:
     
     RegexToken tokens[256];
@@ -126,9 +214,28 @@ LICENSE
 #include <stdio.h>
 #include <stddef.h>
 #include <string.h>
+#include <stdlib.h>
 #include <assert.h>
 
+// Long runs of a character class (like the [a-z]* in [a-z][a-z0-9]*) are matched 16 bytes at a time with SSE2, or 32
+// with AVX2 where the CPU has it. That reads whole vectors, so it can read past the end of the text (but never into
+// the next memory page), which AddressSanitizer would flag, so it's off there. Define REMIMU_NO_SIMD to turn it off.
+#if !defined(REMIMU_NO_SIMD) && defined(__GNUC__) && defined(__SSE2__)
+#if defined(__SANITIZE_ADDRESS__)
+#define REMIMU_NO_SIMD
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define REMIMU_NO_SIMD
+#endif
+#endif
+#endif
+#if !defined(REMIMU_NO_SIMD) && defined(__GNUC__) && defined(__SSE2__)
+#define REMIMU_SIMD
+#include <immintrin.h>
+#endif
+
 static const int REMIMU_FLAG_DOT_NO_NEWLINES = 1;
+static const int REMIMU_FLAG_LINEAR          = 2;
 
 static const uint8_t REMIMU_KIND_NORMAL      = 0;
 static const uint8_t REMIMU_KIND_OPEN        = 1;
@@ -143,6 +250,7 @@ static const uint8_t REMIMU_KIND_END         = 9;
 
 static const uint8_t REMIMU_MODE_POSSESSIVE  = 1;
 static const uint8_t REMIMU_MODE_LAZY        = 2;
+static const uint8_t REMIMU_MODE_LINEAR      = 64; // only on the first token: regex_match uses the linear-time matcher
 static const uint8_t REMIMU_MODE_INVERTED    = 128; // temporary; gets cleared later
 
 typedef struct _RegexToken {
@@ -154,6 +262,85 @@ typedef struct _RegexToken {
     int16_t pair_offset; // from ( or ), offset in token list to matching paren. TODO: move into mask maybe
 } RegexToken;
 
+#ifndef REMIMU_LINEAR_MAX_INSTS
+#ifdef REGEX_STACK_SMOL
+#define REMIMU_LINEAR_MAX_INSTS 128
+#define REMIMU_LINEAR_MAX_CAPS 4
+#define REMIMU_LINEAR_MAX_DEPTH 32
+#else
+#define REMIMU_LINEAR_MAX_INSTS 512 // program size limit for the linear-time matcher; counted repetitions are unrolled
+#define REMIMU_LINEAR_MAX_CAPS 8 // captures it can report; later ones come back as -1
+#define REMIMU_LINEAR_MAX_DEPTH 128 // group nesting limit
+#endif
+#endif
+
+// Instruction of the linear-time matcher's program. Jump targets are relative, so that repeated groups can be copied.
+typedef struct _RegexPikeInst {
+    uint8_t op;
+    uint16_t arg; // token index for byte-matching ops, capture slot for SAVE, token kind for ASSERT
+    int16_t x; // next instruction for JMP, first choice for SPLIT
+    int16_t y; // second choice for SPLIT
+} RegexPikeInst;
+
+typedef struct _RegexPikeProgram {
+    RegexPikeInst insts[REMIMU_LINEAR_MAX_INSTS];
+    uint16_t inst_count;
+    uint16_t cap_count; // capture groups, including group 0 (the whole match)
+} RegexPikeProgram;
+
+static inline int _regex_pike_compile(const RegexToken * tokens, RegexPikeProgram * program);
+
+#define REMIMU_MAX_GROUPS 1024 // quantified group state slots (two per group, including the invisible outer group)
+#define REMIMU_MAX_CLASS_RUNS 16 // repeated tokens per regex whose runs can be matched with SIMD
+#define REMIMU_CLASS_RUN_RANGES 4 // byte ranges a class can have for that
+
+// The byte class of a repeated token, as a few byte ranges that SIMD can check. Never includes the null terminator.
+typedef struct _RegexClassRun {
+    uint16_t token;
+    uint8_t range_count;
+    uint8_t lo[REMIMU_CLASS_RUN_RANGES];
+    uint8_t hi[REMIMU_CLASS_RUN_RANGES];
+} RegexClassRun;
+
+// A parsed regex with everything regex_match would otherwise work out from the tokens on every call. See regex_compile.
+typedef struct _RegexProgram {
+    const RegexToken * tokens; // not copied; must outlive the program
+    uint32_t token_count; // not counting the END token
+    uint16_t group_count; // quantified group state slots used
+    uint16_t cap_count; // capture groups, including group 0 (the whole match)
+    uint16_t group_cap_index[REMIMU_MAX_GROUPS]; // capture index of each quantified group state slot, or 0xFFFF
+    uint16_t first_mask[16]; // bytes that a match can start with; only set if min_length isn't 0
+    uint32_t min_length; // shortest possible match
+    uint8_t anchored; // can only match at index 0 (starts with ^ outside of any alternation)
+    uint8_t prefix[16]; // literal bytes that every match starts with
+    uint8_t prefix_length;
+    RegexClassRun class_runs[REMIMU_MAX_CLASS_RUNS]; // in token order
+    uint8_t class_run_count;
+    RegexClassRun first_skip; // bytes other than first_mask's, if they fit; range_count is 0 otherwise
+    uint8_t linear; // parsed with REMIMU_FLAG_LINEAR; matched with the pike program
+    RegexPikeProgram pike;
+} RegexProgram;
+
+#ifndef REMIMU_SET_MAX_PATTERNS
+#ifdef REGEX_STACK_SMOL
+#define REMIMU_SET_MAX_PATTERNS 16
+#define REMIMU_SET_MAX_INSTS 1024
+#else
+#define REMIMU_SET_MAX_PATTERNS 256 // regexes in a RegexSet
+#define REMIMU_SET_MAX_INSTS 4096 // linear-time matcher instructions of all of a set's regexes together
+#endif
+#endif
+
+// Compiled regexes that get matched at the same index together, in one pass over the text. See regex_set_add.
+typedef struct _RegexSet {
+    const RegexProgram * programs[REMIMU_SET_MAX_PATTERNS]; // not copied; must outlive the set
+    uint16_t count;
+    uint16_t inst_start[REMIMU_SET_MAX_PATTERNS]; // where each regex's instructions start, or 0xFFFF if it's matched on its own
+    RegexPikeInst insts[REMIMU_SET_MAX_INSTS]; // linear-time matcher programs of the regexes that have one, back to back
+    uint16_t inst_owner[REMIMU_SET_MAX_INSTS]; // which regex each instruction belongs to
+    uint16_t inst_count;
+} RegexSet;
+
 /// Returns a negative number on failure:
 /// -1: Regex string is invalid or using unsupported features or too long.
 /// -2: Provided buffer not long enough. Give up, or reallocate with more length and retry.
@@ -161,7 +348,7 @@ typedef struct _RegexToken {
 /// On call, token_count pointer must point to the number of tokens that can be written to the tokens buffer.
 /// On successful return, the number of actually used tokens is written to token_count.
 /// Sets token_count to zero if a regex is not created but no error happened (e.g. empty pattern).
-/// Flags: Not yet used.
+/// Flags: REMIMU_FLAG_DOT_NO_NEWLINES, REMIMU_FLAG_LINEAR (see regex_match_linear; fails with -1 if the regex can't use it).
 /// SAFETY: Pattern must be null-terminated.
 /// SAFETY: tokens buffer must have at least the input token_count number of RegexToken objects. They are allowed to be uninitialized.
 static inline int regex_parse(const char * pattern, RegexToken * tokens, int16_t * token_count, int32_t flags)
@@ -797,101 +984,906 @@ static inline int regex_parse(const char * pattern, RegexToken * tokens, int16_t
     #undef _REGEX_SET_MASK
     #undef _REGEX_CLEAR_TOKEN
     
+    if (flags & REMIMU_FLAG_LINEAR)
+    {
+        RegexPikeProgram program;
+        if (_regex_pike_compile(tokens, &program) != 0)
+        {
+            puts("regex can't use the linear-time matcher (possessive or atomic group, or too big)");
+            return -1;
+        }
+        tokens[0].mode |= REMIMU_MODE_LINEAR;
+    }
+    
     return 0;
 }
 
+// A backtracking point of the backtracking matcher. 24 bytes; matches that would need indexes or counts past 32 bits
+// fail with -2 instead.
 typedef struct _RegexMatcherState {
-    uint32_t k;
+    uint32_t i; // relative to start_i
+    uint32_t range_min;
+    uint32_t range_max;
     uint32_t group_state; // quantified group temp state (e.g. number of repetitions)
     uint32_t prev; // for )s, stack index of corresponding previous quantified state
+    uint16_t k;
+    uint8_t dummy; // only there for captures; rewinding skips it
+} RegexMatcherState;
+
+#ifndef REMIMU_STACK_STATES
 #ifdef REGEX_STACK_SMOL
-    uint32_t i;
-    uint32_t range_min;
-    uint32_t range_max;
+#define REMIMU_STACK_STATES 256
 #else
-    uint64_t i;
-    uint64_t range_min;
-    uint64_t range_max;
+#define REMIMU_STACK_STATES 1024 // backtracking points regex_match_program keeps on the thread's stack
 #endif
-} RegexMatcherState;
+#endif
+#ifndef REMIMU_HEAP_STATES
+#define REMIMU_HEAP_STATES 0 // how many regex_match_program can grow to on the heap after that; 0 means it never does
+#endif
+
+// Memory for the backtracking matcher's rewind states, for regex_match_program_mem. It uses the arena first, then
+// moves to the heap, doubling in size up to heap_max states. Running out of both is a -2 failure.
+typedef struct _RegexMemory {
+    RegexMatcherState * arena; // caller-provided; can be null
+    uint32_t arena_size; // in states
+    uint32_t heap_max; // 0 means never using the heap
+    RegexMatcherState * heap; // kept between matches for reuse; free it with regex_memory_free
+    uint32_t heap_size;
+} RegexMemory;
+
+static inline void regex_memory_free(RegexMemory * memory)
+{
+    free(memory->heap);
+    memory->heap = 0;
+    memory->heap_size = 0;
+}
+
+// Moves the states to a bigger heap buffer, or returns null if there's no more room.
+static inline RegexMatcherState * _regex_grow_stack(RegexMemory * memory, RegexMatcherState * states, uint32_t * capacity)
+{
+    if (*capacity >= memory->heap_max)
+        return 0;
+    uint32_t want = *capacity < memory->heap_max / 2 ? *capacity * 2 : memory->heap_max;
+    if (want < REMIMU_STACK_STATES && memory->heap_max >= REMIMU_STACK_STATES)
+        want = REMIMU_STACK_STATES;
+    if (memory->heap_size < want)
+    {
+        RegexMatcherState * heap = 0;
+        if (states == memory->heap)
+        {
+            heap = (RegexMatcherState *)realloc(memory->heap, want * sizeof(RegexMatcherState));
+            if (heap)
+                states = heap;
+        }
+        else
+        {
+            free(memory->heap);
+            memory->heap = 0;
+            memory->heap_size = 0;
+            heap = (RegexMatcherState *)malloc(want * sizeof(RegexMatcherState));
+        }
+        if (!heap)
+            return 0;
+        memory->heap = heap;
+        memory->heap_size = want;
+    }
+    if (states != memory->heap)
+        memcpy(memory->heap, states, *capacity * sizeof(RegexMatcherState));
+    *capacity = memory->heap_size;
+    return memory->heap;
+}
 
 // NOTE: undef'd later
 #define _REGEX_CHECK_MASK(K, byte) (!!(tokens[K].mask[((uint8_t)byte)>>4] & (1 << ((uint8_t)byte & 0xF))))
 
-// Returns match length if text starts with a regex match.
-// Returns -1 if the text doesn't start with a regex match.
-// Returns -2 if the matcher ran out of memory or the regex is too complex.
-// Returns -3 if the regex is somehow invalid.
-// The first cap_slots capture positions and spans (lengths) will be written to cap_pos and cap_span. If zero, will not be written to.
-// SAFETY: The text variable must be null-terminated, and start_i must be the index of a character within the string or its null terminator.
-// SAFETY: Tokens array must be terminated by a REMIMU_KIND_END token (done by default by regex_parse).
-// SAFETY: Partial capture data may be written even if the match fails.
 #ifdef __cplusplus
 #define REMIMU_STRING_TYPE T &
-template <typename T>
 #else
 #define REMIMU_STRING_TYPE char *
 #endif
-static inline int64_t regex_match(const RegexToken * tokens, const REMIMU_STRING_TYPE text, size_t start_i, uint16_t cap_slots, int64_t * cap_pos, int64_t * cap_span)
+
+// LINEAR-TIME MATCHER
+//
+// A Pike VM: the regex is compiled into a small program (counted repetitions unrolled), and every possible match runs
+// in lockstep over the text, one byte at a time, with at most one thread per instruction. That's O(text * program)
+// time no matter what the regex is. Threads are kept in priority order, and lower-priority threads are dropped once a
+// higher-priority one matches, so it finds the same match as the backtracking matcher: greedy and lazy quantifiers
+// and alternation order all work the same way.
+//
+// Possessive quantifiers work on single tokens (e.g. \w++ or [0-9]{2,4}+): those keep consuming as long as the next
+// byte fits. Possessive quantifiers on groups and atomic groups need backtracking into a finished group to be cut off,
+// which lockstep matching can't do, so regexes with them can't be compiled for it.
+//
+// Captures can differ in one way: when the last repetition of a group matched nothing, PCRE2 and the backtracking
+// matcher report that empty repetition, but this reports the one before it.
+//
+// Memory is fixed: about (32 * REMIMU_LINEAR_MAX_CAPS + 96) * REMIMU_LINEAR_MAX_INSTS bytes of stack.
+
+static const uint8_t _REGEX_PIKE_CHAR   = 0; // consume a byte in tokens[arg].mask
+static const uint8_t _REGEX_PIKE_PLOOP  = 1; // consume bytes in tokens[arg].mask for as long as there are any
+static const uint8_t _REGEX_PIKE_POPT   = 2; // consume a byte in tokens[arg].mask if there is one
+static const uint8_t _REGEX_PIKE_SPLIT  = 3;
+static const uint8_t _REGEX_PIKE_JMP    = 4;
+static const uint8_t _REGEX_PIKE_SAVE   = 5;
+static const uint8_t _REGEX_PIKE_ASSERT = 6;
+static const uint8_t _REGEX_PIKE_MATCH  = 7;
+
+static const uint16_t _REGEX_PIKE_NONE = 0xFFFF;
+
+// Turns prog[start..*n) into `lo` to `hi - 1` copies of itself (hi == 0 means no limit), like a quantifier on it does.
+// Returns -2 if that doesn't fit.
+static inline int _regex_pike_repeat(RegexPikeInst * prog, uint16_t * n, RegexPikeInst * scratch, uint16_t start, uint16_t lo, uint16_t hi, uint8_t lazy)
 {
-#ifdef REGEX_VERBOSE
-    const uint8_t verbose = 1;
-#else
-    const uint8_t verbose = 0;
-#endif
+    if (lo == 1 && hi == 2)
+        return 0;
     
-#define IF_VERBOSE(X) { if (verbose) { X } }
+    uint16_t len = *n - start;
+    memcpy(scratch, prog + start, len * sizeof(RegexPikeInst));
+    uint32_t at = start;
     
-#ifdef REGEX_STACK_SMOL
-    const uint16_t stack_size_max = 256;
-#else
-    const uint16_t stack_size_max = 1024;
+    #define _REGEX_PIKE_APPEND_BODY() { \
+        if (at + len > REMIMU_LINEAR_MAX_INSTS) \
+            return -2; \
+        memcpy(prog + at, scratch, len * sizeof(RegexPikeInst)); \
+        at += len; \
+    }
+    #define _REGEX_PIKE_EMIT(OP, X, Y) { \
+        if (at >= REMIMU_LINEAR_MAX_INSTS) \
+            return -2; \
+        prog[at].op = (OP); \
+        prog[at].arg = 0; \
+        prog[at].x = (X); \
+        prog[at].y = (Y); \
+        at += 1; \
+    }
+    
+    // with no limit, the last required copy doubles as the loop
+    uint16_t required = (hi == 0 && lo > 0) ? lo - 1 : lo;
+    for (uint16_t c = 0; c < required; c++)
+        _REGEX_PIKE_APPEND_BODY()
+    
+    if (hi == 0)
+    {
+        // x* is compiled as (x+)?, so that an iteration that matches nothing still gets to leave the loop
+        // (split L, out;) L: body; split L, out; out:
+        uint32_t skip = at;
+        if (lo == 0)
+            _REGEX_PIKE_EMIT(_REGEX_PIKE_SPLIT, 1, 0)
+        uint32_t loop = at;
+        _REGEX_PIKE_APPEND_BODY()
+        _REGEX_PIKE_EMIT(_REGEX_PIKE_SPLIT, -(int16_t)(at - loop), 1)
+        if (lo == 0)
+            prog[skip].y = at - skip;
+        if (lazy)
+        {
+            prog[at - 1].x = 1;
+            prog[at - 1].y = -(int16_t)(at - 1 - loop);
+            if (lo == 0)
+            {
+                prog[skip].x = prog[skip].y;
+                prog[skip].y = 1;
+            }
+        }
+    }
+    else
+    {
+        // split body, out; body; split body, out; body; ...; out:
+        uint32_t first = at;
+        for (uint32_t c = lo + 1; c < hi; c++)
+        {
+            _REGEX_PIKE_EMIT(_REGEX_PIKE_SPLIT, 1, 0)
+            _REGEX_PIKE_APPEND_BODY()
+        }
+        for (uint32_t split = first; split < at; split += len + 1)
+        {
+            prog[split].x = lazy ? at - split : 1;
+            prog[split].y = lazy ? 1 : at - split;
+        }
+    }
+    
+    #undef _REGEX_PIKE_APPEND_BODY
+    #undef _REGEX_PIKE_EMIT
+    
+    *n = at;
+    return 0;
+}
+
+// Returns 0 on success, -1 if the regex uses something the linear-time matcher can't do, or -2 if it's too big for it.
+static inline int _regex_pike_compile(const RegexToken * tokens, RegexPikeProgram * program)
+{
+    RegexPikeInst * prog = program->insts;
+    RegexPikeInst scratch[REMIMU_LINEAR_MAX_INSTS];
+    uint16_t n = 0;
+    
+    // groups being compiled
+    struct {
+        uint16_t start; // where their code starts
+        uint16_t split; // SPLIT in front of the current alternative, or _REGEX_PIKE_NONE
+        uint16_t jumps; // last JMP from the end of an alternative to the end of the group; each one's arg links to the one before
+        uint16_t cap; // capture group, or _REGEX_PIKE_NONE
+    } groups[REMIMU_LINEAR_MAX_DEPTH];
+    uint16_t depth = 0;
+    uint16_t caps = 0;
+    
+    #define _REGEX_PIKE_EMIT(OP, ARG, X) { \
+        if (n >= REMIMU_LINEAR_MAX_INSTS) \
+            return -2; \
+        prog[n].op = (OP); \
+        prog[n].arg = (ARG); \
+        prog[n].x = (X); \
+        prog[n].y = 0; \
+        n += 1; \
+    }
+    // an alternative that another one follows starts with a SPLIT to that one
+    #define _REGEX_PIKE_START_ALTERNATIVE(SEPARATOR) { \
+        groups[depth - 1].split = _REGEX_PIKE_NONE; \
+        if (tokens[SEPARATOR].kind == REMIMU_KIND_OR) \
+        { \
+            groups[depth - 1].split = n; \
+            _REGEX_PIKE_EMIT(_REGEX_PIKE_SPLIT, 0, 1) \
+        } \
+    }
+    
+    for (uint32_t k = 0; tokens[k].kind != REMIMU_KIND_END; k++)
+    {
+        const RegexToken * token = tokens + k;
+        uint8_t lazy = !!(token->mode & REMIMU_MODE_LAZY);
+        if (token->kind == REMIMU_KIND_OPEN || token->kind == REMIMU_KIND_NCOPEN)
+        {
+            if (token->mode & REMIMU_MODE_POSSESSIVE)
+                return -1;
+            uint16_t cap = token->kind == REMIMU_KIND_OPEN ? caps++ : _REGEX_PIKE_NONE;
+            // deliberately unmatchable group (e.g. (a){0}); its capture groups still count
+            if (token->count_hi == 1)
+            {
+                for (uint32_t k2 = k + 1; k2 < k + token->pair_offset; k2++)
+                    caps += tokens[k2].kind == REMIMU_KIND_OPEN;
+                k += token->pair_offset;
+                continue;
+            }
+            if (depth >= REMIMU_LINEAR_MAX_DEPTH)
+                return -2;
+            groups[depth].start = n;
+            groups[depth].jumps = _REGEX_PIKE_NONE;
+            groups[depth].cap = cap < REMIMU_LINEAR_MAX_CAPS ? cap : _REGEX_PIKE_NONE;
+            depth += 1;
+            if (groups[depth - 1].cap != _REGEX_PIKE_NONE)
+                _REGEX_PIKE_EMIT(_REGEX_PIKE_SAVE, cap * 2, 0)
+            _REGEX_PIKE_START_ALTERNATIVE(k + token->mask[15])
+        }
+        else if (token->kind == REMIMU_KIND_OR)
+        {
+            if (depth == 0)
+                return -1;
+            uint16_t jump = n;
+            _REGEX_PIKE_EMIT(_REGEX_PIKE_JMP, groups[depth - 1].jumps, 0)
+            groups[depth - 1].jumps = jump;
+            if (groups[depth - 1].split != _REGEX_PIKE_NONE)
+                prog[groups[depth - 1].split].y = n - groups[depth - 1].split;
+            _REGEX_PIKE_START_ALTERNATIVE(k + token->pair_offset)
+        }
+        else if (token->kind == REMIMU_KIND_CLOSE)
+        {
+            if (depth == 0 || (token->mode & REMIMU_MODE_POSSESSIVE))
+                return -1;
+            depth -= 1;
+            for (uint16_t jump = groups[depth].jumps; jump != _REGEX_PIKE_NONE; jump = prog[jump].arg)
+                prog[jump].x = n - jump;
+            if (groups[depth].cap != _REGEX_PIKE_NONE)
+                _REGEX_PIKE_EMIT(_REGEX_PIKE_SAVE, groups[depth].cap * 2 + 1, 0)
+            if (_regex_pike_repeat(prog, &n, scratch, groups[depth].start, token->count_lo, token->count_hi, lazy) != 0)
+                return -2;
+        }
+        else if (token->kind == REMIMU_KIND_NORMAL)
+        {
+            // deliberately unmatchable token (e.g. a{0})
+            if (token->count_hi == 1)
+                continue;
+            if (token->mode & REMIMU_MODE_POSSESSIVE)
+            {
+                for (uint16_t c = 0; c < token->count_lo; c++)
+                    _REGEX_PIKE_EMIT(_REGEX_PIKE_CHAR, k, 0)
+                if (token->count_hi == 0)
+                    _REGEX_PIKE_EMIT(_REGEX_PIKE_PLOOP, k, 0)
+                for (uint32_t c = token->count_lo + 1; c < token->count_hi; c++)
+                    _REGEX_PIKE_EMIT(_REGEX_PIKE_POPT, k, 0)
+            }
+            else
+            {
+                uint16_t start = n;
+                _REGEX_PIKE_EMIT(_REGEX_PIKE_CHAR, k, 0)
+                if (_regex_pike_repeat(prog, &n, scratch, start, token->count_lo, token->count_hi, lazy) != 0)
+                    return -2;
+            }
+        }
+        else
+            _REGEX_PIKE_EMIT(_REGEX_PIKE_ASSERT, token->kind, 0)
+    }
+    if (depth != 0)
+        return -1;
+    _REGEX_PIKE_EMIT(_REGEX_PIKE_MATCH, 0, 0)
+    
+    #undef _REGEX_PIKE_EMIT
+    #undef _REGEX_PIKE_START_ALTERNATIVE
+    
+    program->inst_count = n;
+    program->cap_count = caps;
+    return 0;
+}
+
+static inline uint8_t _regex_is_word_byte(uint8_t c)
+{
+    return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '_';
+}
+
+// Runs a compiled program. Returns the same things as regex_match.
+// With search set, also starts a thread at every later index that can start a match (one whose byte is in first_mask,
+// if given) until something matches, and writes where the match starts to match_start. If nothing matched, it writes
+// the index where it ran out of threads instead, which every index before has been tried at.
+#ifdef __cplusplus
+template <typename T>
 #endif
-    const uint16_t aux_stats_size = 1024;
-    if (cap_slots > aux_stats_size)
-        cap_slots = aux_stats_size;
+static inline int64_t _regex_pike_run(const RegexToken * tokens, const RegexPikeProgram * program, const REMIMU_STRING_TYPE text, size_t start_i, uint16_t cap_slots, int64_t * cap_pos, int64_t * cap_span,
+    uint8_t search, const uint16_t * first_mask, int64_t * match_start)
+{
+    const RegexPikeInst * prog = program->insts;
+    uint16_t tracked = cap_slots < REMIMU_LINEAR_MAX_CAPS ? cap_slots : REMIMU_LINEAR_MAX_CAPS;
+    if (search && tracked == 0)
+        tracked = 1; // for where the match starts
+    if (tracked > program->cap_count)
+        tracked = program->cap_count;
+    uint16_t slots = tracked * 2;
     
-    // quantified group state
-    uint8_t q_group_accepts_zero[aux_stats_size];
-    uint32_t q_group_state[aux_stats_size]; // number of repetitions
-    uint32_t q_group_stack[aux_stats_size]; // location of most recent corresponding ) on stack. 0 means nowhere
+    // the threads at the current and next text position, in priority order, with their capture slots
+    uint16_t list_pc[2][REMIMU_LINEAR_MAX_INSTS];
+    int64_t list_caps[2][REMIMU_LINEAR_MAX_INSTS * REMIMU_LINEAR_MAX_CAPS * 2];
+    uint16_t list_n[2] = {0, 0};
+    // which step last visited each instruction; each only gets one thread per step
+    uint32_t visited[REMIMU_LINEAR_MAX_INSTS];
+    memset(visited, 0, program->inst_count * sizeof(uint32_t));
+    uint32_t step = 1;
+    
+    int64_t caps[REMIMU_LINEAR_MAX_CAPS * 2];
+    int64_t best[REMIMU_LINEAR_MAX_CAPS * 2];
+    for (uint16_t s = 0; s < slots; s++)
+        caps[s] = -1;
+    
+    // for following jumps without recursion; a slot means putting that capture slot back to `old` instead
+    struct {
+        uint16_t pc;
+        uint16_t slot;
+        int64_t old;
+    } stack[REMIMU_LINEAR_MAX_INSTS * 3 + 1];
+    
+    // adds the threads that reach a byte-consuming instruction from pc without consuming anything, in priority order
+    #define _REGEX_PIKE_ADD(LIST, PC, I) { \
+        uint32_t sp = 0; \
+        stack[sp].pc = (PC); \
+        stack[sp++].slot = _REGEX_PIKE_NONE; \
+        while (sp > 0) \
+        { \
+            sp -= 1; \
+            if (stack[sp].slot != _REGEX_PIKE_NONE) \
+            { \
+                caps[stack[sp].slot] = stack[sp].old; \
+                continue; \
+            } \
+            uint16_t pc = stack[sp].pc; \
+            if (visited[pc] == step) \
+                continue; \
+            visited[pc] = step; \
+            const RegexPikeInst * inst = prog + pc; \
+            uint8_t here = text[(I)]; \
+            uint8_t add = 0; \
+            uint16_t next = _REGEX_PIKE_NONE; \
+            if (inst->op == _REGEX_PIKE_CHAR || inst->op == _REGEX_PIKE_MATCH) \
+                add = 1; \
+            else if (inst->op == _REGEX_PIKE_PLOOP || inst->op == _REGEX_PIKE_POPT) \
+            { \
+                if (here != 0 && _REGEX_CHECK_MASK(inst->arg, here)) \
+                    add = 1; \
+                else \
+                    next = pc + 1; \
+            } \
+            else if (inst->op == _REGEX_PIKE_JMP) \
+                next = pc + inst->x; \
+            else if (inst->op == _REGEX_PIKE_SPLIT) \
+            { \
+                stack[sp].pc = pc + inst->y; \
+                stack[sp++].slot = _REGEX_PIKE_NONE; \
+                next = pc + inst->x; \
+            } \
+            else if (inst->op == _REGEX_PIKE_SAVE) \
+            { \
+                if (inst->arg < slots) \
+                { \
+                    stack[sp].slot = inst->arg; \
+                    stack[sp++].old = caps[inst->arg]; \
+                    caps[inst->arg] = (I); \
+                } \
+                next = pc + 1; \
+            } \
+            else if (inst->op == _REGEX_PIKE_ASSERT) \
+            { \
+                uint8_t ok = 1; \
+                if (inst->arg == REMIMU_KIND_CARET) \
+                    ok = (I) == 0; \
+                else if (inst->arg == REMIMU_KIND_DOLLAR) \
+                    ok = here == 0; \
+                else \
+                { \
+                    uint8_t before = (I) != 0 && _regex_is_word_byte(text[(I) - 1]); \
+                    uint8_t after = here != 0 && _regex_is_word_byte(here); \
+                    ok = (before != after) == (inst->arg == REMIMU_KIND_BOUND); \
+                } \
+                if (ok) \
+                    next = pc + 1; \
+            } \
+            if (add) \
+            { \
+                list_pc[LIST][list_n[LIST]] = pc; \
+                memcpy(list_caps[LIST] + list_n[LIST] * slots, caps, slots * sizeof(int64_t)); \
+                list_n[LIST] += 1; \
+            } \
+            if (next != _REGEX_PIKE_NONE) \
+            { \
+                stack[sp].pc = next; \
+                stack[sp++].slot = _REGEX_PIKE_NONE; \
+            } \
+        } \
+    }
     
-    uint16_t q_group_cap_index[aux_stats_size];
-    memset(q_group_cap_index, 0xFF, sizeof(q_group_cap_index));
+    int64_t matched = -1;
+    uint64_t i = start_i;
+    uint8_t cur = 0;
+    _REGEX_PIKE_ADD(cur, 0, i)
+    while (list_n[cur] > 0)
+    {
+        uint8_t c = text[i];
+        uint8_t nxt = cur ^ 1;
+        list_n[nxt] = 0;
+        step += 1;
+        if (step == 0)
+        {
+            memset(visited, 0, program->inst_count * sizeof(uint32_t));
+            step = 1;
+        }
+        for (uint16_t t = 0; t < list_n[cur]; t++)
+        {
+            uint16_t pc = list_pc[cur][t];
+            const RegexPikeInst * inst = prog + pc;
+            if (inst->op == _REGEX_PIKE_MATCH)
+            {
+                // anything after this thread has lower priority
+                matched = i;
+                memcpy(best, list_caps[cur] + t * slots, slots * sizeof(int64_t));
+                break;
+            }
+            if (c == 0)
+                continue;
+            // PLOOP and POPT threads only exist when the byte fits
+            if (inst->op == _REGEX_PIKE_CHAR && !_REGEX_CHECK_MASK(inst->arg, c))
+                continue;
+            memcpy(caps, list_caps[cur] + t * slots, slots * sizeof(int64_t));
+            _REGEX_PIKE_ADD(nxt, inst->op == _REGEX_PIKE_PLOOP ? pc : pc + 1, i + 1)
+        }
+        if (c == 0)
+            break;
+        // new threads have lower priority than the ones that started earlier
+        uint8_t next_c = text[i + 1];
+        if (search && matched < 0 && (!first_mask || (next_c != 0 && (first_mask[next_c >> 4] & (1 << (next_c & 0xF))))))
+        {
+            for (uint16_t s = 0; s < slots; s++)
+                caps[s] = -1;
+            _REGEX_PIKE_ADD(nxt, 0, i + 1)
+        }
+        i += 1;
+        cur = nxt;
+    }
+    
+    #undef _REGEX_PIKE_ADD
+    
+    if (search)
+        *match_start = matched < 0 ? (int64_t)i : best[0];
+    if (matched < 0)
+        return -1;
+    for (uint16_t n = 0; n < program->cap_count && n < cap_slots; n++)
+    {
+        cap_pos[n] = -1;
+        cap_span[n] = -1;
+        if (n < tracked && best[n * 2] >= 0 && best[n * 2 + 1] >= best[n * 2])
+        {
+            cap_pos[n] = best[n * 2];
+            cap_span[n] = best[n * 2 + 1] - best[n * 2];
+        }
+    }
+    return matched;
+}
+
+// Like regex_match, but in O(text length * regex size) time, using fixed memory. Returns -3 if the regex can't be
+// matched this way (see the LINEAR-TIME MATCHER notes above). regex_match calls this by itself for regexes parsed with
+// REMIMU_FLAG_LINEAR.
+#ifdef __cplusplus
+template <typename T>
+#endif
+static inline int64_t regex_match_linear(const RegexToken * tokens, const REMIMU_STRING_TYPE text, size_t start_i, uint16_t cap_slots, int64_t * cap_pos, int64_t * cap_span)
+{
+    RegexPikeProgram program;
+    if (_regex_pike_compile(tokens, &program) != 0)
+        return -3;
+    return _regex_pike_run(tokens, &program, text, start_i, cap_slots, cap_pos, cap_span, 0, 0, 0);
+}
+
+static inline const RegexClassRun * _regex_find_class_run(const RegexProgram * program, uint32_t k)
+{
+    for (uint8_t r = 0; r < program->class_run_count && program->class_runs[r].token <= k; r++)
+    {
+        if (program->class_runs[r].token == k)
+            return &program->class_runs[r];
+    }
+    return 0;
+}
+
+// Where the text's bytes are, if they're in one piece; SIMD and the libc string functions are only used then.
+#ifdef __cplusplus
+template <typename T>
+static inline const char * _regex_text_data(const T &) { return 0; }
+static inline const char * _regex_text_data(const char * const & text) { return text; }
+static inline const char * _regex_text_data(char * const & text) { return text; }
+template <size_t N>
+static inline const char * _regex_text_data(const char (& text)[N]) { return text; }
+#else
+#define _regex_text_data(TEXT) ((const char *)(TEXT))
+#endif
+
+// Sets run to the bytes in mask as byte ranges, leaving out the null terminator. Returns 0 if there are too many.
+static inline uint8_t _regex_mask_to_run(const uint16_t * mask, RegexClassRun * run)
+{
+    run->range_count = 0;
+    int start = -1;
+    for (int b = 1; b <= 256; b++)
+    {
+        int in = b < 256 && (mask[b >> 4] & (1 << (b & 0xF)));
+        if (in && start < 0)
+            start = b;
+        else if (!in && start >= 0)
+        {
+            if (run->range_count == REMIMU_CLASS_RUN_RANGES)
+            {
+                run->range_count = 0;
+                return 0;
+            }
+            run->lo[run->range_count] = start;
+            run->hi[run->range_count] = b - 1;
+            run->range_count += 1;
+            start = -1;
+        }
+    }
+    return 1;
+}
+
+#ifdef REMIMU_SIMD
+
+static inline uint8_t _regex_class_run_has(const RegexClassRun * run, uint8_t c)
+{
+    uint8_t in = 0;
+    for (uint8_t r = 0; r < run->range_count; r++)
+        in |= (uint8_t)(c - run->lo[r]) <= (uint8_t)(run->hi[r] - run->lo[r]);
+    return in;
+}
+
+// How many bytes from p on are in the run's class, up to max, a vector at a time. Vectors never cross into another
+// memory page: the bytes before a page boundary are checked one at a time. Leaves the last few bytes before max, if
+// there's less than a vector of them, to the caller.
+static inline size_t _regex_class_run_sse2(const RegexClassRun * run, const char * p, size_t max)
+{
+    __m128i lo[REMIMU_CLASS_RUN_RANGES];
+    __m128i span[REMIMU_CLASS_RUN_RANGES];
+    for (uint8_t r = 0; r < run->range_count; r++)
+    {
+        lo[r] = _mm_set1_epi8((char)run->lo[r]);
+        span[r] = _mm_set1_epi8((char)(run->hi[r] - run->lo[r]));
+    }
+    size_t n = 0;
+    while (n + 16 <= max)
+    {
+        if (((uintptr_t)(p + n) & 4095) > 4096 - 16)
+        {
+            if (!_regex_class_run_has(run, p[n]))
+                return n;
+            n += 1;
+            continue;
+        }
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + n));
+        __m128i in = _mm_setzero_si128();
+        // v - lo <= hi - lo, unsigned
+        for (uint8_t r = 0; r < run->range_count; r++)
+            in = _mm_or_si128(in, _mm_cmpeq_epi8(_mm_subs_epu8(_mm_sub_epi8(v, lo[r]), span[r]), _mm_setzero_si128()));
+        uint32_t bits = (uint32_t)_mm_movemask_epi8(in);
+        if (bits != 0xFFFF)
+            return n + __builtin_ctz(~bits);
+        n += 16;
+    }
+    return n;
+}
+
+// The AVX2 version is built next to the SSE2 one and picked at runtime, unless the compiler targets AVX2 anyway.
+#if defined(__AVX2__)
+#define REMIMU_AVX2_TARGET
+#define REMIMU_HAS_AVX2() 1
+#elif defined(__x86_64__) && defined(__linux__)
+#define REMIMU_AVX2_TARGET __attribute__((target("avx2")))
+#define REMIMU_HAS_AVX2() __builtin_cpu_supports("avx2")
+#endif
+
+#ifdef REMIMU_AVX2_TARGET
+// Same as _regex_class_run_sse2, 32 bytes at a time.
+REMIMU_AVX2_TARGET static inline size_t _regex_class_run_avx2(const RegexClassRun * run, const char * p, size_t max)
+{
+    __m256i lo[REMIMU_CLASS_RUN_RANGES];
+    __m256i span[REMIMU_CLASS_RUN_RANGES];
+    for (uint8_t r = 0; r < run->range_count; r++)
+    {
+        lo[r] = _mm256_set1_epi8((char)run->lo[r]);
+        span[r] = _mm256_set1_epi8((char)(run->hi[r] - run->lo[r]));
+    }
+    size_t n = 0;
+    while (n + 32 <= max)
+    {
+        if (((uintptr_t)(p + n) & 4095) > 4096 - 32)
+        {
+            if (!_regex_class_run_has(run, p[n]))
+                return n;
+            n += 1;
+            continue;
+        }
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + n));
+        __m256i in = _mm256_setzero_si256();
+        for (uint8_t r = 0; r < run->range_count; r++)
+            in = _mm256_or_si256(in, _mm256_cmpeq_epi8(_mm256_subs_epu8(_mm256_sub_epi8(v, lo[r]), span[r]), _mm256_setzero_si256()));
+        uint32_t bits = (uint32_t)_mm256_movemask_epi8(in);
+        if (bits != 0xFFFFFFFF)
+            return n + __builtin_ctz(~bits);
+        n += 32;
+    }
+    return n;
+}
+#endif
+
+static inline size_t _regex_class_run_simd(const RegexClassRun * run, const char * p, size_t max)
+{
+#ifdef REMIMU_AVX2_TARGET
+    if (REMIMU_HAS_AVX2())
+        return _regex_class_run_avx2(run, p, max);
+#endif
+    return _regex_class_run_sse2(run, p, max);
+}
+
+#endif // REMIMU_SIMD
+
+// Works out everything about a parsed regex that doesn't depend on the text, so that regex_match_program only does
+// work proportional to the text. The program points at the tokens instead of copying them.
+// Returns 0 on success, -2 if the regex has too many groups, or -3 if the regex is somehow invalid.
+// SAFETY: Tokens array must be terminated by a REMIMU_KIND_END token (done by default by regex_parse).
+static inline int regex_compile(const RegexToken * tokens, RegexProgram * program)
+{
+    program->tokens = tokens;
+    program->linear = !!(tokens[0].mode & REMIMU_MODE_LINEAR);
+    if (program->linear && _regex_pike_compile(tokens, &program->pike) != 0)
+        return -3;
     
-    uint64_t tokens_len = 0;
     uint32_t k = 0;
-    uint16_t caps = 0;
+    uint16_t group_count = 0;
+    for (k = 0; tokens[k].kind != REMIMU_KIND_END; k++)
+    {
+        if (tokens[k].kind == REMIMU_KIND_CLOSE || tokens[k].kind == REMIMU_KIND_OPEN || tokens[k].kind == REMIMU_KIND_NCOPEN)
+        {
+            if (tokens[k].mask[0] >= REMIMU_MAX_GROUPS)
+                return -2; // too many quantified groups
+            if (tokens[k].mask[0] >= group_count)
+                group_count = tokens[k].mask[0] + 1;
+        }
+    }
+    program->token_count = k;
+    program->group_count = group_count;
     
-    while (tokens[k].kind != REMIMU_KIND_END)
+    memset(program->group_cap_index, 0xFF, group_count * sizeof(uint16_t));
+    uint16_t caps = 0;
+    for (k = 0; k < program->token_count; k++)
     {
-        if (tokens[k].kind == REMIMU_KIND_OPEN && caps < cap_slots)
+        if (tokens[k].kind == REMIMU_KIND_OPEN)
         {
-            q_group_cap_index[tokens[k].mask[0]] = caps;
-            q_group_cap_index[tokens[k + tokens[k].pair_offset].mask[0]] = caps;
-            cap_pos[caps] = -1;
-            cap_span[caps] = -1;
+            program->group_cap_index[tokens[k].mask[0]] = caps;
+            program->group_cap_index[tokens[k + tokens[k].pair_offset].mask[0]] = caps;
             caps += 1;
         }
-        k += 1;
-        if (tokens[k].kind == REMIMU_KIND_CLOSE || tokens[k].kind == REMIMU_KIND_OPEN || tokens[k].kind == REMIMU_KIND_NCOPEN)
+    }
+    program->cap_count = caps;
+    
+    program->anchored = tokens[1].kind == REMIMU_KIND_CARET && tokens[0].mask[15] == tokens[0].pair_offset;
+    
+    // literal prefix: tokens that match one specific byte exactly once, before anything else (anchors match nothing)
+    program->prefix_length = 0;
+    for (k = 1; tokens[0].mask[15] == tokens[0].pair_offset && k < program->token_count && program->prefix_length < sizeof(program->prefix); k++)
+    {
+        const RegexToken * token = tokens + k;
+        if (token->kind == REMIMU_KIND_CARET || token->kind == REMIMU_KIND_DOLLAR || token->kind == REMIMU_KIND_BOUND || token->kind == REMIMU_KIND_NBOUND)
+            continue;
+        if (token->kind != REMIMU_KIND_NORMAL || token->count_lo != 1 || token->count_hi != 2)
+            break;
+        int byte = -1;
+        for (int b = 0; b < 256 && byte != -2; b++)
+        {
+            if (token->mask[b >> 4] & (1 << (b & 0xF)))
+                byte = byte == -1 ? b : -2;
+        }
+        if (byte <= 0)
+            break;
+        program->prefix[program->prefix_length++] = byte;
+    }
+    
+    // classes of tokens that can repeat a lot, as byte ranges
+    program->class_run_count = 0;
+    for (k = 0; k < program->token_count && program->class_run_count < REMIMU_MAX_CLASS_RUNS; k++)
+    {
+        const RegexToken * token = tokens + k;
+        if (token->kind != REMIMU_KIND_NORMAL || (token->count_hi != 0 && token->count_hi <= 16))
+            continue;
+        RegexClassRun * run = &program->class_runs[program->class_run_count];
+        run->token = k;
+        if (_regex_mask_to_run(token->mask, run) && run->range_count > 0)
+            program->class_run_count += 1;
+    }
+    
+    // shortest match and possible first bytes, one group at a time; frames[0] stands for the outside of the regex
+    const uint16_t depth_max = 256;
+    struct {
+        uint64_t min_length; // shortest match of any alternative so far
+        uint64_t alt_min_length; // shortest match of the current alternative so far
+        uint16_t first_mask[16]; // possible first bytes of any alternative so far
+        uint8_t nullable; // whether any alternative so far can match nothing
+        uint8_t alt_nullable; // whether the current alternative so far can match nothing
+    } frames[depth_max];
+    uint16_t depth = 0;
+    memset(frames, 0, sizeof(frames[0]));
+    frames[0].alt_nullable = 1;
+    
+    #define _REGEX_CLAMP_LENGTH(X) ((X) > 0xFFFFFFFF ? 0xFFFFFFFF : (X))
+    #define _REGEX_END_ALTERNATIVE() { \
+        if (frames[depth].alt_min_length < frames[depth].min_length) \
+            frames[depth].min_length = frames[depth].alt_min_length; \
+        frames[depth].nullable |= frames[depth].alt_nullable; \
+        frames[depth].alt_min_length = 0; \
+        frames[depth].alt_nullable = 1; \
+    }
+    // adds something that can start with the bytes in MASK to the current alternative
+    #define _REGEX_ADD_ELEMENT(MASK, MIN_LENGTH, NULLABLE) { \
+        if (frames[depth].alt_nullable) \
+            for (int b = 0; b < 16; b++) \
+                frames[depth].first_mask[b] |= (MASK)[b]; \
+        frames[depth].alt_nullable &= (NULLABLE); \
+        frames[depth].alt_min_length = _REGEX_CLAMP_LENGTH(frames[depth].alt_min_length + (MIN_LENGTH)); \
+    }
+    
+    uint8_t analyzed = 1;
+    for (k = 0; k < program->token_count && analyzed; k++)
+    {
+        const RegexToken * token = tokens + k;
+        uint8_t is_open = token->kind == REMIMU_KIND_OPEN || token->kind == REMIMU_KIND_NCOPEN;
+        // deliberately unmatchable token or group (e.g. a{0} or (a){0}); matches nothing
+        if ((token->kind == REMIMU_KIND_NORMAL || is_open) && token->count_hi == 1)
+            k += is_open ? token->pair_offset : 0;
+        else if (token->kind == REMIMU_KIND_NORMAL)
+            _REGEX_ADD_ELEMENT(token->mask, token->count_lo, token->count_lo == 0)
+        else if (is_open)
         {
-            if (tokens[k].mask[0] >= aux_stats_size)
+            if (depth + 1 >= depth_max)
+                analyzed = 0;
+            else
             {
-                puts("too many qualified groups. returning");
-                return -2; // OOM: too many quantified groups
+                depth += 1;
+                memset(&frames[depth], 0, sizeof(frames[0]));
+                frames[depth].min_length = 0xFFFFFFFF;
+                frames[depth].alt_nullable = 1;
             }
-            
-            q_group_state[tokens[k].mask[0]] = 0;
-            q_group_stack[tokens[k].mask[0]] = 0;
-            q_group_accepts_zero[tokens[k].mask[0]] = 0;
         }
+        else if (token->kind == REMIMU_KIND_OR)
+            _REGEX_END_ALTERNATIVE()
+        else if (token->kind == REMIMU_KIND_CLOSE)
+        {
+            _REGEX_END_ALTERNATIVE()
+            depth -= 1;
+            _REGEX_ADD_ELEMENT(frames[depth + 1].first_mask, frames[depth + 1].min_length * token->count_lo,
+                frames[depth + 1].nullable || token->count_lo == 0)
+        }
+        // anchors match nothing, so they don't change anything here
     }
     
-    tokens_len = k;
+    #undef _REGEX_CLAMP_LENGTH
+    #undef _REGEX_END_ALTERNATIVE
+    #undef _REGEX_ADD_ELEMENT
     
-    RegexMatcherState rewind_stack[stack_size_max];
-    uint16_t stack_n = 0;
+    memset(program->first_mask, 0, sizeof(program->first_mask));
+    program->min_length = 0;
+    if (analyzed && !frames[0].alt_nullable)
+    {
+        program->min_length = frames[0].alt_min_length;
+        memcpy(program->first_mask, frames[0].first_mask, sizeof(program->first_mask));
+    }
+    
+    // bytes that can't start a match, for regex_search to skip over
+    program->first_skip.range_count = 0;
+    if (program->min_length != 0)
+    {
+        uint16_t skip_mask[16];
+        for (int b = 0; b < 16; b++)
+            skip_mask[b] = ~program->first_mask[b];
+        _regex_mask_to_run(skip_mask, &program->first_skip);
+    }
+    
+    return 0;
+}
+
+// Same as regex_match_program, keeping backtracking points in the given memory instead.
+#ifdef __cplusplus
+template <typename T>
+#endif
+static inline int64_t regex_match_program_mem(const RegexProgram * program, const REMIMU_STRING_TYPE text, size_t start_i, uint16_t cap_slots, int64_t * cap_pos, int64_t * cap_span, RegexMemory * memory)
+{
+    const RegexToken * tokens = program->tokens;
+    
+    if (program->anchored && start_i != 0)
+        return -1;
+    if (program->min_length != 0)
+    {
+        uint8_t c = text[start_i];
+        if (c == 0 || !(program->first_mask[c >> 4] & (1 << (c & 0xF))))
+            return -1;
+    }
+    
+    for (uint8_t n = 0; n < program->prefix_length; n++)
+    {
+        if ((uint8_t)text[start_i + n] != program->prefix[n])
+            return -1;
+    }
+    
+    if (program->linear)
+        return _regex_pike_run(tokens, &program->pike, text, start_i, cap_slots, cap_pos, cap_span, 0, 0, 0);
+
+#ifdef REGEX_VERBOSE
+    const uint8_t verbose = 1;
+#else
+    const uint8_t verbose = 0;
+#endif
+    
+#define IF_VERBOSE(X) { if (verbose) { X } }
+    
+    if (cap_slots > program->cap_count)
+        cap_slots = program->cap_count;
+    uint16_t caps = cap_slots;
+    for (uint16_t n = 0; n < caps; n++)
+    {
+        cap_pos[n] = -1;
+        cap_span[n] = -1;
+    }
+    
+    // quantified group state
+    uint8_t q_group_accepts_zero[REMIMU_MAX_GROUPS];
+    uint32_t q_group_state[REMIMU_MAX_GROUPS]; // number of repetitions
+    uint32_t q_group_stack[REMIMU_MAX_GROUPS]; // location of most recent corresponding ) on stack. 0 means nowhere
+    memset(q_group_accepts_zero, 0, program->group_count * sizeof(uint8_t));
+    memset(q_group_state, 0, program->group_count * sizeof(uint32_t));
+    memset(q_group_stack, 0, program->group_count * sizeof(uint32_t));
+    
+    // capture index of a quantified group state slot, or 0xFFFF if it's not captured or past cap_slots
+    #define _REGEX_CAP_INDEX(G) (program->group_cap_index[G] < caps ? program->group_cap_index[G] : 0xFFFF)
+    
+    uint64_t tokens_len = program->token_count;
+    uint32_t k = 0;
+    
+    RegexMatcherState * rewind_stack = memory->arena;
+    uint32_t stack_size_max = memory->arena ? memory->arena_size : 0;
+    uint32_t stack_n = 0;
     
     uint64_t i = start_i;
     
@@ -910,18 +1902,24 @@ static inline int64_t regex_match(const RegexToken * tokens, const REMIMU_STRING
     #define _REWIND_DO_SAVE_RAW(K, ISDUMMY) { \
         if (stack_n >= stack_size_max) \
         { \
-            puts("out of backtracking room. returning"); \
-            return -2; \
+            rewind_stack = _regex_grow_stack(memory, rewind_stack, &stack_size_max); \
+            if (!rewind_stack) \
+            { \
+                puts("out of backtracking room. returning"); \
+                return -2; \
+            } \
         } \
+        if (i - start_i > 0xFFFFFFFF || range_min > 0xFFFFFFFF) \
+            return -2; \
         RegexMatcherState s; \
         memset(&s, 0, sizeof(RegexMatcherState)); \
-        s.i = i; \
+        s.i = i - start_i; \
         s.k = (K); \
         s.range_min = range_min; \
         s.range_max = range_max; \
         s.prev = 0; \
-        if (ISDUMMY) s.prev = 0xFAC7; \
-        else if (tokens[s.k].kind == REMIMU_KIND_CLOSE) \
+        s.dummy = (ISDUMMY); \
+        if (!s.dummy && tokens[s.k].kind == REMIMU_KIND_CLOSE) \
         { \
             s.group_state = q_group_state[tokens[s.k].mask[0]]; \
             s.prev = q_group_stack[tokens[s.k].mask[0]]; \
@@ -931,6 +1929,7 @@ static inline int64_t regex_match(const RegexToken * tokens, const REMIMU_STRING
         _P_TEXT_HIGHLIGHTED() \
         IF_VERBOSE(printf("-- saving rewind state k %u i %zd rmin %zu rmax %zd (line %d) (depth %d prev %d)\n", s.k, i, range_min, range_max, __LINE__, stack_n, s.prev);) \
     }
+    #define _REWIND_I(N) (start_i + rewind_stack[N].i)
     #define _REWIND_DO_SAVE_DUMMY(K) _REWIND_DO_SAVE_RAW(K, 1)
     #define _REWIND_DO_SAVE(K) _REWIND_DO_SAVE_RAW(K, 0)
     
@@ -938,12 +1937,12 @@ static inline int64_t regex_match(const RegexToken * tokens, const REMIMU_STRING
         if (stack_n == 0) \
             return -1; \
         stack_n -= 1; \
-        while (stack_n > 0 && rewind_stack[stack_n].prev == 0xFAC7) stack_n -= 1; \
+        while (stack_n > 0 && rewind_stack[stack_n].dummy) stack_n -= 1; \
         just_rewinded = 1; \
         range_min = rewind_stack[stack_n].range_min; \
         range_max = rewind_stack[stack_n].range_max; \
-        assert(rewind_stack[stack_n].i <= i); \
-        i = rewind_stack[stack_n].i; \
+        assert(_REWIND_I(stack_n) <= i); \
+        i = _REWIND_I(stack_n); \
         k = rewind_stack[stack_n].k; \
         if (tokens[k].kind == REMIMU_KIND_CLOSE) \
         { \
@@ -965,6 +1964,36 @@ static inline int64_t regex_match(const RegexToken * tokens, const REMIMU_STRING
     w_mask[6] = 0xFFFE;
     w_mask[7] = 0x07FF;
     #define _REGEX_CHECK_IS_W(byte) (!!(w_mask[((uint8_t)byte)>>4] & (1 << ((uint8_t)byte & 0xF))))
+
+#ifdef REMIMU_SIMD
+    const char * text_data = _regex_text_data(text);
+    // after 16 bytes of a run, does the rest a vector at a time, if the text is in one piece
+    #define _REGEX_CONSUME_CLASS_SIMD(LIMIT) { \
+        if (n == scalar_end && text_data) \
+        { \
+            const RegexClassRun * run = _regex_find_class_run(program, k); \
+            if (run) \
+            { \
+                size_t got = _regex_class_run_simd(run, text_data + i, (LIMIT) - n); \
+                i += got; \
+                n += got; \
+            } \
+        } \
+    }
+#else
+    #define _REGEX_CONSUME_CLASS_SIMD(LIMIT)
+#endif
+    // consumes bytes of token k's class while n < LIMIT
+    #define _REGEX_CONSUME_CLASS(LIMIT) { \
+        uint64_t scalar_end = n + 16; \
+        (void)scalar_end; \
+        while (n < (LIMIT) && text[i] != 0 && _REGEX_CHECK_MASK(k, text[i])) \
+        { \
+            i += 1; \
+            n += 1; \
+            _REGEX_CONSUME_CLASS_SIMD(LIMIT) \
+        } \
+    }
     
     size_t limit = 10000;
     for (k = 0; k < tokens_len; k++)
@@ -1111,7 +2140,7 @@ static inline int64_t regex_match(const RegexToken * tokens, const REMIMU_STRING
                 if (tokens[k].count_lo == 1 && tokens[k].count_hi == 2)
                 {
                     // for captures
-                    uint16_t cap_index = q_group_cap_index[tokens[k].mask[0]];
+                    uint16_t cap_index = _REGEX_CAP_INDEX(tokens[k].mask[0]);
                     if (cap_index != 0xFFFF)
                         _REWIND_DO_SAVE_DUMMY(k)
                 }
@@ -1155,21 +2184,21 @@ static inline int64_t regex_match(const RegexToken * tokens, const REMIMU_STRING
                         // fallback case to detect zero-length matches when we backtracked into the inside of this group
                         // after an attempted parse of a second copy of itself
                         uint8_t force_zero = 0;
-                        if (prev != 0 && (uint32_t)rewind_stack[prev].i > (uint32_t)i)
+                        if (prev != 0 && _REWIND_I(prev) > i)
                         {
                             // find matching open paren
                             size_t n = stack_n - 1;
                             while (n > 0 && rewind_stack[n].k != k + tokens[k].pair_offset)
                                 n -= 1;
                             assert(n > 0);
-                            if (rewind_stack[n].i == i)
+                            if (_REWIND_I(n) == i)
                                 force_zero = 1;
                         }
                         
                         // reject zero-length matches
-                        if ((force_zero || (prev != 0 && (uint32_t)rewind_stack[prev].i == (uint32_t)i))) //  && q_group_state[tokens[k].mask[0]] > 0
+                        if ((force_zero || (prev != 0 && _REWIND_I(prev) == i))) //  && q_group_state[tokens[k].mask[0]] > 0
                         {
-                            IF_VERBOSE(printf("rejecting zero-length match..... %d %zd %zd\n", force_zero, rewind_stack[prev].i, i);)
+                            IF_VERBOSE(printf("rejecting zero-length match..... %d %zd %zd\n", force_zero, _REWIND_I(prev), i);)
                             IF_VERBOSE(printf("%d (k: %d)\n", q_group_state[tokens[k].mask[0]], k);)
                             
                             q_group_accepts_zero[tokens[k].mask[0]] = 1;
@@ -1181,7 +2210,7 @@ static inline int64_t regex_match(const RegexToken * tokens, const REMIMU_STRING
                         {
                             IF_VERBOSE(printf("nidnfasidfnidfndifn-------      %d, %d, %zd\n", q_group_state[tokens[k].mask[0]], tokens[k].count_lo, range_min);)
                             if (prev)
-                                IF_VERBOSE(printf("lazy doesn't think it's zero-length. prev i %zd vs i %zd (depth %d)\n", rewind_stack[prev].i, i, stack_n);)
+                                IF_VERBOSE(printf("lazy doesn't think it's zero-length. prev i %zd vs i %zd (depth %d)\n", _REWIND_I(prev), i, stack_n);)
                             // continue on to past the group; group retry is in rewind state
                             q_group_state[tokens[k].mask[0]] += 1;
                             _REWIND_DO_SAVE(k)
@@ -1253,7 +2282,7 @@ static inline int64_t regex_match(const RegexToken * tokens, const REMIMU_STRING
                                 q_group_state[tokens[k].mask[0]] = 0;
                                 
                                 // for captures
-                                uint16_t cap_index = q_group_cap_index[tokens[k].mask[0]];
+                                uint16_t cap_index = _REGEX_CAP_INDEX(tokens[k].mask[0]);
                                 if (cap_index != 0xFFFF)
                                     _REWIND_DO_SAVE_DUMMY(k)
                             }
@@ -1274,11 +2303,7 @@ static inline int64_t regex_match(const RegexToken * tokens, const REMIMU_STRING
                     uint64_t n = 0;
                     // do whatever the obligatory minimum amount of matching is
                     uint64_t old_i = i;
-                    while (n < tokens[k].count_lo && text[i] != 0 && _REGEX_CHECK_MASK(k, text[i]))
-                    {
-                        i += 1;
-                        n += 1;
-                    }
+                    _REGEX_CONSUME_CLASS(tokens[k].count_lo)
                     if (n < tokens[k].count_lo)
                     {
                         IF_VERBOSE(printf("non-match A. rewinding (token %d)\n", k);)
@@ -1287,11 +2312,13 @@ static inline int64_t regex_match(const RegexToken * tokens, const REMIMU_STRING
                         continue;
                     }
                     
+                    // no rewind state if rewinding to it could only rewind again (e.g. a token that matches one byte)
                     if (tokens[k].mode & REMIMU_MODE_LAZY)
                     {
                         range_min = n;
                         range_max = tokens[k].count_hi - 1;
-                        _REWIND_DO_SAVE(k)
+                        if (tokens[k].count_hi < 2 || n + 1 < tokens[k].count_hi)
+                            _REWIND_DO_SAVE(k)
                     }
                     else
                     {
@@ -1299,15 +2326,10 @@ static inline int64_t regex_match(const RegexToken * tokens, const REMIMU_STRING
                         if (limit == 0)
                             limit = ~limit;
                         range_min = n;
-                        while (text[i] != 0 && _REGEX_CHECK_MASK(k, text[i]) && n + 1 < limit)
-                        {
-                            IF_VERBOSE(printf("match!! (%c)\n", text[i]);)
-                            i += 1;
-                            n += 1;
-                        }
+                        _REGEX_CONSUME_CLASS(limit - 1)
                         range_max = n;
                         IF_VERBOSE(printf("set rmin to %zd and rmax to %zd on entry into normal greedy token with k %d\n", range_min, range_max, k);)
-                        if (!(tokens[k].mode & REMIMU_MODE_POSSESSIVE))
+                        if (!(tokens[k].mode & REMIMU_MODE_POSSESSIVE) && range_max > range_min)
                             _REWIND_DO_SAVE(k)
                     }
                 }
@@ -1371,13 +2393,13 @@ static inline int64_t regex_match(const RegexToken * tokens, const REMIMU_STRING
             int kind = tokens[s.k].kind;
             if (kind == REMIMU_KIND_OPEN || kind == REMIMU_KIND_CLOSE)
             {
-                uint16_t cap_index = q_group_cap_index[tokens[s.k].mask[0]];
+                uint16_t cap_index = _REGEX_CAP_INDEX(tokens[s.k].mask[0]);
                 if (cap_index == 0xFFFF)
                     continue;
                 if (tokens[s.k].kind == REMIMU_KIND_OPEN)
-                    cap_pos[cap_index] = s.i;
+                    cap_pos[cap_index] = start_i + s.i;
                 else if (cap_pos[cap_index] >= 0)
-                    cap_span[cap_index] = s.i - cap_pos[cap_index];
+                    cap_span[cap_index] = start_i + s.i - cap_pos[cap_index];
             }
         }
         // re-deinitialize capture positions that have no associated capture span
@@ -1389,13 +2411,307 @@ static inline int64_t regex_match(const RegexToken * tokens, const REMIMU_STRING
     }
     
     #undef _REWIND_DO_SAVE
+    #undef _REWIND_DO_SAVE_DUMMY
+    #undef _REWIND_DO_SAVE_RAW
+    #undef _REWIND_I
     #undef _REWIND_OR_ABORT
     #undef _REGEX_CHECK_IS_W
+    #undef _REGEX_CAP_INDEX
+    #undef _REGEX_CONSUME_CLASS
+    #undef _REGEX_CONSUME_CLASS_SIMD
     #undef _P_TEXT_HIGHLIGHTED
     #undef IF_VERBOSE
     
     return i;
 }
+
+// Returns match length if text starts with a regex match.
+// Returns -1 if the text doesn't start with a regex match.
+// Returns -2 if the matcher ran out of memory or the regex is too complex.
+// Returns -3 if the regex is somehow invalid.
+// The first cap_slots capture positions and spans (lengths) will be written to cap_pos and cap_span. If zero, will not be written to.
+// Backtracking uses REMIMU_STACK_STATES states on the thread's stack, then up to REMIMU_HEAP_STATES on the heap.
+// SAFETY: The text variable must be null-terminated, and start_i must be the index of a character within the string or its null terminator.
+// SAFETY: The program's tokens must still exist.
+// SAFETY: Partial capture data may be written even if the match fails.
+#ifdef __cplusplus
+template <typename T>
+#endif
+static inline int64_t regex_match_program(const RegexProgram * program, const REMIMU_STRING_TYPE text, size_t start_i, uint16_t cap_slots, int64_t * cap_pos, int64_t * cap_span)
+{
+    RegexMatcherState states[REMIMU_STACK_STATES];
+    RegexMemory memory = {states, REMIMU_STACK_STATES, REMIMU_HEAP_STATES, 0, 0};
+    int64_t ret = regex_match_program_mem(program, text, start_i, cap_slots, cap_pos, cap_span, &memory);
+    regex_memory_free(&memory);
+    return ret;
+}
+
+// Same as regex_match_program, for a regex that's only matched once. Compiling a RegexProgram once with regex_compile
+// and using that is faster when matching the same regex many times.
+// SAFETY: Tokens array must be terminated by a REMIMU_KIND_END token (done by default by regex_parse).
+#ifdef __cplusplus
+template <typename T>
+#endif
+static inline int64_t regex_match(const RegexToken * tokens, const REMIMU_STRING_TYPE text, size_t start_i, uint16_t cap_slots, int64_t * cap_pos, int64_t * cap_span)
+{
+    RegexProgram program;
+    int e = regex_compile(tokens, &program);
+    if (e != 0)
+        return e;
+    return regex_match_program(&program, text, start_i, cap_slots, cap_pos, cap_span);
+}
+
+// The first index from i on that a match could start at, or the index of the null terminator if there's none.
+#ifdef __cplusplus
+template <typename T>
+#endif
+static inline size_t _regex_next_candidate(const RegexProgram * program, const REMIMU_STRING_TYPE text, size_t i)
+{
+    if (program->min_length == 0)
+        return i;
+    const char * text_data = _regex_text_data(text);
+    if (text_data && program->prefix_length > 0)
+    {
+        const char * found = strchr(text_data + i, program->prefix[0]);
+        return found ? (size_t)(found - text_data) : i + strlen(text_data + i);
+    }
+#ifdef REMIMU_SIMD
+    // the null terminator isn't in first_skip, so this stops at it at the latest
+    if (text_data && program->first_skip.range_count > 0)
+        i += _regex_class_run_simd(&program->first_skip, text_data + i, SIZE_MAX - i);
+#endif
+    while (1)
+    {
+        uint8_t c = text[i];
+        if (c == 0 || (program->first_mask[c >> 4] & (1 << (c & 0xF))))
+            return i;
+        i += 1;
+    }
+}
+
+// Returns the index of the leftmost match at or after start_i, and writes its length to match_length.
+// Returns -1 if there's no match, or -2 or -3 like regex_match_program does.
+// Captures are written like regex_match_program does, for the match found.
+// Indexes that can't start a match are skipped without running the matcher: with strchr if every match starts with
+// the same byte, otherwise a vector at a time where SIMD is available. Regexes parsed with REMIMU_FLAG_LINEAR are
+// searched in one pass, so the whole search takes linear time, not just each attempt.
+// SAFETY: The same as regex_match_program.
+#ifdef __cplusplus
+template <typename T>
+#endif
+static inline int64_t regex_search(const RegexProgram * program, const REMIMU_STRING_TYPE text, size_t start_i, int64_t * match_length, uint16_t cap_slots, int64_t * cap_pos, int64_t * cap_span)
+{
+    if (program->anchored && start_i != 0)
+        return -1;
+    size_t i = _regex_next_candidate(program, text, start_i);
+    if (program->anchored && i != 0)
+        return -1;
+    
+    // one pass while there are threads; skips ahead when there are none
+    while (program->linear)
+    {
+        int64_t match_start = i;
+        int64_t end = _regex_pike_run(program->tokens, &program->pike, text, i, cap_slots, cap_pos, cap_span,
+            !program->anchored, program->min_length != 0 ? program->first_mask : 0, &match_start);
+        if (end >= 0)
+        {
+            *match_length = end - match_start;
+            return match_start;
+        }
+        if (end != -1 || program->anchored || text[match_start] == 0)
+            return end;
+        i = _regex_next_candidate(program, text, match_start + 1);
+    }
+    
+    while (1)
+    {
+        int64_t end = regex_match_program(program, text, i, cap_slots, cap_pos, cap_span);
+        if (end >= 0)
+        {
+            *match_length = end - (int64_t)i;
+            return i;
+        }
+        if (end != -1 || text[i] == 0 || program->anchored)
+            return end;
+        i = _regex_next_candidate(program, text, i + 1);
+    }
+}
+
+static inline void regex_set_init(RegexSet * set)
+{
+    set->count = 0;
+    set->inst_count = 0;
+}
+
+// Adds a compiled regex to the set. Returns its index in the set, or -2 if the set is full.
+// Regexes that the linear-time matcher can do (whether they were parsed with REMIMU_FLAG_LINEAR or not) share one pass
+// over the text while there's room in the set's program; the rest are matched on their own by regex_set_match.
+static inline int regex_set_add(RegexSet * set, const RegexProgram * program)
+{
+    if (set->count == REMIMU_SET_MAX_PATTERNS)
+        return -2;
+    uint16_t index = set->count++;
+    set->programs[index] = program;
+    set->inst_start[index] = 0xFFFF;
+    
+    const RegexPikeProgram * pike = &program->pike;
+    RegexPikeProgram compiled;
+    if (!program->linear)
+    {
+        if (_regex_pike_compile(program->tokens, &compiled) != 0)
+            return index;
+        pike = &compiled;
+    }
+    if (set->inst_count + pike->inst_count > REMIMU_SET_MAX_INSTS)
+        return index;
+    // jumps are relative, so the instructions work anywhere
+    memcpy(set->insts + set->inst_count, pike->insts, pike->inst_count * sizeof(RegexPikeInst));
+    for (uint16_t n = 0; n < pike->inst_count; n++)
+        set->inst_owner[set->inst_count + n] = index;
+    set->inst_start[index] = set->inst_count;
+    set->inst_count += pike->inst_count;
+    return index;
+}
+
+// Matches every regex in the set at start_i. Writes the length of each one's match to lengths (in the order they were
+// added), or -1 if it doesn't match there, or -2 or -3 like regex_match_program. Returns how many matched.
+// Each regex's match is the one regex_match_linear would find for it.
+// SAFETY: The same as regex_match_program. lengths must have room for every regex in the set.
+#ifdef __cplusplus
+template <typename T>
+#endif
+static inline int regex_set_match(const RegexSet * set, const REMIMU_STRING_TYPE text, size_t start_i, int64_t * lengths)
+{
+    // the threads at the current and next text position, in priority order; each regex's threads are ordered like they
+    // would be if it were matched alone
+    uint16_t list_pc[2][REMIMU_SET_MAX_INSTS];
+    uint16_t list_n[2] = {0, 0};
+    uint32_t visited[REMIMU_SET_MAX_INSTS];
+    uint32_t cut[REMIMU_SET_MAX_PATTERNS]; // step where each regex last matched; its lower-priority threads stop there
+    uint16_t stack[REMIMU_SET_MAX_INSTS * 2 + 1];
+    memset(visited, 0, set->inst_count * sizeof(uint32_t));
+    memset(cut, 0, set->count * sizeof(uint32_t));
+    uint32_t step = 1;
+    
+    // like _REGEX_PIKE_ADD, without captures
+    #define _REGEX_SET_ADD(LIST, PC, I) { \
+        uint32_t sp = 0; \
+        stack[sp++] = (PC); \
+        while (sp > 0) \
+        { \
+            uint16_t pc = stack[--sp]; \
+            if (visited[pc] == step) \
+                continue; \
+            visited[pc] = step; \
+            const RegexPikeInst * inst = set->insts + pc; \
+            const RegexToken * tokens = set->programs[set->inst_owner[pc]]->tokens; \
+            uint8_t here = text[(I)]; \
+            uint8_t add = 0; \
+            uint16_t next = _REGEX_PIKE_NONE; \
+            if (inst->op == _REGEX_PIKE_CHAR || inst->op == _REGEX_PIKE_MATCH) \
+                add = 1; \
+            else if (inst->op == _REGEX_PIKE_PLOOP || inst->op == _REGEX_PIKE_POPT) \
+            { \
+                if (here != 0 && _REGEX_CHECK_MASK(inst->arg, here)) \
+                    add = 1; \
+                else \
+                    next = pc + 1; \
+            } \
+            else if (inst->op == _REGEX_PIKE_JMP) \
+                next = pc + inst->x; \
+            else if (inst->op == _REGEX_PIKE_SPLIT) \
+            { \
+                stack[sp++] = pc + inst->y; \
+                next = pc + inst->x; \
+            } \
+            else if (inst->op == _REGEX_PIKE_SAVE) \
+                next = pc + 1; \
+            else if (inst->op == _REGEX_PIKE_ASSERT) \
+            { \
+                uint8_t ok = 1; \
+                if (inst->arg == REMIMU_KIND_CARET) \
+                    ok = (I) == 0; \
+                else if (inst->arg == REMIMU_KIND_DOLLAR) \
+                    ok = here == 0; \
+                else \
+                { \
+                    uint8_t before = (I) != 0 && _regex_is_word_byte(text[(I) - 1]); \
+                    uint8_t after = here != 0 && _regex_is_word_byte(here); \
+                    ok = (before != after) == (inst->arg == REMIMU_KIND_BOUND); \
+                } \
+                if (ok) \
+                    next = pc + 1; \
+            } \
+            if (add) \
+                list_pc[LIST][list_n[LIST]++] = pc; \
+            if (next != _REGEX_PIKE_NONE) \
+                stack[sp++] = next; \
+        } \
+    }
+    
+    int matched = 0;
+    uint8_t first = text[start_i];
+    uint8_t cur = 0;
+    for (uint16_t r = 0; r < set->count; r++)
+    {
+        const RegexProgram * program = set->programs[r];
+        lengths[r] = -1;
+        if (set->inst_start[r] == 0xFFFF)
+        {
+            int64_t end = regex_match_program(program, text, start_i, 0, 0, 0);
+            lengths[r] = end >= 0 ? end - (int64_t)start_i : end;
+            matched += end >= 0;
+        }
+        // the same checks regex_match_program starts with
+        else if (!(program->anchored && start_i != 0)
+            && !(program->min_length != 0 && (first == 0 || !(program->first_mask[first >> 4] & (1 << (first & 0xF))))))
+            _REGEX_SET_ADD(cur, set->inst_start[r], start_i)
+    }
+    
+    uint64_t i = start_i;
+    while (list_n[cur] > 0)
+    {
+        uint8_t c = text[i];
+        uint8_t nxt = cur ^ 1;
+        list_n[nxt] = 0;
+        step += 1;
+        if (step == 0)
+        {
+            memset(visited, 0, set->inst_count * sizeof(uint32_t));
+            memset(cut, 0, set->count * sizeof(uint32_t));
+            step = 1;
+        }
+        for (uint16_t t = 0; t < list_n[cur]; t++)
+        {
+            uint16_t pc = list_pc[cur][t];
+            uint16_t owner = set->inst_owner[pc];
+            if (cut[owner] == step)
+                continue;
+            const RegexPikeInst * inst = set->insts + pc;
+            if (inst->op == _REGEX_PIKE_MATCH)
+            {
+                matched += lengths[owner] < 0;
+                lengths[owner] = i - start_i;
+                cut[owner] = step;
+                continue;
+            }
+            if (c == 0)
+                continue;
+            const RegexToken * tokens = set->programs[owner]->tokens;
+            if (inst->op == _REGEX_PIKE_CHAR && !_REGEX_CHECK_MASK(inst->arg, c))
+                continue;
+            _REGEX_SET_ADD(nxt, inst->op == _REGEX_PIKE_PLOOP ? pc : pc + 1, i + 1)
+        }
+        if (c == 0)
+            break;
+        i += 1;
+        cur = nxt;
+    }
+    
+    #undef _REGEX_SET_ADD
+    
+    return matched;
+}
 #undef REMIMU_STRING_TYPE
 
 static inline void print_regex_tokens(RegexToken * tokens)
@@ -1419,7 +2735,7 @@ static inline void print_regex_tokens(RegexToken * tokens)
     };
     for (int k = 0;; k++)
     {
-        printf("%s\t%s\t", kind_to_str[tokens[k].kind], mode_to_str[tokens[k].mode]);
+        printf("%s\t%s\t", kind_to_str[tokens[k].kind], mode_to_str[tokens[k].mode & 3]);
         
         int c_old = -1;
         for (int c = 0; c < (tokens[k].kind ? 0 : 256); c++)
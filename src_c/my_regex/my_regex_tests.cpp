@@ -370,6 +370,14 @@ void testify(void)
             }
         }
         
+        // same regex for the linear-time matcher, if it can take it
+        RegexToken linear_tokens[512];
+        int16_t linear_token_count = sizeof(linear_tokens)/sizeof(linear_tokens[0]);
+        bool has_linear = regex_parse(regex, linear_tokens, &linear_token_count, REMIMU_FLAG_LINEAR) == 0;
+        static RegexProgram linear_program;
+        if (has_linear)
+            assert(regex_compile(linear_tokens, &linear_program) == 0);
+        
         #ifndef BE_QUIET
         printf("token count: %d\n", token_count);
         print_regex_tokens(tokens);
@@ -395,6 +403,11 @@ void testify(void)
         }
         total_pcre2_regex_time += t;
         
+        // unanchored, for regex_search
+        pcre2_code * re_search = pcre2_compile(PCRE2_SPTR8(regex), PCRE2_ZERO_TERMINATED,
+            PCRE2_NO_UTF_CHECK | PCRE2_DOTALL | PCRE2_NO_AUTO_POSSESS | PCRE2_NO_DOTSTAR_ANCHOR | PCRE2_NO_START_OPTIMIZE,
+            &errorcode, &erroroffset, NULL);
+        
         for (size_t j = 0; j < sizeof(texts) / sizeof(texts[0]); j++)
         {
             const char * text = texts[j];
@@ -489,9 +502,56 @@ void testify(void)
                 }
             }
             
+            if (has_linear)
+            {
+                int64_t linear_cap_pos[16];
+                int64_t linear_cap_span[16];
+                int64_t linear_len = regex_match(linear_tokens, text, 0, 16, linear_cap_pos, linear_cap_span);
+                #ifndef BE_QUIET
+                printf("linear-time matcher found %zd\n", linear_len);
+                #endif
+                assert(linear_len != -2 && linear_len != -3);
+                if (match_len != -2)
+                    assert(linear_len == match_len);
+                if (submatch_count > 0)
+                    assert(linear_len == pcre2_len);
+                if (submatch_count > 0 && linear_len >= 0)
+                {
+                    for (int x = 0; x < submatch_count && x < REMIMU_LINEAR_MAX_CAPS; x++)
+                    {
+                        size_t where = ovector[x*2];
+                        size_t pcre2_len = ovector[x*2+1] - where;
+                        // a final repetition that matched nothing; the linear-time matcher reports the one before it
+                        if (pcre2_len == 0)
+                            continue;
+                        assert(where     == (size_t)linear_cap_pos[x]);
+                        assert(pcre2_len == (size_t)linear_cap_span[x]);
+                    }
+                }
+                
+                // leftmost match anywhere in the text
+                pcre2_match_data * search_data = pcre2_match_data_create_from_pattern(re_search, 0);
+                int search_count = pcre2_match(re_search, PCRE2_SPTR8(text), text_str.size(), 0, PCRE2_NO_UTF_CHECK, search_data, 0);
+                int64_t search_len = -1;
+                int64_t search_at = regex_search(&linear_program, text, 0, &search_len, 0, 0, 0);
+                #ifndef BE_QUIET
+                printf("search found %zd with len %zd\n", search_at, search_len);
+                #endif
+                if (search_count > 0)
+                {
+                    PCRE2_SIZE * search_ovector = pcre2_get_ovector_pointer(search_data);
+                    assert(search_at == (int64_t)search_ovector[0]);
+                    assert(search_len == (int64_t)(search_ovector[1] - search_ovector[0]));
+                }
+                else if (search_count == PCRE2_ERROR_NOMATCH)
+                    assert(search_at == -1);
+                pcre2_match_data_free(search_data);
+            }
+            
             pcre2_match_data_free(match_data);
         }
         pcre2_code_free(re);
+        pcre2_code_free(re_search);
     }
     
     printf("Slowest regex for me to parse at %f seconds:\n%s\n", slowest_my_regex_time, slowest_my_regex);
@@ -523,6 +583,55 @@ void testify(void)
     
     print_regex_tokens(tokens);
     
+    // backtracking memory: a long string literal needs more rewind states than regex_match_program keeps on the stack
+    {
+        RegexToken tokens[256];
+        int16_t token_count = sizeof(tokens)/sizeof(tokens[0]);
+        assert(regex_parse("\"(?:[^\"\\\\]|\\\\.)*\"", tokens, &token_count, 0) == 0);
+        static RegexProgram program;
+        assert(regex_compile(tokens, &program) == 0);
+        
+        std::string text = "\"";
+        for (size_t i = 0; i < 20000; i++)
+            text += i % 50 == 7 ? "\\\"" : "x";
+        text += "\"";
+        int64_t literal_len = text.size();
+        text += " tail";
+        
+        assert(regex_match_program(&program, text.c_str(), 0, 0, 0, 0) == -2);
+        
+        RegexMatcherState arena[256];
+        RegexMemory arena_only = {arena, 256, 0, 0, 0};
+        assert(regex_match_program_mem(&program, text.c_str(), 0, 0, 0, 0, &arena_only) == -2);
+        assert(!arena_only.heap);
+        
+        RegexMemory capped = {arena, 256, 4096, 0, 0};
+        assert(regex_match_program_mem(&program, text.c_str(), 0, 0, 0, 0, &capped) == -2);
+        assert(capped.heap_size <= 4096);
+        regex_memory_free(&capped);
+        
+        RegexMemory heap_only = {0, 0, 1 << 20, 0, 0};
+        assert(regex_match_program_mem(&program, text.c_str(), 0, 0, 0, 0, &heap_only) == literal_len);
+        assert(heap_only.heap_size > REMIMU_STACK_STATES);
+        regex_memory_free(&heap_only);
+        
+        // one RegexMemory for several matches: the heap it grew into is reused, not allocated again
+        RegexMemory memory = {arena, 256, 1 << 20, 0, 0};
+        assert(regex_match_program_mem(&program, text.c_str(), 0, 0, 0, 0, &memory) == literal_len);
+        RegexMatcherState * heap = memory.heap;
+        uint32_t heap_size = memory.heap_size;
+        assert(heap && heap_size > REMIMU_STACK_STATES);
+        assert(regex_match_program_mem(&program, text.c_str(), 0, 0, 0, 0, &memory) == literal_len);
+        assert(memory.heap == heap && memory.heap_size == heap_size);
+        std::string shifted = "xx" + text;
+        assert(regex_match_program_mem(&program, shifted.c_str(), 2, 0, 0, 0, &memory) == 2 + literal_len);
+        assert(regex_match_program_mem(&program, "\"short\"", 0, 0, 0, 0, &memory) == 7);
+        assert(regex_match_program_mem(&program, "\"open", 0, 0, 0, 0, &memory) == -1);
+        assert(memory.heap == heap && memory.heap_size == heap_size);
+        regex_memory_free(&memory);
+        assert(!memory.heap && memory.heap_size == 0);
+    }
+    
     puts("All regex tests passed!");
     
     if (1)
@@ -0,0 +1,492 @@
+#ifndef MUALI_PROFILE
+#define MUALI_PROFILE
+
+// Included by interpreter.hpp.
+
+// How profiles name a function: the name it was defined with, or its index in all_funcs if it doesn't have one, and the
+// line it was defined on. Given an offset into its code, the line that code came from instead, if the line table knows.
+static inline String profile_func_label(const Function * func, const Vec<Shared<Function>> & all_funcs, const HashMap<String, size_t> & func_names,
+    size_t offset = SIZE_MAX)
+{
+    size_t index = 0;
+    while (index < all_funcs.size() && all_funcs[index].get() != func)
+        index++;
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "func#%zu", index);
+    String label = buffer;
+    for (auto & entry : func_names)
+    {
+        if (entry._1 == index)
+            label = entry._0;
+    }
+    size_t row = offset != SIZE_MAX ? func->source_position(offset).row : 0;
+    snprintf(buffer, sizeof(buffer), ":%zu", row ? row : func->row);
+    return label + buffer;
+}
+
+#ifdef PROFILE_EXECUTION
+
+#ifdef PROFILE_EXECUTION_CYCLES
+#include <x86intrin.h>
+#endif
+
+constexpr size_t PROFILE_HOT_SPOTS = 50; // bytecode offsets listed in the flat profile
+
+// Where a PROFILE_EXECUTION build spends its time: dispatches by opcode, by bytecode offset in each function and by call
+// stack. Call stacks are nodes of a calling context tree, so a dispatch only adds to the node that's running, and a call
+// only has to find a child of it. The interpreter tells it about calls with enter, leave and become.
+struct ExecutionProfile {
+    static constexpr uint32_t ROOT = 0; // calls from the host are its children
+    static constexpr uint32_t NONE = 0xFFFFFFFF;
+    
+    struct Node {
+        uint32_t parent;
+        uint32_t func; // index into funcs
+        Vec<uint32_t> children;
+        uint64_t count = 0;
+        uint64_t cycles = 0;
+    };
+    // functions in the order they were first called
+    struct FuncCounts {
+        const Function * func;
+        Vec<uint64_t> counts; // by offset of the opcode in the function's code
+        Vec<uint64_t> cycles;
+    };
+    
+    Vec<Node> nodes;
+    Vec<FuncCounts> funcs;
+    Vec<uint32_t> frames; // node of each active call, innermost last
+    uint64_t op_counts[1<<INTERPRETER_OPCODE_TABLE_BITS] = {};
+    uint64_t op_cycles[1<<INTERPRETER_OPCODE_TABLE_BITS] = {};
+    
+    // the innermost call, cached for record
+    uint32_t node = ROOT;
+    uint32_t func = NONE;
+    const uint8_t * code = nullptr;
+    uint64_t * pc_counts = nullptr;
+#ifdef PROFILE_EXECUTION_CYCLES
+    // the previous dispatch, which gets the cycles up to the next one
+    uint64_t last_time = 0;
+    uint16_t last_op = 0;
+    uint32_t last_node = ROOT;
+    uint32_t last_func = NONE;
+    size_t last_offset = 0;
+#endif
+    
+    ExecutionProfile() { nodes.push_back(Node{NONE, NONE, {}}); }
+    ExecutionProfile(const ExecutionProfile &) = delete;
+    ExecutionProfile & operator=(const ExecutionProfile &) = delete;
+    
+    // called on every dispatch, with pc at the opcode
+    void record(uint16_t op, const uint8_t * pc)
+    {
+        size_t offset = pc - code;
+    #ifdef PROFILE_EXECUTION_CYCLES
+        uint64_t now = __rdtsc();
+        if (last_func != NONE)
+        {
+            uint64_t spent = now - last_time;
+            op_cycles[last_op] += spent;
+            nodes[last_node].cycles += spent;
+            funcs[last_func].cycles[last_offset] += spent;
+        }
+        last_time = now;
+        last_op = op;
+        last_node = node;
+        last_func = func;
+        last_offset = offset;
+    #endif
+        op_counts[op] += 1;
+        nodes[node].count += 1;
+        pc_counts[offset] += 1;
+    }
+    
+    void enter(const Function & callee)
+    {
+        frames.push_back(child(node, callee));
+        set_frame(frames.back());
+    }
+    void leave()
+    {
+        frames.pop_back();
+        set_frame(frames.size() ? frames.back() : ROOT);
+    }
+    // a tail call takes the place of the call that made it
+    void become(const Function & callee)
+    {
+        frames.back() = child(nodes[node].parent, callee);
+        set_frame(frames.back());
+    }
+    
+    void set_frame(uint32_t n)
+    {
+        node = n;
+        func = nodes[n].func;
+        code = func != NONE ? funcs[func].func->code_data() : nullptr;
+        pc_counts = func != NONE ? funcs[func].counts.data() : nullptr;
+    }
+    uint32_t child(uint32_t parent, const Function & callee)
+    {
+        for (auto c : nodes[parent].children)
+        {
+            if (funcs[nodes[c].func].func == &callee)
+                return c;
+        }
+        return add_child(parent, callee);
+    }
+    [[gnu::noinline]] uint32_t add_child(uint32_t parent, const Function & callee)
+    {
+        uint32_t f = 0;
+        while (f < funcs.size() && funcs[f].func != &callee)
+            f++;
+        if (f == funcs.size())
+        {
+            size_t size = callee.code_size();
+            funcs.push_back(FuncCounts{&callee, Vec<uint64_t>(size, 0), Vec<uint64_t>(size, 0)});
+        }
+        uint32_t n = nodes.size();
+        nodes.push_back(Node{parent, f, {}});
+        nodes[parent].children.push_back(n);
+        return n;
+    }
+    
+    // what the dumps rank by: cycles if they were counted, dispatches otherwise
+    static uint64_t cost(uint64_t count, uint64_t cycles)
+    {
+    #ifdef PROFILE_EXECUTION_CYCLES
+        (void)count;
+        return cycles;
+    #else
+        (void)cycles;
+        return count;
+    #endif
+    }
+    
+    Vec<String> func_labels(const Vec<Shared<Function>> & all_funcs, const HashMap<String, size_t> & func_names)
+    {
+        Vec<String> labels;
+        for (auto & counts : funcs)
+            labels.push_back(profile_func_label(counts.func, all_funcs, func_names));
+        return labels;
+    }
+    
+    // Writes totals by opcode, by function (self, and total including what it called) and for the hottest bytecode
+    // offsets, most expensive first.
+    void dump_flat(const char * path, const Vec<Shared<Function>> & all_funcs, const HashMap<String, size_t> & func_names)
+    {
+        auto f = fopen(path, "wb");
+        if (!f)
+            return (void)printf("warning: couldn't write profile %s\n", path);
+        auto labels = func_labels(all_funcs, func_names);
+        uint64_t total = 0;
+        for (auto & n : nodes)
+            total += cost(n.count, n.cycles);
+        auto percent = [&](uint64_t x) { return total ? 100.0 * x / total : 0.0; };
+    #ifdef PROFILE_EXECUTION_CYCLES
+        fprintf(f, "%zu cycles\n", (size_t)total);
+    #else
+        fprintf(f, "%zu dispatches\n", (size_t)total);
+    #endif
+        
+        struct Row {
+            uint32_t key;
+            size_t offset;
+            uint64_t count;
+            uint64_t cost;
+        };
+        // Vec's sorts need something to sort
+        auto sort_by_cost = [](Vec<Row> & rows)
+        {
+            if (rows.size() > 1)
+                rows.merge_sort([](const Row & a, const Row & b) { return a.cost > b.cost; });
+        };
+        
+        // 8-bit opcodes fill every entry of the opcode table that has their low byte
+        Vec<Row> rows;
+        for (uint32_t op = 0; op < (1<<INTERPRETER_OPCODE_TABLE_BITS); op++)
+        {
+            if (op_counts[op] == 0)
+                continue;
+            uint32_t key = (op & 0xFF) >= 0x80 ? (op & 0xFF) : op;
+            size_t r = 0;
+            while (r < rows.size() && rows[r].key != key)
+                r++;
+            if (r == rows.size())
+                rows.push_back(Row{key, 0, 0, 0});
+            rows[r].count += op_counts[op];
+            rows[r].cost += cost(op_counts[op], op_cycles[op]);
+        }
+        sort_by_cost(rows);
+        fprintf(f, "\nopcode     dispatches   share\n");
+        for (auto & row : rows)
+            fprintf(f, "%04X  %15zu  %5.1f%%\n", row.key, (size_t)row.count, percent(row.cost));
+        
+        // a function's total counts each call stack it's on once, even if it recursed
+        Vec<uint64_t> subtree(nodes.size(), 0);
+        for (size_t n = 0; n < nodes.size(); n++)
+            subtree[n] = cost(nodes[n].count, nodes[n].cycles);
+        for (size_t n = nodes.size(); n-- > 1;)
+            subtree[nodes[n].parent] += subtree[n];
+        Vec<uint64_t> self(funcs.size(), 0);
+        Vec<uint64_t> inclusive(funcs.size(), 0);
+        Vec<uint32_t> on_path(funcs.size(), 0);
+        Vec<uint32_t> walk;
+        walk.push_back(ROOT);
+        while (walk.size())
+        {
+            auto n = walk.back();
+            walk.pop_back();
+            if (n & 0x80000000)
+            {
+                on_path[nodes[n & 0x7FFFFFFF].func] -= 1;
+                continue;
+            }
+            if (n != ROOT)
+            {
+                auto fn = nodes[n].func;
+                self[fn] += cost(nodes[n].count, nodes[n].cycles);
+                if (on_path[fn]++ == 0)
+                    inclusive[fn] += subtree[n];
+                walk.push_back(n | 0x80000000);
+            }
+            for (auto c : nodes[n].children)
+                walk.push_back(c);
+        }
+        rows.clear();
+        for (uint32_t fn = 0; fn < funcs.size(); fn++)
+            rows.push_back(Row{fn, 0, inclusive[fn], self[fn]});
+        sort_by_cost(rows);
+        fprintf(f, "\n  self   total  function\n");
+        for (auto & row : rows)
+            fprintf(f, "%5.1f%%  %5.1f%%  %s\n", percent(row.cost), percent(row.count), labels[row.key].data());
+        
+        rows.clear();
+        for (uint32_t fn = 0; fn < funcs.size(); fn++)
+        {
+            for (size_t offset = 0; offset < funcs[fn].counts.size(); offset++)
+            {
+                if (funcs[fn].counts[offset])
+                    rows.push_back(Row{fn, offset, funcs[fn].counts[offset], cost(funcs[fn].counts[offset], funcs[fn].cycles[offset])});
+            }
+        }
+        sort_by_cost(rows);
+        fprintf(f, "\n     dispatches   share  at (source line:column)\n");
+        for (size_t r = 0; r < rows.size() && r < PROFILE_HOT_SPOTS; r++)
+        {
+            auto & row = rows[r];
+            auto pos = funcs[row.key].func->source_position(row.offset);
+            fprintf(f, "%15zu  %5.1f%%  %s+%zu (%zu:%zu)\n", (size_t)row.count, percent(row.cost), labels[row.key].data(), row.offset,
+                pos.row, pos.column);
+        }
+        fclose(f);
+    }
+    
+    // Writes one "main;f;g 1234" line per call stack that anything ran in, as flamegraph.pl and similar tools take.
+    void dump_stacks(const char * path, const Vec<Shared<Function>> & all_funcs, const HashMap<String, size_t> & func_names)
+    {
+        auto f = fopen(path, "wb");
+        if (!f)
+            return (void)printf("warning: couldn't write profile %s\n", path);
+        auto labels = func_labels(all_funcs, func_names);
+        Vec<uint32_t> path_nodes;
+        for (uint32_t n = 1; n < nodes.size(); n++)
+        {
+            uint64_t spent = cost(nodes[n].count, nodes[n].cycles);
+            if (spent == 0)
+                continue;
+            path_nodes.clear();
+            for (auto p = n; p != ROOT; p = nodes[p].parent)
+                path_nodes.push_back(p);
+            for (size_t k = path_nodes.size(); k-- > 0;)
+                fprintf(f, "%s%s", labels[nodes[path_nodes[k]].func].data(), k ? ";" : "");
+            fprintf(f, " %zu\n", (size_t)spent);
+        }
+        fclose(f);
+    }
+};
+
+#endif
+
+#ifdef PROFILE_SAMPLING
+
+#include <atomic>
+#include <signal.h>
+#include <sys/time.h>
+#include <ucontext.h>
+
+constexpr size_t SAMPLE_MAX_DEPTH = 128; // innermost calls kept per sample
+constexpr size_t SAMPLE_BUFFER_FRAMES = 1 << 20; // for all samples together; samples that don't fit get dropped
+
+// A call the interpreter is in, as the sampler sees it.
+struct ShadowFrame {
+    const Function * func;
+    const uint8_t * pc; // just past the call op that made the call after it, like a return address
+    const uint8_t * const * live_pc = nullptr; // with USE_LOOP_DISPATCH, where run_frame keeps pc
+};
+
+// Where the interrupted code was in the innermost call: whichever register points into its bytecode, trying the ones
+// that handlers get pc in first (rsi normally, r13 with preserve_none). Handlers keep pc in a register, so this costs
+// the dispatch path nothing. Falls back to the start of the function, which is also where machine code from the JITs
+// gets charged.
+static inline const uint8_t * sampled_pc(const void * context, const ShadowFrame & frame)
+{
+    auto & func = *frame.func;
+    if (frame.live_pc && uintptr_t(*frame.live_pc - func.code_data()) < func.code_size())
+        return *frame.live_pc;
+#if defined __x86_64__ && defined __linux__
+    auto regs = ((const ucontext_t *)context)->uc_mcontext.gregs;
+    auto start = (uintptr_t)func.code_data();
+    const int order[] = {REG_RSI, REG_R13, REG_RDI, REG_RDX, REG_RCX, REG_R8, REG_R9, REG_RAX, REG_RBX, REG_RBP,
+        REG_R10, REG_R11, REG_R12, REG_R14, REG_R15};
+    for (auto r : order)
+    {
+        if ((uintptr_t)regs[r] - start < func.code_size())
+            return (const uint8_t *)regs[r];
+    }
+#else
+    (void)context;
+#endif
+    return func.code_data();
+}
+
+// Samples where a PROFILE_SAMPLING build is, from a SIGPROF timer. The interpreter keeps a stack of the calls it's in,
+// and the signal handler copies it into a buffer that was allocated up front, with the innermost call's position taken
+// from the interrupted registers. The samples get turned into call stacks when the program ends.
+struct SamplingProfiler {
+    ShadowFrame * frames = (ShadowFrame *)calloc(INTERPRETER_MAX_CALL_DEPTH + 2, sizeof(ShadowFrame));
+    volatile size_t depth = 0;
+    const uint8_t * call_pc = nullptr; // set by the call ops, for enter
+    
+    // each sample is a {nullptr, nullptr} frame, then its calls, innermost first
+    ShadowFrame * samples = nullptr;
+    volatile size_t used = 0;
+    size_t sample_count = 0;
+    size_t dropped = 0;
+    
+    SamplingProfiler() { }
+    SamplingProfiler(const SamplingProfiler &) = delete;
+    SamplingProfiler & operator=(const SamplingProfiler &) = delete;
+    ~SamplingProfiler()
+    {
+        stop();
+        free(frames);
+        free(samples);
+    }
+    
+    void enter(const Function & callee)
+    {
+        if (depth)
+            frames[depth - 1].pc = call_pc;
+        frames[depth] = ShadowFrame{&callee, callee.code_data()};
+        // the handler can only see the frame once it's filled in
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        depth = depth + 1;
+    }
+    void leave()
+    {
+        depth = depth - 1;
+    }
+    void become(const Function & callee)
+    {
+        frames[depth - 1].func = &callee;
+    }
+    
+    void take_sample(const void * context)
+    {
+        size_t n = depth;
+        if (n == 0)
+            return;
+        size_t kept = n < SAMPLE_MAX_DEPTH ? n : SAMPLE_MAX_DEPTH;
+        if (used + kept + 1 > SAMPLE_BUFFER_FRAMES)
+            return (void)(dropped += 1);
+        size_t at = used;
+        samples[at++] = ShadowFrame{nullptr, nullptr};
+        samples[at++] = ShadowFrame{frames[n - 1].func, sampled_pc(context, frames[n - 1])};
+        for (size_t k = 1; k < kept; k++)
+            samples[at++] = frames[n - 1 - k];
+        used = at;
+        sample_count += 1;
+    }
+    
+    // Starts taking samples `hz` times per second of CPU time. Only one sampler can run at a time.
+    void start(size_t hz);
+    void stop();
+    
+    // Writes one "main:3;f:7;g:9 123" line per call stack that samples landed in, as flamegraph.pl and similar tools
+    // take, with each call named by the source line it was at. Stacks deeper than SAMPLE_MAX_DEPTH start with "...".
+    void dump(const char * path, const Vec<Shared<Function>> & all_funcs, const HashMap<String, size_t> & func_names)
+    {
+        auto f = fopen(path, "wb");
+        if (!f)
+            return (void)printf("warning: couldn't write profile %s\n", path);
+        HashMap<String, size_t> stacks;
+        Vec<String> stack;
+        for (size_t i = 0; i < used;)
+        {
+            stack.clear();
+            for (i += 1; i < used && samples[i].func; i++)
+            {
+                // outer calls have the pc just past their call op, which may be the start of the next line's code
+                size_t offset = samples[i].pc - samples[i].func->code_data();
+                if (stack.size() && offset)
+                    offset -= 1;
+                stack.push_back(profile_func_label(samples[i].func, all_funcs, func_names, offset));
+            }
+            String line = stack.size() == SAMPLE_MAX_DEPTH ? "...;" : "";
+            for (size_t k = stack.size(); k-- > 0;)
+            {
+                line += stack[k];
+                if (k)
+                    line += ';';
+            }
+            stacks.insert(line, (stacks.count(line) ? stacks[line] : 0) + 1);
+        }
+        for (auto & entry : stacks)
+            fprintf(f, "%s %zu\n", entry._0.data(), entry._1);
+        fclose(f);
+        if (dropped)
+            printf("warning: the profile buffer filled up, so %zu of %zu samples were dropped\n", dropped, dropped + sample_count);
+    }
+};
+
+inline SamplingProfiler * active_sampler = nullptr;
+
+static inline void sampling_profiler_signal(int, siginfo_t *, void * context)
+{
+    if (active_sampler)
+        active_sampler->take_sample(context);
+}
+
+inline void SamplingProfiler::start(size_t hz)
+{
+    if (!samples)
+        samples = (ShadowFrame *)calloc(SAMPLE_BUFFER_FRAMES, sizeof(ShadowFrame));
+    active_sampler = this;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = sampling_profiler_signal;
+    action.sa_flags = SA_RESTART | SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, nullptr);
+    size_t period = hz ? 1000000 / hz : 1000; // microseconds
+    struct itimerval timer;
+    timer.it_interval.tv_sec = period / 1000000;
+    timer.it_interval.tv_usec = period ? period % 1000000 : 1;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, nullptr);
+}
+
+inline void SamplingProfiler::stop()
+{
+    if (active_sampler != this)
+        return;
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    signal(SIGPROF, SIG_DFL);
+    active_sampler = nullptr;
+}
+
+#endif
+
+#endif // MUALI_PROFILE
@@ -0,0 +1,677 @@
+#ifndef MUALI_REGALLOC
+#define MUALI_REGALLOC
+
+// Included by compiler.hpp once the code emitters are defined.
+
+// Register allocation over a function's finished bytecode.
+//
+// The code generator gives every expression result a temporary from a free list and then copies it to where it's needed,
+// so `x = a + b` comes out as `set t, a; add t, b; set x, t`. This pass cleans that up afterwards:
+// 1) Each temporary is split into webs: groups of writes and the reads that they reach. A register number that the free
+//    list handed out for several unrelated values becomes several webs.
+// 2) Liveness is computed for the webs and the variables, and from it which of them interfere.
+// 3) The two sides of each register-to-register copy that don't interfere are merged, and the copy is deleted, so the
+//    example above becomes `set x, a; add x, b`.
+// 4) The webs that are left get the lowest register numbers that don't clash, which keeps num_regs as small as possible.
+//
+// Variables keep their numbers. Call arguments stay in one contiguous block. Each block still sits above everything
+// that's live across its call, because the callee's register window starts there and overwrites the rest of the frame.
+// Code the pass doesn't understand, or that it couldn't allocate, is left as it was.
+
+// What each operand of an opcode does, one letter per letter of opcode_operands:
+// u: reads a register, d: writes it, m: reads and writes it, b: base of an argument block, n: any other varlen int,
+// -: not a varlen int.
+static inline const char * register_roles(uint16_t op)
+{
+    switch (op)
+    {
+    case OP_J: case OP_RETURNIMM:
+        return "-";
+    case OP_JIF: case OP_JIFNOT:
+        return "u-";
+    case OP_JCMP:
+        return "uu--";
+    case OP_JCMPIMM:
+        return "u---";
+    case OP_JILTIMM:
+        return "u--";
+    case OP_JINCILTIMM: case OP_JINCILTIMM_INT:
+        return "m--";
+    case OP_JINCILT:
+        return "mu-";
+    case OP_INCI: case OP_INCI_INT: case OP_DECI: case OP_DECI_INT: case OP_NEGATE: case OP_NEGATE_F:
+    case OP_CHECK_I: case OP_CHECK_F:
+        return "m";
+    case OP_SETZEROI:
+        return "d";
+    case OP_RETURNVAL:
+        return "u";
+    case OP_SET: case OP_SET_I: case OP_SET_F:
+        return "du";
+    case OP_ADD: case OP_ADD_F: case OP_ADD_FF: case OP_SUB: case OP_MUL:
+    case OP_DIV: case OP_DIV_F: case OP_DIV_FF: case OP_DIV_FI: case OP_SHL: case OP_SHR:
+    case OP_CMPE: case OP_CMPNE: case OP_CMPGT: case OP_CMPLT: case OP_CMPGTE: case OP_CMPLTE:
+        return "mu";
+    case OP_SETIMM:
+        return "d-";
+    case OP_ADDIMM: case OP_SUBIMM: case OP_SUBIMM_I: case OP_MULIMM: case OP_DIVIMM:
+    case OP_SHLIMM: case OP_SHLIMM_I: case OP_SHRIMM:
+        return "m-";
+    case OP_CALL:
+        return "dnbn";
+    case OP_CALL_INDIRECT:
+        return "dubn";
+    case OP_CALLDISCARD: case OP_BECOME:
+        return "nbn";
+    case OP_CALLD_INDIRECT: case OP_BECOME_INDIRECT:
+        return "ubn";
+    case OP_BULKLOOP:
+        return "mmmmmmmm-";
+    default:
+        return nullptr;
+    }
+}
+
+static inline bool code_falls_through(uint16_t op)
+{
+    return op != OP_J && op != OP_RETURNVAL && op != OP_RETURNIMM && op != OP_BECOME && op != OP_BECOME_INDIRECT;
+}
+
+struct CodeRef {
+    size_t reg;
+    char role; // u, d or m
+    size_t def = SIZE_MAX; // allocate_registers: for temporaries, the write this is (d, m) or one of the writes that reach it (u)
+    size_t node = 0; // allocate_registers: interference graph node
+};
+
+struct CodeInsn {
+    size_t pos;
+    size_t len;
+    uint16_t op;
+    Vec<CodeRef> refs; // register operands in order, then the arguments of a call
+    int64_t target = -1; // for jumps: index of the target instruction (the instruction count for the end of the code)
+    size_t call = SIZE_MAX; // index into the calls
+};
+
+struct CodeCall {
+    size_t argbase;
+    size_t argc;
+    size_t insn;
+    size_t first_arg; // index of the first argument in the refs
+    size_t base = SIZE_MAX; // allocate_registers: where the argument block goes
+};
+
+// Splits code into instructions. Returns false if there's an opcode that register_roles doesn't know or a jump that
+// doesn't land on an instruction.
+static inline bool decode_code(const Vec<uint8_t> & code, Vec<CodeInsn> & insns, Vec<CodeCall> & calls)
+{
+    Vec<size_t> insn_at(code.size() + 1, SIZE_MAX);
+    size_t i = 0;
+    while (i < code.size())
+    {
+        uint16_t op = i + 1 < code.size() ? opcode_at(code.data() + i) : code[i];
+        auto operands = opcode_operands(op);
+        auto roles = register_roles(op);
+        size_t len = instruction_length(code.data() + i, op);
+        if (!operands || !roles || len == 0 || i + len > code.size())
+            return false;
+        
+        CodeInsn insn;
+        insn.pos = i;
+        insn.len = len;
+        insn.op = op;
+        CodeCall call;
+        size_t p = i + opcode_length(op);
+        for (size_t k = 0; operands[k]; k++)
+        {
+            size_t value = operands[k] == 'r' ? varlen_int_value(code.data() + p) : 0;
+            if (roles[k] == 'u' || roles[k] == 'd' || roles[k] == 'm')
+                insn.refs.push_back(CodeRef{value, roles[k]});
+            else if (roles[k] == 'b')
+                call.argbase = value;
+            else if (roles[k] == 'n' && k > 0 && roles[k - 1] == 'b')
+                call.argc = value;
+            else if (operands[k] == 'j')
+            {
+                int32_t offset;
+                memcpy(&offset, code.data() + p, 4);
+                insn.target = int64_t(i + len) + offset;
+                if (insn.target < 0 || insn.target > (int64_t)code.size())
+                    return false;
+            }
+            p += operand_length(code.data() + p, operands[k]);
+        }
+        if (strchr(roles, 'b'))
+        {
+            call.first_arg = insn.refs.size();
+            for (size_t a = 0; a < call.argc; a++)
+                insn.refs.push_back(CodeRef{call.argbase + a, 'u'});
+            call.insn = insns.size();
+            insn.call = calls.size();
+            calls.push_back(call);
+        }
+        insn_at[i] = insns.size();
+        insns.push_back(std::move(insn));
+        i += len;
+    }
+    insn_at[code.size()] = insns.size();
+    for (auto & insn : insns)
+    {
+        if (insn.target < 0)
+            continue;
+        insn.target = insn_at[insn.target];
+        if (insn.target == (int64_t)SIZE_MAX)
+            return false;
+    }
+    return true;
+}
+
+// Once copies are gone, what's left of a block that only held copies for a control flow edge is a J. Jumps that land on
+// a J go straight to where it goes instead, and Js that only go to the next instruction, or that nothing jumps or falls
+// through to anymore, are dropped. Takes the instructions that are dropped already; changes jump targets to match.
+static inline void drop_jumps(Vec<CodeInsn> & insns, Vec<bool> & dropped)
+{
+    size_t n = insns.size();
+    auto next_kept = [&](size_t i)
+    {
+        while (i < n && dropped[i])
+            i++;
+        return i;
+    };
+    for (auto & insn : insns)
+    {
+        if (insn.target < 0)
+            continue;
+        // a loop of Js, like `while (true) {}`, stops after going around once
+        size_t t = next_kept(insn.target);
+        for (size_t steps = 0; t < n && insns[t].op == OP_J && steps < n; steps++)
+            t = next_kept(insns[t].target);
+        insn.target = t;
+    }
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        Vec<bool> reached(n + 1, false);
+        bool falls_into = true;
+        for (size_t i = 0; i < n; i++)
+        {
+            if (dropped[i])
+                continue;
+            reached[i] = reached[i] || falls_into;
+            falls_into = code_falls_through(insns[i].op);
+            if (insns[i].target >= 0)
+                reached[next_kept(insns[i].target)] = true;
+        }
+        for (size_t i = 0; i < n; i++)
+        {
+            if (dropped[i] || insns[i].op != OP_J)
+                continue;
+            if (!reached[i] || next_kept(insns[i].target) == next_kept(i + 1))
+            {
+                dropped[i] = true;
+                changed = true;
+            }
+        }
+    }
+}
+
+// Reallocates the registers of func, whose code ends with its final return (the terminating zero isn't there yet).
+// Updates num_regs. Returns false, leaving func alone, if the code has something the pass can't handle.
+static inline bool allocate_registers(Shared<Function> func)
+{
+    auto & code = func->code;
+    size_t var_count = func->num_vars;
+    
+    // decode
+    Vec<CodeInsn> insns;
+    Vec<CodeCall> calls;
+    if (!decode_code(code, insns, calls))
+        return false;
+    size_t n = insns.size();
+    size_t reg_count = var_count;
+    for (auto & insn : insns)
+    {
+        for (auto & ref : insn.refs)
+        {
+            if (ref.reg + 1 > reg_count)
+                reg_count = ref.reg + 1;
+        }
+    }
+    for (auto & call : calls)
+    {
+        if (call.argbase < var_count)
+            return false;
+    }
+    
+    // successors of each instruction; n stands for leaving the function
+    auto successors = [&](size_t i, size_t * out) -> size_t
+    {
+        auto op = insns[i].op;
+        size_t count = 0;
+        if (op != OP_J && op != OP_RETURNVAL && op != OP_RETURNIMM && op != OP_BECOME && op != OP_BECOME_INDIRECT)
+            out[count++] = i + 1;
+        if (insns[i].target >= 0)
+            out[count++] = insns[i].target;
+        return count;
+    };
+    
+    auto union_find = [](Vec<size_t> & parent, size_t x)
+    {
+        while (parent[x] != x)
+        {
+            parent[x] = parent[parent[x]];
+            x = parent[x];
+        }
+        return x;
+    };
+    auto has_bit = [](const uint64_t * bits, size_t i) { return !!(bits[i / 64] & (1ULL << (i % 64))); };
+    size_t words = 0; // of the node bitsets, once there are nodes
+    auto for_each_bit = [&](const uint64_t * bits, auto && f)
+    {
+        for (size_t w = 0; w < words; w++)
+        {
+            for (uint64_t b = bits[w]; b; b &= b - 1)
+                f(w * 64 + __builtin_ctzll(b));
+        }
+    };
+    
+    // 1) webs: reaching writes, one temporary at a time
+    Vec<Vec<CodeRef *>> writes_of(reg_count, Vec<CodeRef *>{});
+    struct Read {
+        size_t insn;
+        CodeRef * ref;
+    };
+    Vec<Vec<Read>> reads_of(reg_count, Vec<Read>{});
+    Vec<size_t> def_parent;
+    for (size_t i = 0; i < n; i++)
+    {
+        for (auto & ref : insns[i].refs)
+        {
+            if (ref.reg < var_count)
+                continue;
+            if (ref.role != 'u')
+            {
+                ref.def = def_parent.size();
+                def_parent.push_back(ref.def);
+                writes_of[ref.reg].push_back(&ref);
+            }
+            if (ref.role != 'd')
+                reads_of[ref.reg].push_back(Read{i, &ref});
+        }
+    }
+    Vec<size_t> def_insn(def_parent.size(), 0);
+    for (size_t i = 0; i < n; i++)
+    {
+        for (auto & ref : insns[i].refs)
+        {
+            if (ref.reg >= var_count && ref.role != 'u')
+                def_insn[ref.def] = i;
+        }
+    }
+    Vec<size_t> local_write(n + 1, SIZE_MAX);
+    for (size_t reg = var_count; reg < reg_count; reg++)
+    {
+        auto & writes = writes_of[reg];
+        if (writes.size() == 0)
+        {
+            if (reads_of[reg].size())
+                return false;
+            continue;
+        }
+        size_t def_words = (writes.size() + 63) / 64;
+        for (size_t w = 0; w < writes.size(); w++)
+            local_write[def_insn[writes[w]->def]] = w;
+        
+        Vec<uint64_t> reaching((n + 1) * def_words, 0);
+        Vec<uint64_t> out(def_words, 0);
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (size_t i = 0; i < n; i++)
+            {
+                if (local_write[i] != SIZE_MAX)
+                {
+                    for (size_t w = 0; w < def_words; w++)
+                        out[w] = 0;
+                    out[local_write[i] / 64] |= 1ULL << (local_write[i] % 64);
+                }
+                else
+                {
+                    for (size_t w = 0; w < def_words; w++)
+                        out[w] = reaching[i * def_words + w];
+                }
+                size_t next[2];
+                size_t count = successors(i, next);
+                for (size_t s = 0; s < count; s++)
+                {
+                    for (size_t w = 0; w < def_words; w++)
+                    {
+                        auto merged = reaching[next[s] * def_words + w] | out[w];
+                        changed = changed || merged != reaching[next[s] * def_words + w];
+                        reaching[next[s] * def_words + w] = merged;
+                    }
+                }
+            }
+        }
+        
+        for (auto & read : reads_of[reg])
+        {
+            auto ref = read.ref;
+            size_t first = SIZE_MAX;
+            for (size_t w = 0; w < writes.size(); w++)
+            {
+                if (!has_bit(reaching.data() + read.insn * def_words, w))
+                    continue;
+                auto def = union_find(def_parent, writes[w]->def);
+                if (first == SIZE_MAX)
+                    first = def;
+                else
+                    def_parent[def] = first;
+            }
+            // a read that nothing writes first
+            if (first == SIZE_MAX)
+                return false;
+            if (ref->role == 'u')
+                ref->def = first;
+            else
+                def_parent[union_find(def_parent, ref->def)] = first;
+        }
+        for (size_t w = 0; w < writes.size(); w++)
+            local_write[def_insn[writes[w]->def]] = SIZE_MAX;
+    }
+    
+    // nodes: the variables, then the webs
+    Vec<size_t> web_node(def_parent.size(), SIZE_MAX);
+    size_t node_count = var_count;
+    for (auto & insn : insns)
+    {
+        for (auto & ref : insn.refs)
+        {
+            if (ref.reg < var_count)
+            {
+                ref.node = ref.reg;
+                continue;
+            }
+            auto root = union_find(def_parent, ref.def);
+            if (web_node[root] == SIZE_MAX)
+                web_node[root] = node_count++;
+            ref.node = web_node[root];
+        }
+    }
+    
+    words = (node_count + 63) / 64;
+    if (node_count > (1 << 14) || (n + 1) * words > (1 << 24))
+        return false;
+    
+    // 2) liveness
+    Vec<uint64_t> live_in((n + 1) * words, 0);
+    Vec<uint64_t> live(words, 0);
+    auto compute_live_out = [&](size_t i)
+    {
+        for (size_t w = 0; w < words; w++)
+            live[w] = 0;
+        size_t next[2];
+        size_t count = successors(i, next);
+        for (size_t s = 0; s < count; s++)
+        {
+            for (size_t w = 0; w < words; w++)
+                live[w] |= live_in[next[s] * words + w];
+        }
+    };
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (size_t i = n; i-- > 0;)
+        {
+            compute_live_out(i);
+            for (auto & ref : insns[i].refs)
+            {
+                if (ref.role != 'u')
+                    live[ref.node / 64] &= ~(1ULL << (ref.node % 64));
+            }
+            for (auto & ref : insns[i].refs)
+            {
+                if (ref.role != 'd')
+                    live[ref.node / 64] |= 1ULL << (ref.node % 64);
+            }
+            for (size_t w = 0; w < words; w++)
+            {
+                changed = changed || live[w] != live_in[i * words + w];
+                live_in[i * words + w] = live[w];
+            }
+        }
+    }
+    for (size_t node = var_count; node < node_count; node++)
+    {
+        if (has_bit(live_in.data(), node))
+            return false;
+    }
+    
+    // interference: what a write overwrites must not be live after it (except the source of a copy), and the arguments
+    // of a call must not share registers with anything that lives through the call
+    Vec<uint64_t> interferes(node_count * words, 0);
+    auto add_edge = [&](size_t a, size_t b)
+    {
+        if (a == b)
+            return;
+        interferes[a * words + b / 64] |= 1ULL << (b % 64);
+        interferes[b * words + a / 64] |= 1ULL << (a % 64);
+    };
+    Vec<Vec<size_t>> live_across(calls.size(), Vec<size_t>{});
+    for (size_t i = 0; i < n; i++)
+    {
+        auto & insn = insns[i];
+        compute_live_out(i);
+        bool is_copy = insn.op == OP_SET || insn.op == OP_SET_I || insn.op == OP_SET_F;
+        for (auto & ref : insn.refs)
+        {
+            if (ref.role == 'u')
+                continue;
+            for_each_bit(live.data(), [&](size_t node)
+            {
+                if (!(is_copy && node == insn.refs[1].node))
+                    add_edge(ref.node, node);
+            });
+        }
+        if (insn.call == SIZE_MAX)
+            continue;
+        auto & call = calls[insn.call];
+        for_each_bit(live.data(), [&](size_t node)
+        {
+            if (insn.refs[0].role == 'd' && insn.refs[0].node == node)
+                return;
+            live_across[insn.call].push_back(node);
+            for (size_t a = 0; a < call.argc; a++)
+                add_edge(insn.refs[call.first_arg + a].node, node);
+        });
+    }
+    
+    // 3) coalescing
+    Vec<size_t> parent(node_count, 0);
+    Vec<size_t> block_call(node_count, SIZE_MAX);
+    for (size_t node = 0; node < node_count; node++)
+        parent[node] = node;
+    for (size_t c = 0; c < calls.size(); c++)
+    {
+        auto & call = calls[c];
+        for (size_t a = 0; a < call.argc; a++)
+        {
+            auto node = insns[call.insn].refs[call.first_arg + a].node;
+            if (node < var_count || block_call[node] != SIZE_MAX)
+                return false;
+            block_call[node] = c;
+        }
+    }
+    auto is_fixed = [&](size_t node) { return node < var_count || block_call[node] != SIZE_MAX; };
+    for (auto & insn : insns)
+    {
+        if (insn.op != OP_SET && insn.op != OP_SET_I && insn.op != OP_SET_F)
+            continue;
+        auto a = union_find(parent, insn.refs[0].node);
+        auto b = union_find(parent, insn.refs[1].node);
+        if (a == b || has_bit(interferes.data() + a * words, b) || (is_fixed(a) && is_fixed(b)))
+            continue;
+        if (is_fixed(b))
+            std::swap(a, b);
+        parent[b] = a;
+        for_each_bit(interferes.data() + b * words, [&](size_t node) { add_edge(a, node); });
+    }
+    
+    // 4) coloring, in order of first appearance; an argument block is placed all at once when the first of it shows up
+    Vec<size_t> color(node_count, SIZE_MAX);
+    for (size_t node = 0; node < var_count; node++)
+        color[node] = node;
+    auto clashes = [&](size_t node, size_t c)
+    {
+        bool ret = false;
+        for_each_bit(interferes.data() + node * words, [&](size_t other) { ret = ret || color[union_find(parent, other)] == c; });
+        return ret;
+    };
+    auto color_alone = [&](size_t rep)
+    {
+        size_t c = var_count;
+        while (clashes(rep, c))
+            c++;
+        color[rep] = c;
+    };
+    // lowest base for a call's argument block that's above everything live across the call, which gets its registers
+    // first if it doesn't have them yet; SIZE_MAX if some of it is in an argument block that hasn't been placed
+    auto lowest_base = [&](size_t c)
+    {
+        size_t base = var_count;
+        for (auto node : live_across[c])
+        {
+            auto rep = union_find(parent, node);
+            if (color[rep] == SIZE_MAX && block_call[rep] != SIZE_MAX)
+                return SIZE_MAX;
+            if (color[rep] == SIZE_MAX)
+                color_alone(rep);
+            if (color[rep] + 1 > base)
+                base = color[rep] + 1;
+        }
+        return base;
+    };
+    for (auto & insn : insns)
+    {
+        for (auto & ref : insn.refs)
+        {
+            auto rep = union_find(parent, ref.node);
+            if (color[rep] != SIZE_MAX)
+                continue;
+            if (block_call[rep] == SIZE_MAX)
+            {
+                color_alone(rep);
+                continue;
+            }
+            auto & call = calls[block_call[rep]];
+            auto & args = insns[call.insn].refs;
+            size_t base = lowest_base(block_call[rep]);
+            if (base == SIZE_MAX)
+                return false;
+            for (size_t a = 0; a < call.argc; a++)
+            {
+                if (clashes(union_find(parent, args[call.first_arg + a].node), base + a))
+                {
+                    base += 1;
+                    a = SIZE_MAX;
+                }
+            }
+            for (size_t a = 0; a < call.argc; a++)
+                color[union_find(parent, args[call.first_arg + a].node)] = base + a;
+            call.base = base;
+        }
+    }
+    for (size_t c = 0; c < calls.size(); c++)
+    {
+        if (calls[c].base == SIZE_MAX)
+            calls[c].base = lowest_base(c);
+        if (calls[c].base == SIZE_MAX)
+            return false;
+    }
+    
+    // check the result before using it
+    size_t frame_size = var_count;
+    for (size_t node = 0; node < node_count; node++)
+    {
+        auto rep = union_find(parent, node);
+        if (rep == node && clashes(node, color[node]))
+            return false;
+        if (color[rep] + 1 > frame_size)
+            frame_size = color[rep] + 1;
+    }
+    for (size_t c = 0; c < calls.size(); c++)
+    {
+        for (auto node : live_across[c])
+        {
+            if (color[union_find(parent, node)] >= calls[c].base)
+                return false;
+        }
+        if (calls[c].base + calls[c].argc > frame_size)
+            frame_size = calls[c].base + calls[c].argc;
+    }
+    
+    // 5) re-encode with the new registers, without the copies that became no-ops, and with the jumps fixed up
+    auto reg_of = [&](const CodeRef & ref) { return color[union_find(parent, ref.node)]; };
+    Vec<bool> dropped(n, false);
+    for (size_t i = 0; i < n; i++)
+    {
+        auto & insn = insns[i];
+        dropped[i] = (insn.op == OP_SET || insn.op == OP_SET_I || insn.op == OP_SET_F) && reg_of(insn.refs[0]) == reg_of(insn.refs[1]);
+    }
+    drop_jumps(insns, dropped);
+    Vec<uint8_t> new_code;
+    Vec<size_t> new_pos(n + 1, 0);
+    Vec<size_t> jump_fields(n, SIZE_MAX);
+    Vec<CodeMove> moves;
+    for (size_t i = 0; i < n; i++)
+    {
+        auto & insn = insns[i];
+        new_pos[i] = new_code.size();
+        if (dropped[i])
+            continue;
+        moves.push_back(CodeMove{insn.pos, new_code.size()});
+        auto operands = opcode_operands(insn.op);
+        auto roles = register_roles(insn.op);
+        size_t p = insn.pos + opcode_length(insn.op);
+        for (size_t k = insn.pos; k < p; k++)
+            new_code.push_back(code[k]);
+        size_t r = 0;
+        for (size_t k = 0; operands[k]; k++)
+        {
+            size_t len = operand_length(code.data() + p, operands[k]);
+            if (roles[k] == 'u' || roles[k] == 'd' || roles[k] == 'm')
+                push_varlen_int(new_code, reg_of(insn.refs[r++]));
+            else if (roles[k] == 'b')
+                push_varlen_int(new_code, calls[insn.call].base);
+            else if (operands[k] == 'j')
+            {
+                jump_fields[i] = new_code.size();
+                push_u32(new_code, 0);
+            }
+            else
+            {
+                for (size_t b = 0; b < len; b++)
+                    new_code.push_back(code[p + b]);
+            }
+            p += len;
+        }
+    }
+    new_pos[n] = new_code.size();
+    for (size_t i = 0; i < n; i++)
+    {
+        if (jump_fields[i] == SIZE_MAX)
+            continue;
+        int32_t offset = int64_t(new_pos[insns[i].target]) - int64_t(jump_fields[i] + 4);
+        memcpy(new_code.data() + jump_fields[i], &offset, 4);
+    }
+    
+    code = std::move(new_code);
+    func->line_table = line_table_remap(func->line_table, moves);
+    func->num_regs = frame_size - var_count;
+    return true;
+}
+
+#endif // MUALI_REGALLOC
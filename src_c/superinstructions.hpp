@@ -0,0 +1,35 @@
+#ifndef MUALI_SUPERINSTRUCTIONS
+#define MUALI_SUPERINSTRUCTIONS
+
+// Generated by gen_superinstructions.py from opcode profiles. Regenerate it instead of editing it.
+// X(superinstruction opcode, name, then the body name and opcode of each op it runs)
+
+#define SUPERINSTRUCTIONS_2(X) \
+    X(0xF3, mulimm__jcmp, mulimm, OP_MULIMM, jcmp, OP_JCMP) \
+    X(0xF5, addimm__set, addimm, OP_ADDIMM, set, OP_SET) \
+    X(0xF6, set__shrimm, set, OP_SET, shrimm, OP_SHRIMM) \
+    X(0xF7, shrimm__set_i, shrimm, OP_SHRIMM, set_i, OP_SET_I) \
+    X(0xFB, add__jcmpimm, add, OP_ADD, jcmpimm, OP_JCMPIMM) \
+    X(0xFC, add__j, add, OP_ADD, j, OP_J) \
+    X(0xFD, sub__add, sub, OP_SUB, add, OP_ADD) \
+    X(0xFE, set__set, set, OP_SET, set, OP_SET) \
+    X(0xB02, set_i__mulimm, set_i, OP_SET_I, mulimm, OP_MULIMM) \
+    X(0xB04, set_i__shlimm_i, set_i, OP_SET_I, shlimm_i, OP_SHLIMM_I) \
+    X(0xB05, shlimm_i__jcmp, shlimm_i, OP_SHLIMM_I, jcmp, OP_JCMP) \
+    X(0xB06, set_i__sub, set_i, OP_SET_I, sub, OP_SUB) \
+    X(0xB07, set_i__j, set_i, OP_SET_I, j, OP_J)
+
+#define SUPERINSTRUCTIONS_3(X) \
+    X(0xF1, set__shrimm__set_i, set, OP_SET, shrimm, OP_SHRIMM, set_i, OP_SET_I) \
+    X(0xF2, shrimm__set_i__shlimm_i, shrimm, OP_SHRIMM, set_i, OP_SET_I, shlimm_i, OP_SHLIMM_I) \
+    X(0xF4, sub__add__j, sub, OP_SUB, add, OP_ADD, j, OP_J) \
+    X(0xF8, addimm__set__set, addimm, OP_ADDIMM, set, OP_SET, set, OP_SET) \
+    X(0xF9, addimm__addimm__set, addimm, OP_ADDIMM, addimm, OP_ADDIMM, set, OP_SET) \
+    X(0xFA, mulimm__addimm__addimm, mulimm, OP_MULIMM, addimm, OP_ADDIMM, addimm, OP_ADDIMM) \
+    X(0xB00, set_i__mulimm__jcmp, set_i, OP_SET_I, mulimm, OP_MULIMM, jcmp, OP_JCMP) \
+    X(0xB01, set_i__shlimm_i__jcmp, set_i, OP_SET_I, shlimm_i, OP_SHLIMM_I, jcmp, OP_JCMP) \
+    X(0xB03, set_i__sub__add, set_i, OP_SET_I, sub, OP_SUB, add, OP_ADD) \
+    X(0xB08, set_i__shrimm__shlimm_i, set_i, OP_SET_I, shrimm, OP_SHRIMM, shlimm_i, OP_SHLIMM_I) \
+    X(0xB09, shlimm_i__set_i__sub, shlimm_i, OP_SHLIMM_I, set_i, OP_SET_I, sub, OP_SUB)
+
+#endif // MUALI_SUPERINSTRUCTIONS
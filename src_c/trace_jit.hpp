@@ -0,0 +1,628 @@
+#ifndef MUALI_TRACE_JIT
+#define MUALI_TRACE_JIT
+
+// Included by interpreter.hpp after jit.hpp, when USE_TRACING_JIT is defined.
+
+// Tracing JIT for counted loops, the ones closed by jinciltimm, jinciltimm_int or jincilt.
+// - Each time one of those jumps back, the loop's TraceSlot counts it. Once the loop is hot, its next iteration is run
+//   one op at a time through the op bodies, recording the ops, which way each jump went, and the kinds of the vars
+//   each op touched.
+// - If that iteration got back to the start of the loop using only ops and kinds that traces handle, and every var it
+//   touched ends it with the kind it started with, the recording becomes machine code that loops over it.
+// - A trace checks the kinds of its vars once, on entry, and then keeps them in machine registers across iterations:
+//   ints and bools in general purpose registers and floats in SSE registers. Jumps that go the other way than they did
+//   while recording are side exits, which write the registers back to vars and return where the interpreter picks up.
+// - A loop whose recordings keep failing, or whose traces keep being entered with the wrong kinds, is left to the
+//   interpreter after TRACE_MAX_FAILURES tries.
+// Traces never call out, so they can use every register except rbx (vars) and the scratch ones.
+
+#ifdef USE_JIT
+#error "USE_TRACING_JIT can't be used together with USE_JIT"
+#endif
+#ifdef VARIABLE_NANBOXED
+#error "USE_TRACING_JIT needs the tagged-union Variable"
+#endif
+
+constexpr uint16_t TRACE_HOT_LOOP = 56; // backedges before a loop gets recorded
+constexpr uint16_t TRACE_MAX_FAILURES = 4; // recordings before a loop is left to the interpreter for good
+constexpr uint16_t TRACE_MAX_BAILS = 64; // entries whose kind checks fail before a trace is thrown away
+constexpr size_t TRACE_MAX_STEPS = 500;
+constexpr size_t TRACE_MAX_TRACES = 1024;
+
+// where traces keep vars: rsi, rdi, r8-r15 and xmm2-xmm15. rax, rcx and rdx (for idiv) and xmm0-xmm1 are scratch.
+constexpr uint8_t TRACE_GPRS[] = {6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+constexpr uint8_t TRACE_XMMS[] = {2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+constexpr uint8_t TRACE_NO_REG = 0xFF;
+
+struct TraceStep {
+    uint16_t op;
+    const uint8_t * operands;
+    const uint8_t * end;
+    bool taken; // for jumps
+    uint8_t var_count;
+    size_t var_indexes[3]; // the op's var operands
+    TypeId kinds[3]; // what kinds they had after it ran
+};
+
+struct TraceVar {
+    size_t index;
+    TypeId entry_kind;
+    TypeId kind; // while compiling, as of the current step
+    uint8_t gpr = TRACE_NO_REG;
+    uint8_t xmm = TRACE_NO_REG;
+};
+
+static bool trace_supports_op(uint16_t op)
+{
+    switch (op)
+    {
+    case OP_J: case OP_JIF: case OP_JIFNOT: case OP_JCMP: case OP_JCMPIMM: case OP_JILTIMM:
+    case OP_JINCILTIMM: case OP_JINCILTIMM_INT: case OP_JINCILT:
+    case OP_INCI: case OP_INCI_INT: case OP_DECI: case OP_DECI_INT: case OP_NEGATE: case OP_NEGATE_F:
+    case OP_SETIMM: case OP_SET: case OP_SET_I: case OP_SET_F: case OP_SETZEROI: case OP_CHECK_I: case OP_CHECK_F:
+    case OP_ADD: case OP_ADD_F: case OP_ADD_FF: case OP_ADDIMM: case OP_SUB: case OP_SUBIMM: case OP_SUBIMM_I:
+    case OP_MUL: case OP_MULIMM: case OP_DIV: case OP_DIV_F: case OP_DIV_FF: case OP_DIV_FI: case OP_DIVIMM:
+    case OP_SHL: case OP_SHLIMM: case OP_SHLIMM_I: case OP_SHR: case OP_SHRIMM:
+    case OP_CMPE: case OP_CMPNE: case OP_CMPGT: case OP_CMPLT: case OP_CMPGTE: case OP_CMPLTE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Finds the var operands of the op whose operands start at pc. Returns how many there are.
+static uint8_t trace_var_operands(uint16_t op, const uint8_t * pc, size_t * indexes)
+{
+    uint8_t count = 0;
+    for (const char * operands = opcode_operands(op); *operands; operands++)
+    {
+        switch (*operands)
+        {
+        case 'r':
+            indexes[count++] = read_varlen_int(pc);
+            break;
+        case 'i':
+            read_immediate(pc);
+            break;
+        case 'b':
+            pc += 1;
+            break;
+        case 'j':
+            pc += 4;
+            break;
+        case 'q':
+            pc += 8;
+            break;
+        }
+    }
+    return count;
+}
+
+static TraceVar * trace_find_var(Vec<TraceVar> & tvars, size_t index)
+{
+    for (auto & v : tvars)
+    {
+        if (v.index == index)
+            return &v;
+    }
+    return nullptr;
+}
+
+// REX prefix for a pair of register numbers, if they need one
+static void trace_rex(JitAssembler & a, bool w, uint8_t reg, uint8_t rm)
+{
+    uint8_t rex = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+    if (rex != 0x40)
+        a.code.push_back(rex);
+}
+// `opcode` with registers reg and rm. `prefix` is a mandatory prefix (66 or F2) or 0.
+static void trace_rr(JitAssembler & a, uint8_t prefix, bool w, std::initializer_list<uint8_t> opcode, uint8_t reg, uint8_t rm)
+{
+    if (prefix)
+        a.code.push_back(prefix);
+    trace_rex(a, w, reg, rm);
+    a.emit(opcode);
+    a.code.push_back(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+// `opcode` with register reg and [rbx + disp32] addressing vars[index], plus `field` bytes
+static void trace_rm(JitAssembler & a, uint8_t prefix, bool w, std::initializer_list<uint8_t> opcode, uint8_t reg,
+    size_t index, size_t field = 0)
+{
+    if (prefix)
+        a.code.push_back(prefix);
+    trace_rex(a, w, reg, 3);
+    a.emit(opcode);
+    a.code.push_back(0x80 | ((reg & 7) << 3) | 3);
+    a.emit32(uint32_t(index * sizeof(Variable) + field));
+}
+static void trace_mov_imm(JitAssembler & a, uint8_t reg, uint64_t n)
+{
+    trace_rex(a, true, 0, reg);
+    a.code.push_back(0xB8 + (reg & 7));
+    a.emit64(n);
+}
+static void trace_mov_float_imm(JitAssembler & a, uint8_t xmm, double f)
+{
+    uint64_t bits;
+    memcpy(&bits, &f, 8);
+    trace_mov_imm(a, JIT_RAX, bits);
+    trace_rr(a, 0x66, true, {0x0F, 0x6E}, xmm, JIT_RAX); // movq xmm, rax
+}
+
+// Writes every var back from its register, as the kind it has at this point.
+static void trace_spill(JitAssembler & a, const Vec<TraceVar> & tvars, const Vec<TypeId> & kinds)
+{
+    for (size_t i = 0; i < tvars.size(); i++)
+    {
+        auto & v = tvars[i];
+        if (kinds[i] == TYPEID_FLOAT)
+            trace_rm(a, 0xF2, false, {0x0F, 0x11}, v.xmm, v.index); // movsd [var], xmm
+        else
+            trace_rm(a, 0, true, {0x89}, v.gpr, v.index); // mov [var], gpr
+        trace_rm(a, 0, false, {0xC7}, 0, v.index, JIT_TYPE_FIELD); // mov dword [var.type], kind
+        a.emit32(kinds[i]);
+    }
+}
+
+constexpr uint8_t TRACE_NOT_A_JUMP = 0;
+
+// Emits the machine code for one recorded op, given the kinds its vars have going into it (in tvars).
+// For conditional jumps, `cc` gets the condition under which the jump is taken, after the emitted code; otherwise it's
+// JIT_ALWAYS for `j` and TRACE_NOT_A_JUMP for everything else. Returns false for kinds that traces don't handle.
+static bool trace_emit_step(JitAssembler & a, const TraceStep & step, Vec<TraceVar> & tvars, uint8_t & cc)
+{
+    cc = TRACE_NOT_A_JUMP;
+    auto pc = step.operands;
+    auto op = step.op;
+    
+    auto is_num = [](TypeId kind) { return kind == TYPEID_INT || kind == TYPEID_FLOAT; };
+    
+    // arithmetic: x = x OP rhs, where rhs is a var (y) or an immediate
+    auto arith = [&](TraceVar & x, TraceVar * y, const Variable * imm, uint8_t sse_op, uint8_t int_op) -> bool
+    {
+        TypeId rhs_kind = y ? y->kind : imm->kind();
+        if (!is_num(x.kind) || !is_num(rhs_kind))
+            return false;
+        if (x.kind == TYPEID_INT && rhs_kind == TYPEID_INT)
+        {
+            uint8_t rhs = y ? y->gpr : JIT_RCX;
+            if (!y)
+                trace_mov_imm(a, JIT_RCX, imm->get_int());
+            if (int_op == 0x01 || int_op == 0x29) // add, sub
+                trace_rr(a, 0, true, {int_op}, rhs, x.gpr);
+            else if (int_op == 0xAF) // imul
+                trace_rr(a, 0, true, {0x0F, 0xAF}, x.gpr, rhs);
+            else // idiv
+            {
+                trace_rr(a, 0, true, {0x89}, x.gpr, JIT_RAX); // mov rax, x
+                a.emit({0x48, 0x99}); // cqo
+                trace_rr(a, 0, true, {0xF7}, 7, rhs); // idiv rhs
+                trace_rr(a, 0, true, {0x89}, JIT_RAX, x.gpr); // mov x, rax
+            }
+            return true;
+        }
+        // float result: the int side, if any, is converted first
+        uint8_t rhs;
+        if (y && y->kind == TYPEID_FLOAT)
+            rhs = y->xmm;
+        else if (y)
+        {
+            trace_rr(a, 0xF2, true, {0x0F, 0x2A}, 0, y->gpr); // cvtsi2sd xmm0, y
+            rhs = 0;
+        }
+        else
+        {
+            trace_mov_float_imm(a, 1, imm->kind() == TYPEID_FLOAT ? imm->get_float() : double(imm->get_int()));
+            rhs = 1;
+        }
+        if (x.kind == TYPEID_INT)
+            trace_rr(a, 0xF2, true, {0x0F, 0x2A}, x.xmm, x.gpr); // cvtsi2sd x, x
+        trace_rr(a, 0xF2, false, {0x0F, sse_op}, x.xmm, rhs);
+        x.kind = TYPEID_FLOAT;
+        return true;
+    };
+    auto negate_float = [&](TraceVar & x)
+    {
+        trace_mov_imm(a, JIT_RAX, 0x8000000000000000ULL);
+        trace_rr(a, 0x66, true, {0x0F, 0x6E}, 0, JIT_RAX); // movq xmm0, rax
+        trace_rr(a, 0x66, false, {0x0F, 0x57}, x.xmm, 0); // xorpd x, xmm0
+    };
+    // flags for x compared to y (signed), for ints or bools
+    auto compare = [&](TraceVar & x, TraceVar & y) -> bool
+    {
+        bool ints = x.kind == TYPEID_INT && y.kind == TYPEID_INT;
+        bool bools = x.kind == TYPEID_BOOL && y.kind == TYPEID_BOOL;
+        if (!ints && !bools)
+            return false;
+        trace_rr(a, 0, true, {0x39}, y.gpr, x.gpr); // cmp x, y
+        return true;
+    };
+    auto compare_imm = [&](TraceVar & x, int64_t n)
+    {
+        trace_mov_imm(a, JIT_RCX, n);
+        trace_rr(a, 0, true, {0x39}, JIT_RCX, x.gpr); // cmp x, rcx
+    };
+    
+    TraceVar * x = step.var_count > 0 ? trace_find_var(tvars, step.var_indexes[0]) : nullptr;
+    TraceVar * y = step.var_count > 1 ? trace_find_var(tvars, step.var_indexes[1]) : nullptr;
+    
+    switch (op)
+    {
+    case OP_J:
+        cc = JIT_ALWAYS;
+        return true;
+    case OP_JIF: case OP_JIFNOT:
+        if (x->kind != TYPEID_BOOL && x->kind != TYPEID_INT)
+            return false;
+        trace_rr(a, 0, true, {0x85}, x->gpr, x->gpr); // test x, x
+        cc = op == OP_JIF ? JIT_CC_NE : JIT_CC_E;
+        return true;
+    case OP_JCMP:
+    {
+        read_varlen_int(pc);
+        read_varlen_int(pc);
+        cc = jit_compare_cc(read_u8(pc));
+        return cc != JIT_ALWAYS && compare(*x, *y);
+    }
+    case OP_JCMPIMM:
+    {
+        read_varlen_int(pc);
+        auto imm = read_immediate(pc);
+        cc = jit_compare_cc(read_u8(pc));
+        if (cc == JIT_ALWAYS || x->kind != TYPEID_INT || imm.kind() != TYPEID_INT)
+            return false;
+        compare_imm(*x, imm.get_int());
+        return true;
+    }
+    case OP_JILTIMM: case OP_JINCILTIMM: case OP_JINCILTIMM_INT:
+    {
+        read_varlen_int(pc);
+        int64_t imm = read_u64(pc);
+        if (x->kind != TYPEID_INT)
+            return false;
+        if (op != OP_JILTIMM)
+        {
+            trace_rr(a, 0, true, {0x83}, 0, x->gpr); // add x, 1
+            a.code.push_back(1);
+        }
+        compare_imm(*x, imm);
+        cc = JIT_CC_L;
+        return true;
+    }
+    case OP_JINCILT:
+        if (x->kind != TYPEID_INT || y->kind != TYPEID_INT)
+            return false;
+        trace_rr(a, 0, true, {0x83}, 0, x->gpr); // add x, 1
+        a.code.push_back(1);
+        compare(*x, *y);
+        cc = JIT_CC_L;
+        return true;
+    case OP_INCI: case OP_INCI_INT: case OP_DECI: case OP_DECI_INT:
+        if (x->kind != TYPEID_INT)
+            return false;
+        trace_rr(a, 0, true, {0x83}, (op == OP_INCI || op == OP_INCI_INT) ? 0 : 5, x->gpr); // add/sub x, 1
+        a.code.push_back(1);
+        return true;
+    case OP_NEGATE:
+        if (x->kind == TYPEID_INT)
+            trace_rr(a, 0, true, {0xF7}, 3, x->gpr); // neg x
+        else if (x->kind == TYPEID_FLOAT)
+            negate_float(*x);
+        else
+            return false;
+        return true;
+    case OP_NEGATE_F:
+        if (x->kind != TYPEID_FLOAT)
+            return false;
+        negate_float(*x);
+        return true;
+    case OP_SETIMM:
+    {
+        read_varlen_int(pc);
+        auto imm = read_immediate(pc);
+        if (imm.kind() == TYPEID_INT)
+            trace_mov_imm(a, x->gpr, imm.get_int());
+        else if (imm.kind() == TYPEID_BOOL)
+            trace_mov_imm(a, x->gpr, imm.get_bool());
+        else if (imm.kind() == TYPEID_FLOAT)
+            trace_mov_float_imm(a, x->xmm, imm.get_float());
+        else
+            return false;
+        x->kind = imm.kind();
+        return true;
+    }
+    case OP_SET: case OP_SET_I: case OP_SET_F:
+        if ((op == OP_SET_I && y->kind != TYPEID_INT) || (op == OP_SET_F && y->kind != TYPEID_FLOAT))
+            return false;
+        if (y->kind == TYPEID_FLOAT)
+            trace_rr(a, 0x66, false, {0x0F, 0x28}, x->xmm, y->xmm); // movapd x, y
+        else
+            trace_rr(a, 0, true, {0x89}, y->gpr, x->gpr); // mov x, y
+        x->kind = y->kind;
+        return true;
+    case OP_CHECK_I:
+        return x->kind == TYPEID_INT;
+    case OP_CHECK_F:
+        return x->kind == TYPEID_FLOAT;
+    case OP_SETZEROI:
+        trace_rr(a, 0, false, {0x31}, x->gpr, x->gpr); // xor x, x
+        x->kind = TYPEID_INT;
+        return true;
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+    {
+        uint8_t sse_op = op == OP_ADD ? 0x58 : op == OP_SUB ? 0x5C : op == OP_MUL ? 0x59 : 0x5E;
+        uint8_t int_op = op == OP_ADD ? 0x01 : op == OP_SUB ? 0x29 : op == OP_MUL ? 0xAF : 0xF7;
+        return arith(*x, y, nullptr, sse_op, int_op);
+    }
+    case OP_ADD_F: case OP_ADD_FF: case OP_DIV_F: case OP_DIV_FF: case OP_DIV_FI:
+    {
+        if (x->kind != TYPEID_FLOAT)
+            return false;
+        if ((op == OP_ADD_FF || op == OP_DIV_FF) && y->kind != TYPEID_FLOAT)
+            return false;
+        if (op == OP_DIV_FI && y->kind != TYPEID_INT)
+            return false;
+        return arith(*x, y, nullptr, (op == OP_ADD_F || op == OP_ADD_FF) ? 0x58 : 0x5E, 0);
+    }
+    case OP_ADDIMM: case OP_SUBIMM: case OP_MULIMM: case OP_DIVIMM: case OP_SUBIMM_I:
+    {
+        read_varlen_int(pc);
+        auto imm = read_immediate(pc);
+        if (op == OP_SUBIMM_I && (x->kind != TYPEID_INT || imm.kind() != TYPEID_INT))
+            return false;
+        uint8_t sse_op = op == OP_ADDIMM ? 0x58 : (op == OP_SUBIMM || op == OP_SUBIMM_I) ? 0x5C : op == OP_MULIMM ? 0x59 : 0x5E;
+        uint8_t int_op = op == OP_ADDIMM ? 0x01 : (op == OP_SUBIMM || op == OP_SUBIMM_I) ? 0x29 : op == OP_MULIMM ? 0xAF : 0xF7;
+        return arith(*x, nullptr, &imm, sse_op, int_op);
+    }
+    case OP_SHLIMM: case OP_SHLIMM_I: case OP_SHRIMM:
+    {
+        read_varlen_int(pc);
+        auto imm = read_immediate(pc);
+        if (x->kind != TYPEID_INT || imm.kind() != TYPEID_INT || imm.get_int() < 0 || imm.get_int() > 63)
+            return false;
+        trace_rr(a, 0, true, {0xC1}, op == OP_SHRIMM ? 7 : 4, x->gpr); // sar/shl x, imm
+        a.code.push_back(uint8_t(imm.get_int()));
+        return true;
+    }
+    case OP_SHL: case OP_SHR:
+        if (x->kind != TYPEID_INT || y->kind != TYPEID_INT)
+            return false;
+        trace_rr(a, 0, true, {0x89}, y->gpr, JIT_RCX); // mov rcx, y
+        trace_rr(a, 0, true, {0xD3}, op == OP_SHR ? 7 : 4, x->gpr); // sar/shl x, cl
+        return true;
+    case OP_CMPE: case OP_CMPNE: case OP_CMPGT: case OP_CMPLT: case OP_CMPGTE: case OP_CMPLTE:
+    {
+        if (!compare(*x, *y))
+            return false;
+        uint8_t set_cc = jit_compare_cc(op - OP_CMPE + OPINFO_CMPE);
+        a.emit({0x0F, uint8_t(0x90 | set_cc), 0xC0}); // setcc al
+        a.emit({0x0F, 0xB6, 0xC0}); // movzx eax, al
+        trace_rr(a, 0, true, {0x89}, JIT_RAX, x->gpr); // mov x, rax
+        x->kind = TYPEID_BOOL;
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+// Turns a recorded loop iteration into machine code. Returns null if it can't.
+static TraceCode trace_compile(Interpreter * global, const Vec<TraceStep> & steps, Vec<TraceVar> & tvars, const uint8_t * head)
+{
+    // every var gets a register for each kind it's ever seen with, and has to come back around with its entry kind
+    size_t gprs_used = 0;
+    size_t xmms_used = 0;
+    auto give_register = [&](TraceVar & v, TypeId kind) -> bool
+    {
+        if (kind == TYPEID_INT || kind == TYPEID_BOOL)
+        {
+            if (v.gpr == TRACE_NO_REG && gprs_used < sizeof(TRACE_GPRS))
+                v.gpr = TRACE_GPRS[gprs_used++];
+            return v.gpr != TRACE_NO_REG;
+        }
+        if (kind == TYPEID_FLOAT)
+        {
+            if (v.xmm == TRACE_NO_REG && xmms_used < sizeof(TRACE_XMMS))
+                v.xmm = TRACE_XMMS[xmms_used++];
+            return v.xmm != TRACE_NO_REG;
+        }
+        return false;
+    };
+    for (auto & v : tvars)
+    {
+        if (!give_register(v, v.entry_kind))
+            return nullptr;
+        v.kind = v.entry_kind;
+    }
+    for (auto & step : steps)
+    {
+        for (size_t k = 0; k < step.var_count; k++)
+        {
+            auto v = trace_find_var(tvars, step.var_indexes[k]);
+            if (!give_register(*v, step.kinds[k]))
+                return nullptr;
+            v->kind = step.kinds[k];
+        }
+    }
+    for (auto & v : tvars)
+    {
+        if (v.kind != v.entry_kind)
+            return nullptr;
+        v.kind = v.entry_kind;
+    }
+    
+    struct Exit {
+        size_t at;
+        const uint8_t * resume;
+        Vec<TypeId> kinds;
+    };
+    Vec<Exit> exits;
+    Vec<size_t> to_bail;
+    auto add_exit = [&](size_t at, const uint8_t * resume)
+    {
+        Vec<TypeId> kinds;
+        for (auto & v : tvars)
+            kinds.push_back(v.kind);
+        exits.push_back({at, resume, std::move(kinds)});
+    };
+    
+    JitAssembler a;
+    a.emit({0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57}); // push rbx; push r12; push r13; push r14; push r15
+    a.emit({0x48, 0x89, 0xFB}); // mov rbx, rdi
+    
+    // check the kinds of all the vars before touching any of them
+    for (auto & v : tvars)
+    {
+        trace_rm(a, 0, false, {0x83}, 7, v.index, JIT_TYPE_FIELD); // cmp dword [var.type], kind
+        a.code.push_back(uint8_t(v.entry_kind));
+        to_bail.push_back(a.jump(JIT_CC_NE));
+    }
+    for (auto & v : tvars)
+    {
+        if (v.entry_kind == TYPEID_FLOAT)
+            trace_rm(a, 0xF2, false, {0x0F, 0x10}, v.xmm, v.index); // movsd xmm, [var]
+        else
+            trace_rm(a, 0, true, {0x8B}, v.gpr, v.index); // mov gpr, [var]
+    }
+    
+    size_t loop = a.code.size();
+    for (size_t i = 0; i < steps.size(); i++)
+    {
+        auto & step = steps[i];
+        uint8_t cc;
+        if (!trace_emit_step(a, step, tvars, cc))
+            return nullptr;
+        for (size_t k = 0; k < step.var_count; k++)
+        {
+            if (trace_find_var(tvars, step.var_indexes[k])->kind != step.kinds[k])
+                return nullptr;
+        }
+        if (cc == TRACE_NOT_A_JUMP || cc == JIT_ALWAYS)
+            continue;
+        
+        int32_t offset;
+        memcpy(&offset, step.end - 4, 4);
+        const uint8_t * target = step.end + offset;
+        if (i + 1 == steps.size())
+        {
+            // the jump that closes the loop
+            a.patch(a.jump(cc), loop);
+            add_exit(a.jump(JIT_ALWAYS), step.end);
+        }
+        else if (step.taken)
+            add_exit(a.jump(cc ^ 1), step.end);
+        else
+            add_exit(a.jump(cc), target);
+    }
+    
+    Vec<size_t> to_epilogue;
+    for (auto & exit : exits)
+    {
+        a.patch(exit.at, a.code.size());
+        trace_spill(a, tvars, exit.kinds);
+        trace_mov_imm(a, JIT_RAX, (uint64_t)exit.resume);
+        to_epilogue.push_back(a.jump(JIT_ALWAYS));
+    }
+    for (auto at : to_bail)
+        a.patch(at, a.code.size());
+    trace_mov_imm(a, JIT_RAX, (uint64_t)head);
+    for (auto at : to_epilogue)
+        a.patch(at, a.code.size());
+    a.emit({0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3}); // pop r15; pop r14; pop r13; pop r12; pop rbx; ret
+    
+    auto mapping = jit_make_executable(a.code);
+    if (!mapping)
+        return nullptr;
+    global->trace_code.push_back(MakeShared<CodeMapping>(std::move(*mapping)));
+    return (TraceCode)global->trace_code.back()->data;
+}
+
+// Runs one iteration of the loop starting at head through the op bodies, recording it, and compiles the recording if it
+// went around the whole loop. Returns where the interpreter picks up again: head if the recording went around, or the op
+// it stopped at.
+static const uint8_t * trace_record(Interpreter * global, Variable * vars, TraceSlot & slot, const uint8_t * head)
+{
+    Vec<TraceStep> steps;
+    Vec<TraceVar> tvars;
+    const uint8_t * pc = head;
+    bool closed = false;
+    
+    global->trace_recording = true;
+    while (steps.size() < TRACE_MAX_STEPS)
+    {
+        uint16_t op = unfused_opcode(opcode_at(pc));
+        if (!trace_supports_op(op))
+            break;
+        TraceStep step = {};
+        step.op = op;
+        step.operands = pc + opcode_length(op);
+        step.end = pc + instruction_length(pc, op);
+        step.var_count = trace_var_operands(op, step.operands, step.var_indexes);
+        for (size_t k = 0; k < step.var_count; k++)
+        {
+            auto index = step.var_indexes[k];
+            if (!trace_find_var(tvars, index))
+                tvars.push_back({index, vars[index].kind(), vars[index].kind()});
+        }
+        
+        pc = jit_body_for(op)(vars, step.operands, global);
+        
+        step.taken = pc != step.end;
+        for (size_t k = 0; k < step.var_count; k++)
+            step.kinds[k] = vars[step.var_indexes[k]].kind();
+        steps.push_back(step);
+        
+        // jumps are followed wherever they go in the function, so blocks the compiler moved out of the loop's range
+        // are recorded like any other; the recording only ends at the backedge, an op traces don't handle, or the
+        // step limit
+        if (step.end == slot.backedge_end)
+        {
+            closed = pc == head;
+            break;
+        }
+    }
+    global->trace_recording = false;
+    
+    if (closed && global->trace_code.size() < TRACE_MAX_TRACES)
+        slot.trace = trace_compile(global, steps, tvars, head);
+    if (!slot.trace)
+        slot.failures += 1;
+    return pc;
+}
+
+static const uint8_t * trace_backedge(Interpreter * global, Variable * vars, const uint8_t * backedge_end, const uint8_t * head)
+{
+    if (global->trace_recording)
+        return head;
+    auto & slot = global->trace_slots[mix_hash((uint64_t)backedge_end) % TRACE_SLOT_COUNT];
+    if (slot.backedge_end != backedge_end)
+    {
+        slot.backedge_end = backedge_end;
+        slot.count = 0;
+        slot.failures = 0;
+        slot.bails = 0;
+        slot.trace = nullptr;
+    }
+    if (slot.trace)
+    {
+        auto resume = slot.trace(vars);
+        if (resume != head)
+        {
+            slot.bails = 0;
+            return resume;
+        }
+        // the vars didn't have the kinds the trace was recorded with; once that keeps happening, record the loop again
+        if (++slot.bails < TRACE_MAX_BAILS)
+            return head;
+        slot.trace = nullptr;
+        slot.bails = 0;
+        slot.failures += 1;
+        return head;
+    }
+    if (slot.failures >= TRACE_MAX_FAILURES || ++slot.count < TRACE_HOT_LOOP)
+        return head;
+    slot.count = 0;
+    return trace_record(global, vars, slot, head);
+}
+
+#endif // MUALI_TRACE_JIT
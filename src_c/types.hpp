@@ -6,11 +6,13 @@
 #include <cstdlib> // size_t, malloc/free
 #include <cstring> // memcpy, memmove
 #include <cstddef> // nullptr_t
+#include <cstdint>
 
 #include <utility> // std::move, std::forward
 #include <initializer_list> // initializer list constructors
 #include <type_traits> // is_convertible_v
 #include <new> // placement new
+#include <functional> // std::hash
 
 // ####
 // helpers
@@ -582,6 +584,13 @@ public:
     {
         return erase_at(size() - 1);
     }
+    /// Keeps the capacity.
+    constexpr void clear()
+    {
+        for (size_t i = 0; i < mlength; i++)
+            ((T*)mbuffer)[i].~T();
+        mlength = 0;
+    }
     /// Pointer must be within data().
     constexpr void erase(const T * which)
     {
@@ -822,6 +831,185 @@ struct ListSet {
     auto end() noexcept { return list.end(); }
 };
 
+// std::hash is often the identity (libstdc++ does that for integers), which clusters badly in power-of-two tables
+static inline uint64_t mix_hash(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Open addressing table of indexes into a separate Vec of entries, with Robin Hood probing: an entry being inserted
+// takes the slot of any entry that's closer to its home slot, so probe lengths stay short even when the table is full.
+// Lookups can stop as soon as they see an entry closer to home than they are. Used by HashMap and HashSet.
+struct HashIndex {
+    struct Slot {
+        uint32_t hash;
+        uint32_t index; // entry index + 1, or 0 if the slot is empty
+    };
+    Vec<Slot> slots; // size is zero or a power of two
+    
+    size_t mask() const { return slots.size() - 1; }
+    
+    // returns the entry index, or -1 if there's no match
+    template<typename F>
+    size_t find(uint32_t hash, F && matches) const
+    {
+        if (slots.size() == 0)
+            return -1;
+        for (size_t pos = hash & mask(), dist = 0; ; pos = (pos + 1) & mask(), dist++)
+        {
+            const auto & slot = slots[pos];
+            if (slot.index == 0 || ((pos - slot.hash) & mask()) < dist)
+                return -1;
+            if (slot.hash == hash && matches(slot.index - 1))
+                return slot.index - 1;
+        }
+    }
+    
+    void place(uint32_t hash, size_t index)
+    {
+        Slot item = {hash, uint32_t(index + 1)};
+        for (size_t pos = hash & mask(), dist = 0; ; pos = (pos + 1) & mask(), dist++)
+        {
+            auto & slot = slots[pos];
+            if (slot.index == 0)
+            {
+                slot = item;
+                return;
+            }
+            size_t slot_dist = (pos - slot.hash) & mask();
+            if (slot_dist < dist)
+            {
+                Slot temp = slot;
+                slot = item;
+                item = temp;
+                dist = slot_dist;
+            }
+        }
+    }
+    
+    // call before adding an entry; keeps the load factor at or under 3/4
+    void reserve_for(size_t entry_count)
+    {
+        if (entry_count * 4 <= slots.size() * 3)
+            return;
+        Vec<Slot> old(slots.size() ? slots.size() * 2 : 8, Slot{0, 0});
+        old.swap_contents(slots);
+        for (auto & slot : old)
+        {
+            if (slot.index != 0)
+                place(slot.hash, slot.index - 1);
+        }
+    }
+    
+    void clear()
+    {
+        for (auto & slot : slots)
+            slot = Slot{0, 0};
+    }
+};
+
+template<typename T>
+static inline uint32_t hash_key(const T & key)
+{
+    return uint32_t(mix_hash(std::hash<T>{}(key)) >> 32);
+}
+
+// Drop-in replacement for ListMap with O(1) lookups. Iterates in insertion order instead of sorted order.
+// Like ListMap, inserting can move existing entries, so references into the map don't survive inserts.
+template<typename TK, typename TV>
+struct HashMap {
+    Vec<Pair<TK, TV>> entries;
+    HashIndex index;
+    
+    size_t find(const TK & key) const
+    {
+        return index.find(hash_key(key), [&](size_t i) { return entries[i]._0 == key; });
+    }
+    
+    TV & operator[](const TK & key)
+    {
+        uint32_t hash = hash_key(key);
+        size_t i = index.find(hash, [&](size_t i) { return entries[i]._0 == key; });
+        if (i != (size_t)-1)
+            return entries[i]._1;
+        index.reserve_for(entries.size() + 1);
+        entries.push_back(Pair<TK, TV>{key, TV{}});
+        index.place(hash, entries.size() - 1);
+        return entries.back()._1;
+    }
+    size_t count(const TK & key) const
+    {
+        return find(key) != (size_t)-1;
+    }
+    size_t size() const { return entries.size(); }
+    void clear()
+    {
+        entries.clear();
+        index.clear();
+    }
+    
+    template<typename U1, typename U2>
+    void insert(U1 && key, U2 && val)
+    {
+        uint32_t hash = hash_key(key);
+        size_t i = index.find(hash, [&](size_t i) { return entries[i]._0 == key; });
+        if (i != (size_t)-1)
+        {
+            entries[i]._1 = std::forward<U2>(val);
+            return;
+        }
+        index.reserve_for(entries.size() + 1);
+        entries.push_back(Pair<TK, TV>{std::forward<U1>(key), std::forward<U2>(val)});
+        index.place(hash, entries.size() - 1);
+    }
+    
+    auto begin() noexcept { return entries.begin(); }
+    auto end() noexcept { return entries.end(); }
+    auto begin() const noexcept { return entries.begin(); }
+    auto end() const noexcept { return entries.end(); }
+};
+
+// Drop-in replacement for ListSet with O(1) lookups. Iterates in insertion order instead of sorted order.
+template<typename T>
+struct HashSet {
+    Vec<T> entries;
+    HashIndex index;
+    
+    size_t count(const T & key) const
+    {
+        return index.find(hash_key(key), [&](size_t i) { return entries[i] == key; }) != (size_t)-1;
+    }
+    size_t size() const { return entries.size(); }
+    void clear()
+    {
+        entries.clear();
+        index.clear();
+    }
+    
+    template<typename U1>
+    void insert(U1 && key)
+    {
+        uint32_t hash = hash_key(key);
+        size_t i = index.find(hash, [&](size_t i) { return entries[i] == key; });
+        if (i != (size_t)-1)
+        {
+            entries[i] = std::forward<U1>(key);
+            return;
+        }
+        index.reserve_for(entries.size() + 1);
+        entries.push_back(std::forward<U1>(key));
+        index.place(hash, entries.size() - 1);
+    }
+    
+    auto begin() noexcept { return entries.begin(); }
+    auto end() noexcept { return entries.end(); }
+    auto begin() const noexcept { return entries.begin(); }
+    auto end() const noexcept { return entries.end(); }
+};
+
 class String {
 private:
     // if bytes.size() is not zero, is long string with bytes.size() - 1 number of non-null chars and 1 null terminator
@@ -981,23 +1169,45 @@ public:
     }
 };
 
-/*
+// FNV-1a
 template <>
 struct std::hash<String>
 {
-    size_t operator()(const String & string) const
+    size_t operator()(const String & string) const noexcept
     {
         const char * dat = string.data();
         const size_t len = string.size();
-        size_t hashval = 0;
+        uint64_t hashval = 0xcbf29ce484222325ULL;
         for (size_t i = 0; i < len; i++)
         {
-            hashval ^= hash<char>()(dat[i]);
-            hashval *= 0xf491;
+            hashval ^= (unsigned char)dat[i];
+            hashval *= 0x100000001b3ULL;
         }
         return hashval;
     }
 };
-*/
+
+// by identity, like Shared's operator==
+template <typename T>
+struct std::hash<Shared<T>>
+{
+    size_t operator()(const Shared<T> & shared) const noexcept
+    {
+        return std::hash<T *>{}(shared.get());
+    }
+};
+
+// by contents, like Vec's operator==
+template <typename T>
+struct std::hash<Vec<T>>
+{
+    size_t operator()(const Vec<T> & vec) const noexcept
+    {
+        uint64_t hashval = vec.size();
+        for (auto & item : vec)
+            hashval = mix_hash(hashval ^ std::hash<T>{}(item));
+        return hashval;
+    }
+};
 
 #endif // _INCLUDE_BXX_TYPES
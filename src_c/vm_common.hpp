@@ -27,6 +27,46 @@
 
 // If none of the above VARLEN_VARREG... defines are defined, VLQ encoding will be used, which is the third fastest
 
+//#define PROFILE_OPCODE_SEQUENCES
+// Counts how often each pair and triple of opcodes runs back to back, and appends the counts to a file when the program ends
+// (MUALI_OPCODE_PROFILE, or opcode_profile.txt). gen_superinstructions.py turns those files into superinstructions.hpp.
+// Also stops the compiler from fusing opcodes, so that what gets counted is the plain opcodes.
+//#define PROFILE_EXECUTION
+// Counts every dispatch by opcode, by bytecode offset in each function and by call stack, and writes a flat profile
+// (MUALI_PROFILE, or profile.txt) and collapsed stacks for flamegraphs (MUALI_PROFILE_STACKS, or profile_stacks.txt) when
+// the program ends. Code that a JIT turned into machine code doesn't dispatch, so it isn't counted. See profile.hpp.
+//#define PROFILE_EXECUTION_CYCLES
+// With PROFILE_EXECUTION, also charges the rdtsc cycles from each dispatch to the next one to the first, and ranks by those.
+//#define PROFILE_SAMPLING
+// Samples the call stack on a SIGPROF timer (MUALI_SAMPLE_HZ times a second of CPU time, or 1000) and writes the samples
+// as collapsed stacks (MUALI_SAMPLES, or samples.txt) when the program ends. Cheap enough to leave on for long runs: the
+// dispatch path doesn't change, and calls only keep a stack of the calls the interpreter is in. See profile.hpp.
+
+// Identifiers for the encoding settings chosen above. Bytecode caches record these, so that a build with different settings refuses to load them.
+#ifdef OPCODES_ALWAYS_8BIT
+constexpr uint32_t OPCODE_ENCODING_ID = 1;
+#elif defined OPCODES_ALWAYS_16BIT
+constexpr uint32_t OPCODE_ENCODING_ID = 2;
+#else
+constexpr uint32_t OPCODE_ENCODING_ID = 0;
+#endif
+
+#ifdef VARLEN_VARREG_16BIT
+constexpr uint32_t VARREG_ENCODING_ID = 1;
+#elif defined VARLEN_VARREG_8BIT
+constexpr uint32_t VARREG_ENCODING_ID = 2;
+#elif defined VARLEN_VARREG_SB15LE
+constexpr uint32_t VARREG_ENCODING_ID = 3;
+#elif defined VARLEN_VARREG_SB15
+constexpr uint32_t VARREG_ENCODING_ID = 4;
+#elif defined VARLEN_VARREG_LZ4LIKE
+constexpr uint32_t VARREG_ENCODING_ID = 5;
+#elif defined VARLEN_VARREG_LEB128
+constexpr uint32_t VARREG_ENCODING_ID = 6;
+#else
+constexpr uint32_t VARREG_ENCODING_ID = 0; // VLQ
+#endif
+
 typedef uint32_t TypeId;
 
 constexpr uint32_t TYPEID_NULL    = 0;
@@ -41,17 +81,63 @@ constexpr uint32_t TYPEID_VARIANT = 31;
 constexpr uint32_t TYPEID_CUSTOM  = 32;
 constexpr uint32_t TYPEID_INVALID = -1;
 
+// Read-only memory that code of cached functions points into (e.g. an mmapped bytecode cache file).
+// Released when the last Global/Interpreter holding it goes away.
+struct CodeMapping {
+    const uint8_t * data = nullptr;
+    size_t size = 0;
+    void (*release)(CodeMapping &) = nullptr;
+    
+    CodeMapping() { }
+    CodeMapping(const uint8_t * data, size_t size, void (*release)(CodeMapping &)) : data(data), size(size), release(release) { }
+    CodeMapping(CodeMapping && other) : data(other.data), size(other.size), release(other.release)
+    {
+        other.data = nullptr;
+        other.size = 0;
+        other.release = nullptr;
+    }
+    CodeMapping(const CodeMapping &) = delete;
+    CodeMapping & operator=(const CodeMapping &) = delete;
+    ~CodeMapping()
+    {
+        if (release)
+            release(*this);
+    }
+};
+
+#include "line_table.hpp"
+
 struct Function {
     Vec<uint8_t> code;
+    // if set, the function's code lives in a CodeMapping instead of `code`
+    const uint8_t * mapped_code = nullptr;
+    size_t mapped_code_size = 0;
     size_t num_args = 0;
     size_t num_vars = 0;
     size_t num_regs = 0;
+    // where it was defined in the source, for profiles
+    size_t row = 0;
+    size_t column = 0;
+    // maps code offsets to source positions (see line_table.hpp); can be mapped like the code is
+    Vec<uint8_t> line_table;
+    const uint8_t * mapped_line_table = nullptr;
+    size_t mapped_line_table_size = 0;
+    // machine code made by the JIT (see jit.hpp), if it compiled this function; owned by the Interpreter
+    const uint8_t * jit_entry = nullptr;
+    
+    const uint8_t * code_data() const { return mapped_code ? mapped_code : code.data(); }
+    size_t code_size() const { return mapped_code ? mapped_code_size : code.size(); }
+    const uint8_t * line_table_data() const { return mapped_line_table ? mapped_line_table : line_table.data(); }
+    size_t line_table_size() const { return mapped_line_table ? mapped_line_table_size : line_table.size(); }
+    // Source position of the code at offset; row 0 if unknown. Scans the whole table, so keep it off hot paths.
+    SourcePos source_position(size_t offset) const { return line_table_lookup(line_table_data(), line_table_size(), offset); }
 };
 
 struct Global {
     Vec<Shared<Function>> funcs;
-    ListMap<String, size_t> func_names;
-    ListMap<String, size_t> var_names;
+    HashMap<String, size_t> func_names;
+    HashMap<String, size_t> var_names;
+    Shared<CodeMapping> mapping;
 };
 
 constexpr uint8_t OPINFO_CMPE         = 0x00;
@@ -60,10 +146,13 @@ constexpr uint8_t OPINFO_CMPGT        = 0x02;
 constexpr uint8_t OPINFO_CMPLT        = 0x03;
 constexpr uint8_t OPINFO_CMPGTE       = 0x04;
 constexpr uint8_t OPINFO_CMPLTE       = 0x05;
+constexpr uint8_t OPINFO_NEGATE       = 0x80; // can be combined with the above
 
 constexpr uint16_t OP_SET_I            = 0x802;
 constexpr uint16_t OP_SUBIMM_I         = 0x807;
 constexpr uint16_t OP_SET_F            = 0x812;
+constexpr uint16_t OP_CHECK_I          = 0x803; // faults unless the register holds an int
+constexpr uint16_t OP_CHECK_F          = 0x813; // or a float, converting ints to one
 constexpr uint16_t OP_ADD_F            = 0x814;
 constexpr uint16_t OP_ADD_FF           = 0x824;
 constexpr uint16_t OP_DIV_F            = 0x81A;
@@ -79,6 +168,7 @@ constexpr uint16_t OP_NEGATE_F         = 0xA10;
 constexpr uint16_t OP_JINCILT          = 0xD0E;
 constexpr uint16_t OP_JINCILTIMM       = 0xD0F;
 constexpr uint16_t OP_JINCILTIMM_INT   = 0xD10;
+constexpr uint16_t OP_BULKLOOP         = 0xD20; // runs a whole counted loop with SIMD; see bulk_loop.hpp
 
 constexpr uint16_t OP_SQRT             = 0xF10;
 constexpr uint16_t OP_EXIT             = 0xF12;
@@ -199,4 +289,188 @@ constexpr uint16_t OP_BECOME_INDIRECT  = 0xEF;
 
 constexpr uint16_t OP_NOOP             = 0xF0;
 
+// Operands of each opcode, one letter per operand, in order:
+// r: var-reg (VARLEN_VARREG... encoding), i: immediate (type byte, then the value), b: u8, q: u64, j: i32 jump offset,
+// k: bulk loop kernel (u16 length, then that many bytes)
+// Returns null for opcodes that the compiler never emits.
+static inline const char * opcode_operands(uint16_t op)
+{
+    switch (op)
+    {
+    case OP_J:
+        return "j";
+    case OP_JIF: case OP_JIFNOT:
+        return "rj";
+    case OP_JCMP:
+        return "rrbj";
+    case OP_JCMPIMM:
+        return "ribj";
+    case OP_JILTIMM: case OP_JINCILTIMM: case OP_JINCILTIMM_INT:
+        return "rqj";
+    case OP_JINCILT:
+        return "rrj";
+    case OP_INCI: case OP_INCI_INT: case OP_DECI: case OP_DECI_INT:
+    case OP_NEGATE: case OP_NEGATE_F: case OP_SETZEROI: case OP_RETURNVAL: case OP_CHECK_I: case OP_CHECK_F:
+        return "r";
+    case OP_SET: case OP_SET_I: case OP_SET_F:
+    case OP_ADD: case OP_ADD_F: case OP_ADD_FF: case OP_SUB: case OP_MUL:
+    case OP_DIV: case OP_DIV_F: case OP_DIV_FF: case OP_DIV_FI: case OP_SHL: case OP_SHR:
+    case OP_CMPE: case OP_CMPNE: case OP_CMPGT: case OP_CMPLT: case OP_CMPGTE: case OP_CMPLTE:
+        return "rr";
+    case OP_SETIMM: case OP_ADDIMM: case OP_SUBIMM: case OP_SUBIMM_I: case OP_MULIMM: case OP_DIVIMM:
+    case OP_SHLIMM: case OP_SHLIMM_I: case OP_SHRIMM:
+        return "ri";
+    case OP_RETURNIMM:
+        return "i";
+    case OP_BULKLOOP:
+        return "rrrrrrrrk";
+    case OP_CALL: case OP_CALL_INDIRECT:
+        return "rrrr";
+    case OP_CALLDISCARD: case OP_CALLD_INDIRECT: case OP_BECOME: case OP_BECOME_INDIRECT:
+        return "rrr";
+    default:
+        return nullptr;
+    }
+}
+
+// Reads the opcode at `code`, the same way the dispatcher does, but without the junk in the high byte of one-byte opcodes.
+static inline uint16_t opcode_at(const uint8_t * code)
+{
+#ifdef OPCODES_ALWAYS_8BIT
+    return *code;
+#else
+    uint16_t op = code[0] | (uint16_t(code[1]) << 8);
+    op &= (1<<INTERPRETER_OPCODE_TABLE_BITS) - 1;
+    if ((op & 0xFF) >= 0x80)
+        op &= 0xFF;
+    return op;
+#endif
+}
+
+static inline size_t opcode_length(uint16_t op)
+{
+#ifdef OPCODES_ALWAYS_8BIT
+    (void)op;
+    return 1;
+#elif defined OPCODES_ALWAYS_16BIT
+    (void)op;
+    return 2;
+#else
+    return op > 0xFF ? 2 : 1;
+#endif
+}
+
+static inline size_t varlen_int_length(const uint8_t * code)
+{
+#ifdef VARLEN_VARREG_16BIT
+    (void)code;
+    return 2;
+#elif defined VARLEN_VARREG_8BIT
+    (void)code;
+    return 1;
+#elif defined VARLEN_VARREG_SB15LE || defined VARLEN_VARREG_SB15
+    return (code[0] & 0x80) ? 2 : 1;
+#elif defined VARLEN_VARREG_LZ4LIKE
+    size_t n = 1;
+    while (code[n - 1] == 0xFF)
+        n += 1;
+    return n;
+#else
+    size_t n = 1;
+    while (code[n - 1] & 0x80)
+        n += 1;
+    return n;
+#endif
+}
+
+// Value of the varlen int at `code`, the same way the interpreter reads it.
+static inline size_t varlen_int_value(const uint8_t * code)
+{
+#ifdef VARLEN_VARREG_16BIT
+    return code[0] | (size_t(code[1]) << 8);
+#elif defined VARLEN_VARREG_8BIT
+    return code[0];
+#elif defined VARLEN_VARREG_SB15LE
+    return (code[0] & 0x80) ? code[0] ^ (size_t(code[1]) << 7) : code[0];
+#elif defined VARLEN_VARREG_SB15
+    return (code[0] & 0x80) ? ((size_t(code[0]) & 0x7F) << 7) | code[1] : code[0];
+#elif defined VARLEN_VARREG_LZ4LIKE
+    size_t ret = 0;
+    size_t n = 0;
+    while (code[n] == 0xFF)
+        ret += code[n++];
+    return ret + code[n];
+#elif defined VARLEN_VARREG_LEB128
+    size_t ret = 0;
+    size_t n = 0;
+    do
+        ret |= (size_t(code[n]) & 0x7F) << (n * 7);
+    while (code[n++] & 0x80);
+    return ret;
+#else
+    size_t ret = 0;
+    size_t n = 0;
+    do
+        ret = (ret << 7) | (code[n] & 0x7F);
+    while (code[n++] & 0x80);
+    return ret;
+#endif
+}
+
+// Length in bytes of one operand at `code`, given its letter from opcode_operands.
+static inline size_t operand_length(const uint8_t * code, char kind)
+{
+    switch (kind)
+    {
+    case 'r':
+        return varlen_int_length(code);
+    case 'i':
+        if (code[0] == TYPEID_INT || code[0] == TYPEID_FLOAT)
+            return 9;
+        else if (code[0] == TYPEID_BOOL)
+            return 2;
+        return 1;
+    case 'b':
+        return 1;
+    case 'j':
+        return 4;
+    case 'q':
+        return 8;
+    case 'k':
+        return 2 + (code[0] | (size_t(code[1]) << 8));
+    }
+    return 0;
+}
+
+// Length in bytes of the instruction at `code` if its opcode were `op`, or 0 if `op` is unknown.
+static inline size_t instruction_length(const uint8_t * code, uint16_t op)
+{
+    const char * operands = opcode_operands(op);
+    if (!operands)
+        return 0;
+    size_t n = opcode_length(op);
+    for (; *operands; operands++)
+        n += operand_length(code + n, *operands);
+    return n;
+}
+// Length in bytes of the instruction at `code`, or 0 if its opcode is unknown.
+static inline size_t instruction_length(const uint8_t * code)
+{
+    return instruction_length(code, opcode_at(code));
+}
+
+#include "superinstructions.hpp"
+#include "bulk_loop.hpp"
+
+// The op that a superinstruction starts with, or op itself for a plain op. Code that walks fused code doesn't need
+// superinstructions, since the ops they cover are still in the code after them.
+static inline uint16_t unfused_opcode(uint16_t op)
+{
+    #define _UNFUSE(OPCODE, NAME, A, OP_A, ...) if (op == OPCODE) return OP_A;
+    SUPERINSTRUCTIONS_2(_UNFUSE)
+    SUPERINSTRUCTIONS_3(_UNFUSE)
+    #undef _UNFUSE
+    return op;
+}
+
 #endif // MUALI_VM_COMMON